@@ -34,8 +34,62 @@ enum confd_status {
     kConfdNoMemory                      = 7,
     /// Invalid arguments to call
     kConfdInvalidArguments              = 8,
+    /// The request did not complete before its deadline
+    kConfdTimedOut                      = 9,
+    /// The key's version did not match the expected version (for conditional updates)
+    kConfdVersionMismatch               = 10,
 };
 
+/**
+ * @brief Flags for confd_open_ex
+ */
+enum confd_open_flags {
+    /**
+     * Give each thread its own connection to confd, rather than serializing all threads' requests
+     * over a single shared connection. Connections are established lazily, the first time a
+     * thread makes a request.
+     */
+    kConfdOpenPerThread                 = (1 << 0),
+    /**
+     * Don't connect to confd; instead, open its database directly and handle all requests
+     * in-process. The path passed to confd_open_ex is then that of the database, rather than
+     * confd's socket.
+     *
+     * This is intended for tools that run while confd is stopped, such as factory provisioning.
+     * The database is locked while open, so this fails with `-EWOULDBLOCK` if confd (or another
+     * process in embedded mode) is using it. Statistics and traces are not available, and
+     * connection handles still connect to confd.
+     *
+     * The data store is set up from confd's config file (`/usr/etc/confd.toml`), if present, so
+     * that volatile keys, factory defaults and write debouncing apply as they do in confd. If
+     * confd is configured to keep its keys in memory rather than the database, this fails with
+     * `-ENOTSUP`.
+     */
+    kConfdOpenEmbedded                  = (1 << 1),
+};
+
+/**
+ * @brief Atomic operations on integer keys (for confd_integer_op)
+ */
+enum confd_integer_operation {
+    /// Add the operand to the key's value
+    kConfdIntegerAdd                    = 0,
+    /// Subtract the operand from the key's value
+    kConfdIntegerSubtract               = 1,
+    /// Set the key's value to the smaller of its value and the operand
+    kConfdIntegerMin                    = 2,
+    /// Set the key's value to the larger of its value and the operand
+    kConfdIntegerMax                    = 3,
+};
+
+/**
+ * @brief Connection handle
+ *
+ * An explicitly managed connection to confd, created with confd_handle_open. All calls that take
+ * a handle also accept NULL, in which case the default connection (set up by confd_open) is used.
+ */
+typedef struct confd_handle confd_handle_t;
+
 
 /**
  * @brief Get library version
@@ -69,6 +123,11 @@ const char *confd_strerror(int error);
  * Set up the initial socket connection to confd. This must be invoked before any other calls in
  * this API. The connection will remain valid until it is explicitly closed with confd_close.
  *
+ * If the connection is lost (for example, because confd restarted) it is re-established by the
+ * next call, retrying with exponential backoff for a few seconds while confd comes back up. Reads
+ * and writes that were interrupted by the connection loss are transparently sent again; deletes
+ * fail with a negative error code, since it's unknown whether they were performed.
+ *
  * @param socketPath Location of the UNIX domain socket confd is listening on, or `nullptr` to
  *        use the default
  *
@@ -76,6 +135,20 @@ const char *confd_strerror(int error);
  */
 int confd_open(const char *socketPath);
 
+/**
+ * @brief Establish connection to confd, with options
+ *
+ * Like confd_open, but allows specifying how the connection is shared between threads, or opening
+ * the database in-process instead.
+ *
+ * @param socketPath Location of the UNIX domain socket confd is listening on, or `nullptr` to
+ *        use the default; in embedded mode, the location of the database instead
+ * @param flags A combination of `confd_open_flags` values
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int confd_open_ex(const char *socketPath, const unsigned int flags);
+
 /**
  * @brief Terminate confd connection
  *
@@ -88,6 +161,56 @@ int confd_open(const char *socketPath);
  */
 int confd_close();
 
+/**
+ * @brief Open a connection handle
+ *
+ * Establishes a new connection to confd, independent of the default connection. Requests on the
+ * handle are serialized, so it should generally be used by only a single thread at a time.
+ *
+ * @param socketPath Location of the UNIX domain socket confd is listening on, or `nullptr` to
+ *        use the default
+ * @param outHandle Variable to receive the connection handle
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int confd_handle_open(const char *socketPath, confd_handle_t **outHandle);
+
+/**
+ * @brief Close a connection handle
+ *
+ * @param handle Handle previously returned by confd_handle_open; it is invalid after this call.
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int confd_handle_close(confd_handle_t *handle);
+
+/**
+ * @brief Set the request timeout
+ *
+ * Bound the time taken by each call: if a request hasn't been sent and its reply received within
+ * the timeout, the call fails with `kConfdTimedOut`. By default, calls wait indefinitely.
+ *
+ * The connection is closed when a request times out; it's re-established by the next call.
+ *
+ * @param timeoutMs Maximum duration of each call, in milliseconds, or 0 to wait indefinitely
+ *
+ * @return 0 on success, or a negative error code.
+ *
+ * @remark This applies to the default connection, as well as all connection handles that don't
+ *         have their own timeout set.
+ */
+int confd_set_timeout(const unsigned int timeoutMs);
+
+/**
+ * @brief Set the request timeout of a connection handle
+ *
+ * @param handle Connection handle to set the timeout of
+ * @param timeoutMs Maximum duration of each call, in milliseconds, or 0 to wait indefinitely
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int confd_handle_set_timeout(confd_handle_t *handle, const unsigned int timeoutMs);
+
 
 
 /**
@@ -104,6 +227,12 @@ int confd_close();
  */
 int confd_get_string(const char *key, char *outStr, const size_t outStrLen, size_t *outActualLen);
 
+/**
+ * @brief Same as confd_get_string, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_get_string(confd_handle_t *handle, const char *key, char *outStr,
+        const size_t outStrLen, size_t *outActualLen);
+
 /**
  * @brief Read config key (blob)
  *
@@ -118,6 +247,62 @@ int confd_get_string(const char *key, char *outStr, const size_t outStrLen, size
  */
 int confd_get_blob(const char *key, void *outBlob, const size_t outBlobLen, size_t *outActualLen);
 
+/**
+ * @brief Same as confd_get_blob, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_get_blob(confd_handle_t *handle, const char *key, void *outBlob,
+        const size_t outBlobLen, size_t *outActualLen);
+
+/**
+ * @brief Read config key (string), without copying it
+ *
+ * Reads a configuration key whose value is a string, and returns a pointer to the string in the
+ * connection's receive buffer. This avoids copying the value, and having to know its size ahead
+ * of time.
+ *
+ * @param key Config key to query
+ * @param outStr Variable to receive a pointer to the string; it is NOT zero terminated.
+ * @param outStrLen Variable to receive the length of the string (in bytes)
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark The returned string is read-only, and only remains valid until the next call on the
+ *         same connection. For the default connection, this includes calls made by other threads
+ *         (unless opened in per-thread mode.)
+ */
+int confd_borrow_string(const char *key, const char **outStr, size_t *outStrLen);
+
+/**
+ * @brief Same as confd_borrow_string, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_borrow_string(confd_handle_t *handle, const char *key, const char **outStr,
+        size_t *outStrLen);
+
+/**
+ * @brief Read config key (blob), without copying it
+ *
+ * Reads a configuration key whose value is a blob, and returns a pointer to the blob in the
+ * connection's receive buffer.
+ *
+ * @param key Config key to query
+ * @param outBlob Variable to receive a pointer to the blob
+ * @param outBlobLen Variable to receive the length of the blob (in bytes)
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark As with confd_borrow_string, the returned blob is read-only, and only valid until the
+ *         next call on the same connection.
+ */
+int confd_borrow_blob(const char *key, const void **outBlob, size_t *outBlobLen);
+
+/**
+ * @brief Same as confd_borrow_blob, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_borrow_blob(confd_handle_t *handle, const char *key, const void **outBlob,
+        size_t *outBlobLen);
+
 /**
  * @brief Read config key (integer)
  *
@@ -130,6 +315,11 @@ int confd_get_blob(const char *key, void *outBlob, const size_t outBlobLen, size
  */
 int confd_get_int(const char *key, int64_t *outValue);
 
+/**
+ * @brief Same as confd_get_int, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_get_int(confd_handle_t *handle, const char *key, int64_t *outValue);
+
 /**
  * @brief Read config key (floating point)
  *
@@ -142,6 +332,11 @@ int confd_get_int(const char *key, int64_t *outValue);
  */
 int confd_get_real(const char *key, double *outValue);
 
+/**
+ * @brief Same as confd_get_real, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_get_real(confd_handle_t *handle, const char *key, double *outValue);
+
 /**
  * @brief Read config key (boolean)
  *
@@ -154,7 +349,59 @@ int confd_get_real(const char *key, double *outValue);
  */
 int confd_get_bool(const char *key, bool *outValue);
 
+/**
+ * @brief Same as confd_get_bool, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_get_bool(confd_handle_t *handle, const char *key, bool *outValue);
+
+/**
+ * @brief Get the version of the key read by the last query
+ *
+ * Every key has a version, which is incremented each time its value changes. It's reported
+ * along with the value by each of the confd_get_* and confd_borrow_* calls; use this to retrieve
+ * it afterwards, then pass it to one of the confd_cas_* calls to update the key only if it hasn't
+ * changed since.
+ *
+ * @param outVersion Variable to receive the key's version; this is zero if the key didn't exist.
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark As with confd_borrow_string, this refers to the last call on the same connection. For
+ *         the default connection, this includes calls made by other threads (unless opened in
+ *         per-thread mode.)
+ */
+int confd_get_last_version(uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_get_last_version, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_get_last_version(confd_handle_t *handle, uint64_t *outVersion);
+
+
+
+/**
+ * @brief Set the time to live of updated keys
+ *
+ * All subsequent updates made on the connection set the time after which the updated key expires,
+ * and is removed by confd; updating a key again before then restarts (or, if the time to live has
+ * since been reset to zero, cancels) its expiration. Keys are removed within a fraction of a
+ * second of expiring.
+ *
+ * @remark This applies to the default connection, which may be shared between threads; use a
+ *         separate connection handle if only some updates should set a time to live.
+ *
+ * @param ttlMs Time to live of updated keys (in milliseconds), or zero if they shouldn't expire
+ *
+ * @return Negative error code or one of the confd_status values.
+ */
+int confd_set_update_ttl(const unsigned int ttlMs);
 
+/**
+ * @brief Same as confd_set_update_ttl, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_set_update_ttl(confd_handle_t *handle, const unsigned int ttlMs);
 
 /**
  * @brief Write config key (string)
@@ -169,6 +416,12 @@ int confd_get_bool(const char *key, bool *outValue);
  */
 int confd_set_string(const char *key, const char *str, const size_t strLen);
 
+/**
+ * @brief Same as confd_set_string, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_string(confd_handle_t *handle, const char *key, const char *str,
+        const size_t strLen);
+
 /**
  * @brief Write config key (blob)
  *
@@ -182,6 +435,12 @@ int confd_set_string(const char *key, const char *str, const size_t strLen);
  */
 int confd_set_blob(const char *key, const void *blob, const size_t blobLen);
 
+/**
+ * @brief Same as confd_set_blob, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_blob(confd_handle_t *handle, const char *key, const void *blob,
+        const size_t blobLen);
+
 /**
  * @brief Write config key (integer)
  *
@@ -194,6 +453,11 @@ int confd_set_blob(const char *key, const void *blob, const size_t blobLen);
  */
 int confd_set_int(const char *key, const int64_t value);
 
+/**
+ * @brief Same as confd_set_int, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_int(confd_handle_t *handle, const char *key, const int64_t value);
+
 /**
  * @brief Write config key (floating point)
  *
@@ -206,6 +470,11 @@ int confd_set_int(const char *key, const int64_t value);
  */
 int confd_set_real(const char *key, const double value);
 
+/**
+ * @brief Same as confd_set_real, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_real(confd_handle_t *handle, const char *key, const double value);
+
 /**
  * @brief Write config key (boolean)
  *
@@ -218,6 +487,11 @@ int confd_set_real(const char *key, const double value);
  */
 int confd_set_bool(const char *key, const bool value);
 
+/**
+ * @brief Same as confd_set_bool, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_bool(confd_handle_t *handle, const char *key, const bool value);
+
 /**
  * @brief Write config key (null)
  *
@@ -229,6 +503,160 @@ int confd_set_bool(const char *key, const bool value);
  */
 int confd_set_null(const char *key);
 
+/**
+ * @brief Same as confd_set_null, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_set_null(confd_handle_t *handle, const char *key);
+
+
+
+/**
+ * @brief Atomically modify an integer config key
+ *
+ * Applies the operation to the key's value in confd, in a single step; unlike reading the key and
+ * then writing the modified value, concurrent modifications are never lost. Addition and
+ * subtraction wrap around.
+ *
+ * If the key doesn't exist yet (or is null), it's created, as if its value had been zero (for
+ * addition and subtraction) or the operand (for min and max.)
+ *
+ * @param key Config key to modify
+ * @param op Operation to perform
+ * @param operand Operand for the operation
+ * @param outValue Variable to receive the key's resulting value (may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values; kConfdTypeMismatch if the key
+ *         holds a value that's not an integer.
+ *
+ * @remark If the connection to confd is lost, the call fails rather than being retried, as the
+ *         operation may already have been applied.
+ */
+int confd_integer_op(const char *key, const enum confd_integer_operation op,
+        const int64_t operand, int64_t *outValue);
+
+/**
+ * @brief Same as confd_integer_op, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_integer_op(confd_handle_t *handle, const char *key,
+        const enum confd_integer_operation op, const int64_t operand, int64_t *outValue);
+
+/**
+ * @brief Atomically increment an integer config key
+ *
+ * Shorthand for confd_integer_op with kConfdIntegerAdd; use a negative delta to decrement.
+ *
+ * @param key Config key to increment (it's created with a value of `delta` if it doesn't exist)
+ * @param delta Amount to add to the key's value
+ * @param outValue Variable to receive the key's new value (may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values.
+ */
+int confd_increment(const char *key, const int64_t delta, int64_t *outValue);
+
+/**
+ * @brief Same as confd_increment, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_increment(confd_handle_t *handle, const char *key, const int64_t delta,
+        int64_t *outValue);
+/**
+ * @brief Write config key (string), if it hasn't changed
+ *
+ * Sets the value of a configuration key, but only if its version is still the one given; this
+ * is checked and the key updated atomically. Together with confd_get_last_version, this allows
+ * read-modify-write cycles without races between concurrent writers.
+ *
+ * @param key Config key to update
+ * @param version Version the key is expected to have; zero to only create the key if it doesn't
+ *        exist yet
+ * @param str Buffer containing the string value; it need not be zero terminated.
+ * @param strLen Length of string (characters)
+ * @param outVersion Variable to receive the key's new version if updated, or its current version
+ *        if it wasn't (may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values; kConfdVersionMismatch if the
+ *         key's version didn't match, in which case it's not updated.
+ *
+ * @remark Deleting a key discards its version: if it's created again, its version starts over.
+ */
+int confd_cas_string(const char *key, const uint64_t version, const char *str,
+        const size_t strLen, uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_string, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_string(confd_handle_t *handle, const char *key, const uint64_t version,
+        const char *str, const size_t strLen, uint64_t *outVersion);
+
+/**
+ * @brief Write config key (blob), if it hasn't changed
+ *
+ * @see confd_cas_string
+ */
+int confd_cas_blob(const char *key, const uint64_t version, const void *blob,
+        const size_t blobLen, uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_blob, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_blob(confd_handle_t *handle, const char *key, const uint64_t version,
+        const void *blob, const size_t blobLen, uint64_t *outVersion);
+
+/**
+ * @brief Write config key (integer), if it hasn't changed
+ *
+ * @see confd_cas_string
+ */
+int confd_cas_int(const char *key, const uint64_t version, const int64_t value,
+        uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_int, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_int(confd_handle_t *handle, const char *key, const uint64_t version,
+        const int64_t value, uint64_t *outVersion);
+
+/**
+ * @brief Write config key (floating point), if it hasn't changed
+ *
+ * @see confd_cas_string
+ */
+int confd_cas_real(const char *key, const uint64_t version, const double value,
+        uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_real, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_real(confd_handle_t *handle, const char *key, const uint64_t version,
+        const double value, uint64_t *outVersion);
+
+/**
+ * @brief Write config key (boolean), if it hasn't changed
+ *
+ * @see confd_cas_string
+ */
+int confd_cas_bool(const char *key, const uint64_t version, const bool value,
+        uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_bool, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_bool(confd_handle_t *handle, const char *key, const uint64_t version,
+        const bool value, uint64_t *outVersion);
+
+/**
+ * @brief Write config key (null), if it hasn't changed
+ *
+ * @see confd_cas_string
+ */
+int confd_cas_null(const char *key, const uint64_t version, uint64_t *outVersion);
+
+/**
+ * @brief Same as confd_cas_null, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_cas_null(confd_handle_t *handle, const char *key, const uint64_t version,
+        uint64_t *outVersion);
+
 
 
 /**
@@ -240,6 +668,93 @@ int confd_set_null(const char *key);
  */
 int confd_delete(const char *key);
 
+/**
+ * @brief Same as confd_delete, but using the given connection handle (or NULL for the default)
+ */
+int confd_handle_delete(confd_handle_t *handle, const char *key);
+
+
+
+/**
+ * @brief Update multiple keys at once
+ *
+ * All keys are updated in a single transaction: either all of the updates take effect, or (if
+ * any of them fails) none do. This is much faster than updating the keys individually.
+ *
+ * Large batches are split over multiple requests; confd holds on to the updates until the batch
+ * is complete. If the connection is lost partway through, the batch is discarded and the call
+ * fails with a negative error code.
+ *
+ * @param updates CBOR-encoded map, whose keys are key names and values the new values of the
+ *        respective keys (strings, byte strings, unsigned integers, floats, booleans or null)
+ * @param updatesLen Size of the encoded updates, in bytes
+ *
+ * @return Negative error code or one of the confd_status values.
+ */
+int confd_update_batch(const void *updates, const size_t updatesLen);
+
+/**
+ * @brief Same as confd_update_batch, but using the given connection handle (or NULL for the
+ *        default)
+ */
+int confd_handle_update_batch(confd_handle_t *handle, const void *updates,
+        const size_t updatesLen);
+
+/**
+ * @brief Export the values of all keys, a page at a time
+ *
+ * Retrieves the values of as many keys as fit into a single reply, in name order. The page is
+ * returned as a CBOR-encoded map with a `values` map (from key names to their values) and a
+ * `more` flag; if set, pass the last key name of the page to the next call to continue.
+ *
+ * @param after Key name after which to start, or NULL to start with the first key
+ * @param outBuf Buffer to receive the encoded page; it should be at least 64K
+ * @param outBufLen Size of the output buffer, in bytes
+ * @param outActualLen Variable to receive the actual size of the page (in bytes; may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark If the buffer is too small, the page is truncated; compare the value written to
+ *         `outActualLen` against the buffer size to detect this.
+ */
+int confd_export(const char *after, void *outBuf, const size_t outBufLen, size_t *outActualLen);
+
+
+
+/**
+ * @brief Retrieve daemon statistics
+ *
+ * Queries confd for its performance counters: per-endpoint request counts and latency histograms,
+ * as well as data store counters. The statistics are returned as a CBOR-encoded map.
+ *
+ * @param outBuf Buffer to receive the encoded statistics
+ * @param outBufLen Size of the output buffer, in bytes
+ * @param outActualLen Variable to receive the actual size of the statistics (in bytes; may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark If the buffer is too small, the statistics are truncated; compare the value written to
+ *         `outActualLen` against the buffer size to detect this.
+ */
+int confd_get_stats(void *outBuf, const size_t outBufLen, size_t *outActualLen);
+
+/**
+ * @brief Retrieve traces of recent requests
+ *
+ * Queries confd for the contents of its trace ring: for each of the most recently completed
+ * requests, the endpoint, tag and key name, as well as the time spent in each processing phase.
+ * The traces are returned as a CBOR-encoded array of maps, oldest first.
+ *
+ * @param outBuf Buffer to receive the encoded traces
+ * @param outBufLen Size of the output buffer, in bytes
+ * @param outActualLen Variable to receive the actual size of the traces (in bytes; may be NULL)
+ *
+ * @return Negative error code or one of the confd_status values.
+ *
+ * @remark As with confd_get_stats, a too small buffer truncates the output.
+ */
+int confd_get_trace(void *outBuf, const size_t outBufLen, size_t *outActualLen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,191 @@
+/**
+ * @file
+ *
+ * @brief C++ interface to libconfd
+ *
+ * A thin, header-only wrapper around the C API. Errors are reported by throwing `confd::Error`,
+ * and values can be retrieved without copying, as `std::string_view` or `std::span`.
+ */
+#ifndef LIBCONFD_HPP
+#define LIBCONFD_HPP
+
+#include <confd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace confd {
+/**
+ * @brief libconfd error
+ *
+ * Wraps the status code returned by a failed libconfd call: either one of the `confd_status`
+ * values, or a negative system error code.
+ */
+class Error: public std::runtime_error {
+    public:
+        Error(const int status) : std::runtime_error(confd_strerror(status)), statusCode(status) {}
+
+        /// Get the status code
+        constexpr int status() const {
+            return this->statusCode;
+        }
+
+    private:
+        int statusCode;
+};
+
+/**
+ * @brief Connection to confd
+ *
+ * Either a connection handle owned by this object, or (if default constructed) a reference to
+ * the library's default connection, which must have been set up with confd_open beforehand.
+ *
+ * @remark Views returned by the `get…View` methods point into the connection's receive buffer,
+ *         and are only valid until the next request on the connection.
+ */
+class Connection {
+    public:
+        /// Use the library's default connection
+        Connection() = default;
+
+        /**
+         * @brief Open a new connection
+         *
+         * @param socketPath Path to the confd socket, or `nullptr` to use the default
+         */
+        explicit Connection(const char *socketPath) {
+            Check(confd_handle_open(socketPath, &this->handle));
+        }
+
+        ~Connection() {
+            if(this->handle) {
+                confd_handle_close(this->handle);
+            }
+        }
+
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        Connection(Connection &&other) : handle(std::exchange(other.handle, nullptr)) {}
+        Connection &operator=(Connection &&other) {
+            std::swap(this->handle, other.handle);
+            return *this;
+        }
+
+        /**
+         * @brief Set the maximum duration of each request
+         *
+         * @param timeout Request timeout, or zero to wait indefinitely
+         *
+         * @remark For the default connection, this changes the library-wide default timeout.
+         */
+        void setTimeout(const std::chrono::milliseconds timeout) {
+            const auto ms = static_cast<unsigned int>(timeout.count());
+
+            if(this->handle) {
+                Check(confd_handle_set_timeout(this->handle, ms));
+            } else {
+                Check(confd_set_timeout(ms));
+            }
+        }
+
+        /// Read a string value, without copying it
+        std::string_view getStringView(const char *key) {
+            const char *str{nullptr};
+            size_t len{0};
+
+            Check(confd_handle_borrow_string(this->handle, key, &str, &len));
+            return {str, len};
+        }
+
+        /// Read a blob value, without copying it
+        std::span<const std::byte> getBlobView(const char *key) {
+            const void *blob{nullptr};
+            size_t len{0};
+
+            Check(confd_handle_borrow_blob(this->handle, key, &blob, &len));
+            return {reinterpret_cast<const std::byte *>(blob), len};
+        }
+
+        /// Read a string value
+        std::string getString(const char *key) {
+            return std::string(this->getStringView(key));
+        }
+
+        /// Read an integer value
+        int64_t getInt(const char *key) {
+            int64_t value{0};
+            Check(confd_handle_get_int(this->handle, key, &value));
+            return value;
+        }
+
+        /// Read a floating point value
+        double getReal(const char *key) {
+            double value{0};
+            Check(confd_handle_get_real(this->handle, key, &value));
+            return value;
+        }
+
+        /// Read a boolean value
+        bool getBool(const char *key) {
+            bool value{false};
+            Check(confd_handle_get_bool(this->handle, key, &value));
+            return value;
+        }
+
+        /// Write a string value
+        void setString(const char *key, const std::string_view &value) {
+            Check(confd_handle_set_string(this->handle, key, value.data(), value.size()));
+        }
+
+        /// Write a blob value
+        void setBlob(const char *key, std::span<const std::byte> value) {
+            Check(confd_handle_set_blob(this->handle, key, value.data(), value.size()));
+        }
+
+        /// Write an integer value
+        void setInt(const char *key, const int64_t value) {
+            Check(confd_handle_set_int(this->handle, key, value));
+        }
+
+        /// Write a floating point value
+        void setReal(const char *key, const double value) {
+            Check(confd_handle_set_real(this->handle, key, value));
+        }
+
+        /// Write a boolean value
+        void setBool(const char *key, const bool value) {
+            Check(confd_handle_set_bool(this->handle, key, value));
+        }
+
+        /// Set a key's value to null
+        void setNull(const char *key) {
+            Check(confd_handle_set_null(this->handle, key));
+        }
+
+        /// Delete a key
+        void remove(const char *key) {
+            Check(confd_handle_delete(this->handle, key));
+        }
+
+    private:
+        /// Throw an error if a libconfd call failed
+        static void Check(const int status) {
+            if(status != kConfdStatusSuccess) {
+                throw Error(status);
+            }
+        }
+
+    private:
+        /// Connection handle, or `nullptr` for the default connection
+        confd_handle_t *handle{nullptr};
+};
+}
+
+#endif
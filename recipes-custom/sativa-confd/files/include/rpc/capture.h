@@ -0,0 +1,69 @@
+#ifndef RPC_HELPER_CAPTURE_H
+#define RPC_HELPER_CAPTURE_H
+
+#include <stdint.h>
+
+/// Magic value at the start of a capture file ('CDCP' when read as bytes)
+#define kRpcCaptureMagic 0x50434443
+/// Current capture file format version
+#define kRpcCaptureVersion 0x0001
+
+/**
+ * @brief RPC capture file header
+ *
+ * Capture files start with this header, followed by a sequence of records. Like the RPC messages
+ * themselves, all fields are in the native byte order.
+ */
+struct rpc_capture_header {
+    /// file magic: kRpcCaptureMagic
+    uint32_t magic;
+    /// capture format version: kRpcCaptureVersion
+    uint16_t version;
+    /// reserved, set to 0
+    uint16_t reserved;
+
+    /// wall clock time at which the capture was started (nanoseconds since the UNIX epoch)
+    uint64_t startTime;
+} __attribute__((packed));
+
+/**
+ * @brief Capture record types
+ */
+enum rpc_capture_record_type {
+    /// A request frame was received from a client
+    kRpcCaptureFrame                    = 0x01,
+    /// A client's connection was closed (no data follows)
+    kRpcCaptureClose                    = 0x02,
+};
+
+/**
+ * @brief Capture record flags
+ */
+enum rpc_capture_record_flags {
+    /// Processing of the request failed, and the client's connection was aborted
+    kRpcCaptureFailed                   = (1 << 0),
+};
+
+/**
+ * @brief A single record in a capture file
+ *
+ * Each record is immediately followed by `length` bytes of data: for frames, this is the request
+ * exactly as it was received, beginning with its `rpc_header`.
+ */
+struct rpc_capture_record {
+    /// time at which the event occurred (nanoseconds since the capture was started)
+    uint64_t timestamp;
+    /// time taken by the server to process the request (nanoseconds, saturating)
+    uint32_t duration;
+    /// identifier of the client (unique for the lifetime of the daemon)
+    uint32_t client;
+
+    /// number of bytes of frame data that follow
+    uint16_t length;
+    /// record type: a value of `rpc_capture_record_type`
+    uint8_t type;
+    /// record flags: a combination of `rpc_capture_record_flags`
+    uint8_t flags;
+} __attribute__((packed));
+
+#endif
@@ -40,6 +40,20 @@ enum rpc_endpoint {
     kConfigQuery                        = 0x01,
     /// Update the configuration database (write)
     kConfigUpdate                       = 0x02,
+    /// Retrieve daemon performance counters (read only)
+    kConfigStats                        = 0x03,
+    /// Delete a key from the configuration database
+    kConfigDelete                       = 0x04,
+    /// Retrieve traces of recent requests (read only)
+    kConfigTrace                        = 0x05,
+    /// Update multiple keys in a single transaction (possibly split over multiple messages)
+    kConfigBatchUpdate                  = 0x06,
+    /// Retrieve the values of all keys, a page at a time (read only)
+    kConfigExport                       = 0x07,
+    /// Update a key, only if its version matches the expected version
+    kConfigCompareAndSwap               = 0x08,
+    /// Atomically add to, subtract from, or take the min/max of an integer key's value
+    kConfigIntegerOp                    = 0x09,
 };
 
 #endif
@@ -0,0 +1,623 @@
+/**
+ * @file
+ *
+ * @brief confd load generator
+ *
+ * Starts a number of client threads, each of which issues a configurable mix of reads, writes and
+ * deletes against a confd instance for a fixed amount of time. Afterwards, the throughput and the
+ * latency distribution of each type of operation is printed.
+ *
+ * The benchmark can either connect to an already running confd, or start its own instance on a
+ * temporary database, so it can be run hermetically.
+ */
+#include <confd.h>
+#include <fmt/core.h>
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+/// Types of operations performed by the benchmark
+enum class Op: size_t {
+    Read                                = 0,
+    Write                               = 1,
+    Delete                              = 2,
+};
+/// Total number of operation types
+constexpr static const size_t kNumOps{3};
+/// Display names of operations
+constexpr static const std::array<const char *, kNumOps> kOpNames{{"read", "write", "delete"}};
+
+/**
+ * @brief Benchmark parameters
+ */
+struct Options {
+    /// Socket to connect to (if not spawning our own confd)
+    std::string socketPath{"/var/run/confd/rpc.sock"};
+    /// Path to the confd binary to spawn, if any
+    std::optional<std::filesystem::path> spawnConfd;
+    /// Storage backend of the spawned confd (`sqlite`, `memory` or `transient`)
+    std::string backend{"sqlite"};
+
+    /// Number of client threads
+    size_t threads{1};
+    /// Whether all client threads share the default connection, rather than each having its own
+    bool sharedConnection{false};
+    /// How long to run the benchmark for
+    std::chrono::seconds duration{10};
+
+    /// Number of distinct keys to operate on
+    size_t keys{1000};
+    /// Prefix for all key names
+    std::string prefix{"bench."};
+    /// Relative weights of reads, writes and deletes
+    std::array<unsigned int, kNumOps> mix{{90, 10, 0}};
+    /// Minimum size of values written
+    size_t minValueSize{16};
+    /// Maximum size of values written
+    size_t maxValueSize{16};
+
+    /// Whether all keys are written before the benchmark starts
+    bool preload{true};
+    /// Seed for the random number generators
+    uint64_t seed{0x5a71fa};
+};
+
+/**
+ * @brief Results collected by a single client thread
+ */
+struct ThreadResult {
+    /// Latency of each completed operation, in nanoseconds
+    std::array<std::vector<uint64_t>, kNumOps> latencies;
+    /// Number of failed operations
+    std::array<uint64_t, kNumOps> errors{};
+    /// Number of operations that found no key (reads and deletes of deleted keys)
+    std::array<uint64_t, kNumOps> misses{};
+};
+
+/**
+ * @brief confd instance owned by the benchmark
+ *
+ * Creates a temporary directory to hold the config file, database and socket; then starts confd
+ * with that configuration and waits for it to accept connections. It's shut down again, and the
+ * directory removed, when the object is destroyed.
+ */
+class ConfdInstance {
+    public:
+        ConfdInstance(const std::filesystem::path &binary, const std::string_view &backend);
+        ~ConfdInstance();
+
+        /// Get the path of the RPC socket of this instance
+        const auto &getSocketPath() const {
+            return this->socketPath;
+        }
+
+    private:
+        void waitReady();
+
+    private:
+        /// Maximum time to wait for confd to start accepting connections
+        constexpr static const std::chrono::seconds kStartTimeout{10};
+
+        /// Temporary directory holding all files of the instance
+        std::filesystem::path dir;
+        /// Path to the RPC socket
+        std::filesystem::path socketPath;
+        /// Process id of the daemon
+        pid_t pid{-1};
+};
+
+/**
+ * @brief Start a confd instance on a temporary database
+ *
+ * @param binary Path to the confd executable
+ * @param backend Storage backend to configure
+ */
+ConfdInstance::ConfdInstance(const std::filesystem::path &binary,
+        const std::string_view &backend) {
+    // create the work directory
+    std::string dirTemplate = (std::filesystem::temp_directory_path() / "confd-bench.XXXXXX");
+    if(!mkdtemp(dirTemplate.data())) {
+        throw std::system_error(errno, std::generic_category(), "mkdtemp");
+    }
+
+    this->dir = dirTemplate;
+    this->socketPath = this->dir / "rpc.sock";
+
+    // write a config file
+    const auto confPath = this->dir / "confd.toml";
+    {
+        std::ofstream conf(confPath);
+        conf << "[rpc]" << std::endl
+             << "listen = \"" << this->socketPath.native() << "\"" << std::endl
+             << "[storage]" << std::endl
+             << "dir = \"" << this->dir.native() << "\"" << std::endl
+             << "db = \"bench.db\"" << std::endl
+             << "backend = \"" << backend << "\"" << std::endl;
+    }
+
+    // start the daemon
+    this->pid = fork();
+    if(this->pid == -1) {
+        throw std::system_error(errno, std::generic_category(), "fork");
+    } else if(!this->pid) {
+        execl(binary.c_str(), binary.c_str(), "--config", confPath.c_str(), "--log-level=-2",
+                "--log-simple", nullptr);
+        // if we get here, exec failed
+        fprintf(stderr, "failed to exec '%s': %s\n", binary.c_str(), strerror(errno));
+        _exit(1);
+    }
+
+    this->waitReady();
+}
+
+/**
+ * @brief Stop the confd instance and remove its files
+ */
+ConfdInstance::~ConfdInstance() {
+    if(this->pid > 0) {
+        kill(this->pid, SIGTERM);
+        waitpid(this->pid, nullptr, 0);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(this->dir, ec);
+}
+
+/**
+ * @brief Wait for the daemon to accept connections
+ *
+ * Repeatedly try to connect to the RPC socket, until it succeeds, the daemon exits, or we time
+ * out.
+ */
+void ConfdInstance::waitReady() {
+    const auto deadline = Clock::now() + kStartTimeout;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, this->socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    while(Clock::now() < deadline) {
+        // bail if the daemon died
+        int status;
+        if(waitpid(this->pid, &status, WNOHANG) == this->pid) {
+            this->pid = -1;
+            throw std::runtime_error("confd exited during startup");
+        }
+
+        // try to connect
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd == -1) {
+            throw std::system_error(errno, std::generic_category(), "socket");
+        }
+
+        const int err = connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        close(fd);
+
+        if(!err) {
+            return;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    throw std::runtime_error("timed out waiting for confd to start");
+}
+
+
+
+/**
+ * @brief Generate the name of the key with the given index
+ */
+static std::string KeyName(const Options &opts, const size_t index) {
+    return fmt::format("{}{}", opts.prefix, index);
+}
+
+/**
+ * @brief Write all keys in the key space
+ *
+ * This ensures that reads at the start of the benchmark actually find their key.
+ */
+static void Preload(const Options &opts) {
+    const std::string value(opts.maxValueSize, 'x');
+
+    for(size_t i = 0; i < opts.keys; i++) {
+        const auto key = KeyName(opts, i);
+
+        const int err = confd_set_string(key.c_str(), value.data(), value.size());
+        if(err != kConfdStatusSuccess) {
+            throw std::runtime_error(fmt::format("failed to preload '{}': {} ({})", key,
+                        confd_strerror(err), err));
+        }
+    }
+}
+
+/**
+ * @brief Client thread main loop
+ *
+ * Perform randomly selected operations (according to the configured mix) on random keys, until
+ * the deadline passes.
+ *
+ * @param opts Benchmark parameters
+ * @param index Thread index (used to derive the random seed)
+ * @param handle Connection to perform requests on (NULL for the default connection)
+ * @param start Flag to wait for before starting
+ * @param deadline Time at which the benchmark ends
+ * @param result Where to store the results of this thread
+ */
+static void ClientThread(const Options &opts, const size_t index, confd_handle_t *handle,
+        const std::atomic_bool &start, const Clock::time_point &deadline, ThreadResult &result) {
+    std::mt19937_64 rng(opts.seed + index);
+    std::uniform_int_distribution<size_t> keyDist(0, opts.keys - 1);
+    std::uniform_int_distribution<size_t> sizeDist(opts.minValueSize, opts.maxValueSize);
+    std::discrete_distribution<size_t> opDist(opts.mix.begin(), opts.mix.end());
+
+    // source of value data, and read buffer
+    std::string valueData(opts.maxValueSize, '\0');
+    std::uniform_int_distribution<int> charDist('a', 'z');
+    std::generate(valueData.begin(), valueData.end(), [&]() {
+        return static_cast<char>(charDist(rng));
+    });
+
+    std::vector<char> readBuf(opts.maxValueSize + 1);
+
+    for(auto &vec : result.latencies) {
+        vec.reserve(1024 * 64);
+    }
+
+    while(!start) {
+        std::this_thread::yield();
+    }
+
+    // run operations
+    while(Clock::now() < deadline) {
+        const auto op = static_cast<Op>(opDist(rng));
+        const auto key = KeyName(opts, keyDist(rng));
+        int err{kConfdStatusSuccess};
+
+        const auto opStart = Clock::now();
+
+        switch(op) {
+            case Op::Read: {
+                size_t actual{0};
+                err = confd_handle_get_string(handle, key.c_str(), readBuf.data(),
+                        readBuf.size(), &actual);
+                break;
+            }
+            case Op::Write:
+                err = confd_handle_set_string(handle, key.c_str(), valueData.data(),
+                        sizeDist(rng));
+                break;
+            case Op::Delete:
+                err = confd_handle_delete(handle, key.c_str());
+                break;
+        }
+
+        const auto opEnd = Clock::now();
+        const auto opIdx = static_cast<size_t>(op);
+
+        if(err == kConfdNotFound) {
+            result.misses[opIdx]++;
+        } else if(err != kConfdStatusSuccess) {
+            result.errors[opIdx]++;
+            continue;
+        }
+
+        result.latencies[opIdx].push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(opEnd - opStart).count());
+    }
+}
+
+/**
+ * @brief Get a percentile from a sorted list of samples
+ *
+ * @return Percentile value, converted to µs
+ */
+static double Percentile(const std::vector<uint64_t> &sorted, const double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+
+    const auto idx = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[std::clamp<size_t>(idx, 1, sorted.size()) - 1]) / 1000.;
+}
+
+/**
+ * @brief Print the benchmark results
+ *
+ * Merges the per-thread results, then prints per operation type the count, throughput and the
+ * latency distribution.
+ */
+static void PrintResults(const Options &opts, std::vector<ThreadResult> &results,
+        const std::chrono::duration<double> elapsed) {
+    uint64_t totalOps{0};
+
+    std::cout << fmt::format("{:<8} {:>10} {:>8} {:>8} {:>12} {:>10} {:>10} {:>10} {:>10}",
+            "op", "count", "misses", "errors", "ops/s", "p50 (µs)", "p99 (µs)", "p999 (µs)",
+            "max (µs)") << std::endl;
+
+    for(size_t i = 0; i < kNumOps; i++) {
+        std::vector<uint64_t> samples;
+        uint64_t misses{0}, errors{0};
+
+        for(auto &result : results) {
+            samples.insert(samples.end(), result.latencies[i].begin(), result.latencies[i].end());
+            misses += result.misses[i];
+            errors += result.errors[i];
+        }
+
+        if(samples.empty() && !errors) {
+            continue;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        totalOps += samples.size();
+
+        std::cout << fmt::format("{:<8} {:>10} {:>8} {:>8} {:>12.1f} {:>10.1f} {:>10.1f} {:>10.1f} "
+                "{:>10.1f}", kOpNames[i], samples.size(), misses, errors,
+                static_cast<double>(samples.size()) / elapsed.count(), Percentile(samples, .5),
+                Percentile(samples, .99), Percentile(samples, .999), Percentile(samples, 1.))
+            << std::endl;
+    }
+
+    std::cout << fmt::format("total: {} ops in {:.2f} s ({:.1f} ops/s)", totalOps,
+            elapsed.count(), static_cast<double>(totalOps) / elapsed.count()) << std::endl;
+}
+
+/**
+ * @brief Parse a mix specification
+ *
+ * Mixes are specified as `read:write:delete` weights, e.g. `90:10:0`.
+ */
+static std::array<unsigned int, kNumOps> ParseMix(const std::string &str) {
+    std::array<unsigned int, kNumOps> mix{};
+
+    if(sscanf(str.c_str(), "%u:%u:%u", &mix[0], &mix[1], &mix[2]) != 3) {
+        throw std::invalid_argument(fmt::format("invalid mix `{}` (expected read:write:delete)",
+                    str));
+    } else if(!mix[0] && !mix[1] && !mix[2]) {
+        throw std::invalid_argument("mix must contain at least one operation");
+    }
+
+    return mix;
+}
+
+/**
+ * @brief Get the default path to the confd binary
+ *
+ * Prefer a `confd` binary next to our own executable (as is the case in the build directory),
+ * otherwise fall back to its installed location.
+ */
+static std::filesystem::path DefaultConfdPath() {
+    std::error_code ec;
+    const auto self = std::filesystem::read_symlink("/proc/self/exe", ec);
+
+    if(!ec) {
+        const auto sibling = self.parent_path() / "confd";
+        if(std::filesystem::exists(sibling)) {
+            return sibling;
+        }
+    }
+
+    return "/usr/sbin/confd";
+}
+
+/**
+ * @brief Benchmark entry point
+ *
+ * The benchmark is configured with the following switches:
+ *
+ * - socket: Path to the confd RPC socket to connect to
+ * - spawn: Start a confd instance (optionally at the given path) on a temporary database, and
+ *          benchmark it instead of connecting to an existing instance
+ * - backend: Storage backend of the spawned instance (`sqlite`, `memory` or `transient`)
+ * - threads: Number of client threads
+ * - shared-connection: Have all threads share one connection, rather than each opening its own
+ * - duration: How long to run the benchmark, in seconds
+ * - keys: Number of distinct keys to operate on
+ * - prefix: Prefix to apply to all key names
+ * - mix: Relative weights of reads, writes and deletes, as `read:write:delete`
+ * - value-size: Size of written values in bytes, either as a fixed size or `min:max` range
+ * - no-preload: Do not write all keys before starting the benchmark
+ * - seed: Seed for the random number generators
+ *
+ * @remark With a shared connection, requests from multiple threads are serialized by libconfd;
+ *         compare against the default to see the cost of contending for it.
+ */
+int main(const int argc, char * const *argv) {
+    Options opts;
+    std::optional<ConfdInstance> instance;
+
+    // parse command line
+    int c;
+    while(1) {
+        int index{0};
+        const static struct option options[] = {
+            {"socket",                  required_argument, 0, 0},
+            {"spawn",                   optional_argument, 0, 0},
+            {"threads",                 required_argument, 0, 0},
+            {"duration",                required_argument, 0, 0},
+            {"keys",                    required_argument, 0, 0},
+            {"prefix",                  required_argument, 0, 0},
+            {"mix",                     required_argument, 0, 0},
+            {"value-size",              required_argument, 0, 0},
+            {"no-preload",              no_argument, 0, 0},
+            {"seed",                    required_argument, 0, 0},
+            {"shared-connection",       no_argument, 0, 0},
+            {"backend",                 required_argument, 0, 0},
+            {nullptr,                   0, 0, 0},
+        };
+
+        c = getopt_long(argc, argv, "", options, &index);
+
+        // end of options
+        if(c == -1) {
+            break;
+        }
+        // unknown option
+        else if(c == '?') {
+            return 1;
+        }
+
+        try {
+            switch(index) {
+                case 0:
+                    opts.socketPath = optarg;
+                    break;
+                case 1:
+                    opts.spawnConfd = optarg ? std::filesystem::path(optarg) : DefaultConfdPath();
+                    break;
+                case 2:
+                    opts.threads = std::stoul(optarg);
+                    break;
+                case 3:
+                    opts.duration = std::chrono::seconds(std::stoul(optarg));
+                    break;
+                case 4:
+                    opts.keys = std::stoul(optarg);
+                    break;
+                case 5:
+                    opts.prefix = optarg;
+                    break;
+                case 6:
+                    opts.mix = ParseMix(optarg);
+                    break;
+                case 7: {
+                    const std::string str(optarg);
+                    const auto sep = str.find(':');
+
+                    opts.minValueSize = std::stoul(str.substr(0, sep));
+                    opts.maxValueSize = (sep == std::string::npos) ? opts.minValueSize :
+                        std::stoul(str.substr(sep + 1));
+                    break;
+                }
+                case 8:
+                    opts.preload = false;
+                    break;
+                case 9:
+                    opts.seed = std::stoull(optarg);
+                    break;
+                case 10:
+                    opts.sharedConnection = true;
+                    break;
+                case 11:
+                    opts.backend = optarg;
+                    break;
+            }
+        } catch(const std::exception &e) {
+            std::cerr << fmt::format("invalid value for --{}: {}", options[index].name, e.what())
+                << std::endl;
+            return 1;
+        }
+    }
+
+    // validate args
+    if(!opts.threads || !opts.keys) {
+        std::cerr << "thread and key counts must be nonzero" << std::endl;
+        return 1;
+    } else if(opts.minValueSize > opts.maxValueSize) {
+        std::cerr << "invalid value size range" << std::endl;
+        return 1;
+    }
+
+    try {
+        // start our own confd, if desired, then connect to it
+        if(opts.spawnConfd) {
+            std::cerr << "starting confd: " << opts.spawnConfd->native() << std::endl;
+            instance.emplace(*opts.spawnConfd, opts.backend);
+            opts.socketPath = instance->getSocketPath();
+        }
+
+        int err = confd_open(opts.socketPath.c_str());
+        if(err) {
+            throw std::runtime_error(fmt::format("failed to connect to confd: {}",
+                        confd_strerror(err)));
+        }
+
+        std::cout << fmt::format("confd-bench: {} threads, {} s, {} keys, mix {}:{}:{}, "
+                "values {}..{} bytes", opts.threads, opts.duration.count(), opts.keys, opts.mix[0],
+                opts.mix[1], opts.mix[2], opts.minValueSize, opts.maxValueSize);
+        if(instance) {
+            std::cout << fmt::format(", {} backend", opts.backend);
+        }
+        std::cout << std::endl;
+
+        if(opts.preload) {
+            Preload(opts);
+        }
+
+        // open a connection for each thread, unless they're sharing the default one
+        std::vector<confd_handle_t *> handles(opts.threads, nullptr);
+
+        if(!opts.sharedConnection) {
+            for(auto &handle : handles) {
+                err = confd_handle_open(opts.socketPath.c_str(), &handle);
+                if(err) {
+                    throw std::runtime_error(fmt::format("failed to connect to confd: {}",
+                                confd_strerror(err)));
+                }
+            }
+        }
+
+        // run client threads
+        std::vector<ThreadResult> results(opts.threads);
+        std::vector<std::thread> threads;
+        std::atomic_bool start{false};
+        Clock::time_point deadline;
+
+        for(size_t i = 0; i < opts.threads; i++) {
+            threads.emplace_back(ClientThread, std::cref(opts), i, handles[i], std::cref(start),
+                    std::cref(deadline), std::ref(results[i]));
+        }
+
+        const auto begin = Clock::now();
+        deadline = begin + opts.duration;
+        start = true;
+
+        for(auto &thread : threads) {
+            thread.join();
+        }
+
+        const auto elapsed = Clock::now() - begin;
+
+        for(auto handle : handles) {
+            if(handle) {
+                confd_handle_close(handle);
+            }
+        }
+        confd_close();
+
+        PrintResults(opts, results, elapsed);
+    } catch(const std::exception &e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
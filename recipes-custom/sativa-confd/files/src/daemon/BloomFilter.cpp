@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+
+#include "BloomFilter.h"
+
+/**
+ * @brief Clear the filter, and size it for the given number of strings
+ *
+ * The number of bits is rounded up to a power of two, so the actual false positive rate at the
+ * filter's capacity may be somewhat lower than intended.
+ *
+ * @param capacity Number of strings to size the filter for
+ */
+void BloomFilter::reset(const size_t capacity) {
+    const auto numBits = std::bit_ceil(std::max<size_t>(capacity * kBitsPerString, 64));
+
+    this->bits.assign(numBits / 64, 0);
+    this->mask = numBits - 1;
+    this->capacity = capacity;
+    this->numAdded = 0;
+}
+
+/**
+ * @brief Add a string to the filter
+ *
+ * The bit positions are derived from a single 64-bit hash, whose halves are combined to simulate
+ * independent hash functions (double hashing.)
+ */
+void BloomFilter::add(const std::string_view &str) {
+    const uint64_t hash = std::hash<std::string_view>{}(str);
+    const uint64_t h1 = hash & 0xFFFFFFFF, h2 = (hash >> 32) | 1;
+
+    for(size_t i = 0; i < kNumHashes; i++) {
+        const auto bit = (h1 + i * h2) & this->mask;
+        this->bits[bit / 64] |= (uint64_t{1} << (bit % 64));
+    }
+
+    this->numAdded++;
+}
+
+/**
+ * @brief Test whether a string may have been added to the filter
+ *
+ * @return Whether the string may have been added; if false, it definitely wasn't
+ */
+bool BloomFilter::mayContain(const std::string_view &str) const {
+    const uint64_t hash = std::hash<std::string_view>{}(str);
+    const uint64_t h1 = hash & 0xFFFFFFFF, h2 = (hash >> 32) | 1;
+
+    for(size_t i = 0; i < kNumHashes; i++) {
+        const auto bit = (h1 + i * h2) & this->mask;
+        if(!(this->bits[bit / 64] & (uint64_t{1} << (bit % 64)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Estimate the current false positive rate
+ *
+ * This is the theoretical rate for the number of strings added so far; strings added more than
+ * once are counted each time, so it's an upper bound.
+ */
+double BloomFilter::getExpectedFalsePositiveRate() const {
+    const double numBits = static_cast<double>(this->mask + 1);
+    const double fill = 1. - std::exp(-static_cast<double>(kNumHashes * this->numAdded) / numBits);
+
+    return std::pow(fill, kNumHashes);
+}
@@ -0,0 +1,62 @@
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Bloom filter over strings
+ *
+ * Answers whether a string may have been added to the filter: if it says no, the string was
+ * definitely never added; if it says yes, it was added, or it's a false positive. The filter is
+ * sized for a number of strings (its capacity), at which the false positive rate is about 1%;
+ * adding more strings than that raises the false positive rate, so the filter should be rebuilt
+ * with a larger capacity instead.
+ *
+ * Strings can't be removed from the filter: to drop them, it has to be rebuilt from scratch.
+ */
+class BloomFilter {
+    public:
+        BloomFilter(const size_t capacity = 0) {
+            this->reset(capacity);
+        }
+
+        void reset(const size_t capacity);
+        void add(const std::string_view &str);
+        bool mayContain(const std::string_view &str) const;
+
+        /// Get the number of strings the filter is sized for
+        size_t getCapacity() const {
+            return this->capacity;
+        }
+        /// Get the number of strings added since the filter was last reset
+        size_t size() const {
+            return this->numAdded;
+        }
+        /// Get the memory used by the filter's bits, in bytes
+        size_t getMemoryUsage() const {
+            return this->bits.size() * sizeof(uint64_t);
+        }
+        double getExpectedFalsePositiveRate() const;
+
+    private:
+        /// Number of bits per string, at the filter's capacity
+        constexpr static const size_t kBitsPerString{10};
+        /// Number of bits set per string (optimal for the number of bits per string)
+        constexpr static const size_t kNumHashes{7};
+
+    private:
+        /// Bits of the filter
+        std::vector<uint64_t> bits;
+        /// Mask applied to bit indices (the number of bits is always a power of two)
+        uint64_t mask{0};
+
+        /// Number of strings the filter is sized for
+        size_t capacity{0};
+        /// Number of strings added
+        size_t numAdded{0};
+};
+
+#endif
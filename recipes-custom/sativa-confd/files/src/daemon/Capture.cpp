@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+#include <plog/Log.h>
+#include <rpc/capture.h>
+
+#include "Capture.h"
+
+/**
+ * @brief Open a capture file
+ *
+ * Create (or truncate) the capture file at the given path and write its header. Captures contain
+ * the values of all keys written, so the file is only accessible by the owner.
+ *
+ * @param path Path of the capture file
+ */
+CaptureWriter::CaptureWriter(const std::filesystem::path &path) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open capture file");
+    }
+
+    // an existing file keeps its permissions, so restrict those as well
+    if(fchmod(fd, 0600) == -1) {
+        const auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "set capture file permissions");
+    }
+
+    this->file = fdopen(fd, "wb");
+    if(!this->file) {
+        const auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "open capture file stream");
+    }
+
+    this->buffer.resize(kBufferSize);
+    setvbuf(this->file, this->buffer.data(), _IOFBF, this->buffer.size());
+
+    // write the header
+    const auto now = std::chrono::system_clock::now();
+
+    const struct rpc_capture_header hdr{
+        .magic = kRpcCaptureMagic,
+        .version = kRpcCaptureVersion,
+        .reserved = 0,
+        .startTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now.time_since_epoch()).count()),
+    };
+
+    if(fwrite(&hdr, sizeof(hdr), 1, this->file) != 1) {
+        const auto err = errno;
+        fclose(this->file);
+        this->file = nullptr;
+        throw std::system_error(err, std::generic_category(), "write capture header");
+    }
+
+    PLOG_INFO << "capturing RPC traffic to " << path.native();
+}
+
+/**
+ * @brief Flush outstanding records and close the capture file
+ */
+CaptureWriter::~CaptureWriter() {
+    if(this->file) {
+        fclose(this->file);
+    }
+}
+
+/**
+ * @brief Record a request frame
+ *
+ * @param client Identifier of the client that sent the request
+ * @param received Time at which the request was received
+ * @param duration Time taken to process the request
+ * @param frame Request frame (including its header)
+ * @param failed Whether processing of the request failed
+ */
+void CaptureWriter::recordFrame(const uint32_t client, const Clock::time_point received,
+        const Clock::duration duration, std::span<const std::byte> frame, const bool failed) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    frame = frame.first(std::min<size_t>(frame.size(), std::numeric_limits<uint16_t>::max()));
+
+    const struct rpc_capture_record record{
+        .timestamp = this->timestampFor(received),
+        .duration = static_cast<uint32_t>(std::clamp<int64_t>(ns, 0,
+                    std::numeric_limits<uint32_t>::max())),
+        .client = client,
+        .length = static_cast<uint16_t>(frame.size()),
+        .type = kRpcCaptureFrame,
+        .flags = static_cast<uint8_t>(failed ? kRpcCaptureFailed : 0),
+    };
+
+    this->write(record, frame);
+}
+
+/**
+ * @brief Record that a client's connection was closed
+ *
+ * @param client Identifier of the client whose connection was closed
+ */
+void CaptureWriter::recordClose(const uint32_t client) {
+    const struct rpc_capture_record record{
+        .timestamp = this->timestampFor(Clock::now()),
+        .duration = 0,
+        .client = client,
+        .length = 0,
+        .type = kRpcCaptureClose,
+        .flags = 0,
+    };
+
+    this->write(record, {});
+}
+
+/**
+ * @brief Append a record to the capture file
+ *
+ * Failing to write to the capture file isn't fatal: it's logged, but the request otherwise
+ * proceeds as normal.
+ */
+void CaptureWriter::write(const struct rpc_capture_record &record,
+        std::span<const std::byte> data) {
+    if(fwrite(&record, sizeof(record), 1, this->file) != 1 ||
+            (!data.empty() && fwrite(data.data(), data.size(), 1, this->file) != 1)) {
+        PLOG_WARNING << "failed to write capture record: " << strerror(errno);
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * @file
+ *
+ * @brief RPC traffic recorder
+ *
+ * Writes every request received by the RPC server to a capture file, so that real access patterns
+ * can later be replayed against a test instance with `confd-replay`.
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+/**
+ * @brief Capture file writer
+ *
+ * Records are appended to a buffered file stream, so recording a request doesn't usually incur a
+ * system call. The buffer is flushed when full, and when the writer is destroyed.
+ */
+class CaptureWriter {
+    public:
+        /// Clock used for record timestamps
+        using Clock = std::chrono::steady_clock;
+
+        CaptureWriter(const std::filesystem::path &path);
+        ~CaptureWriter();
+
+        void recordFrame(const uint32_t client, const Clock::time_point received,
+                const Clock::duration duration, std::span<const std::byte> frame,
+                const bool failed);
+        void recordClose(const uint32_t client);
+
+    private:
+        void write(const struct rpc_capture_record &, std::span<const std::byte>);
+
+        /// Get the timestamp (relative to the capture start) for a time point
+        uint64_t timestampFor(const Clock::time_point time) const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time - this->start)
+                .count();
+        }
+
+    private:
+        /// Size of the file stream buffer
+        constexpr static const size_t kBufferSize{64 * 1024};
+
+        /// Capture file
+        FILE *file{nullptr};
+        /// Buffer for the file stream
+        std::vector<char> buffer;
+
+        /// Time at which the capture was started
+        Clock::time_point start{Clock::now()};
+};
+
+#endif
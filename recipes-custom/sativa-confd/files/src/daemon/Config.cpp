@@ -13,10 +13,23 @@
 
 #include "Config.h"
 
+std::unordered_set<std::string> Config::gOpenedFiles;
+
 std::filesystem::path Config::gSocketPath;
 mode_t Config::gSocketMode{S_IRWXU | S_IRWXG | S_IRWXO};
+std::filesystem::path Config::gCapturePath;
+std::chrono::milliseconds Config::gSlowThreshold{0};
 
 std::filesystem::path Config::gStoragePath;
+std::filesystem::path Config::gDefaultsPath;
+std::vector<std::string> Config::gVolatilePrefixes;
+bool Config::gTouchUnchanged{false};
+std::vector<Config::DebouncePolicy> Config::gDebouncePolicies;
+size_t Config::gValueCacheSize{0};
+Config::StorageBackendType Config::gBackend{StorageBackendType::Sqlite};
+bool Config::gMemorySyncWrites{false};
+size_t Config::gMemoryCompactSize{256 * 1024};
+std::chrono::seconds Config::gMemoryCheckpointInterval{30};
 std::vector<Config::AccessDescriptor> Config::gAllowList;
 
 /**
@@ -27,8 +40,6 @@ std::vector<Config::AccessDescriptor> Config::gAllowList;
  * @param isRoot Whether this is the root config file, or one that was included
  */
 void Config::Read(const std::filesystem::path &path, const bool isRoot) {
-    static std::unordered_set<std::string> gOpenedFiles;
-
     // ensure file hasn't been read before (to avoid loops) before parsing it
     const auto &nativePath = path.native();
     if(gOpenedFiles.contains(nativePath)) {
@@ -92,10 +103,38 @@ void Config::Read(const std::filesystem::path &path, const bool isRoot) {
     }
 }
 
+/**
+ * @brief Discard the configuration read so far
+ *
+ * All settings are restored to their defaults, so the config file can be read again; this is used
+ * by the library in embedded mode, which reads the config each time it opens the data store.
+ */
+void Config::Reset() {
+    gOpenedFiles.clear();
+
+    gSocketPath.clear();
+    gSocketMode = S_IRWXU | S_IRWXG | S_IRWXO;
+    gCapturePath.clear();
+    gSlowThreshold = std::chrono::milliseconds(0);
+
+    gStoragePath.clear();
+    gDefaultsPath.clear();
+    gVolatilePrefixes.clear();
+    gTouchUnchanged = false;
+    gDebouncePolicies.clear();
+    gValueCacheSize = 0;
+    gBackend = StorageBackendType::Sqlite;
+    gMemorySyncWrites = false;
+    gMemoryCompactSize = 256 * 1024;
+    gMemoryCheckpointInterval = std::chrono::seconds(30);
+    gAllowList.clear();
+}
+
 /**
  * @brief Read RPC configuration
  *
- * This just reads out the listen socket path.
+ * This reads out the listen socket path, its permissions, the optional traffic capture file, and
+ * the slow request logging threshold.
  */
 void Config::ReadRpc(const toml::table &tbl) {
     const std::string path = tbl["listen"].value_or("");
@@ -110,6 +149,20 @@ void Config::ReadRpc(const toml::table &tbl) {
     if(mode >= 0) {
         gSocketMode = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     }
+
+    // record all requests to this file, if specified
+    const std::string capture = tbl["capture"].value_or("");
+    if(!capture.empty()) {
+        gCapturePath = capture;
+    }
+
+    // log requests slower than this many milliseconds
+    const auto slowlog = tbl["slowlog"].value_or(0);
+    if(slowlog < 0) {
+        throw std::runtime_error("invalid `rpc.slowlog` key (expected non-negative integer)");
+    }
+
+    gSlowThreshold = std::chrono::milliseconds(slowlog);
 }
 
 /**
@@ -117,6 +170,21 @@ void Config::ReadRpc(const toml::table &tbl) {
  *
  * Assemble the full path to the sqlite database file that stores the configuration data, while
  * checking that the containing directory at least exists.
+ *
+ * Additionally, the optional `volatile` key holds a list of key prefixes: keys under them are
+ * kept only in memory, and are lost when the daemon exits.
+ *
+ * Writes that don't change a key's value are skipped; if `unchanged` is set to `touch`, the key's
+ * timestamp is still updated. Writes to keys under the prefixes in the `debounce` tables are held
+ * in memory until the key is quiet for a while.
+ *
+ * The `backend` key selects where keys are stored: either in the sqlite database (`sqlite`, the
+ * default) or in memory (`memory`), persisted via a write log and snapshots next to the database
+ * path; the latter is configured by the `memory` table. For testing and benchmarking, `transient`
+ * holds keys in memory without persisting them at all.
+ *
+ * The optional `defaults` key is the path of a read-only image of factory defaults (as built by
+ * `confd-mkdefaults`), which keys missing from the backend fall through to.
  */
 void Config::ReadStorage(const toml::table &tbl) {
     // get directory
@@ -134,6 +202,122 @@ void Config::ReadStorage(const toml::table &tbl) {
     }
 
     gStoragePath /= name;
+
+    // factory defaults image
+    const std::string defaults = tbl["defaults"].value_or("");
+    if(!defaults.empty()) {
+        gDefaultsPath = defaults;
+    }
+
+    // volatile key prefixes
+    const auto prefixes = tbl["volatile"];
+    if(prefixes) {
+        if(!prefixes.is_array()) {
+            throw std::runtime_error("invalid storage.volatile key (expected array)");
+        }
+
+        prefixes.as_array()->for_each([](auto&& el) {
+            if(!el.is_string() || el.as_string()->get().empty()) {
+                throw std::runtime_error("invalid storage.volatile value (expected string)");
+            }
+            gVolatilePrefixes.emplace_back(*(el.as_string()));
+        });
+    }
+
+    // handling of unchanged writes
+    const std::string unchanged = tbl["unchanged"].value_or("skip");
+    if(unchanged == "touch") {
+        gTouchUnchanged = true;
+    } else if(unchanged != "skip") {
+        throw std::runtime_error(fmt::format("invalid storage.unchanged value '{}'", unchanged));
+    }
+
+    // write debounce policies
+    const auto debounce = tbl["debounce"];
+    if(debounce) {
+        if(!debounce.is_array_of_tables()) {
+            throw std::runtime_error("invalid storage.debounce key (expected array of tables)");
+        }
+
+        for(const auto &policy : *debounce.as_array()) {
+            ReadStorageDebounce(*policy.as_table());
+        }
+    }
+
+    // encoded value cache
+    const auto valueCache = tbl["valueCache"].value_or(static_cast<int64_t>(gValueCacheSize));
+    if(valueCache < 0) {
+        throw std::runtime_error("invalid storage.valueCache key (expected non-negative integer)");
+    }
+    gValueCacheSize = static_cast<size_t>(valueCache);
+
+    // storage backend
+    const std::string backend = tbl["backend"].value_or("sqlite");
+    if(backend == "sqlite") {
+        gBackend = StorageBackendType::Sqlite;
+    } else if(backend == "memory") {
+        gBackend = StorageBackendType::Memory;
+    } else if(backend == "transient") {
+        gBackend = StorageBackendType::Transient;
+    } else {
+        throw std::runtime_error(fmt::format("invalid storage.backend value '{}'", backend));
+    }
+
+    const auto memory = tbl["memory"];
+    if(memory) {
+        if(!memory.is_table()) {
+            throw std::runtime_error("invalid storage.memory key (expected table)");
+        }
+        ReadStorageMemory(*memory.as_table());
+    }
+}
+
+/**
+ * @brief Read the in-memory storage configuration
+ *
+ * This consists of whether the write log is synced after every write (`sync`), the size in bytes
+ * above which it's compacted into a new snapshot (`compact`), and the interval in seconds at
+ * which the log is synced and checked for compaction (`checkpoint`).
+ */
+void Config::ReadStorageMemory(const toml::table &tbl) {
+    gMemorySyncWrites = tbl["sync"].value_or(gMemorySyncWrites);
+
+    const auto compact = tbl["compact"].value_or(static_cast<int64_t>(gMemoryCompactSize));
+    if(compact <= 0) {
+        throw std::runtime_error("invalid storage.memory.compact key (expected positive integer)");
+    }
+    gMemoryCompactSize = static_cast<size_t>(compact);
+
+    const auto checkpoint = tbl["checkpoint"].value_or(gMemoryCheckpointInterval.count());
+    if(checkpoint <= 0) {
+        throw std::runtime_error(
+                "invalid storage.memory.checkpoint key (expected positive integer)");
+    }
+    gMemoryCheckpointInterval = std::chrono::seconds(checkpoint);
+}
+
+/**
+ * @brief Read a write debounce policy
+ *
+ * Each policy has a key `prefix` it applies to, and the `interval` (in milliseconds) a key must be
+ * quiet for before its latest value is written to the database.
+ */
+void Config::ReadStorageDebounce(const toml::table &tbl) {
+    const std::string prefix = tbl["prefix"].value_or("");
+    if(prefix.empty()) {
+        throw std::runtime_error("invalid storage.debounce.prefix key (expected string)");
+    }
+
+    const auto interval = tbl["interval"].value_or(0);
+    if(interval <= 0) {
+        throw std::runtime_error(
+                "invalid storage.debounce.interval key (expected positive integer)");
+    }
+
+    gDebouncePolicies.push_back({
+        .prefix = prefix,
+        .interval = std::chrono::milliseconds(interval),
+    });
 }
 
 /**
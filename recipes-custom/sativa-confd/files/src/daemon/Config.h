@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <chrono>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -37,8 +38,34 @@ class Config {
             std::unordered_set<std::string> allowed;
         };
 
+        /**
+         * @brief Debounce policy for a key prefix
+         *
+         * Writes to keys under the prefix are held in memory, and only the latest value is written
+         * to the database once the key hasn't been written for the given interval.
+         */
+        struct DebouncePolicy {
+            /// Key prefix the policy applies to
+            std::string prefix;
+            /// Time after the last write to a key before it's written to the database
+            std::chrono::milliseconds interval;
+        };
+
+        /**
+         * @brief Storage backend holding the data store's keys
+         */
+        enum class StorageBackendType {
+            /// sqlite database
+            Sqlite,
+            /// All keys held in memory, persisted by a write log
+            Memory,
+            /// All keys held in memory, and lost when the daemon exits
+            Transient,
+        };
+
     public:
         static void Read(const std::filesystem::path &path, const bool isRoot = true);
+        static void Reset();
 
         /// Get the path for the RPC listening socket
         static const auto &GetRpcSocketPath() {
@@ -48,15 +75,61 @@ class Config {
         static const auto GetRpcSocketPermissions() {
             return gSocketMode;
         }
+        /// Get the path of the RPC traffic capture file (empty if capturing is disabled)
+        static const auto &GetRpcCapturePath() {
+            return gCapturePath;
+        }
+        /// Get the time above which requests are logged as slow (zero if disabled)
+        static const auto GetRpcSlowThreshold() {
+            return gSlowThreshold;
+        }
 
         /// Get the path of the storage database
         static const auto &GetStoragePath() {
             return gStoragePath;
         }
+        /// Get the path of the factory defaults image (empty if there is none)
+        static const auto &GetDefaultsPath() {
+            return gDefaultsPath;
+        }
+        /// Get the key prefixes whose keys are held only in memory
+        static const auto &GetVolatilePrefixes() {
+            return gVolatilePrefixes;
+        }
+        /// Whether writes of a key's current value should update its timestamp
+        static const auto GetStorageTouchUnchanged() {
+            return gTouchUnchanged;
+        }
+        /// Get the write debounce policies
+        static const auto &GetDebouncePolicies() {
+            return gDebouncePolicies;
+        }
+        /// Get the maximum size of the encoded value cache, in bytes (zero if disabled)
+        static const auto GetStorageValueCacheSize() {
+            return gValueCacheSize;
+        }
+        /// Get the storage backend that holds all keys
+        static const auto GetStorageBackend() {
+            return gBackend;
+        }
+        /// Whether the write log is synced after every write (in-memory mode)
+        static const auto GetMemorySyncWrites() {
+            return gMemorySyncWrites;
+        }
+        /// Get the size of the write log above which it's compacted (in-memory mode)
+        static const auto GetMemoryCompactSize() {
+            return gMemoryCompactSize;
+        }
+        /// Get the interval at which the write log is synced and compacted (in-memory mode)
+        static const auto GetMemoryCheckpointInterval() {
+            return gMemoryCheckpointInterval;
+        }
 
     private:
         static void ReadRpc(const toml::table &);
         static void ReadStorage(const toml::table &);
+        static void ReadStorageDebounce(const toml::table &);
+        static void ReadStorageMemory(const toml::table &);
         static void ReadAccess(const toml::table &);
         static void ReadAccessAllow(const toml::table &);
 
@@ -64,13 +137,38 @@ class Config {
         static void ProcessIncludeDirectory(const std::filesystem::path &);
 
     private:
+        /// Config files read so far
+        static std::unordered_set<std::string> gOpenedFiles;
+
         /// Path to the UNIX domain socket used for RPC
         static std::filesystem::path gSocketPath;
         /// Permissions to apply to the domain socket (if any)
         static mode_t gSocketMode;
+        /// File to which all received RPC requests are recorded
+        static std::filesystem::path gCapturePath;
+        /// Requests taking longer than this are logged
+        static std::chrono::milliseconds gSlowThreshold;
 
         /// Path of the database file
         static std::filesystem::path gStoragePath;
+        /// Path of the read-only factory defaults image
+        static std::filesystem::path gDefaultsPath;
+        /// Key prefixes that are never written to the database
+        static std::vector<std::string> gVolatilePrefixes;
+        /// Update the timestamp of keys when they are written with their current value
+        static bool gTouchUnchanged;
+        /// Write debounce policies
+        static std::vector<DebouncePolicy> gDebouncePolicies;
+        /// Maximum size of the encoded value cache (in bytes)
+        static size_t gValueCacheSize;
+        /// Storage backend holding all keys
+        static StorageBackendType gBackend;
+        /// Sync the write log after every write
+        static bool gMemorySyncWrites;
+        /// Size of the write log (in bytes) above which it's compacted
+        static size_t gMemoryCompactSize;
+        /// Interval at which the write log is synced and compacted
+        static std::chrono::seconds gMemoryCheckpointInterval;
         /// Allowed access list
         static std::vector<AccessDescriptor> gAllowList;
 };
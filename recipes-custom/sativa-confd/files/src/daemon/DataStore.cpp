@@ -1,167 +1,246 @@
 #include <algorithm>
 #include <chrono>
+#include <optional>
 #include <stdexcept>
-#include <type_traits>
 
 #include <fmt/format.h>
 #include <plog/Log.h>
-#include <SQLiteCpp/SQLiteCpp.h>
 
 #include "DataStore.h"
+#include "SqliteBackend.h"
 #include "Types.h"
-#include "version.h"
 
 /**
- * @brief Open the data store at the given path
+ * @brief Calculate the result of an atomic integer operation
+ *
+ * @param op Operation to perform
+ * @param oldValue Current value of the key, if it has one
+ * @param operand Operand for the operation
+ */
+static int64_t ApplyIntegerOp(const DataStore::IntegerOp op, const std::optional<int64_t> oldValue,
+        const int64_t operand) {
+    switch(op) {
+        case DataStore::IntegerOp::Add:
+            return static_cast<int64_t>(static_cast<uint64_t>(oldValue.value_or(0)) +
+                    static_cast<uint64_t>(operand));
+        case DataStore::IntegerOp::Subtract:
+            return static_cast<int64_t>(static_cast<uint64_t>(oldValue.value_or(0)) -
+                    static_cast<uint64_t>(operand));
+        case DataStore::IntegerOp::Min:
+            return std::min(oldValue.value_or(operand), operand);
+        case DataStore::IntegerOp::Max:
+            return std::max(oldValue.value_or(operand), operand);
+    }
+
+    throw std::invalid_argument("invalid integer op");
+}
+
+/**
+ * @brief Open the sqlite data store at the given path
  *
  * If there is not yet a datastore at the given path, it's initialized with the current schema.
  * Otherwise, it's simply opened as is, with a few basic consistency checks.
  *
  * @param dbPath Path on disk of the sqlite3 database
+ * @param volatilePrefixes Key prefixes whose keys are kept in memory, rather than the database
+ *
+ * @throw std::system_error The data store is already open in another process (EWOULDBLOCK)
  */
-DataStore::DataStore(const std::filesystem::path &dbPath) {
-    // open db and apply pragmas
-    PLOG_INFO << "opening db: " << dbPath.native();
-    this->db = std::make_unique<SQLite::Database>(dbPath,
-            (SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE));
-
-    this->db->exec("PRAGMA foreign_keys = ON;");
-
-    // check if db needs to be initialized
-    if(!this->db->tableExists(kMetaTableName)) {
-        PLOG_WARNING << "db is empty! initializing schema";
-        this->initSchema();
-    }
-
-    // validate schema version
-    auto versionStr = this->getMetaValue("schema.version");
-    if(!versionStr) {
-        throw std::logic_error("failed to get schema version!");
-    }
-
-    const auto version = std::stoul(*versionStr);
-    PLOG_DEBUG << "Current schema version: " << version;
-
-    if(version > kCurrentSchemaVersion) {
-        throw std::runtime_error(fmt::format("unsupported schema version {} (expected {})",
-                    version, kCurrentSchemaVersion));
-    }
-}
-
-/**
- * @brief Apply the default schema to the database
- *
- * Create the default tables in the database, and fills in some metadata information.
- */
-void DataStore::initSchema() {
-    SQLite::Transaction txn(*this->db);
-
-    /*
-     * Create the metadata table
-     *
-     * This table holds general information about the contents of the data store, including the
-     * schema version and application version used to edit this data.
-     */
-    this->db->exec(R"STR(
-CREATE TABLE MetaInfo (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    key text,
-    value text
-);
-CREATE UNIQUE INDEX MetaInfo_i1 ON MetaInfo(key);
-)STR");
-
-    /*
-     * Create the property keys meta table
-     *
-     * It's used to hold the string property keys (used for accessing properties) and map them to
-     * an associated type, timestamps, and an unique id.
-     *
-     * An index is created on the key for fast searching.
-     */
-    this->db->exec(R"STR(
-CREATE TABLE PropertyKeys (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    key text,
-    valueType integer,
-    createdAt datetime DEFAULT (strftime('%s','now')),
-    updatedAt datetime DEFAULT (strftime('%s','now'))
-);
-CREATE UNIQUE INDEX PropertyKeys_i1 ON PropertyKeys(key);
-)STR");
-
-    /*
-     * Create property value tables
-     *
-     * For each of the different value types, create one table that has a `value` column of the
-     * appropriate type. Splitting them out ensures that we don't accidentally coerce types between
-     * columns.
-     *
-     * An index is created on the `propertyId` column of each table.
-     */
-    this->db->exec(R"STR(
-CREATE TABLE PropertyValuesString (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    propertyId integer,
-    value text,
-    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
-);
-CREATE UNIQUE INDEX PropertyValuesString_i1 ON PropertyValuesString(propertyId);
-CREATE INDEX PropertyValuesString_i2 ON PropertyValuesString(propertyId);
-
-CREATE TABLE PropertyValuesBlob (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    propertyId integer,
-    value blob,
-    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
-);
-CREATE UNIQUE INDEX PropertyValuesBlob_i1 ON PropertyValuesBlob(propertyId);
-CREATE INDEX PropertyValuesBlob_i2 ON PropertyValuesBlob(propertyId);
-
-CREATE TABLE PropertyValuesInteger (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    propertyId integer,
-    value integer,
-    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
-);
-CREATE UNIQUE INDEX PropertyValuesInteger_i1 ON PropertyValuesInteger(propertyId);
-CREATE INDEX PropertyValuesInteger_i2 ON PropertyValuesInteger(propertyId);
-
-CREATE TABLE PropertyValuesReal (
-    id integer PRIMARY KEY AUTOINCREMENT,
-    propertyId integer,
-    value real,
-    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
-);
-CREATE UNIQUE INDEX PropertyValuesReal_i1 ON PropertyValuesReal(propertyId);
-CREATE INDEX PropertyValuesReal_i2 ON PropertyValuesReal(propertyId);
-)STR");
-
-    /*
-     * Insert some metadata about the schema version, collect garbage, then commit the transaction
-     * to ensure the database on disk is updated.
-     */
-    SQLite::Statement insMeta(*this->db, "INSERT INTO MetaInfo(key, value) VALUES (:key, :value);");
-
-    insMeta.bind(":key", "creator.swversion");
-    insMeta.bind(":value", kVersion);
-    insMeta.exec();
-    insMeta.reset();
-
-    const auto now = std::chrono::system_clock::now();
-
-    insMeta.bind(":key", "creator.timestamp");
-    insMeta.bind(":value",
-            std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
-    insMeta.exec();
-    insMeta.reset();
-
-    insMeta.bind(":key", "schema.version");
-    insMeta.bind(":value", kCurrentSchemaVersion);
-    insMeta.exec();
-
-    // finally, commit the transaction so all changes are applied at once
-    txn.commit();
+DataStore::DataStore(const std::filesystem::path &dbPath,
+        const std::vector<std::string> &volatilePrefixes) :
+    DataStore(std::make_unique<SqliteBackend>(dbPath), volatilePrefixes) {
+}
+
+/**
+ * @brief Create a data store on top of the given backend
+ *
+ * @param backend Backend holding all keys (other than volatile keys)
+ * @param volatilePrefixes Key prefixes whose keys are kept in memory, rather than the backend
+ */
+DataStore::DataStore(std::unique_ptr<StorageBackend> backend,
+        const std::vector<std::string> &volatilePrefixes) : backend(std::move(backend)),
+    volatilePrefixes(volatilePrefixes) {
+    this->lastSyncCount = CountingVfs::GetTotalSyncs();
+
+    // account writes to the prefixes of committed transactions
+    this->backend->setTransactionHook([this](const bool committed) {
+        if(committed) {
+            this->handleCommit();
+        } else {
+            this->dirtyPrefixes.clear();
+        }
+    });
+}
+
+/**
+ * @brief Close the data store
+ *
+ * Any debounced writes that are still pending are written to the backend first.
+ */
+DataStore::~DataStore() {
+    try {
+        std::lock_guard lg(this->dbLock);
+        this->persistPendingWrites(true);
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to write pending writes: " << e.what();
+    }
+}
+
+thread_local std::chrono::nanoseconds DataStore::gLastLockWait{0};
+
+/**
+ * @brief Acquire one of the data store's locks
+ *
+ * The lock is first acquired optimistically; only if that fails is the time spent waiting for it
+ * measured, so the uncontended case doesn't need to read the clock.
+ *
+ * @param mutex Lock to acquire (either the database or volatile key lock)
+ *
+ * @return Lock guard holding the lock
+ */
+std::unique_lock<std::mutex> DataStore::acquireLock(std::mutex &mutex) {
+    std::unique_lock lock(mutex, std::try_to_lock);
+    if(lock.owns_lock()) {
+        gLastLockWait = std::chrono::nanoseconds::zero();
+        return lock;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    lock.lock();
+    gLastLockWait = std::chrono::steady_clock::now() - start;
+
+    return lock;
+}
+
+/**
+ * @brief Get a snapshot of the data store's performance counters
+ */
+DataStore::Stats DataStore::getStats() {
+    std::lock_guard lg(this->dbLock);
+    std::lock_guard lg2(this->volatileLock);
+
+    const auto counters = this->backend->getCounters();
+
+    Stats stats{
+        .statements = counters.statements,
+        .commits = this->numCommits,
+        .cacheHits = counters.cacheHits,
+        .cacheMisses = counters.cacheMisses,
+        .dbSize = counters.diskSize,
+        .volatileKeys = this->volatileKeys.size(),
+        .unchangedWrites = this->numUnchangedWrites,
+        .debouncedWrites = this->numDebouncedWrites,
+        .pendingWrites = this->pendingWrites.size(),
+        .defaultKeys = this->defaults ? this->defaults->size() : 0,
+        .defaultReads = this->numDefaultReads,
+        .valueCacheEntries = this->valueCache.size(),
+        .valueCacheBytes = this->valueCache.getBytes(),
+        .valueCacheHits = this->valueCache.getHits(),
+        .valueCacheMisses = this->valueCache.getMisses(),
+        .filterBytes = counters.filterBytes,
+        .filterKeys = counters.filterKeys,
+        .filterRebuilds = counters.filterRebuilds,
+        .filterNegatives = counters.filterNegatives,
+        .filterFalsePositives = counters.filterFalsePositives,
+        .pageWrites = counters.pageWrites,
+        .logicalBytes = this->numLogicalBytes,
+        .hotKeys = this->hotKeys.top(kHotKeysReported),
+    };
+
+    // flash wear counters
+    this->attributeSyncs();
+    stats.prefixes.insert(this->prefixWrites.begin(), this->prefixWrites.end());
+
+    for(size_t i = 0; i < CountingVfs::kNumFileTypes; i++) {
+        stats.files[i] = CountingVfs::GetCounters(static_cast<CountingVfs::FileType>(i));
+    }
+
+    return stats;
+}
+
+/**
+ * @brief Set the image of factory defaults below the backend
+ *
+ * Keys that don't exist in the backend are read from the image instead. Volatile keys never fall
+ * through to it.
+ *
+ * @param defaults Defaults image, or nullptr to remove it
+ */
+void DataStore::setDefaults(std::unique_ptr<DefaultsImage> defaults) {
+    std::lock_guard lg(this->dbLock);
+    this->defaults = std::move(defaults);
+    this->valueCache.clear();
+}
+
+/**
+ * @brief Set up the cache of encoded values
+ *
+ * Values returned by getKeyEncoded() are encoded with the given encoder, and the most recently
+ * read ones are cached. Volatile keys and debounced writes aren't cached.
+ *
+ * @param maxBytes Maximum total size of the encoded values in the cache
+ * @param encoder Function to encode values
+ */
+void DataStore::setValueCache(const size_t maxBytes, ValueEncoder encoder) {
+    std::lock_guard lg(this->dbLock);
+    this->valueCache = EncodedValueCache(maxBytes);
+    this->valueEncoder = std::move(encoder);
+}
+
+/**
+ * @brief Debounce writes to keys under the given prefix
+ *
+ * Rather than writing every update of such keys to the backend, they are held in memory until the
+ * key hasn't been written for the given interval, at which point the latest value is written.
+ * Reads always return the latest value.
+ *
+ * @param prefix Key prefix; it applies to the key with this name, and all of its children
+ * @param interval Time after the most recent write before the key is written to the backend
+ */
+void DataStore::addDebouncePolicy(const std::string_view &prefix,
+        const std::chrono::milliseconds interval) {
+    std::lock_guard lg(this->dbLock);
+    this->debouncePolicies.emplace_back(prefix, interval);
+}
+
+/**
+ * @brief Write all debounced writes whose interval has elapsed to the backend
+ *
+ * @return Number of keys written
+ */
+size_t DataStore::flushPendingWrites() {
+    auto lg = this->acquireLock();
+    return this->persistPendingWrites(false);
+}
+
+/**
+ * @brief Get the time at which the next debounced write is due
+ *
+ * @return Earliest deadline of all pending writes, or nothing if there are none
+ */
+std::optional<DataStore::Clock::time_point> DataStore::getNextFlushTime() {
+    auto lg = this->acquireLock();
+    std::optional<Clock::time_point> next;
+
+    for(const auto &[name, pending] : this->pendingWrites) {
+        if(!next || pending.deadline < *next) {
+            next = pending.deadline;
+        }
+    }
+
+    return next;
+}
+
+/**
+ * @brief Make all committed changes durable
+ *
+ * This should be called periodically for backends that don't make changes durable right away
+ * (such as the in-memory backend, which syncs and compacts its write log); otherwise, it does
+ * nothing.
+ */
+void DataStore::checkpoint() {
+    auto lg = this->acquireLock();
+    this->backend->checkpoint();
 }
 
 
@@ -170,70 +249,194 @@ CREATE INDEX PropertyValuesReal_i2 ON PropertyValuesReal(propertyId);
  * @brief Get the value for a property key
  *
  * Retrieve the value for the configuration option with the specified name, which must match
- * exactly.
+ * exactly. If the key doesn't exist, its default value (if any) is returned.
+ *
+ * @param name Name of the key to read
+ * @param outVersion If not null, receives the key's version (or zero, if it doesn't exist)
  *
  * @throw std::logic_error Database consistency error
  *
  * @return Property value (or std::monostate if not found)
  */
-PropertyValue DataStore::getKey(const std::string_view &name) {
-    std::lock_guard lg(this->dbLock);
+PropertyValue DataStore::getKey(const std::string_view &name, uint64_t *outVersion) {
+    if(this->isVolatile(name)) {
+        auto lg = this->acquireLock(this->volatileLock);
+        return this->readKey(this->volatileKeys, name, outVersion);
+    }
 
-    // get the id and type information
-    SQLite::Statement stmtInfo(*this->db, "SELECT id, valueType FROM PropertyKeys WHERE key = :keyName;");
-    stmtInfo.bind(":keyName", name.data());
+    auto lg = this->acquireLock();
 
-    if(!stmtInfo.executeStep()) {
-        return std::monostate();
+    // debounced writes that haven't been written yet take precedence
+    const auto pending = this->pendingWrites.find(name);
+    if(pending != this->pendingWrites.end()) {
+        if(outVersion) {
+            *outVersion = pending->second.baseVersion + pending->second.updates;
+        }
+        return pending->second.value;
     }
 
-    const uint32_t keyId = stmtInfo.getColumn("id");
-    const uint32_t valueType = stmtInfo.getColumn("valueType");
+    return this->readKey(*this->backend, name, outVersion);
+}
 
-    if(valueType == static_cast<uint32_t>(PropertyValueType::Null)) {
-        // if the value is `null`, we have nothing more to do
-        return nullptr;
-    } // TODO: validate the type value better here
+/**
+ * @brief Get the encoded value of a key
+ *
+ * Like getKey(), but returns the value encoded by the value cache's encoder. Cached values are
+ * returned without accessing the backend; otherwise, the value is read and encoded (and cached,
+ * unless it's a volatile key, or a debounced write.)
+ *
+ * @param name Name of the key to read
+ *
+ * @return Encoded value and version of the key, or nullptr if it doesn't exist
+ *
+ * @throw std::logic_error No value cache was set up
+ */
+EncodedValueCache::EntryPtr DataStore::getKeyEncoded(const std::string_view &name) {
+    if(!this->valueEncoder) {
+        throw std::logic_error("value cache not set up");
+    }
+
+    auto encode = [&](const PropertyValue &value, const uint64_t version) {
+        return std::make_shared<const EncodedValueCache::Entry>(EncodedValueCache::Entry{
+            .data = this->valueEncoder(value),
+            .version = version,
+        });
+    };
+
+    uint64_t version{0};
+
+    if(this->isVolatile(name)) {
+        auto lg = this->acquireLock(this->volatileLock);
 
-    // set up the query for the value
-    const auto tableName = ValueTableName(static_cast<PropertyValueType>(valueType));
-    if(tableName.empty()) {
-        throw std::logic_error(fmt::format("unknown value table for type ${:x}", valueType));
+        const auto value = this->readKey(this->volatileKeys, name, &version);
+        if(std::holds_alternative<std::monostate>(value)) {
+            return nullptr;
+        }
+        return encode(value, version);
     }
 
-    // XXX: is there a better way than formatting in the table name?
-    SQLite::Statement stmtQuery(*this->db, fmt::format("SELECT id, propertyId, value FROM {} "
-            "WHERE propertyId = :keyId;", tableName));
-    stmtQuery.bind(":keyId", keyId);
+    auto lg = this->acquireLock();
+
+    const auto pending = this->pendingWrites.find(name);
+    if(pending != this->pendingWrites.end()) {
+        return encode(pending->second.value,
+                pending->second.baseVersion + pending->second.updates);
+    }
 
-    // finally, get its value
-    if(!stmtQuery.executeStep()) {
-        throw std::logic_error(
-                fmt::format("property '{}' ({}) (type ${:x}, table '{}') has no value!", name,
-                    keyId, valueType, tableName));
+    if(auto entry = this->valueCache.get(name)) {
+        return entry;
     }
 
-    switch(static_cast<PropertyValueType>(valueType)) {
-        case PropertyValueType::String:
-            return static_cast<std::string>(stmtQuery.getColumn("value"));
-        case PropertyValueType::Blob: {
-            const auto byteStr = static_cast<std::string>(stmtQuery.getColumn("value"));
+    const auto value = this->readKey(*this->backend, name, &version);
+    if(std::holds_alternative<std::monostate>(value)) {
+        return nullptr;
+    }
 
-            std::vector<std::byte> vec;
+    auto entry = encode(value, version);
+    this->valueCache.insert(name, entry);
+    return entry;
+}
 
-            auto bytePtr = reinterpret_cast<const std::byte *>(byteStr.data());
-            std::copy(bytePtr, bytePtr + byteStr.size(), std::back_inserter(vec));
-            return vec;
+/**
+ * @brief Read the value of a key from a backend
+ *
+ * Implements getKey(), without taking the lock. Keys missing from the main backend fall through to
+ * the defaults image.
+ *
+ * @param store Backend holding the key
+ * @param name Name of the key to read
+ * @param outVersion If not null, receives the key's version (or zero, if it doesn't exist)
+ *
+ * @return Property value (or std::monostate if not found)
+ */
+PropertyValue DataStore::readKey(StorageBackend &store, const std::string_view &name,
+        uint64_t *outVersion) {
+    auto record = store.get(name);
+    if(!record && &store == this->backend.get()) {
+        record = this->getDefault(name);
+        if(record) {
+            this->numDefaultReads++;
         }
-        case PropertyValueType::Integer:
-            return static_cast<uint64_t>(static_cast<long long>(stmtQuery.getColumn("value")));
-        case PropertyValueType::Real:
-            return static_cast<double>(stmtQuery.getColumn("value"));
+    }
+
+    if(outVersion) {
+        *outVersion = record ? record->version : 0;
+    }
+    return record ? std::move(record->value) : std::monostate();
+}
+
+/**
+ * @brief Get the default value of a key, as a record
+ *
+ * Default keys have version 0, so that the first change to the key creates it at version 1.
+ *
+ * @return Record holding the key's default value, or nothing if it has none
+ */
+std::optional<StorageBackend::Record> DataStore::getDefault(const std::string_view &name) {
+    if(!this->defaults) {
+        return std::nullopt;
+    }
+
+    auto value = this->defaults->get(name);
+    if(!value) {
+        return std::nullopt;
+    }
 
-        default:
-            throw std::logic_error(fmt::format("unsupported value type ${:x} (key {}/{})",
-                        valueType, name, keyId));
+    return StorageBackend::Record{.value = std::move(*value), .version = 0};
+}
+
+/**
+ * @brief Get the values of all keys, in name order
+ *
+ * Used to page through the entire data store: each call returns the keys following the last key
+ * returned by the previous call. Keys in the defaults image are merged in, unless they exist in
+ * the backend.
+ *
+ * @param after Only return keys whose name sorts after this one (pass an empty string to start
+ *        from the first key)
+ * @param limit Maximum number of keys to return
+ *
+ * @return Key names and their values
+ *
+ * @remark Volatile keys are not returned, since they aren't part of the persistent configuration.
+ */
+PropertyList DataStore::getKeys(const std::string_view &after, const size_t limit) {
+    PropertyList values;
+
+    auto lg = this->acquireLock();
+
+    this->persistPendingWrites(true);
+
+    this->backend->scan(after, limit, [&](auto &&name, auto &&record) {
+        values.emplace_back(std::move(name), std::move(record.value));
+    });
+
+    if(!this->defaults) {
+        return values;
     }
+
+    // merge the defaults (both are sorted by name; keys in the backend take precedence)
+    PropertyList stored;
+    stored.swap(values);
+
+    auto it = stored.begin();
+    auto index = this->defaults->upperBound(after);
+    const auto numDefaults = this->defaults->size();
+
+    while(values.size() < limit && (it != stored.end() || index < numDefaults)) {
+        if(index < numDefaults &&
+                (it == stored.end() || this->defaults->getName(index) < it->first)) {
+            values.emplace_back(this->defaults->getName(index), this->defaults->getValue(index));
+            index++;
+        } else {
+            if(index < numDefaults && this->defaults->getName(index) == it->first) {
+                index++;
+            }
+            values.push_back(std::move(*it++));
+        }
+    }
+
+    return values;
 }
 
 /**
@@ -249,87 +452,444 @@ PropertyValue DataStore::getKey(const std::string_view &name) {
  * @remark If an existing key is updated, it must be updated with data of the same type as it was
  *         originally created with. To change the value type of a key, delete the key and create
  *         it anew; or set its value to `null` before changing to delete the old value.
+ *
+ * @remark If the key is under a debounced prefix, the write is held in memory for now.
  */
 void DataStore::setKey(const std::string_view &name, const PropertyValue &value) {
-    std::lock_guard lg(this->dbLock);
+    if(this->isVolatile(name)) {
+        auto lg = this->acquireLock(this->volatileLock);
+        this->writeKey(this->volatileKeys, name, value);
+        return;
+    }
+
+    auto lg = this->acquireLock();
+
+    if(const auto interval = this->getDebounceInterval(name)) {
+        return this->debounceWrite(name, value, *interval);
+    }
 
-    // get the id and type information
-    SQLite::Statement stmtInfo(*this->db, "SELECT id, valueType FROM PropertyKeys WHERE key = :keyName;");
-    stmtInfo.bind(":keyName", name.data());
-
-    if(!stmtInfo.executeStep()) {
-        // key doesn't exist yet, so insert it
-        return this->insertKey(name, value);
-    }
-
-    /*
-     * Get info about the existing key and its type. There's several different cases we take based
-     * on the combination of the old and new value type:
-     *
-     * - Old type = null:  The key's value is updated without any additional constraints.
-     * - Old type = other: The key's value may only be set to null or the old type.
-     *
-     * This is a mostly arbitrary restriction intended to detect potential bugs in client
-     * applications. (That's why setting a key to `null` is allowed: to callers, that's not really
-     * a different type but a value, yet we treat it as a different value type.)
-     */
-    const uint32_t keyId = stmtInfo.getColumn("id");
-    const uint32_t oldValueType = stmtInfo.getColumn("valueType");
-
-    if(oldValueType == static_cast<uint32_t>(PropertyValueType::Null)) {
-        // allow any type to be set without further checking
-        return this->updateKey(keyId, static_cast<PropertyValueType>(oldValueType), value);
-    } else {
-        // ensure the new value type is either null…
-        if(std::holds_alternative<std::nullptr_t>(value)) {
-            return this->updateKey(keyId, static_cast<PropertyValueType>(oldValueType), value);
+    StorageBackend::Transaction txn(*this->backend);
+    this->writeKey(*this->backend, name, value);
+    txn.commit();
+}
+
+/**
+ * @brief Set a property value, and its expiration time
+ *
+ * Like setKey(), but additionally sets (or clears) the time at which the key expires. Expired keys
+ * aren't removed by the data store itself, but by calling expireKeys().
+ *
+ * @param name Name of the key to set or update
+ * @param value Value to set the key to
+ * @param expiresAt Time at which the key expires, or nothing if it shouldn't expire
+ *
+ * @remark Other updates to the key (including via setKey()) leave its expiration time unchanged.
+ */
+void DataStore::setKeyWithExpiry(const std::string_view &name, const PropertyValue &value,
+        const std::optional<ExpiryTime> &expiresAt) {
+    const bool isVolatile = this->isVolatile(name);
+    auto &store = this->storeFor(name);
+    auto lg = this->acquireLock(this->lockFor(name));
+
+    StorageBackend::Transaction txn(store);
+    if(!isVolatile) {
+        this->flushPendingWrite(name);
+    }
+
+    this->writeKey(store, name, value, nullptr, &expiresAt);
+    txn.commit();
+
+    if(!isVolatile) {
+        this->dropPendingWrite(name);
+    }
+}
+
+/**
+ * @brief Set a property value, if its version matches
+ *
+ * Implements optimistic concurrency: the key is only updated if its current version is the one
+ * the caller expects (i.e. the version it read the key's old value at), so concurrent
+ * read-modify-write cycles don't overwrite each others' changes.
+ *
+ * @param name Name of the key to set or update
+ * @param value Value to set the key to
+ * @param expectedVersion Version the key must currently have; specify zero to only create the
+ *        key if it doesn't exist yet.
+ *
+ * @return Whether the update was applied, and the key's (new or current) version
+ *
+ * @remark Deleting a key discards its version: if it's created again, it starts over at 1.
+ */
+DataStore::CasResult DataStore::setKeyIfVersion(const std::string_view &name,
+        const PropertyValue &value, const uint64_t expectedVersion) {
+    const bool isVolatile = this->isVolatile(name);
+    auto &store = this->storeFor(name);
+    auto lg = this->acquireLock(this->lockFor(name));
+
+    // the update may not be applied, so pending writes can't share its transaction
+    if(!isVolatile) {
+        this->persistPendingWrite(name);
+    }
+
+    StorageBackend::Transaction txn(store);
+
+    const auto current = store.get(name);
+    const uint64_t version = current ? current->version : 0;
+    if(version != expectedVersion) {
+        return {.applied = false, .version = version};
+    }
+
+    // new keys start at version 1; updates increment it (unless they didn't change the value)
+    uint64_t newVersion{0};
+    this->writeKey(store, name, value, &newVersion);
+    txn.commit();
+
+    return {.applied = true, .version = newVersion};
+}
+
+/**
+ * @brief Atomically modify the value of an integer key
+ *
+ * The key's current value is read, combined with the operand, and the result written back, all in
+ * a single transaction; so unlike reading and then setting the key, concurrent modifications are
+ * never lost. Values are treated as signed integers, and addition and subtraction wrap around.
+ *
+ * If the key doesn't exist (or its value is null), it's created as if its value had been zero
+ * (for addition and subtraction) or the operand (for min and max.) The key's timestamp and
+ * version are only updated if its value actually changes.
+ *
+ * @param name Name of the key to modify
+ * @param op Operation to perform
+ * @param operand Operand for the operation
+ * @param outVersion If not null, receives the key's version after the operation
+ *
+ * @return The key's resulting value, or nothing if the key holds a value that's not an integer
+ */
+std::optional<int64_t> DataStore::applyIntegerOp(const std::string_view &name, const IntegerOp op,
+        const int64_t operand, uint64_t *outVersion) {
+    const bool isVolatile = this->isVolatile(name);
+    auto &store = this->storeFor(name);
+    auto lg = this->acquireLock(this->lockFor(name));
+
+    // the operation may be rejected, so pending writes can't share its transaction
+    if(!isVolatile) {
+        this->persistPendingWrite(name);
+    }
+
+    StorageBackend::Transaction txn(store);
+
+    std::optional<int64_t> result;
+    uint64_t version{0};
+    bool changed{false};
+
+    store.update(name, [&](auto &record) {
+        // get the current value, if any
+        std::optional<int64_t> oldValue;
+
+        if(!record && !isVolatile) {
+            record = this->getDefault(name);
         }
-        // …or the existing value type
-        else if(oldValueType == static_cast<uint32_t>(TypeForValue(value))) {
-            return this->updateKey(keyId, static_cast<PropertyValueType>(oldValueType), value);
+
+        if(record) {
+            const auto &value = record->value;
+            if(std::holds_alternative<uint64_t>(value)) {
+                oldValue = static_cast<int64_t>(std::get<uint64_t>(value));
+            } else if(!std::holds_alternative<std::nullptr_t>(value)) {
+                return false;
+            }
         }
-        // otherwise, the set attempt is not permitted
-        else {
-            throw std::invalid_argument(fmt::format("changing type of key '{}' not allowed", name));
+
+        // calculate the new value and write it back (if needed)
+        result = ApplyIntegerOp(op, oldValue, operand);
+
+        if(!record) {
+            record.emplace(StorageBackend::Record{.value = static_cast<uint64_t>(*result)});
+            changed = true;
+        } else if(!oldValue || *oldValue != *result) {
+            record->value = static_cast<uint64_t>(*result);
+            record->version++;
+            changed = true;
         }
+
+        version = record->version;
+        return changed;
+    });
+
+    if(!result) {
+        return std::nullopt;
     }
+
+    if(changed && !isVolatile) {
+        this->recordWrite(name, sizeof(*result));
+        this->valueCache.remove(name);
+    }
+    txn.commit();
+
+    if(outVersion) {
+        *outVersion = version;
+    }
+    return result;
+}
+
+/**
+ * @brief Set the values of multiple keys
+ *
+ * All keys are updated in a single transaction; so if any of the updates fails, none of the keys
+ * are modified. Otherwise, each key is updated as if by setKey().
+ *
+ * @param values Key names and their new values
+ */
+void DataStore::setKeys(const PropertyList &values) {
+    const auto stats = this->bulkLoad(values);
+
+    PLOG_DEBUG << fmt::format("set {} keys ({} new, {} updated) in {:.1f} ms ({:.0f} keys/s)",
+            values.size(), stats.inserted, stats.updated,
+            std::chrono::duration<double, std::milli>(stats.duration).count(),
+            stats.keysPerSec());
+}
+
+/**
+ * @brief Load a large number of keys at once
+ *
+ * This is optimized for populating a (mostly) empty data store, such as when building factory
+ * images: all keys are written in a single bulk load transaction, in name order, so they are
+ * appended to the key index sequentially. New keys are inserted through the backend's fast path
+ * (for sqlite, prepared statements that are reused for every key); keys that already exist are
+ * updated as if by setKey().
+ *
+ * As with setKeys(), if any key fails to be written, none of them are. Volatile keys are written in
+ * a transaction of their own, which is only committed along with the main one.
+ *
+ * @param values Key names and their new values
+ *
+ * @return Number of keys written, and the time taken
+ */
+DataStore::BulkLoadStats DataStore::bulkLoad(const PropertyList &values) {
+    const auto start = std::chrono::steady_clock::now();
+    BulkLoadStats stats;
+
+    // sort the keys by name (keeping duplicate keys in the order they were specified)
+    std::vector<const PropertyList::value_type *> sorted, volatileSorted;
+    sorted.reserve(values.size());
+
+    for(const auto &pair : values) {
+        if(this->isVolatile(pair.first)) {
+            volatileSorted.push_back(&pair);
+        } else {
+            sorted.push_back(&pair);
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto a, const auto b) {
+        return a->first < b->first;
+    });
+
+    auto lg = this->acquireLock();
+    auto lg2 = this->acquireLock(this->volatileLock);
+
+    this->persistPendingWrites(true);
+
+    // stage updates to volatile keys (this validates them before touching the main backend)
+    std::optional<StorageBackend::Transaction> volatileTxn;
+    if(!volatileSorted.empty()) {
+        volatileTxn.emplace(this->volatileKeys);
+
+        for(const auto pair : volatileSorted) {
+            const auto &[name, value] = *pair;
+            ValidateWrite(name, value);
+
+            if(this->volatileKeys.insert(name, NormalizeValue(value))) {
+                stats.inserted++;
+            } else {
+                this->writeKey(this->volatileKeys, name, value);
+                stats.updated++;
+            }
+        }
+
+        // batches of only volatile keys don't need a transaction in the main backend at all
+        if(sorted.empty()) {
+            volatileTxn->commit();
+
+            stats.duration = std::chrono::steady_clock::now() - start;
+            return stats;
+        }
+    }
+
+    this->backend->beginBulkLoad();
+
+    try {
+        for(const auto pair : sorted) {
+            const auto &[name, value] = *pair;
+            ValidateWrite(name, value);
+
+            // keys with a default must be compared against it, so they take the slow path too
+            const bool hasDefault = this->defaults && this->defaults->contains(name);
+
+            if(!hasDefault && this->backend->insert(name, NormalizeValue(value))) {
+                this->recordWrite(name, ValueSize(value));
+                stats.inserted++;
+            } else {
+                // update existing keys the slow way
+                this->writeKey(*this->backend, name, value);
+                stats.updated++;
+            }
+        }
+
+        this->backend->commit();
+    } catch(const std::exception &) {
+        try {
+            this->backend->rollback();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to roll back bulk load: " << e.what();
+        }
+
+        throw;
+    }
+
+    if(volatileTxn) {
+        volatileTxn->commit();
+    }
+
+    stats.duration = std::chrono::steady_clock::now() - start;
+    return stats;
 }
 
 /**
  * @brief Delete a configuration key
  *
  * This function will delete only individual keys, whose key matches the specified name exactly.
+ * Keys in the defaults image can't be deleted: deleting a key reverts it to its default value.
  *
  * @throw std::runtime_error The provided key path is not terminal (e.g. it has children)
  *
  * @return Number of deleted keys
  */
 size_t DataStore::deleteKey(const std::string_view &name) {
+    if(this->isVolatile(name)) {
+        auto lg = this->acquireLock(this->volatileLock);
+
+        if(this->volatileKeys.hasChildren(name)) {
+            throw std::runtime_error(fmt::format("key '{}' has children", name));
+        }
+
+        return this->volatileKeys.remove(name);
+    }
+
+    auto lg = this->acquireLock();
+
+    // pending writes may create the key (or its children)
+    this->persistPendingWrites(true);
+
     // ensure this is a terminal (has value) key
     if(this->hasChildren(name)) {
         throw std::runtime_error(fmt::format("key '{}' has children", name));
     }
 
-    // delete PropertyKeys row; the associated PropertyValues* entry is deleted by constraint
-    SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE key = :keyName;");
-    stmt.bind(":keyName", name.data());
+    StorageBackend::Transaction txn(*this->backend);
 
-    return stmt.exec();
+    const auto deleted = this->backend->remove(name);
+    if(deleted) {
+        this->recordWrite(name, 0);
+        this->valueCache.remove(name);
+    }
+
+    txn.commit();
+    return deleted;
 }
 
 /**
  * @brief Delete all keys under a given key path
  *
- * All keys whose name starts with the provided key path will be deleted.
+ * All keys whose name starts with the provided key path will be deleted, including volatile keys.
+ * As with deleteKey(), keys in the defaults image revert to their default values.
  *
  * @return Number of deleted keys
  */
 size_t DataStore::deleteSubkeys(const std::string_view &namePrefix) {
-    SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE key LIKE :keyPrefix;");
-    // match _at least_ one extra character after prefix (should be a period)
-    stmt.bind(":keyPrefix", fmt::format("{}.%", namePrefix));
+    auto lg = this->acquireLock();
 
-    return stmt.exec();
+    this->persistPendingWrites(true);
+
+    StorageBackend::Transaction txn(*this->backend);
+
+    auto deleted = this->backend->removeChildren(namePrefix);
+    if(deleted) {
+        this->recordWrite(namePrefix, 0);
+        // backends may match children more loosely than by name prefix (sqlite's LIKE ignores case)
+        this->valueCache.clear();
+    }
+
+    txn.commit();
+
+    // then, remove any volatile keys under it
+    auto lg2 = this->acquireLock(this->volatileLock);
+    deleted += this->volatileKeys.removeChildren(namePrefix);
+
+    return deleted;
+}
+
+/**
+ * @brief Get all keys that have an expiration time
+ *
+ * This is used to schedule the expiration of keys when the data store is opened. Volatile keys
+ * aren't included, as they never outlive the data store.
+ *
+ * @return Names of keys, and the times at which they expire (which may have already passed)
+ */
+std::vector<std::pair<std::string, DataStore::ExpiryTime>> DataStore::getExpiringKeys() {
+    auto lg = this->acquireLock();
+    return this->backend->getExpiring();
+}
+
+/**
+ * @brief Remove expired keys
+ *
+ * All keys are removed in a single transaction. The caller is responsible for determining which
+ * keys have expired; keys that don't (or no longer) have an expiration time are left alone.
+ *
+ * @param names Names of the keys to remove
+ *
+ * @return Number of keys removed
+ */
+size_t DataStore::expireKeys(const std::vector<std::string> &names) {
+    size_t removed{0};
+
+    // split off volatile keys
+    std::vector<const std::string *> persistent;
+    persistent.reserve(names.size());
+
+    {
+        auto lg = this->acquireLock(this->volatileLock);
+
+        for(const auto &name : names) {
+            if(!this->isVolatile(name)) {
+                persistent.push_back(&name);
+            } else if(this->volatileKeys.removeExpiring(name)) {
+                removed++;
+            }
+        }
+    }
+
+    if(persistent.empty()) {
+        return removed;
+    }
+
+    // then remove the remaining keys from the main backend
+    auto lg = this->acquireLock();
+
+    this->persistPendingWrites(true);
+
+    StorageBackend::Transaction txn(*this->backend);
+
+    for(const auto name : persistent) {
+        if(this->backend->removeExpiring(*name)) {
+            this->recordWrite(*name, 0);
+            this->valueCache.remove(*name);
+            removed++;
+        }
+    }
+
+    txn.commit();
+    return removed;
 }
 
 
@@ -337,158 +897,415 @@ size_t DataStore::deleteSubkeys(const std::string_view &namePrefix) {
 /**
  * @brief Check whether the given key path has child keys
  *
- * Queries whether there exist any keys whose name starts with the specified key path.
+ * Queries whether there exist any keys whose name starts with the specified key path. Volatile keys
+ * and defaults are checked as well, so the volatile key lock must not be held.
  */
 bool DataStore::hasChildren(const std::string_view &name) {
-    SQLite::Statement stmt(*this->db, "SELECT COUNT(*) FROM PropertyKeys WHERE key LIKE :keyName;");
-    stmt.bind(":keyPrefix", fmt::format("{}.%", name));
+    {
+        std::lock_guard lg(this->volatileLock);
+        if(this->volatileKeys.hasChildren(name)) {
+            return true;
+        }
+    }
 
-    return stmt.exec() != 0;
+    return this->backend->hasChildren(name) ||
+        (this->defaults && this->defaults->hasChildren(name));
 }
 
 /**
- * @brief Retrieve the value of a metadata key
+ * @brief Check whether a key is volatile
+ *
+ * A key is volatile if its name is one of the volatile key prefixes, or a child key of one.
  */
-std::optional<std::string> DataStore::getMetaValue(const std::string_view &key) {
-    SQLite::Statement stmt(*this->db, "SELECT id, key, value FROM MetaInfo WHERE key = :keyName;");
-    stmt.bind(":keyName", key.data());
-
-    if(!stmt.executeStep()) {
-        // no such key
-        return nullptr;
+bool DataStore::isVolatile(const std::string_view &name) const {
+    for(const auto &prefix : this->volatilePrefixes) {
+        if(name.starts_with(prefix) &&
+                (name.size() == prefix.size() || name[prefix.size()] == '.')) {
+            return true;
+        }
     }
 
-    // read out the value column
-    return static_cast<std::string>(stmt.getColumn("value"));
+    return false;
 }
 
 /**
- * @brief Insert a new key in the data store
+ * @brief Apply a new value to a key's record
+ *
+ * New keys are created at version 1; existing keys have their version incremented, unless the
+ * value didn't change.
  *
- * Allocate a new row into the data store, including a new value row if needed.
+ * This is a mostly arbitrary restriction intended to detect potential bugs in client applications:
+ * a key's value may only be changed to null, or another value of the same type, unless it's null.
+ * (That's why setting a key to `null` is allowed: to callers, that's not really a different type
+ * but a value, yet we treat it as a different value type.)
  *
- * @param keyName Name of the new key
- * @param value Value of the new key
+ * @param record Record to update (or create)
+ * @param name Name of the key (for error messages)
+ * @param value New value of the key; must be normalized
  *
- * @throw std::runtime_error Database consistency errors
+ * @return Whether the key was created, or its value changed
+ *
+ * @throw std::invalid_argument The value can't be changed to this type
  */
-void DataStore::insertKey(const std::string_view &keyName, const PropertyValue &value) {
-    int err;
+bool DataStore::ApplyValue(std::optional<StorageBackend::Record> &record,
+        const std::string_view &name, PropertyValue &&value) {
+    if(!record) {
+        record.emplace(StorageBackend::Record{.value = std::move(value)});
+        return true;
+    }
 
-    // validate inputs
-    if(keyName.empty()) {
-        throw std::invalid_argument("invalid name");
-    } else if(std::holds_alternative<std::monostate>(value)) {
-        throw std::invalid_argument("invalid value");
+    if(record->value == value) {
+        return false;
+    } else if(!IsValidTypeChange(record->value, value)) {
+        throw std::invalid_argument(fmt::format("changing type of key '{}' not allowed", name));
     }
 
-    // set up a transaction
-    SQLite::Transaction txn(*this->db);
+    record->value = std::move(value);
+    record->version++;
+    return true;
+}
 
-    // insert the key row
-    const auto type = TypeForValue(value);
+/**
+ * @brief Insert or update a key
+ *
+ * Implements setKey(), without taking the lock or starting a transaction. If the key already has
+ * the given value (or it doesn't exist, and that's its default value), nothing is written (except
+ * for its timestamp, if so configured.)
+ *
+ * Writes to the main backend are accounted to the key's prefix; writes to volatile keys aren't.
+ *
+ * @param store Backend holding the key
+ * @param name Name of the key to set or update
+ * @param value Value to set the key to
+ * @param outVersion If not null, receives the key's version after the write
+ * @param expiresAt If not null, the key's expiration time is also set to this
+ *
+ * @return Whether the key was created, or its value changed
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+bool DataStore::writeKey(StorageBackend &store, const std::string_view &name,
+        const PropertyValue &value, uint64_t *outVersion,
+        const std::optional<ExpiryTime> *expiresAt) {
+    ValidateWrite(name, value);
+
+    const bool isMain = (&store == this->backend.get());
+    auto newValue = NormalizeValue(value);
+
+    // common case: an existing key gets a different value of the same type
+    if(!expiresAt) {
+        if(const auto version = store.replace(name, newValue)) {
+            if(outVersion) {
+                *outVersion = *version;
+            }
+            if(isMain) {
+                this->recordWrite(name, ValueSize(value));
+                this->valueCache.remove(name);
+            }
+            return true;
+        }
+    }
+
+    bool changed{false}, written{false};
+
+    store.update(name, [&](auto &record) {
+        // keys that only have a default are compared (and type checked) against it
+        if(!record && isMain) {
+            record = this->getDefault(name);
+        }
+
+        changed = ApplyValue(record, name, std::move(newValue));
+        written = changed;
+
+        // changing only the expiration time doesn't count as an update
+        if(expiresAt && record->expiresAt != *expiresAt) {
+            record->expiresAt = *expiresAt;
+            written = true;
+        }
 
-    PLOG_DEBUG << "set key '" << keyName << "' type " << (uint32_t) type;
+        if(outVersion) {
+            *outVersion = record->version;
+        }
+        return written;
+    });
 
-    SQLite::Statement infoStmt(*this->db, "INSERT INTO PropertyKeys (key, valueType) "
-            "VALUES (:key, :type);");
-    infoStmt.bind(":key", keyName.data());
-    infoStmt.bind(":type", static_cast<long>(type));
+    if(!isMain) {
+        return changed;
+    }
 
-    err = infoStmt.exec();
-    if(!err) {
-        throw std::runtime_error("failed to insert property key info");
+    if(written) {
+        this->recordWrite(name, changed ? ValueSize(value) : 0);
+        this->valueCache.remove(name);
+        return changed;
     }
 
-    const auto keyId = this->db->getLastInsertRowid();
-    PLOG_VERBOSE << "inserted key '" << keyName << "': " << keyId;
+    // writes that wouldn't change anything were skipped
+    this->numUnchangedWrites++;
+
+    if(this->unchangedPolicy == UnchangedWritePolicy::Touch) {
+        this->recordWrite(name, 0);
+        store.touch(name);
+    }
 
-    // if value is non-null, insert a value row
-    if(type != PropertyValueType::Null) {
-        SQLite::Statement valueStmt(*this->db, fmt::format("INSERT INTO {} (propertyId, value) "
-                "VALUES(:keyId, :value);", ValueTableName(type)));
-        valueStmt.bind(":keyId", keyId);
-        BindValue(valueStmt, ":value", value);
+    return false;
+}
 
-        err = valueStmt.exec();
-        if(!err) {
-            throw std::runtime_error("failed to insert property key value");
+/**
+ * @brief Get the debounce interval for a key
+ *
+ * @return Interval of the first debounce policy whose prefix matches the key, if any
+ */
+std::optional<std::chrono::milliseconds> DataStore::getDebounceInterval(
+        const std::string_view &name) {
+    for(const auto &[prefix, interval] : this->debouncePolicies) {
+        if(name.starts_with(prefix) &&
+                (name.size() == prefix.size() || name[prefix.size()] == '.')) {
+            return interval;
         }
     }
 
-    // commit the transaction
-    txn.commit();
+    return std::nullopt;
 }
 
 /**
- * @brief Update the value of an existing key
+ * @brief Hold a write to a debounced key in memory
+ *
+ * The write is validated the same way as if it was written right away; if it's the first write
+ * since the key was last written to the backend, the key's current value is read to do so.
+ * Each write pushes back the time at which the key is written to the backend.
+ *
+ * @param name Name of the key to set or update
+ * @param value Value to set the key to
+ * @param interval Time after this write at which the key is written to the backend
  *
- * @param keyId Primary key id of the key to update
- * @param oldValueType Type of the old value of this property
- * @param newValue New value to assign to the key
+ * @remark The database lock must be held.
  */
-void DataStore::updateKey(const uint32_t keyId, const PropertyValueType oldValueType,
-        const PropertyValue &newValue) {
-    const auto newValueType = TypeForValue(newValue);
+void DataStore::debounceWrite(const std::string_view &name, const PropertyValue &value,
+        const std::chrono::milliseconds interval) {
+    ValidateWrite(name, value);
+
+    const auto newValue = NormalizeValue(value);
+    const auto deadline = Clock::now() + interval;
+
+    // a write is already pending, so replace its value
+    auto it = this->pendingWrites.find(name);
+    if(it != this->pendingWrites.end()) {
+        auto &pending = it->second;
+
+        if(pending.value == newValue) {
+            this->numUnchangedWrites++;
+            return;
+        } else if(!IsValidTypeChange(pending.value, newValue)) {
+            throw std::invalid_argument(fmt::format("changing type of key '{}' not allowed",
+                        name));
+        }
 
-    PLOG_WARNING << "update key " << keyId << " old type " << (uint32_t) oldValueType << " new "
-        << (uint32_t) newValueType;
+        pending.value = newValue;
+        pending.updates++;
+        pending.deadline = deadline;
 
-    // start a transaction
-    SQLite::Transaction txn(*this->db);
+        this->numDebouncedWrites++;
+        return;
+    }
 
-    // update the type of the key (if needed)
-    if(oldValueType != newValueType) {
-        // update the info row
-        SQLite::Statement updateStmt(*this->db, "UPDATE PropertyKeys SET valueType = :newValueType "
-                "WHERE id = :keyId;");
-        updateStmt.bind(":keyId", keyId);
-        updateStmt.bind(":newValueType", static_cast<uint32_t>(newValueType));
+    // otherwise, validate against the value in the backend
+    uint64_t version{0};
+    const auto current = this->readKey(*this->backend, name, &version);
 
-        if(!updateStmt.exec()) {
-            throw std::runtime_error("failed to update property key type");
-        }
+    if(current == newValue) {
+        this->numUnchangedWrites++;
+        return;
+    } else if(!std::holds_alternative<std::monostate>(current) &&
+            !IsValidTypeChange(current, newValue)) {
+        throw std::invalid_argument(fmt::format("changing type of key '{}' not allowed", name));
+    }
+
+    this->pendingWrites.emplace(name, PendingWrite{
+        .value = newValue,
+        .baseVersion = version,
+        .deadline = deadline,
+    });
+}
+
+/**
+ * @brief Write a key's pending debounced write (if any) to the backend
+ *
+ * This is done before any other operation on the key, so that it operates on its latest value.
+ *
+ * The pending write is kept until dropPendingWrite() is called, once the transaction has been
+ * committed: if it's rolled back instead (or the commit fails) the write is still pending, and
+ * will be written again later.
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+void DataStore::flushPendingWrite(const std::string_view &name) {
+    auto it = this->pendingWrites.find(name);
+    if(it == this->pendingWrites.end()) {
+        return;
+    }
+
+    const auto &pending = it->second;
+    this->recordWrite(it->first, ValueSize(pending.value));
+
+    // the key's version accounts for all writes that were debounced
+    this->backend->update(it->first, [&](auto &record) {
+        ApplyValue(record, it->first, PropertyValue(pending.value));
+        record->version = pending.baseVersion + pending.updates;
+        return true;
+    });
+
+    this->valueCache.remove(it->first);
+}
+
+/**
+ * @brief Forget a key's pending debounced write, after it was written to the backend
+ *
+ * @remark Only call this once the transaction in which flushPendingWrite() wrote the key has been
+ *         committed.
+ */
+void DataStore::dropPendingWrite(const std::string_view &name) {
+    auto it = this->pendingWrites.find(name);
+    if(it != this->pendingWrites.end()) {
+        this->pendingWrites.erase(it);
+    }
+}
+
+/**
+ * @brief Write a key's pending debounced write (if any) to the backend, in its own transaction
+ *
+ * This is used before conditional updates: they may end up not changing anything, and rolling
+ * back their transaction.
+ *
+ * @remark The database lock must be held.
+ */
+void DataStore::persistPendingWrite(const std::string_view &name) {
+    if(!this->pendingWrites.contains(name)) {
+        return;
+    }
+
+    StorageBackend::Transaction txn(*this->backend);
+    this->flushPendingWrite(name);
+    txn.commit();
 
-        // delete old value row, if exists
-        SQLite::Statement delValStmt(*this->db, fmt::format("DELETE FROM {} "
-                    "WHERE propertyId = :keyId;", ValueTableName(oldValueType)));
-        delValStmt.bind(":keyId", keyId);
-        delValStmt.exec();
+    this->dropPendingWrite(name);
+}
+
+/**
+ * @brief Write pending debounced writes to the backend
+ *
+ * All writes are made in a single transaction. If it fails, the writes remain pending, so they are
+ * retried the next time.
+ *
+ * @param all Whether to write all pending writes, rather than only those that are due
+ *
+ * @return Number of keys written
+ *
+ * @remark The database lock must be held.
+ */
+size_t DataStore::persistPendingWrites(const bool all) {
+    if(this->pendingWrites.empty()) {
+        return 0;
     }
 
-    // insert (or update) a value row
-    if(newValueType != PropertyValueType::Null) {
-        SQLite::Statement stmt(*this->db, fmt::format("INSERT INTO {} (propertyId, value) "
-                    "VALUES (:keyId, :value) ON CONFLICT(propertyId) DO UPDATE SET value=:value",
-                ValueTableName(newValueType)));
-        stmt.bind(":keyId", keyId);
-        BindValue(stmt, ":value", newValue);
+    const auto now = Clock::now();
 
-        if(!stmt.exec()) {
-            throw std::runtime_error("failed to upsert value");
+    std::vector<std::string> due;
+    for(const auto &[name, pending] : this->pendingWrites) {
+        if(all || pending.deadline <= now) {
+            due.push_back(name);
         }
     }
 
-    // update the entry's "last modified" timestamp and commit changes
-    this->updateKeyTimestamp(keyId);
+    if(due.empty()) {
+        return 0;
+    }
 
+    StorageBackend::Transaction txn(*this->backend);
+    for(const auto &name : due) {
+        this->flushPendingWrite(name);
+    }
     txn.commit();
+
+    for(const auto &name : due) {
+        this->dropPendingWrite(name);
+    }
+
+    return due.size();
 }
 
 /**
- * @brief Update the "last modified" timestamp of a key
+ * @brief Account a write to the main backend to the key's prefix
  *
- * @param keyId Primary key id of the key
+ * This must be called before the transaction containing the write is committed, so that the write
+ * is included in that commit.
  *
- * @remark This should be wrapped in an outer transaction.
+ * @param name Name of the key written (or deleted)
+ * @param valueBytes Size of the value written, in bytes
  */
-void DataStore::updateKeyTimestamp(const uint32_t keyId) {
-    SQLite::Statement stmt(*this->db, "UPDATE PropertyKeys SET updatedAt = strftime('%s','now') "
-            "WHERE id = :keyId;");
-    stmt.bind(":keyId", keyId);
+void DataStore::recordWrite(const std::string_view &name, const size_t valueBytes) {
+    const auto prefix = name.substr(0, name.find('.'));
+
+    auto it = this->prefixWrites.find(prefix);
+    if(it == this->prefixWrites.end()) {
+        it = this->prefixWrites.emplace(prefix, PrefixWriteStats{}).first;
+    }
+
+    const auto bytes = name.size() + valueBytes;
+    it->second.writes++;
+    it->second.bytes += bytes;
+    this->numLogicalBytes += bytes;
+
+    if(!this->dirtyPrefixes.contains(prefix)) {
+        this->dirtyPrefixes.emplace(prefix);
+    }
+    this->hotKeys.record(name);
+}
+
+/**
+ * @brief Handle a transaction being committed
+ *
+ * Invoked by the backend's transaction hook, usually before the commit is actually written out.
+ * The syncs made since the previous commit are attributed to the prefixes written in it, and the
+ * prefixes written in this transaction are remembered to attribute this commit's syncs to them
+ * later. If the backend reports commits after writing them out, this commit's syncs were already
+ * made, so they're attributed right away instead.
+ */
+void DataStore::handleCommit() {
+    const bool written = this->backend->commitHookAfterWrite();
+
+    this->numCommits++;
+    if(!written) {
+        this->attributeSyncs();
+    }
+
+    for(const auto &prefix : this->dirtyPrefixes) {
+        this->prefixWrites.find(prefix)->second.commits++;
+    }
+
+    this->committedPrefixes.clear();
+    this->committedPrefixes.swap(this->dirtyPrefixes);
+
+    if(written) {
+        this->attributeSyncs();
+    }
+}
+
+/**
+ * @brief Attribute all syncs since the last call to the prefixes of the last commit
+ *
+ * Each of the prefixes is charged for all of the syncs, since the commit would've required them
+ * regardless of which of them were written.
+ */
+void DataStore::attributeSyncs() {
+    const auto syncs = CountingVfs::GetTotalSyncs();
+    const auto delta = syncs - this->lastSyncCount;
+    this->lastSyncCount = syncs;
+
+    if(!delta) {
+        return;
+    }
 
-    int err = stmt.exec();
-    if(!err) {
-        throw std::runtime_error("failed to update property key timestamp");
+    for(const auto &prefix : this->committedPrefixes) {
+        this->prefixWrites.find(prefix)->second.syncs += delta;
     }
 }
@@ -1,162 +1,410 @@
 #ifndef DATASTORE_H
 #define DATASTORE_H
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
 #include <string_view>
-#include <type_traits>
-
-#include <SQLiteCpp/SQLiteCpp.h>
+#include <variant>
+#include <vector>
 
+#include "DefaultsImage.h"
+#include "EncodedValueCache.h"
+#include "MemoryBackend.h"
+#include "StorageBackend.h"
 #include "Types.h"
+#include "WearStats.h"
 
 /**
  * @brief Configuration data store handler
  *
- * This is a thin wrapper around an sqlite3 database (which in turn is provided by SQLiteCpp) which
- * actually holds all of the configuration data.
+ * This implements the rules for how keys may be read and changed on top of a StorageBackend, which
+ * actually holds all of the configuration data: by default, an sqlite3 database.
+ *
+ * Keys under any of the volatile prefixes are the exception: they are held in a separate, transient
+ * in-memory backend instead, and never touch the main backend. They otherwise behave the same as
+ * all other keys, but are lost when the data store is closed; and they aren't included when
+ * enumerating keys.
+ *
+ * Writes that don't change a key's value are skipped. Writes to keys under a debounced prefix are
+ * held in memory, and only the latest value is written to the backend once the key has been quiet
+ * for the prefix's interval; flushPendingWrites() must be called periodically to do so.
+ *
+ * All writes to the main backend are accounted to the key's top-level prefix, so that the services
+ * responsible for most of the wear on the underlying flash can be identified.
+ *
+ * Optionally, a read-only image of factory defaults sits below the main backend: keys that aren't
+ * in the backend fall through to it. Default keys read as version 0, and are only copied into the
+ * backend once they're changed, so it holds just the keys that differ from their defaults;
+ * deleting a key reverts it to its default.
+ *
+ * Reads can also return values in the encoding used by the RPC interface, from a cache of encoded
+ * values: hits are answered without accessing the backend, or encoding the value again. Every
+ * change to a key drops its cached value.
+ *
+ * Backends that don't make changes durable right away (such as the in-memory backend persisted by
+ * a write log) need checkpoint() to be called periodically.
  */
 class DataStore {
     public:
-        DataStore(const std::filesystem::path &dbPath);
-        ~DataStore() = default;
+        /// Time at which a key expires
+        using ExpiryTime = StorageBackend::ExpiryTime;
+        /// Clock used for debouncing writes
+        using Clock = std::chrono::steady_clock;
+
+        /// Longest time to live a key may be given (the most libconfd can request, ~50 days)
+        constexpr static const std::chrono::milliseconds kMaxTtl{UINT32_MAX};
+
+        /**
+         * @brief How to handle writes that don't change a key's value
+         */
+        enum class UnchangedWritePolicy {
+            /// Skip the write entirely
+            Skip,
+            /// Only update the key's "last modified" timestamp
+            Touch,
+        };
+
+        /**
+         * @brief Write counters for a top-level key prefix
+         */
+        struct PrefixWriteStats {
+            /// Number of writes to keys under the prefix
+            uint64_t writes{0};
+            /// Logical bytes written (key names and values)
+            uint64_t bytes{0};
+            /// Number of commits that included writes to keys under the prefix
+            uint64_t commits{0};
+            /// Number of syncs issued by those commits
+            uint64_t syncs{0};
+        };
+
+        /**
+         * @brief Data store performance counters
+         *
+         * A snapshot of the counters maintained by the data store, which can be used to gauge how
+         * much work the underlying database is doing.
+         */
+        struct Stats {
+            /// Number of SQL statements executed (sqlite backend only)
+            uint64_t statements{0};
+            /// Number of transactions committed (including implicit ones)
+            uint64_t commits{0};
+            /// Page cache hits
+            uint64_t cacheHits{0};
+            /// Page cache misses
+            uint64_t cacheMisses{0};
+            /// Size of the backend's files on disk, in bytes
+            uint64_t dbSize{0};
+            /// Number of volatile (in-memory) keys
+            uint64_t volatileKeys{0};
+            /// Number of writes skipped because they didn't change the key's value
+            uint64_t unchangedWrites{0};
+            /// Number of debounced writes that were superseded before being written to the db
+            uint64_t debouncedWrites{0};
+            /// Number of debounced writes not yet written to the database
+            uint64_t pendingWrites{0};
+            /// Number of keys in the defaults image
+            uint64_t defaultKeys{0};
+            /// Number of reads served from the defaults image
+            uint64_t defaultReads{0};
+
+            /// Number of values in the encoded value cache
+            uint64_t valueCacheEntries{0};
+            /// Total size of the values in the encoded value cache, in bytes
+            uint64_t valueCacheBytes{0};
+            /// Number of encoded reads served from the cache
+            uint64_t valueCacheHits{0};
+            /// Number of encoded reads that had to read (and encode) the value
+            uint64_t valueCacheMisses{0};
+
+            /// Memory used by the backend's filter of existing key names, in bytes
+            uint64_t filterBytes{0};
+            /// Number of key names in the backend's key filter
+            uint64_t filterKeys{0};
+            /// Number of times the key filter was rebuilt
+            uint64_t filterRebuilds{0};
+            /// Number of lookups of missing keys answered by the key filter alone
+            uint64_t filterNegatives{0};
+            /// Number of lookups of missing keys that passed the key filter
+            uint64_t filterFalsePositives{0};
+
+            /// Number of pages written to the database files by the page cache
+            uint64_t pageWrites{0};
+            /// Logical bytes written to the database (key names and values)
+            uint64_t logicalBytes{0};
+            /// Physical I/O on the database files, indexed by CountingVfs::FileType
+            std::array<CountingVfs::Counters, CountingVfs::kNumFileTypes> files{};
+            /// Write counters for each top-level key prefix
+            std::map<std::string, PrefixWriteStats> prefixes;
+            /// Most frequently written keys, in descending order
+            std::vector<HotKeyTracker::Entry> hotKeys;
+        };
+
+        /**
+         * @brief Atomic operations on integer keys
+         */
+        enum class IntegerOp {
+            /// Add the operand to the value
+            Add,
+            /// Subtract the operand from the value
+            Subtract,
+            /// Set the value to the smaller of the value and the operand
+            Min,
+            /// Set the value to the larger of the value and the operand
+            Max,
+        };
+
+        /**
+         * @brief Result of a conditional update
+         */
+        struct CasResult {
+            /// Whether the key's version matched, and the update was applied
+            bool applied{false};
+            /**
+             * @brief Version of the key
+             *
+             * If the update was applied, this is the key's new version; otherwise, it's the
+             * current version (or zero, if the key doesn't exist.)
+             */
+            uint64_t version{0};
+        };
+
+        /**
+         * @brief Results of a bulk load
+         */
+        struct BulkLoadStats {
+            /// Number of keys that were newly created
+            size_t inserted{0};
+            /// Number of existing keys that were updated
+            size_t updated{0};
+            /// Total time taken (including waiting for the lock)
+            std::chrono::nanoseconds duration{0};
+
+            /// Get the load rate, in keys per second
+            double keysPerSec() const {
+                const auto secs = std::chrono::duration<double>(this->duration).count();
+                return secs > 0 ? (this->inserted + this->updated) / secs : 0;
+            }
+        };
 
-        PropertyValue getKey(const std::string_view &name);
+    public:
+        DataStore(const std::filesystem::path &dbPath,
+                const std::vector<std::string> &volatilePrefixes = {});
+        DataStore(std::unique_ptr<StorageBackend> backend,
+                const std::vector<std::string> &volatilePrefixes = {});
+        ~DataStore();
+
+        /// Function producing the encoding of a value (as held in the encoded value cache)
+        using ValueEncoder = std::function<std::vector<std::byte>(const PropertyValue &)>;
+
+        /// Set how writes that don't change a key's value are handled
+        void setUnchangedWritePolicy(const UnchangedWritePolicy policy) {
+            this->unchangedPolicy = policy;
+        }
+        void setDefaults(std::unique_ptr<DefaultsImage> defaults);
+        void setValueCache(const size_t maxBytes, ValueEncoder encoder);
+        void addDebouncePolicy(const std::string_view &prefix,
+                const std::chrono::milliseconds interval);
+        size_t flushPendingWrites();
+        std::optional<Clock::time_point> getNextFlushTime();
+        void checkpoint();
+
+        Stats getStats();
+
+        PropertyValue getKey(const std::string_view &name, uint64_t *outVersion = nullptr);
+        EncodedValueCache::EntryPtr getKeyEncoded(const std::string_view &name);
+        PropertyList getKeys(const std::string_view &after, const size_t limit);
         void setKey(const std::string_view &name, const PropertyValue &value);
+        void setKeyWithExpiry(const std::string_view &name, const PropertyValue &value,
+                const std::optional<ExpiryTime> &expiresAt);
+        CasResult setKeyIfVersion(const std::string_view &name, const PropertyValue &value,
+                const uint64_t expectedVersion);
+        std::optional<int64_t> applyIntegerOp(const std::string_view &name, const IntegerOp op,
+                const int64_t operand, uint64_t *outVersion = nullptr);
+        void setKeys(const PropertyList &values);
+        BulkLoadStats bulkLoad(const PropertyList &values);
 
         size_t deleteKey(const std::string_view &name);
         size_t deleteSubkeys(const std::string_view &namePrefix);
 
-    private:
-        /// Name of the metadata table
-        constexpr static const char *kMetaTableName{"MetaInfo"};
+        std::vector<std::pair<std::string, ExpiryTime>> getExpiringKeys();
+        size_t expireKeys(const std::vector<std::string> &names);
+
         /**
-         * @brief Current schema version
+         * @brief Get the time the most recent data store operation waited for the database lock
          *
-         * This integer value defines the database schema version. It's expected to be a
-         * monotonically increasing value, where numerically higher values indicate newer schemas.
+         * This is tracked per thread, so it always refers to an operation made by the caller.
          */
-        constexpr static const uint32_t kCurrentSchemaVersion{1};
+        static auto GetLastLockWait() {
+            return gLastLockWait;
+        }
+
+    private:
+        /// Number of keys tracked to determine the most frequently written keys
+        constexpr static const size_t kHotKeyCapacity{64};
+        /// Number of most frequently written keys reported in the statistics
+        constexpr static const size_t kHotKeysReported{10};
 
         /**
-         * @brief Property value types
-         *
-         * This enum defines the numeric values for the `valueType` columnn in the `PropertyKeys`
-         * table, which is used to store the keys (names) and types of properties.
+         * @brief A debounced write that hasn't been written to the database yet
          */
-        enum class PropertyValueType: uint32_t {
-            /// No associated data
-            Null                        = 0,
-            /// UTF-8 encoded string
-            String                      = 1,
-            /// Raw, unformatted binary data
-            Blob                        = 2,
-            /// Unsigned integer
-            Integer                     = 3,
-            /// Floating point (decimal) number
-            Real                        = 4,
+        struct PendingWrite {
+            /// Latest value of the key
+            PropertyValue value;
+            /// Version of the key in the database (zero if it doesn't exist there yet)
+            uint64_t baseVersion{0};
+            /// Number of writes made since; each increments the key's version
+            uint64_t updates{1};
+            /// Time at which the value is written to the database
+            Clock::time_point deadline;
         };
 
-        void initSchema();
+        std::unique_lock<std::mutex> acquireLock(std::mutex &mutex);
+        /// Acquire the database lock
+        inline auto acquireLock() {
+            return this->acquireLock(this->dbLock);
+        }
 
-        bool hasChildren(const std::string_view &keyName);
-        std::optional<std::string> getMetaValue(const std::string_view &key);
-
-        void insertKey(const std::string_view &keyName, const PropertyValue &value);
-        void updateKey(const uint32_t keyId, const PropertyValueType oldValueType,
-                const PropertyValue &newValue);
-        void updateKeyTimestamp(const uint32_t keyId);
-
-        /// Get the name of the table containing values of the given type
-        constexpr static std::string_view ValueTableName(const PropertyValueType t) {
-            switch(t) {
-                case PropertyValueType::String:
-                    return "PropertyValuesString";
-                case PropertyValueType::Blob:
-                    return "PropertyValuesBlob";
-                case PropertyValueType::Integer:
-                    return "PropertyValuesInteger";
-                case PropertyValueType::Real:
-                    return "PropertyValuesReal";
-                default:
-                    return "";
-            }
+        /// Get the backend holding the given key
+        inline StorageBackend &storeFor(const std::string_view &name) {
+            return this->isVolatile(name) ? this->volatileKeys : *this->backend;
         }
-        /// Get the property value type enum (to store in the db) for a given value type
-        constexpr static inline PropertyValueType TypeForValue(const PropertyValue &val) {
-            return std::visit([](auto&& arg) -> PropertyValueType {
-                using T = std::decay_t<decltype(arg)>;
-                if constexpr (std::is_same_v<T, std::nullptr_t>) {
-                    return PropertyValueType::Null;
-                }
-                else if constexpr (std::is_same_v<T, std::string>) {
-                    return PropertyValueType::String;
-                }
-                else if constexpr (std::is_same_v<T, Blob>) {
-                    return PropertyValueType::Blob;
-                }
-                else if constexpr (std::is_same_v<T, uint64_t>) {
-                    return PropertyValueType::Integer;
-                }
-                else if constexpr (std::is_same_v<T, double>) {
-                    return PropertyValueType::Real;
-                }
-                // booleans are stored as integers
-                else if constexpr (std::is_same_v<T, bool>) {
-                    return PropertyValueType::Integer;
-                }
-                // any other types get mapped as null as well (in this case, monostate)
-                else {
-                    return PropertyValueType::Null;
-                }
-            }, val);
+        /// Get the lock guarding the backend holding the given key
+        inline std::mutex &lockFor(const std::string_view &name) {
+            return this->isVolatile(name) ? this->volatileLock : this->dbLock;
         }
 
+        PropertyValue readKey(StorageBackend &store, const std::string_view &name,
+                uint64_t *outVersion);
+        std::optional<StorageBackend::Record> getDefault(const std::string_view &name);
+        bool hasChildren(const std::string_view &keyName);
+        bool isVolatile(const std::string_view &name) const;
+
+        std::optional<std::chrono::milliseconds> getDebounceInterval(const std::string_view &name);
+        void debounceWrite(const std::string_view &name, const PropertyValue &value,
+                const std::chrono::milliseconds interval);
+        void flushPendingWrite(const std::string_view &name);
+        void dropPendingWrite(const std::string_view &name);
+        void persistPendingWrite(const std::string_view &name);
+        size_t persistPendingWrites(const bool all);
+
+        bool writeKey(StorageBackend &store, const std::string_view &name,
+                const PropertyValue &value, uint64_t *outVersion = nullptr,
+                const std::optional<ExpiryTime> *expiresAt = nullptr);
+
+        void recordWrite(const std::string_view &name, const size_t valueBytes);
+        void handleCommit();
+        void attributeSyncs();
+
+        static bool ApplyValue(std::optional<StorageBackend::Record> &record,
+                const std::string_view &name, PropertyValue &&value);
+
+        /// Ensure a key name and value may be written at all
+        static void ValidateWrite(const std::string_view &name, const PropertyValue &value) {
+            if(name.empty()) {
+                throw std::invalid_argument("invalid name");
+            } else if(std::holds_alternative<std::monostate>(value)) {
+                throw std::invalid_argument("invalid value");
+            }
+        }
         /**
-         * @brief Bind property value to SQL statement
+         * @brief Test whether a key's value may be changed to the given value
          *
-         * @param stmt Statement to bind to
-         * @param colName Column name to bind the value to
-         * @param value Value to bind
+         * Keys whose value is null may be set to any value; otherwise, the value may only be
+         * changed to null, or another value of the same type. Both values must be normalized.
          */
-        static inline void BindValue(SQLite::Statement &stmt, const std::string_view &colName,
-                const PropertyValue &value) {
-            std::visit([&](auto&& arg) {
-                using T = std::decay_t<decltype(arg)>;
-
-                if constexpr(std::is_same_v<T, std::string>) {
-                    stmt.bind(colName.data(), arg);
-                }
-                else if constexpr(std::is_same_v<T, Blob>) {
-                    stmt.bind(colName.data(), static_cast<const void *>(arg.data()), arg.size());
-                }
-                else if constexpr(std::is_same_v<T, uint64_t>) {
-                    stmt.bind(colName.data(), static_cast<int64_t>(arg));
-                }
-                else if constexpr(std::is_same_v<T, double>) {
-                    stmt.bind(colName.data(), arg);
-                }
-                else if constexpr(std::is_same_v<T, bool>) {
-                    stmt.bind(colName.data(), arg);
-                }
-                // other types should never get through to here
-                else {
-                    throw std::logic_error("invalid type for set");
-                }
-            }, value);
+        constexpr static bool IsValidTypeChange(const PropertyValue &oldValue,
+                const PropertyValue &newValue) {
+            return std::holds_alternative<std::nullptr_t>(oldValue) ||
+                std::holds_alternative<std::nullptr_t>(newValue) ||
+                oldValue.index() == newValue.index();
+        }
+        /// Convert a value to how it's read back from the data store (booleans become integers)
+        static PropertyValue NormalizeValue(const PropertyValue &value) {
+            if(std::holds_alternative<bool>(value)) {
+                return static_cast<uint64_t>(std::get<bool>(value));
+            }
+            return value;
         }
 
-    private:
-        /// storage path on disk of the underlying sqlite database
-        std::filesystem::path path;
+        /// Get the logical size of a value, in bytes
+        static size_t ValueSize(const PropertyValue &value) {
+            if(auto str = std::get_if<std::string>(&value)) {
+                return str->size();
+            } else if(auto blob = std::get_if<Blob>(&value)) {
+                return blob->size();
+            } else if(std::holds_alternative<uint64_t>(value) ||
+                    std::holds_alternative<double>(value)) {
+                return sizeof(uint64_t);
+            } else if(std::holds_alternative<bool>(value)) {
+                return 1;
+            }
+            return 0;
+        }
 
-        /// lock guarding access to the db
+    private:
+        /// Backend holding all keys (except volatile keys)
+        std::unique_ptr<StorageBackend> backend;
+        /// lock guarding access to the backend
         std::mutex dbLock;
-        /// sqlite database holding data
-        std::unique_ptr<SQLite::Database> db;
+
+        /// Factory defaults below the backend (if any)
+        std::unique_ptr<DefaultsImage> defaults;
+        /// Number of reads served from the defaults image
+        uint64_t numDefaultReads{0};
+
+        /// Encoded values of keys in the backend (or defaults image)
+        EncodedValueCache valueCache;
+        /// Encoder for values in the encoded value cache
+        ValueEncoder valueEncoder;
+
+        /// Key prefixes whose keys are held in memory only
+        std::vector<std::string> volatilePrefixes;
+        /// lock guarding access to the volatile keys (taken after the db lock, if both are needed)
+        std::mutex volatileLock;
+        /// Volatile keys and their values
+        MemoryBackend volatileKeys;
+
+        /// Number of commits (updated by the backend's transaction hook)
+        uint64_t numCommits{0};
+
+        /// How to handle writes that don't change a key's value
+        UnchangedWritePolicy unchangedPolicy{UnchangedWritePolicy::Skip};
+        /// Debounced key prefixes, and their intervals
+        std::vector<std::pair<std::string, std::chrono::milliseconds>> debouncePolicies;
+        /// Debounced writes not yet committed to the backend (guarded by the db lock)
+        std::map<std::string, PendingWrite, std::less<>> pendingWrites;
+
+        /// Number of writes skipped because they didn't change the key's value
+        uint64_t numUnchangedWrites{0};
+        /// Number of debounced writes that were superseded before being written
+        uint64_t numDebouncedWrites{0};
+
+        /// Logical bytes written to the backend
+        uint64_t numLogicalBytes{0};
+        /// Write counters for each top-level key prefix
+        std::map<std::string, PrefixWriteStats, std::less<>> prefixWrites;
+        /// Prefixes written to in the current transaction
+        std::set<std::string, std::less<>> dirtyPrefixes;
+        /// Prefixes written to in the most recently committed transaction
+        std::set<std::string, std::less<>> committedPrefixes;
+        /// Total number of syncs, as of when syncs were last attributed to prefixes
+        uint64_t lastSyncCount{0};
+        /// Most frequently written keys
+        HotKeyTracker hotKeys{kHotKeyCapacity};
+
+        /// Time the last operation on this thread waited to acquire the database lock
+        static thread_local std::chrono::nanoseconds gLastLockWait;
 };
 
 #endif
@@ -0,0 +1,372 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "DefaultsImage.h"
+
+/**
+ * @brief Value type tags
+ *
+ * These are the same values as used for the value type column in the database.
+ */
+enum class ValueTag: uint8_t {
+    Null                        = 0,
+    String                      = 1,
+    Blob                        = 2,
+    Integer                     = 3,
+    Real                        = 4,
+};
+
+/**
+ * @brief Read a little endian unsigned integer
+ */
+template<typename T>
+static T LoadLE(const std::byte *data) {
+    static_assert(std::is_unsigned_v<T>);
+
+    T value{0};
+    for(size_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<T>(static_cast<uint8_t>(data[i])) << (i * 8);
+    }
+    return value;
+}
+
+/**
+ * @brief Append a little endian unsigned integer to a buffer
+ */
+template<typename T>
+static void PutLE(std::vector<std::byte> &buf, const T value) {
+    static_assert(std::is_unsigned_v<T>);
+
+    for(size_t i = 0; i < sizeof(T); i++) {
+        buf.push_back(static_cast<std::byte>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+/**
+ * @brief Map a defaults image into memory
+ *
+ * Only the header is validated here; the rest of the image is paged in as keys are looked up.
+ *
+ * @param path Path of the image file
+ *
+ * @throw std::system_error Failed to open or map the file
+ * @throw std::runtime_error The file is not a valid defaults image
+ */
+DefaultsImage::DefaultsImage(const std::filesystem::path &path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open defaults image '{}'", path.native()));
+    }
+
+    struct stat sb;
+    if(fstat(fd, &sb) == -1) {
+        const auto err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "stat defaults image");
+    } else if(static_cast<size_t>(sb.st_size) < kHeaderSize) {
+        close(fd);
+        throw std::runtime_error("defaults image too small");
+    }
+
+    this->length = static_cast<size_t>(sb.st_size);
+
+    // the mapping remains valid once the file is closed
+    auto ptr = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    const auto err = errno;
+    close(fd);
+
+    if(ptr == MAP_FAILED) {
+        throw std::system_error(err, std::generic_category(), "map defaults image");
+    }
+    this->base = static_cast<const std::byte *>(ptr);
+
+    // validate the header
+    try {
+        if(std::memcmp(this->base, kMagic, 8)) {
+            throw std::runtime_error("invalid defaults image magic");
+        }
+
+        const auto version = LoadLE<uint32_t>(this->base + 8);
+        if(version != kFormatVersion) {
+            throw std::runtime_error(fmt::format("unsupported defaults image version {}",
+                        version));
+        }
+
+        this->numKeys = LoadLE<uint32_t>(this->base + 12);
+        if(this->numKeys > (this->length - kHeaderSize) / kEntrySize) {
+            throw std::runtime_error("defaults image index truncated");
+        }
+    } catch(const std::exception &) {
+        munmap(const_cast<std::byte *>(this->base), this->length);
+        throw;
+    }
+}
+
+/**
+ * @brief Unmap the image
+ */
+DefaultsImage::~DefaultsImage() {
+    munmap(const_cast<std::byte *>(this->base), this->length);
+}
+
+/**
+ * @brief Look up the default value of a key
+ *
+ * @return Value of the key, or nothing if the image doesn't contain it
+ */
+std::optional<PropertyValue> DefaultsImage::get(const std::string_view &name) const {
+    const auto index = this->lowerBound(name);
+    if(index == this->numKeys || this->getName(index) != name) {
+        return std::nullopt;
+    }
+
+    return this->getValue(index);
+}
+
+/**
+ * @brief Check whether the image contains any children of the given key
+ */
+bool DefaultsImage::hasChildren(const std::string_view &name) const {
+    const auto prefix = fmt::format("{}.", name);
+    const auto index = this->lowerBound(prefix);
+
+    return index < this->numKeys && this->getName(index).starts_with(prefix);
+}
+
+/**
+ * @brief Find the first key whose name sorts after the given name
+ *
+ * @return Index of the key, or the number of keys if there is none
+ */
+size_t DefaultsImage::upperBound(const std::string_view &name) const {
+    size_t low{0}, high{this->numKeys};
+
+    while(low < high) {
+        const auto mid = low + (high - low) / 2;
+        if(this->getName(mid) <= name) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Find the first key whose name doesn't sort before the given name
+ *
+ * @return Index of the key, or the number of keys if there is none
+ */
+size_t DefaultsImage::lowerBound(const std::string_view &name) const {
+    size_t low{0}, high{this->numKeys};
+
+    while(low < high) {
+        const auto mid = low + (high - low) / 2;
+        if(this->getName(mid) < name) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Get the name of the key at the given index
+ */
+std::string_view DefaultsImage::getName(const size_t index) const {
+    return this->getEntry(index).name;
+}
+
+/**
+ * @brief Decode the value of the key at the given index
+ *
+ * @throw std::runtime_error The value is malformed
+ */
+PropertyValue DefaultsImage::getValue(const size_t index) const {
+    const auto entry = this->getEntry(index);
+    const auto &value = entry.value;
+
+    switch(static_cast<ValueTag>(entry.type)) {
+        case ValueTag::Null:
+            return nullptr;
+        case ValueTag::String:
+            return std::string(reinterpret_cast<const char *>(value.data()), value.size());
+        case ValueTag::Blob:
+            return Blob(value.begin(), value.end());
+        case ValueTag::Integer:
+            if(value.size() == sizeof(uint64_t)) {
+                return LoadLE<uint64_t>(value.data());
+            }
+            break;
+        case ValueTag::Real:
+            if(value.size() == sizeof(uint64_t)) {
+                return std::bit_cast<double>(LoadLE<uint64_t>(value.data()));
+            }
+            break;
+    }
+
+    throw std::runtime_error(fmt::format("invalid value for default key '{}'", entry.name));
+}
+
+/**
+ * @brief Decode the index entry at the given index
+ *
+ * @throw std::runtime_error The entry points outside of the image
+ */
+DefaultsImage::Entry DefaultsImage::getEntry(const size_t index) const {
+    const auto entry = this->base + kHeaderSize + (index * kEntrySize);
+
+    const auto nameOffset = LoadLE<uint32_t>(entry);
+    const auto valueOffset = LoadLE<uint32_t>(entry + 4);
+    const auto valueLength = LoadLE<uint32_t>(entry + 8);
+    const auto nameLength = LoadLE<uint16_t>(entry + 12);
+
+    const auto name = this->getBytes(nameOffset, nameLength);
+
+    return {
+        .name = std::string_view(reinterpret_cast<const char *>(name.data()), name.size()),
+        .value = this->getBytes(valueOffset, valueLength),
+        .type = static_cast<uint8_t>(entry[14]),
+    };
+}
+
+/**
+ * @brief Get a range of bytes in the image
+ *
+ * @throw std::runtime_error The range extends past the end of the image
+ */
+std::span<const std::byte> DefaultsImage::getBytes(const uint64_t offset,
+        const uint64_t length) const {
+    if(offset > this->length || length > this->length - offset) {
+        throw std::runtime_error("defaults image damaged (offset out of range)");
+    }
+
+    return {this->base + offset, static_cast<size_t>(length)};
+}
+
+
+
+/**
+ * @brief Write a defaults image
+ *
+ * The keys are sorted by name, and written to a temporary file, which is then renamed into place.
+ * Boolean values are stored as integers, the same way as the data store does.
+ *
+ * @param path Path of the image file to create
+ * @param values Key names and their values; each key may only be specified once
+ *
+ * @throw std::invalid_argument A key name or value is invalid, or a key was specified twice
+ * @throw std::runtime_error Failed to write the file, or it would be too large
+ */
+void DefaultsImage::Write(const std::filesystem::path &path, const PropertyList &values) {
+    std::vector<const PropertyList::value_type *> sorted;
+    sorted.reserve(values.size());
+
+    for(const auto &pair : values) {
+        sorted.push_back(&pair);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto a, const auto b) {
+        return a->first < b->first;
+    });
+
+    // names and values follow the index
+    std::vector<std::byte> index, data;
+    index.reserve(kHeaderSize + sorted.size() * kEntrySize);
+
+    index.insert(index.end(), reinterpret_cast<const std::byte *>(kMagic),
+            reinterpret_cast<const std::byte *>(kMagic) + 8);
+    PutLE(index, kFormatVersion);
+    PutLE(index, static_cast<uint32_t>(sorted.size()));
+
+    const uint64_t dataStart = kHeaderSize + sorted.size() * kEntrySize;
+
+    for(size_t i = 0; i < sorted.size(); i++) {
+        const auto &[name, value] = *sorted[i];
+
+        if(name.empty() || name.size() > std::numeric_limits<uint16_t>::max()) {
+            throw std::invalid_argument(fmt::format("invalid key name '{}'", name));
+        } else if(i && sorted[i - 1]->first == name) {
+            throw std::invalid_argument(fmt::format("duplicate key '{}'", name));
+        }
+
+        const auto nameOffset = dataStart + data.size();
+        data.insert(data.end(), reinterpret_cast<const std::byte *>(name.data()),
+                reinterpret_cast<const std::byte *>(name.data()) + name.size());
+
+        const auto valueOffset = dataStart + data.size();
+        ValueTag tag;
+
+        if(std::holds_alternative<std::nullptr_t>(value)) {
+            tag = ValueTag::Null;
+        } else if(auto str = std::get_if<std::string>(&value)) {
+            tag = ValueTag::String;
+            data.insert(data.end(), reinterpret_cast<const std::byte *>(str->data()),
+                    reinterpret_cast<const std::byte *>(str->data()) + str->size());
+        } else if(auto blob = std::get_if<Blob>(&value)) {
+            tag = ValueTag::Blob;
+            data.insert(data.end(), blob->begin(), blob->end());
+        } else if(auto integer = std::get_if<uint64_t>(&value)) {
+            tag = ValueTag::Integer;
+            PutLE(data, *integer);
+        } else if(auto real = std::get_if<double>(&value)) {
+            tag = ValueTag::Real;
+            PutLE(data, std::bit_cast<uint64_t>(*real));
+        } else if(auto boolean = std::get_if<bool>(&value)) {
+            tag = ValueTag::Integer;
+            PutLE(data, static_cast<uint64_t>(*boolean));
+        } else {
+            throw std::invalid_argument(fmt::format("invalid value for key '{}'", name));
+        }
+
+        const auto valueLength = dataStart + data.size() - valueOffset;
+        if(dataStart + data.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("defaults image too large");
+        }
+
+        PutLE(index, static_cast<uint32_t>(nameOffset));
+        PutLE(index, static_cast<uint32_t>(valueOffset));
+        PutLE(index, static_cast<uint32_t>(valueLength));
+        PutLE(index, static_cast<uint16_t>(name.size()));
+        index.push_back(static_cast<std::byte>(tag));
+        index.push_back(std::byte{0});
+    }
+
+    // write it out
+    auto tempPath = path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream os(tempPath, std::ios::binary | std::ios::trunc);
+        os.write(reinterpret_cast<const char *>(index.data()), index.size());
+        os.write(reinterpret_cast<const char *>(data.data()), data.size());
+        os.close();
+
+        if(!os) {
+            std::error_code ec;
+            std::filesystem::remove(tempPath, ec);
+            throw std::runtime_error(fmt::format("failed to write '{}'", tempPath.native()));
+        }
+    }
+
+    std::filesystem::rename(tempPath, path);
+}
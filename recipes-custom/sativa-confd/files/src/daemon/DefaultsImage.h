@@ -0,0 +1,101 @@
+#ifndef DEFAULTSIMAGE_H
+#define DEFAULTSIMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+
+#include "Types.h"
+
+/**
+ * @brief Read-only image of factory default keys
+ *
+ * The image is a compact binary file, built at image build time by `confd-mkdefaults`, which is
+ * memory mapped: opening it only needs to validate its header, and pages are read in on demand as
+ * keys are looked up.
+ *
+ * It consists of a header, followed by an index with one fixed size entry per key, sorted by key
+ * name; and finally the key names and values the entries point to. Keys are looked up by binary
+ * search over the index. Since the index is ordered the same way as the data store, it can also
+ * be enumerated alongside it.
+ *
+ * All values are stored in little endian byte order, so images can be built on a host of any
+ * architecture. The index is trusted to be sorted, but all offsets are checked against the size of
+ * the file before they're accessed.
+ */
+class DefaultsImage {
+    public:
+        DefaultsImage(const std::filesystem::path &path);
+        ~DefaultsImage();
+
+        DefaultsImage(const DefaultsImage &) = delete;
+        DefaultsImage &operator=(const DefaultsImage &) = delete;
+
+        /// Get the number of keys in the image
+        size_t size() const {
+            return this->numKeys;
+        }
+        /// Get the size of the image file, in bytes
+        size_t getFileSize() const {
+            return this->length;
+        }
+
+        std::optional<PropertyValue> get(const std::string_view &name) const;
+        /// Test whether the image contains the given key
+        bool contains(const std::string_view &name) const {
+            const auto index = this->lowerBound(name);
+            return index < this->numKeys && this->getName(index) == name;
+        }
+        bool hasChildren(const std::string_view &name) const;
+
+        size_t upperBound(const std::string_view &name) const;
+        std::string_view getName(const size_t index) const;
+        PropertyValue getValue(const size_t index) const;
+
+        static void Write(const std::filesystem::path &path, const PropertyList &values);
+
+    private:
+        /// Magic value at the start of the image
+        constexpr static const char *kMagic{"confddef"};
+        /// Image format version
+        constexpr static const uint32_t kFormatVersion{1};
+        /// Size of the header (magic, format version and number of keys)
+        constexpr static const size_t kHeaderSize{8 + 4 + 4};
+        /**
+         * @brief Size of an index entry
+         *
+         * Each entry consists of the offset of the key's name, offset and length of its value
+         * (all 32 bits), the length of its name (16 bits), its value type, and a reserved byte.
+         */
+        constexpr static const size_t kEntrySize{4 + 4 + 4 + 2 + 1 + 1};
+
+        /**
+         * @brief An index entry, as decoded from the image
+         */
+        struct Entry {
+            /// Key name
+            std::string_view name;
+            /// Raw bytes of the value
+            std::span<const std::byte> value;
+            /// Value type (same as the value types in the database)
+            uint8_t type;
+        };
+
+        size_t lowerBound(const std::string_view &name) const;
+        Entry getEntry(const size_t index) const;
+        std::span<const std::byte> getBytes(const uint64_t offset, const uint64_t length) const;
+
+    private:
+        /// Base of the memory mapped image
+        const std::byte *base{nullptr};
+        /// Size of the image, in bytes
+        size_t length{0};
+
+        /// Number of keys in the image
+        size_t numKeys{0};
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "EncodedValueCache.h"
+
+/**
+ * @brief Look up the encoded value of a key
+ *
+ * A value that is found becomes the most recently used one.
+ *
+ * @return Encoded value, or nullptr if it's not cached
+ */
+EncodedValueCache::EntryPtr EncodedValueCache::get(const std::string_view &name) {
+    auto it = this->index.find(name);
+    if(it == this->index.end()) {
+        this->numMisses++;
+        return nullptr;
+    }
+
+    this->numHits++;
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    return it->second->entry;
+}
+
+/**
+ * @brief Cache the encoded value of a key
+ *
+ * Any value already cached for the key is replaced. The least recently used values are evicted
+ * until the new value fits; values larger than the entire cache aren't cached at all.
+ *
+ * @param name Name of the key
+ * @param entry Encoded value of the key
+ */
+void EncodedValueCache::insert(const std::string_view &name, EntryPtr entry) {
+    this->remove(name);
+
+    const auto size = entry->data.size();
+    if(size > this->maxBytes) {
+        return;
+    }
+
+    while(this->bytes + size > this->maxBytes) {
+        this->erase(std::prev(this->lru.end()));
+    }
+
+    this->lru.push_front({.name = std::string(name), .entry = std::move(entry)});
+    this->index.emplace(this->lru.front().name, this->lru.begin());
+    this->bytes += size;
+}
+
+/**
+ * @brief Drop the cached value of a key, if any
+ */
+void EncodedValueCache::remove(const std::string_view &name) {
+    auto it = this->index.find(name);
+    if(it != this->index.end()) {
+        this->erase(it->second);
+    }
+}
+
+/**
+ * @brief Drop all cached values
+ */
+void EncodedValueCache::clear() {
+    this->index.clear();
+    this->lru.clear();
+    this->bytes = 0;
+}
+
+/**
+ * @brief Drop a cached value
+ *
+ * @param it Value to drop
+ */
+void EncodedValueCache::erase(const NodeList::iterator &it) {
+    this->bytes -= it->entry->data.size();
+    this->index.erase(it->name);
+    this->lru.erase(it);
+}
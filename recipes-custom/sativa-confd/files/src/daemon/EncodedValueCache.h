@@ -0,0 +1,99 @@
+#ifndef ENCODEDVALUECACHE_H
+#define ENCODEDVALUECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Cache of encoded key values
+ *
+ * Holds the values of keys in their wire encoding, so reads can be answered by copying the encoded
+ * value into the reply, rather than reading it from the backend and encoding it again. The cache
+ * is bounded by the total size of the encoded values it holds: the least recently used values are
+ * evicted to make room for new ones.
+ *
+ * Entries are shared, so a value that is evicted (or invalidated) while a reply is being built
+ * from it stays valid until that's done.
+ */
+class EncodedValueCache {
+    public:
+        /**
+         * @brief An encoded value
+         */
+        struct Entry {
+            /// Encoded value
+            std::vector<std::byte> data;
+            /// Version of the key the value was read at
+            uint64_t version{0};
+        };
+        using EntryPtr = std::shared_ptr<const Entry>;
+
+    public:
+        /**
+         * @brief Initialize the cache
+         *
+         * @param maxBytes Maximum total size of encoded values held
+         */
+        EncodedValueCache(const size_t maxBytes = 0) : maxBytes(maxBytes) {}
+
+        EntryPtr get(const std::string_view &name);
+        void insert(const std::string_view &name, EntryPtr entry);
+        void remove(const std::string_view &name);
+        void clear();
+
+        /// Get the number of values in the cache
+        size_t size() const {
+            return this->index.size();
+        }
+        /// Get the total size of the encoded values in the cache, in bytes
+        size_t getBytes() const {
+            return this->bytes;
+        }
+        /// Get the number of lookups that found a value
+        uint64_t getHits() const {
+            return this->numHits;
+        }
+        /// Get the number of lookups that didn't find a value
+        uint64_t getMisses() const {
+            return this->numMisses;
+        }
+
+    private:
+        /**
+         * @brief A cached value
+         */
+        struct Node {
+            /// Name of the key
+            std::string name;
+            /// Encoded value
+            EntryPtr entry;
+        };
+        using NodeList = std::list<Node>;
+
+        void erase(const NodeList::iterator &it);
+
+    private:
+        /// Maximum total size of the encoded values
+        size_t maxBytes;
+        /// Total size of the encoded values
+        size_t bytes{0};
+
+        /// Cached values, most recently used first
+        NodeList lru;
+        /// Cached values, by key name
+        std::map<std::string, NodeList::iterator, std::less<>> index;
+
+        /// Number of lookups that found a value
+        uint64_t numHits{0};
+        /// Number of lookups that didn't find a value
+        uint64_t numMisses{0};
+};
+
+#endif
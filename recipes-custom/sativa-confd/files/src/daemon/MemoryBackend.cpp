@@ -0,0 +1,385 @@
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "MemoryBackend.h"
+
+/**
+ * @brief Open an in-memory backend persisted by a write log
+ *
+ * All keys are restored from the snapshot and write log next to the given path, in order.
+ *
+ * @param path Base path of the snapshot and log files
+ * @param options Write log options
+ *
+ * @throw std::system_error The write log is already open in another process (EWOULDBLOCK)
+ */
+MemoryBackend::MemoryBackend(const std::filesystem::path &path, const WriteLog::Options &options) :
+    fileLock(std::make_unique<FileLock>(path)) {
+    PLOG_INFO << "loading in-memory store: " << path.native();
+
+    this->log = std::make_unique<WriteLog>(path, options);
+    this->log->load([this](WriteLog::Entry &&entry) {
+        switch(entry.op) {
+            case WriteLog::Entry::Op::Set:
+                this->keys.insert_or_assign(std::move(entry.name), Record{
+                    .value = std::move(entry.value),
+                    .version = entry.version,
+                    .expiresAt = entry.expiresAt ?
+                        std::optional(ExpiryFromMsec(*entry.expiresAt)) : std::nullopt,
+                });
+                break;
+            case WriteLog::Entry::Op::Delete:
+                this->keys.erase(entry.name);
+                break;
+            case WriteLog::Entry::Op::DeleteSubkeys: {
+                const auto prefix = entry.name + ".";
+                auto it = this->keys.lower_bound(prefix);
+                while(it != this->keys.end() && it->first.starts_with(prefix)) {
+                    it = this->keys.erase(it);
+                }
+                break;
+            }
+        }
+    });
+
+    PLOG_DEBUG << "restored " << this->keys.size() << " key(s)";
+}
+
+/**
+ * @brief Close the backend
+ *
+ * If there is a write log, a fresh snapshot is left behind, so the next startup doesn't need to
+ * replay the log.
+ */
+MemoryBackend::~MemoryBackend() {
+    if(!this->log) {
+        return;
+    }
+
+    try {
+        this->compactLog();
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to write snapshot: " << e.what();
+    }
+}
+
+/**
+ * @brief Get the backend's performance counters
+ *
+ * Only the size of the write log and snapshot is reported.
+ */
+StorageBackend::Counters MemoryBackend::getCounters() {
+    return {
+        .diskSize = this->log ? this->log->getDiskSize() : 0,
+    };
+}
+
+/**
+ * @brief Make the keys durable
+ *
+ * Syncs the write log to disk; if it has grown large enough, it's compacted into a new snapshot
+ * instead. Without a write log, this does nothing.
+ */
+void MemoryBackend::checkpoint() {
+    if(!this->log) {
+        return;
+    }
+
+    if(this->logNeedsCompaction || this->log->needsCompaction()) {
+        this->compactLog();
+    } else {
+        this->log->sync();
+    }
+}
+
+/**
+ * @brief Write all keys to a new snapshot, and clear the write log
+ */
+void MemoryBackend::compactLog() {
+    std::vector<WriteLog::Entry> entries;
+    entries.reserve(this->keys.size());
+
+    for(const auto &[name, record] : this->keys) {
+        entries.push_back(MakeSetEntry(name, record));
+    }
+
+    this->log->compact(entries);
+    this->logNeedsCompaction = false;
+
+    PLOG_DEBUG << "wrote snapshot of " << entries.size() << " key(s)";
+}
+
+
+
+/**
+ * @brief Start a transaction
+ *
+ * @throw std::logic_error A transaction is already in progress
+ */
+void MemoryBackend::begin() {
+    if(this->inTransaction) {
+        throw std::logic_error("transaction already in progress");
+    }
+
+    this->inTransaction = true;
+}
+
+/**
+ * @brief Commit the current transaction
+ *
+ * All changes made in the transaction are appended to the write log (if any) as a single record.
+ * If that fails, the transaction remains open, so it can be rolled back; it's only reported as
+ * committed once it's been appended.
+ */
+void MemoryBackend::commit() {
+    if(!this->inTransaction) {
+        throw std::logic_error("no transaction in progress");
+    }
+
+    if(this->log && !this->pending.empty()) {
+        try {
+            this->log->append(this->pending);
+        } catch(const std::exception &) {
+            // the log may be left with a partial record, after which nothing can be appended
+            this->logNeedsCompaction = true;
+            throw;
+        }
+    }
+
+    // like sqlite's commit hook, only transactions that changed something are reported
+    const bool changed = !this->undo.empty();
+
+    this->undo.clear();
+    this->pending.clear();
+    this->inTransaction = false;
+
+    if(changed) {
+        this->notifyTransaction(true);
+    }
+}
+
+/**
+ * @brief Roll back the current transaction
+ *
+ * All keys changed in the transaction are restored to their state before it.
+ */
+void MemoryBackend::rollback() {
+    if(!this->inTransaction) {
+        throw std::logic_error("no transaction in progress");
+    }
+
+    for(auto &[name, record] : this->undo) {
+        if(record) {
+            this->keys.insert_or_assign(name, std::move(*record));
+        } else {
+            this->keys.erase(name);
+        }
+    }
+
+    this->undo.clear();
+    this->pending.clear();
+    this->inTransaction = false;
+
+    this->notifyTransaction(false);
+}
+
+/**
+ * @brief Remember a key's state before the current transaction changed it
+ *
+ * Only the first change to each key in a transaction is remembered.
+ */
+void MemoryBackend::saveUndo(const std::string_view &name) {
+    if(this->undo.contains(name)) {
+        return;
+    }
+
+    const auto it = this->keys.find(name);
+    this->undo.emplace(name, (it != this->keys.end()) ? std::optional(it->second) : std::nullopt);
+}
+
+/**
+ * @brief Set or remove a key, as part of the current transaction
+ *
+ * @param name Name of the key to change
+ * @param record New record of the key, or nothing to remove it
+ */
+void MemoryBackend::write(const std::string_view &name, std::optional<Record> &&record) {
+    this->saveUndo(name);
+
+    if(record) {
+        auto it = this->keys.insert_or_assign(std::string(name), std::move(*record)).first;
+        if(this->log) {
+            this->pending.push_back(MakeSetEntry(it->first, it->second));
+        }
+    } else {
+        this->keys.erase(this->keys.find(name));
+        if(this->log) {
+            this->pending.push_back({
+                .op = WriteLog::Entry::Op::Delete,
+                .name = std::string(name),
+            });
+        }
+    }
+}
+
+
+
+/**
+ * @brief Get a key's record
+ */
+std::optional<StorageBackend::Record> MemoryBackend::get(const std::string_view &name) {
+    const auto it = this->keys.find(name);
+    if(it == this->keys.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+/**
+ * @brief Get keys in name order
+ */
+void MemoryBackend::scan(const std::string_view &after, const size_t limit,
+        const ScanCallback &visit) {
+    auto it = this->keys.upper_bound(after);
+    for(size_t i = 0; it != this->keys.end() && i < limit; ++it, ++i) {
+        visit(std::string(it->first), Record(it->second));
+    }
+}
+
+/**
+ * @brief Check whether the given key has any children
+ */
+bool MemoryBackend::hasChildren(const std::string_view &name) {
+    const auto prefix = fmt::format("{}.", name);
+    const auto it = this->keys.lower_bound(prefix);
+
+    return it != this->keys.end() && it->first.starts_with(prefix);
+}
+
+/**
+ * @brief Get all keys with an expiration time
+ *
+ * There is no index of expiring keys, so this needs to visit all keys; it's only used when opening
+ * the data store.
+ */
+std::vector<std::pair<std::string, StorageBackend::ExpiryTime>> MemoryBackend::getExpiring() {
+    std::vector<std::pair<std::string, ExpiryTime>> expiring;
+
+    for(const auto &[name, record] : this->keys) {
+        if(record.expiresAt) {
+            expiring.emplace_back(name, *record.expiresAt);
+        }
+    }
+
+    return expiring;
+}
+
+
+
+/**
+ * @brief Read and modify a key
+ *
+ * The callback operates on a copy of the key's record, which replaces it if the callback returns
+ * true; so if it throws, the key is left unchanged.
+ */
+void MemoryBackend::update(const std::string_view &name, const UpdateCallback &callback) {
+    const auto it = this->keys.find(name);
+    const bool exists = (it != this->keys.end());
+
+    std::optional<Record> record;
+    if(exists) {
+        record = it->second;
+    }
+
+    if(!callback(record) || (!exists && !record)) {
+        return;
+    }
+
+    std::optional<Transaction> txn;
+    if(!this->inTransaction) {
+        txn.emplace(*this);
+    }
+
+    this->write(name, std::move(record));
+
+    if(txn) {
+        txn->commit();
+    }
+}
+
+/**
+ * @brief Remove a key
+ *
+ * @return Number of keys removed (0 or 1)
+ */
+size_t MemoryBackend::remove(const std::string_view &name) {
+    if(!this->keys.contains(name)) {
+        return 0;
+    }
+
+    std::optional<Transaction> txn;
+    if(!this->inTransaction) {
+        txn.emplace(*this);
+    }
+
+    this->write(name, std::nullopt);
+
+    if(txn) {
+        txn->commit();
+    }
+    return 1;
+}
+
+/**
+ * @brief Remove all children of a key
+ *
+ * This is logged as a single change, rather than removing each of the keys individually.
+ *
+ * @return Number of keys removed
+ */
+size_t MemoryBackend::removeChildren(const std::string_view &name) {
+    const auto prefix = fmt::format("{}.", name);
+
+    auto it = this->keys.lower_bound(prefix);
+    if(it == this->keys.end() || !it->first.starts_with(prefix)) {
+        return 0;
+    }
+
+    std::optional<Transaction> txn;
+    if(!this->inTransaction) {
+        txn.emplace(*this);
+    }
+
+    size_t removed{0};
+    while(it != this->keys.end() && it->first.starts_with(prefix)) {
+        this->saveUndo(it->first);
+        it = this->keys.erase(it);
+        removed++;
+    }
+
+    if(this->log) {
+        this->pending.push_back({
+            .op = WriteLog::Entry::Op::DeleteSubkeys,
+            .name = std::string(name),
+        });
+    }
+
+    if(txn) {
+        txn->commit();
+    }
+    return removed;
+}
+
+/**
+ * @brief Remove a key, if it has an expiration time
+ */
+bool MemoryBackend::removeExpiring(const std::string_view &name) {
+    const auto it = this->keys.find(name);
+    if(it == this->keys.end() || !it->second.expiresAt) {
+        return false;
+    }
+
+    return this->remove(name) != 0;
+}
@@ -0,0 +1,110 @@
+#ifndef MEMORYBACKEND_H
+#define MEMORYBACKEND_H
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "StorageBackend.h"
+#include "WriteLog.h"
+
+/**
+ * @brief Storage backend holding all keys in memory
+ *
+ * Keys are held in an ordered map. By itself, nothing is persisted, and all keys are lost when the
+ * backend is destroyed: this is used for volatile keys, and for tests and benchmarks that should
+ * not be affected by disk I/O.
+ *
+ * Optionally, changes can be persisted with a WriteLog: each committed transaction is appended to
+ * the log as a single record, and all keys are restored from the log when it's opened again. In
+ * that case, checkpoint() must be called periodically to sync and compact the log.
+ *
+ * Transactions are implemented by remembering the state of each key before it's first changed in
+ * the transaction, which is restored if the transaction is rolled back.
+ */
+class MemoryBackend: public StorageBackend {
+    public:
+        MemoryBackend() = default;
+        MemoryBackend(const std::filesystem::path &path, const WriteLog::Options &options);
+        ~MemoryBackend() override;
+
+        const char *getName() const override {
+            return this->log ? "memory" : "transient";
+        }
+        Counters getCounters() override;
+        /// Commits are reported once they've been appended to the write log
+        bool commitHookAfterWrite() const override {
+            return true;
+        }
+
+        /// Get the number of keys
+        size_t size() const {
+            return this->keys.size();
+        }
+
+        void begin() override;
+        void commit() override;
+        void rollback() override;
+
+        std::optional<Record> get(const std::string_view &name) override;
+        void scan(const std::string_view &after, const size_t limit,
+                const ScanCallback &visit) override;
+        bool hasChildren(const std::string_view &name) override;
+        std::vector<std::pair<std::string, ExpiryTime>> getExpiring() override;
+
+        void update(const std::string_view &name, const UpdateCallback &callback) override;
+        /// Keys don't have a "last modified" timestamp, so this does nothing
+        void touch(const std::string_view &) override {}
+        size_t remove(const std::string_view &name) override;
+        size_t removeChildren(const std::string_view &name) override;
+        bool removeExpiring(const std::string_view &name) override;
+
+        void checkpoint() override;
+
+    private:
+        /// Map of key names to their records
+        using KeyMap = std::map<std::string, Record, std::less<>>;
+
+        void saveUndo(const std::string_view &name);
+        void write(const std::string_view &name, std::optional<Record> &&record);
+        void compactLog();
+
+        /// Create a write log entry setting a key to the given record
+        static WriteLog::Entry MakeSetEntry(const std::string &name, const Record &record) {
+            return {
+                .op = WriteLog::Entry::Op::Set,
+                .name = name,
+                .value = record.value,
+                .version = record.version,
+                .expiresAt = record.expiresAt ? std::optional(ExpiryToMsec(*record.expiresAt)) :
+                    std::nullopt,
+            };
+        }
+
+    private:
+        /// Lock held on the write log, to exclude other processes (if there is a log)
+        std::unique_ptr<FileLock> fileLock;
+
+        /// All keys and their records
+        KeyMap keys;
+
+        /// Whether a transaction is in progress
+        bool inTransaction{false};
+        /// State of each key changed in the current transaction before its first change
+        std::map<std::string, std::optional<Record>, std::less<>> undo;
+        /// Changes made in the current transaction, to append to the write log
+        std::vector<WriteLog::Entry> pending;
+
+        /// Write log persisting the keys (if any)
+        std::unique_ptr<WriteLog> log;
+        /// Set when a change couldn't be logged; the next checkpoint then writes a full snapshot
+        bool logNeedsCompaction{false};
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -11,6 +12,7 @@
 #include <atomic>
 #include <cerrno>
 #include <cstring>
+#include <optional>
 #include <type_traits>
 #include <system_error>
 
@@ -18,6 +20,7 @@
 #include <plog/Log.h>
 #include <rpc/types.h>
 
+#include "Capture.h"
 #include "Config.h"
 #include "DataStore.h"
 #include "RpcServer.h"
@@ -107,6 +110,9 @@ void RpcServer::initEventLoop() {
     this->initWatchdogEvent();
     this->initSignalEvents();
     this->initSocketEvent();
+    this->initExpiryEvent();
+    this->initFlushEvent();
+    this->initCheckpointEvent();
 }
 
 /**
@@ -145,11 +151,14 @@ void RpcServer::initWatchdogEvent() {
  * @brief Create termination signal events
  *
  * Create an event that watches for POSIX signals that indicate we should restart: specifically,
- * this is SIGINT, SIGTERM, and SIGHUP.
+ * this is SIGINT, SIGTERM, and SIGHUP. SIGPIPE is ignored.
  */
 void RpcServer::initSignalEvents() {
     size_t i{0};
 
+    // writing to a client that has gone away should fail with EPIPE, rather than kill us
+    signal(SIGPIPE, SIG_IGN);
+
     for(const auto signum : kEvents) {
         auto ev = evsignal_new(this->evbase, signum, [](auto fd, auto what, auto ctx) {
             reinterpret_cast<RpcServer *>(ctx)->handleTermination();
@@ -184,6 +193,106 @@ void RpcServer::initSocketEvent() {
     event_add(this->listenEvent, nullptr);
 }
 
+/**
+ * @brief Initialize key expiration
+ *
+ * Create the timer event that drives the expiration timer wheel, and schedule all keys in the
+ * data store that have an expiration time. Keys whose time has already passed (say, because the
+ * daemon wasn't running) expire on the first tick.
+ */
+void RpcServer::initExpiryEvent() {
+    this->expiryEvent = event_new(this->evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
+        reinterpret_cast<RpcServer *>(ctx)->handleExpiryTick();
+    }, this);
+    if(!this->expiryEvent) {
+        throw std::runtime_error("failed to allocate expiry event");
+    }
+
+    const auto keys = this->store->getExpiringKeys();
+    const auto now = std::chrono::system_clock::now();
+    const auto steadyNow = TimerWheel::Clock::now();
+
+    for(const auto &[name, expiresAt] : keys) {
+        this->expiryWheel.schedule(name, steadyNow + std::max(expiresAt - now,
+                    std::chrono::system_clock::duration::zero()));
+    }
+    if(!keys.empty()) {
+        PLOG_DEBUG << "scheduled " << keys.size() << " key(s) for expiration";
+    }
+
+    this->updateExpiryEvent();
+}
+
+/**
+ * @brief Initialize flushing of debounced writes
+ *
+ * Create the timer event used to write debounced keys to the data store once they've stopped
+ * changing. It's only armed while writes are pending.
+ */
+void RpcServer::initFlushEvent() {
+    this->flushEvent = evtimer_new(this->evbase, [](auto, auto, auto ctx) {
+        reinterpret_cast<RpcServer *>(ctx)->handleFlushTimer();
+    }, this);
+    if(!this->flushEvent) {
+        throw std::runtime_error("failed to allocate flush event");
+    }
+}
+
+/**
+ * @brief Initialize periodic checkpoints
+ *
+ * With the in-memory storage backend, the data store's write log is synced (and compacted, if
+ * needed) periodically. Nothing is done for other backends.
+ */
+void RpcServer::initCheckpointEvent() {
+    if(Config::GetStorageBackend() != Config::StorageBackendType::Memory) {
+        return;
+    }
+
+    this->checkpointEvent = event_new(this->evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
+        reinterpret_cast<RpcServer *>(ctx)->handleCheckpointTimer();
+    }, this);
+    if(!this->checkpointEvent) {
+        throw std::runtime_error("failed to allocate checkpoint event");
+    }
+
+    struct timeval tv{
+        .tv_sec  = static_cast<time_t>(Config::GetMemoryCheckpointInterval().count()),
+        .tv_usec = 0,
+    };
+    evtimer_add(this->checkpointEvent, &tv);
+}
+
+/**
+ * @brief Set up traffic capturing
+ *
+ * If a capture file has been configured, open it; all requests will then be recorded to it.
+ */
+void RpcServer::initCapture() {
+    const auto &path = Config::GetRpcCapturePath();
+    if(path.empty()) {
+        return;
+    }
+
+    this->capture = std::make_unique<CaptureWriter>(path);
+}
+
+/**
+ * @brief Set up the data store's encoded value cache
+ *
+ * If enabled, values are cached in the encoding used in query replies, so they can be copied into
+ * replies as is.
+ */
+void RpcServer::initValueCache() {
+    const auto maxBytes = Config::GetStorageValueCacheSize();
+    if(!maxBytes) {
+        return;
+    }
+
+    this->store->setValueCache(maxBytes, SerializeValue);
+    this->useValueCache = true;
+}
+
 /**
  * @brief Shut down the RPC server
  *
@@ -219,6 +328,15 @@ RpcServer::~RpcServer() {
     if(this->watchdogEvent) {
         event_free(this->watchdogEvent);
     }
+    if(this->expiryEvent) {
+        event_free(this->expiryEvent);
+    }
+    if(this->flushEvent) {
+        event_free(this->flushEvent);
+    }
+    if(this->checkpointEvent) {
+        event_free(this->checkpointEvent);
+    }
 
     // shut down event loop
     event_base_free(this->evbase);
@@ -259,6 +377,7 @@ void RpcServer::acceptClient() {
 
     // set up our bookkeeping for it and add it to event loop
     auto cl = std::make_shared<Client>(this, fd);
+    cl->id = static_cast<uint32_t>(++this->numClientsAccepted);
     this->clients.emplace(cl->event, std::move(cl));
 
     PLOG_DEBUG << "Accepted client " << fd << " (" << this->clients.size() << " total)";
@@ -267,47 +386,63 @@ void RpcServer::acceptClient() {
 /**
  * @brief A client connection is ready to read
  *
- * Reads data from the given client connection.
+ * Processes all complete messages received from the given client connection. Large messages may
+ * arrive over multiple reads: a partial message is left in the input buffer until all of it has
+ * been received.
  */
 void RpcServer::handleClientRead(struct bufferevent *ev) {
     // get client struct
-    auto &client = this->clients.at(ev);
-
-    // read client data
-    /**
-     * TODO: rework this so data is buffered over time in the client receive buffer, rather than
-     * being overwritten each time, in case clients decide to do partial writes down the line!
-     */
+    auto client = this->clients.at(ev);
     auto buf = bufferevent_get_input(ev);
-    const size_t pending = evbuffer_get_length(buf);
 
-    client->receiveBuf.resize(pending);
-    int read = evbuffer_remove(buf, static_cast<void *>(client->receiveBuf.data()), pending);
+    while(evbuffer_get_length(buf) >= sizeof(struct rpc_header)) {
+        // peek at the header to determine how long the message is
+        struct rpc_header peekHdr;
+        if(evbuffer_copyout(buf, &peekHdr, sizeof(peekHdr)) != sizeof(peekHdr)) {
+            throw std::runtime_error("failed to read message header from client");
+        }
+
+        if(peekHdr.version != kRpcVersionLatest) {
+            throw std::runtime_error(fmt::format("unsupported rpc version ${:04x}",
+                        static_cast<uint16_t>(peekHdr.version)));
+        } else if(peekHdr.length < sizeof(struct rpc_header)) {
+            throw std::runtime_error(fmt::format("invalid header length ({}, too short)",
+                        static_cast<uint16_t>(peekHdr.length)));
+        }
 
-    if(read == -1) {
-        throw std::runtime_error("failed to drain client read buffer");
-    }
+        if(evbuffer_get_length(buf) < peekHdr.length) {
+            break;
+        }
 
-    // read the header
-    if(read < sizeof(struct rpc_header)) {
-        // we haven't yet read enough bytes; this should never happen, so abort
-        throw std::runtime_error(fmt::format("read too few bytes ({}) from client", read));
+        this->handleClientMessage(client, buf, peekHdr.length);
     }
+}
 
-    const auto hdr = reinterpret_cast<const struct rpc_header *>(client->receiveBuf.data());
+/**
+ * @brief Process a message received from a client
+ *
+ * Removes the message from the client's input buffer, decodes it and invokes the handler of the
+ * endpoint it's addressed to.
+ *
+ * @param client Client connection the message was received on
+ * @param buf Input buffer of the client connection, starting with the message
+ * @param length Total length of the message, including its header
+ */
+void RpcServer::handleClientMessage(std::shared_ptr<Client> &client, struct evbuffer *buf,
+        const size_t length) {
+    // read exactly one message
+    this->curRequest = {};
+    this->curRequest.received = Clock::now();
+
+    client->receiveBuf.resize(length);
+    int read = evbuffer_remove(buf, static_cast<void *>(client->receiveBuf.data()), length);
 
-    if(hdr->version != kRpcVersionLatest) {
-        throw std::runtime_error(fmt::format("unsupported rpc version ${:04x}", hdr->version));
-    } else if(hdr->length < sizeof(struct rpc_header)) {
-        throw std::runtime_error(fmt::format("invalid header length ({}, too short)",
-                    hdr->length));
+    if(read != static_cast<int>(length)) {
+        throw std::runtime_error("failed to drain client read buffer");
     }
 
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(client->receiveBuf.data());
     const auto payloadLen = hdr->length - sizeof(struct rpc_header);
-    if(payloadLen > client->receiveBuf.size()) {
-        throw std::runtime_error(fmt::format("invalid header length ({}, too long)",
-                    hdr->length));
-    }
 
     // decode as CBOR, if desired
     struct cbor_load_result result{};
@@ -319,26 +454,148 @@ void RpcServer::handleClientRead(struct bufferevent *ev) {
                     result.error.position));
     }
 
+    this->curRequest.parsed = Clock::now();
+    this->curRequest.client = client->id;
+    this->curRequest.endpoint = hdr->endpoint;
+    this->curRequest.tag = hdr->tag;
+
     // invoke endpoint handler
+    const auto endpoint = hdr->endpoint;
+
     try {
-        switch(hdr->endpoint) {
+        switch(endpoint) {
             case kConfigQuery:
                 this->doCfgQuery(client->receiveBuf, item, client);
                 break;
             case kConfigUpdate:
                 this->doCfgUpdate(client->receiveBuf, item, client);
                 break;
+            case kConfigDelete:
+                this->doCfgDelete(client->receiveBuf, item, client);
+                break;
+            case kConfigBatchUpdate:
+                this->doCfgBatchUpdate(client->receiveBuf, item, client);
+                break;
+            case kConfigExport:
+                this->doCfgExport(client->receiveBuf, item, client);
+                break;
+            case kConfigCompareAndSwap:
+                this->doCfgCompareAndSwap(client->receiveBuf, item, client);
+                break;
+            case kConfigIntegerOp:
+                this->doCfgIntegerOp(client->receiveBuf, item, client);
+                break;
+            case kConfigStats:
+                this->doStats(client->receiveBuf, client);
+                break;
+            case kConfigTrace:
+                this->doTrace(client->receiveBuf, client);
+                break;
 
             default:
-                throw std::runtime_error(fmt::format("unknown rpc endpoint ${:02x}", hdr->endpoint));
+                throw std::runtime_error(fmt::format("unknown rpc endpoint ${:02x}", endpoint));
         }
     } catch(const std::exception &e) {
         cbor_decref(&item);
+        this->recordRequest(endpoint, false);
+        this->captureRequest(client, {client->receiveBuf.data(), hdr->length}, false);
         throw;
     }
 
     // clean up
     cbor_decref(&item);
+    this->recordRequest(endpoint, true);
+    this->captureRequest(client, {client->receiveBuf.data(), hdr->length}, true);
+}
+
+/**
+ * @brief Update the statistics for a completed request
+ *
+ * Use the timestamps collected while processing the request to update the latency histograms of
+ * the endpoint it was sent to. The request's trace is then added to the trace ring, and logged if
+ * the request took longer than the slow request threshold.
+ *
+ * @param endpoint Endpoint the request was made to
+ * @param success Whether the request was processed successfully
+ */
+void RpcServer::recordRequest(const uint8_t endpoint, const bool success) {
+    auto &ts = this->curRequest;
+    ts.completed = Clock::now();
+    ts.success = success;
+
+    auto &stats = this->endpointStats[endpoint];
+    stats.requests++;
+
+    if(!success) {
+        stats.errors++;
+    } else {
+        stats.parse.record(ts.parsed - ts.received);
+        stats.total.record(ts.completed - ts.received);
+
+        // endpoints that don't touch the data store won't have store timestamps
+        if(ts.storeEnd != Clock::time_point{}) {
+            stats.store.record(ts.storeEnd - ts.storeBegin);
+        }
+        if(ts.encoded != Clock::time_point{}) {
+            stats.encode.record(ts.encoded - std::max(ts.storeEnd, ts.parsed));
+        }
+    }
+
+    // save the trace
+    this->traceRing[this->traceRingWrites++ % kTraceRingSize] = ts;
+
+    const auto threshold = Config::GetRpcSlowThreshold();
+    if(threshold.count() && (ts.completed - ts.received) >= threshold) {
+        this->logSlowRequest(ts);
+    }
+}
+
+/**
+ * @brief Get the duration of a request processing phase, in µs
+ *
+ * @return Time between the two timestamps, or 0 if either of them wasn't recorded
+ */
+static double PhaseDuration(const std::chrono::steady_clock::time_point start,
+        const std::chrono::steady_clock::time_point end) {
+    if(start == std::chrono::steady_clock::time_point{} ||
+            end == std::chrono::steady_clock::time_point{}) {
+        return 0;
+    }
+
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * @brief Log the trace of a slow request
+ */
+void RpcServer::logSlowRequest(const RequestTrace &trace) {
+    PLOG_WARNING << fmt::format("slow request: client {} {} (tag ${:02x}) key '{}'{}: total {:.1f}"
+            " µs (parse {:.1f}, lock wait {:.1f}, store {:.1f}, encode {:.1f})", trace.client,
+            EndpointName(trace.endpoint), trace.tag, trace.getKey(),
+            trace.success ? "" : " (failed)", PhaseDuration(trace.received, trace.completed),
+            PhaseDuration(trace.received, trace.parsed),
+            std::chrono::duration<double, std::micro>(trace.lockWait).count(),
+            PhaseDuration(trace.storeBegin, trace.storeEnd),
+            PhaseDuration(std::max(trace.storeEnd, trace.parsed), trace.encoded));
+}
+
+/**
+ * @brief Record a request to the capture file
+ *
+ * Does nothing if capturing is disabled.
+ *
+ * @param client Client that sent the request
+ * @param frame Request frame, including its header
+ * @param success Whether the request was processed successfully
+ */
+void RpcServer::captureRequest(const std::shared_ptr<Client> &client,
+        std::span<const std::byte> frame, const bool success) {
+    if(!this->capture) {
+        return;
+    }
+
+    this->capture->recordFrame(client->id, this->curRequest.received,
+            this->curRequest.completed - this->curRequest.received, frame, !success);
 }
 
 /**
@@ -360,6 +617,10 @@ void RpcServer::handleClientEvent(struct bufferevent *ev, const size_t flags) {
     }
 
     // in either case, remove the client struct
+    if(this->capture) {
+        this->capture->recordClose(client->id);
+    }
+
     this->clients.erase(ev);
 }
 
@@ -370,6 +631,13 @@ void RpcServer::handleClientEvent(struct bufferevent *ev, const size_t flags) {
  * response to an error of some sort.
  */
 void RpcServer::abortClient(struct bufferevent *ev) {
+    if(this->capture) {
+        auto it = this->clients.find(ev);
+        if(it != this->clients.end()) {
+            this->capture->recordClose(it->second->id);
+        }
+    }
+
     this->clients.erase(ev);
 }
 
@@ -437,6 +705,159 @@ std::string RpcServer::ExtractKeyName(struct cbor_item_t *item) {
 }
 
 
+/**
+ * @brief Decode a key value from a request
+ *
+ * Values may be UTF-8 strings, byte strings (blobs), unsigned integers, floating point values,
+ * booleans or null.
+ *
+ * @param item CBOR item holding the value
+ *
+ * @return The decoded value
+ */
+PropertyValue RpcServer::DecodeValue(struct cbor_item_t *item) {
+    PropertyValue value;
+
+    // figure out its type
+    if(cbor_isa_string(item)) { // UTF-8 string
+        if(!cbor_string_is_definite(item)) {
+            throw std::runtime_error("indefinite strings not supported");
+        }
+        // strings aren't zero terminated, so copy exactly as many bytes as were sent
+        value = std::string(reinterpret_cast<const char *>(cbor_string_handle(item)),
+                cbor_string_length(item));
+    } else if(cbor_isa_bytestring(item)) { // blob
+        // reject indefinite blobs
+        if(!cbor_bytestring_is_definite(item)) {
+            throw std::runtime_error("indefinite bytestrings not supported");
+        }
+
+        const auto blobNumBytes = cbor_bytestring_length(item);
+        const auto blobData = cbor_bytestring_handle(item);
+
+        // copy the blob out
+        std::vector<std::byte> buf;
+        buf.resize(blobNumBytes);
+
+        memcpy(buf.data(), blobData, blobNumBytes);
+        value = buf;
+    } else if(cbor_isa_uint(item)) { // unsigned integer
+        uint64_t temp;
+        switch(cbor_int_get_width(item)) {
+            case CBOR_INT_8:
+                temp = cbor_get_uint8(item);
+                break;
+            case CBOR_INT_16:
+                temp = cbor_get_uint16(item);
+                break;
+            case CBOR_INT_32:
+                temp = cbor_get_uint32(item);
+                break;
+            case CBOR_INT_64:
+                temp = cbor_get_uint64(item);
+                break;
+        }
+        value = temp;
+    } else if(cbor_isa_float_ctrl(item)) { // float, bool or null
+        // a bool or null?
+        if(cbor_float_ctrl_is_ctrl(item)) {
+            if(cbor_is_null(item)) {
+                value = nullptr;
+            } else {
+                value = cbor_get_bool(item);
+            }
+        }
+        // a float value: read it out as a double
+        else {
+            value = cbor_float_get_float(item);
+        }
+    } else {
+        throw std::invalid_argument(fmt::format("invalid value type {}",
+                    cbor_typeof(item)));
+    }
+
+    return value;
+}
+
+/**
+ * @brief Encode a key value for a reply
+ *
+ * @param value Value to encode
+ * @param flags Flags to modify the encoding (only `SinglePrecisionFloat` applies)
+ *
+ * @return CBOR item holding the value, or `nullptr` if there is no value
+ */
+struct cbor_item_t *RpcServer::EncodeValue(const PropertyValue &value, const Flags flags) {
+    return std::visit([&](auto&& arg) -> cbor_item_t * {
+        using T = std::decay_t<decltype(arg)>;
+
+        // null value
+        if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return cbor_new_null();
+        }
+        // UTF-8 string
+        else if constexpr (std::is_same_v<T, std::string>) {
+            return cbor_build_string(arg.c_str());
+        }
+        // byte vector (BLOB)
+        else if constexpr (std::is_same_v<T, Blob>) {
+            return cbor_build_bytestring(reinterpret_cast<cbor_data>(arg.data()), arg.size());
+        }
+        // integer
+        else if constexpr (std::is_same_v<T, uint64_t>) {
+            return cbor_build_uint64(arg);
+        }
+        // double (or float if requested)
+        else if constexpr (std::is_same_v<T, double>) {
+            return (flags & Flags::SinglePrecisionFloat) ? cbor_build_float4(arg) :
+                cbor_build_float8(arg);
+        }
+        // boolean
+        else if constexpr (std::is_same_v<T, bool>) {
+            return cbor_build_bool(arg);
+        }
+        // no value
+        else {
+            return nullptr;
+        }
+    }, value);
+}
+
+/**
+ * @brief Encode a key value, and serialize it
+ *
+ * This produces the same bytes as the value's item in a reply, without any flags applied.
+ *
+ * @param value Value to encode
+ *
+ * @return Serialized CBOR item holding the value
+ *
+ * @throw std::runtime_error The value can't be encoded
+ */
+std::vector<std::byte> RpcServer::SerializeValue(const PropertyValue &value) {
+    auto item = EncodeValue(value);
+    if(!item) {
+        throw std::runtime_error("failed to encode value");
+    }
+
+    size_t bufLen;
+    unsigned char *buf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(item, &buf, &bufLen);
+    cbor_decref(&item);
+
+    if(!serializedBytes) {
+        free(buf);
+        throw std::runtime_error("failed to serialize value");
+    }
+
+    const auto start = reinterpret_cast<const std::byte *>(buf);
+    std::vector<std::byte> data(start, start + serializedBytes);
+    free(buf);
+
+    return data;
+}
+
+
 /**
  * @brief Process a query request to the config endpoint
  *
@@ -458,6 +879,7 @@ void RpcServer::doCfgQuery(std::span<const std::byte> packet, cbor_item_t *item,
     if(keyName.empty()) {
         throw std::runtime_error("failed to get key name (wtf)");
     }
+    this->traceKey(keyName);
 
     // get operation flags
     Flags flags{Flags::None};
@@ -466,10 +888,30 @@ void RpcServer::doCfgQuery(std::span<const std::byte> packet, cbor_item_t *item,
     // TODO: validate access
     PLOG_VERBOSE << fmt::format("key name = '{}' flags = {:04x}", keyName,
             static_cast<uintptr_t>(flags));
-    auto result = this->store->getKey(keyName);
-
+    uint64_t version{0};
     const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
-    this->sendKeyValue(hdr, client, keyName, result, flags);
+
+    // the cache holds values as encoded without any flags
+    if(this->useValueCache && !(flags & Flags::SinglePrecisionFloat)) {
+        this->curRequest.storeBegin = Clock::now();
+        const auto encoded = this->store->getKeyEncoded(keyName);
+        this->curRequest.storeEnd = Clock::now();
+        this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+        if(encoded) {
+            this->sendEncodedKeyValue(hdr, client, keyName, encoded);
+        } else {
+            this->sendKeyValue(hdr, client, keyName, std::monostate(), flags);
+        }
+        return;
+    }
+
+    this->curRequest.storeBegin = Clock::now();
+    auto result = this->store->getKey(keyName, &version);
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+    this->sendKeyValue(hdr, client, keyName, result, flags, version);
 }
 
 /**
@@ -520,80 +962,41 @@ void RpcServer::getCfgQueryFlags(struct cbor_item_t *item, Flags &outFlags) {
  * @param key Key name that was queried
  * @param value Value of the key
  * @param flags Flags to modify the behavior of the routine
+ * @param version Version of the key, if nonzero
  */
 void RpcServer::sendKeyValue(const struct rpc_header *hdr, const std::shared_ptr<Client> &client,
-        const std::string &key, const PropertyValue &value, const Flags flags) {
+        const std::string &key, const PropertyValue &value, const Flags flags,
+        const uint64_t version) {
     bool hasValue;
     const bool found = !std::holds_alternative<std::monostate>(value);
     const bool outputValue = !(flags & Flags::ExcludeValue);
 
     // set up the generic part of the response
-    cbor_item_t *root = cbor_new_definite_map((found ? 3 : 2) - (outputValue ? 0 : 1));
+    cbor_item_t *root = cbor_new_definite_map((found ? 3 : 2) - (outputValue ? 0 : 1) +
+            (version ? 1 : 0));
     cbor_map_add(root, (struct cbor_pair) {
         .key = cbor_move(cbor_build_string("key")),
         .value = cbor_move(cbor_build_string(key.c_str()))
     });
 
+    if(version) {
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("version")),
+            .value = cbor_move(cbor_build_uint64(version))
+        });
+    }
+
     // add the current value (if any)
     if(outputValue) {
-        std::visit([&](auto&& arg) {
-            using T = std::decay_t<decltype(arg)>;
-
-            // null value
-            if constexpr (std::is_same_v<T, std::nullptr_t>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move(cbor_new_null())
-                });
-                hasValue = true;
-            }
-            // UTF-8 string
-            else if constexpr (std::is_same_v<T, std::string>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move(cbor_build_string(arg.c_str()))
-                });
-                hasValue = true;
-            }
-            // byte vector (BLOB)
-            else if constexpr (std::is_same_v<T, Blob>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move(cbor_build_bytestring(reinterpret_cast<cbor_data>(arg.data()),
-                                arg.size()))
-                });
-                hasValue = true;
-            }
-            // integer
-            else if constexpr (std::is_same_v<T, uint64_t>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move(cbor_build_uint64(arg))
-                });
-                hasValue = true;
-            }
-            // double (or float if requested)
-            else if constexpr (std::is_same_v<T, double>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move((flags & Flags::SinglePrecisionFloat) ? cbor_build_float4(arg) :
-                            cbor_build_float8(arg))
-                });
-                hasValue = true;
-            }
-            // boolean
-            else if constexpr (std::is_same_v<T, bool>) {
-                cbor_map_add(root, (struct cbor_pair) {
-                    .key = cbor_move(cbor_build_string("value")),
-                    .value = cbor_move(cbor_build_bool(arg))
-                });
-                hasValue = true;
-            }
-            // no value
-            else if constexpr (std::is_same_v<T, std::monostate>) {
-                hasValue = false;
-            }
-        }, value);
+        auto item = EncodeValue(value, flags);
+        hasValue = (item != nullptr);
+
+        if(item) {
+            cbor_map_add(root, (struct cbor_pair) {
+                .key = cbor_move(cbor_build_string("value")),
+                .value = cbor_move(item)
+            });
+        }
     } else {
         hasValue = !std::holds_alternative<std::monostate>(value);
     }
@@ -609,6 +1012,8 @@ void RpcServer::sendKeyValue(const struct rpc_header *hdr, const std::shared_ptr
     const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
     cbor_decref(&root);
 
+    this->curRequest.encoded = Clock::now();
+
     // send it as a reply (ensuring we don't leak the above buffer… this sucks lol)
     try {
         client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
@@ -619,6 +1024,59 @@ void RpcServer::sendKeyValue(const struct rpc_header *hdr, const std::shared_ptr
     }
 }
 
+/**
+ * @brief Send the already encoded value of a key
+ *
+ * Produces the same reply as sendKeyValue() for a key that was found, but only the surrounding map
+ * is encoded: the encoded value is added to the reply as is, without copying it.
+ *
+ * @param hdr Message to send this as a reply to
+ * @param client Client connection to send the response to
+ * @param key Key name that was queried
+ * @param value Encoded value and version of the key
+ */
+void RpcServer::sendEncodedKeyValue(const struct rpc_header *hdr,
+        const std::shared_ptr<Client> &client, const std::string &key,
+        const EncodedValueCache::EntryPtr &value) {
+    // encoding of the trailing `found: true` pair
+    static const std::array<std::byte, 7> kFoundSuffix{{
+        std::byte{0x65}, std::byte{'f'}, std::byte{'o'}, std::byte{'u'}, std::byte{'n'},
+        std::byte{'d'}, std::byte{0xf5},
+    }};
+
+    // the map and string headers, fixed keys and version take up at most 64 bytes
+    auto &buf = client->transmitBuf;
+    buf.resize(64 + key.size());
+    size_t offset{0};
+
+    auto encode = [&](auto encoder, auto arg) {
+        offset += encoder(arg, reinterpret_cast<unsigned char *>(buf.data() + offset),
+                buf.size() - offset);
+    };
+    auto appendString = [&](const std::string_view &str) {
+        encode(cbor_encode_string_start, str.size());
+        std::copy_n(reinterpret_cast<const std::byte *>(str.data()), str.size(),
+                buf.begin() + offset);
+        offset += str.size();
+    };
+
+    // same layout as sendKeyValue(): key, version (if nonzero), value and found flag
+    encode(cbor_encode_map_start, value->version ? 4 : 3);
+    appendString("key");
+    appendString(key);
+
+    if(value->version) {
+        appendString("version");
+        encode(cbor_encode_uint, value->version);
+    }
+
+    appendString("value");
+
+    this->curRequest.encoded = Clock::now();
+
+    client->replyTo(*hdr, {buf.data(), offset}, value, kFoundSuffix);
+}
+
 
 /**
  * @brief Process a request to update a config key
@@ -626,6 +1084,10 @@ void RpcServer::sendKeyValue(const struct rpc_header *hdr, const std::shared_ptr
  * This request should contain both a `key` and a `value` entry, where the latter is either an
  * UTF-8 string, byte string (blob), an integer, or floating point value.
  *
+ * Optionally, a `ttl` entry specifies the time (in milliseconds) after which the key expires, and
+ * is removed; it may be at most DataStore::kMaxTtl. Updating a key without specifying a TTL clears
+ * its expiration time.
+ *
  * @remark If the value is specified as a boolean, the value is coerced to an unsigned integer
  *         (such that false = zero, true = an implementation-defined non-zero value)
  *
@@ -636,6 +1098,7 @@ void RpcServer::sendKeyValue(const struct rpc_header *hdr, const std::shared_ptr
 void RpcServer::doCfgUpdate(std::span<const std::byte> packet, cbor_item_t *item,
         std::shared_ptr<Client> &client) {
     PropertyValue value;
+    std::optional<std::chrono::milliseconds> ttl;
 
     // validate inputs
     if(!cbor_isa_map(item)) {
@@ -647,6 +1110,7 @@ void RpcServer::doCfgUpdate(std::span<const std::byte> packet, cbor_item_t *item
     if(keyName.empty()) {
         throw std::runtime_error("failed to get key name (wtf)");
     }
+    this->traceKey(keyName);
 
     // TODO: validate key access
 
@@ -675,66 +1139,42 @@ void RpcServer::doCfgUpdate(std::span<const std::byte> packet, cbor_item_t *item
             throw std::runtime_error("failed to get map key string");
         }
 
+        // get the TTL, if specified
+        if(std::string_view(keyStr, keyStrLen) == "ttl") {
+            if(!cbor_isa_uint(pair.value) || !cbor_get_int(pair.value)) {
+                throw std::invalid_argument("invalid `ttl` (expected non-zero uint)");
+            } else if(cbor_get_int(pair.value) >
+                    static_cast<uint64_t>(DataStore::kMaxTtl.count())) {
+                throw std::invalid_argument(fmt::format("invalid `ttl` (must be at most {} ms)",
+                            DataStore::kMaxTtl.count()));
+            }
+            ttl = std::chrono::milliseconds(cbor_get_int(pair.value));
+            continue;
+        }
+
         // if it's not the `value` key, bail
         if(strncmp(keyStr, "value", keyStrLen) != 0) {
             continue;
         }
 
-        // figure out its type
-        if(cbor_isa_string(pair.value)) { // UTF-8 string
-            if(!cbor_string_is_definite(pair.value)) {
-                throw std::runtime_error("indefinite strings not supported");
-            }
-            value = reinterpret_cast<const char *>(cbor_string_handle(pair.value));
-        } else if(cbor_isa_bytestring(pair.value)) { // blob
-            // reject indefinite blobs
-            if(!cbor_bytestring_is_definite(pair.value)) {
-                throw std::runtime_error("indefinite bytestrings not supported");
-            }
-
-            const auto blobNumBytes = cbor_bytestring_length(pair.value);
-            const auto blobData = cbor_bytestring_handle(pair.value);
-
-            // copy the blob out
-            std::vector<std::byte> buf;
-            buf.resize(blobNumBytes);
-
-            memcpy(buf.data(), blobData, blobNumBytes);
-            value = buf;
-        } else if(cbor_isa_uint(pair.value)) { // unsigned integer
-            uint64_t temp;
-            switch(cbor_int_get_width(pair.value)) {
-                case CBOR_INT_8:
-                    temp = cbor_get_uint8(pair.value);
-                    break;
-                case CBOR_INT_16:
-                    temp = cbor_get_uint16(pair.value);
-                    break;
-                case CBOR_INT_32:
-                    temp = cbor_get_uint32(pair.value);
-                    break;
-                case CBOR_INT_64:
-                    temp = cbor_get_uint64(pair.value);
-                    break;
-            }
-            value = temp;
-        } else if(cbor_isa_float_ctrl(pair.value)) { // float or bool
-            // probably a bool?
-            if(cbor_float_ctrl_is_ctrl(pair.value)) {
-                value = cbor_get_bool(pair.value);
-            }
-            // a float value: read it out as a double
-            else {
-                value = cbor_float_get_float(pair.value);
-            }
-        } else {
-            throw std::invalid_argument(fmt::format("invalid value type {}",
-                        cbor_typeof(pair.value)));
-        }
+        value = DecodeValue(pair.value);
     }
 
-    // perform update
-    this->store->setKey(keyName, value);
+    // perform update (the expiration time only needs updating if the key has or gets a TTL)
+    this->curRequest.storeBegin = Clock::now();
+    if(ttl) {
+        this->store->setKeyWithExpiry(keyName, value, std::chrono::system_clock::now() + *ttl);
+        this->expiryWheel.schedule(keyName, TimerWheel::Clock::now() + *ttl);
+        this->updateExpiryEvent();
+    } else if(this->expiryWheel.contains(keyName)) {
+        this->store->setKeyWithExpiry(keyName, value, std::nullopt);
+        this->expiryWheel.cancel(keyName);
+    } else {
+        this->store->setKey(keyName, value);
+        this->updateFlushEvent();
+    }
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
 
     // send a reply (assume success if we get here)
     const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
@@ -743,21 +1183,897 @@ void RpcServer::doCfgUpdate(std::span<const std::byte> packet, cbor_item_t *item
 }
 
 /**
- * @brief Handle a signal that indicates the process should terminate
+ * @brief Process a conditional update of a config key
+ *
+ * Like a regular update, the request contains the `key` and its new `value`; in addition, it has
+ * the `version` the key is expected to currently have (zero, if it shouldn't exist yet.) The key
+ * is only updated if its version matches.
+ *
+ * The reply contains the key name, whether the key was `updated`, and its `version`: the new
+ * version if it was updated, or its current version otherwise.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param item Root CBOR item in payload of message
+ * @param client Pointer to client this request originated on
  */
-void RpcServer::handleTermination() {
-    PLOG_INFO << "Received signal, terminating...";
+void RpcServer::doCfgCompareAndSwap(std::span<const std::byte> packet, cbor_item_t *item,
+        const std::shared_ptr<Client> &client) {
+    PropertyValue value;
+    std::optional<uint64_t> expectedVersion;
 
-    gRun = false;
-    event_base_loopbreak(this->evbase);
-}
+    // validate inputs
+    if(!cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
 
+    const auto keyName = ExtractKeyName(item);
+    if(keyName.empty()) {
+        throw std::runtime_error("failed to get key name (wtf)");
+    }
+    this->traceKey(keyName);
 
+    // TODO: validate key access
 
-/**
- * @brief Create a new client data structure
- *
- * Initialize a buffer event (used for event notifications, like the connection being closed; as
+    // get the new value and expected version
+    auto keys = cbor_map_handle(item);
+
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        auto &pair = keys[i];
+
+        if(!cbor_isa_string(pair.key)) {
+            throw std::runtime_error("invalid map key type (expected string)");
+        }
+
+        const std::string_view keyStr{reinterpret_cast<const char *>(
+                cbor_string_handle(pair.key)), cbor_string_length(pair.key)};
+
+        if(keyStr == "value") {
+            value = DecodeValue(pair.value);
+        } else if(keyStr == "version") {
+            if(!cbor_isa_uint(pair.value)) {
+                throw std::invalid_argument("invalid type for `version` (expected uint)");
+            }
+            expectedVersion = cbor_get_int(pair.value);
+        }
+    }
+
+    if(!expectedVersion) {
+        throw std::invalid_argument("missing `version`");
+    }
+
+    // perform update
+    this->curRequest.storeBegin = Clock::now();
+    const auto result = this->store->setKeyIfVersion(keyName, value, *expectedVersion);
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+    // build the reply
+    cbor_item_t *root = cbor_new_definite_map(3);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("key")),
+        .value = cbor_move(cbor_build_string(keyName.c_str()))
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("updated")),
+        .value = cbor_move(cbor_build_bool(result.applied))
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("version")),
+        .value = cbor_move(cbor_build_uint64(result.version))
+    });
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Process an atomic operation on an integer key
+ *
+ * The request contains the `key`, the operation (`op`: one of `add`, `sub`, `min` or `max`) and
+ * its `operand`, an integer. The operation is applied to the key's value in a single transaction.
+ *
+ * The reply contains the key name and whether it was `updated`; if so, it also has the key's
+ * resulting `value` and `version`. If the key holds a value of another type, it's not updated.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param item Root CBOR item in payload of message
+ * @param client Pointer to client this request originated on
+ */
+void RpcServer::doCfgIntegerOp(std::span<const std::byte> packet, cbor_item_t *item,
+        const std::shared_ptr<Client> &client) {
+    std::optional<DataStore::IntegerOp> op;
+    std::optional<uint64_t> operand;
+
+    // validate inputs
+    if(!cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    const auto keyName = ExtractKeyName(item);
+    if(keyName.empty()) {
+        throw std::runtime_error("failed to get key name (wtf)");
+    }
+    this->traceKey(keyName);
+
+    // TODO: validate key access
+
+    // get the operation and its operand
+    auto keys = cbor_map_handle(item);
+
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        auto &pair = keys[i];
+
+        if(!cbor_isa_string(pair.key)) {
+            throw std::runtime_error("invalid map key type (expected string)");
+        }
+
+        const std::string_view keyStr{reinterpret_cast<const char *>(
+                cbor_string_handle(pair.key)), cbor_string_length(pair.key)};
+
+        if(keyStr == "op") {
+            if(!cbor_isa_string(pair.value)) {
+                throw std::invalid_argument("invalid type for `op` (expected string)");
+            }
+
+            const std::string_view opStr{reinterpret_cast<const char *>(
+                    cbor_string_handle(pair.value)), cbor_string_length(pair.value)};
+
+            if(opStr == "add") {
+                op = DataStore::IntegerOp::Add;
+            } else if(opStr == "sub") {
+                op = DataStore::IntegerOp::Subtract;
+            } else if(opStr == "min") {
+                op = DataStore::IntegerOp::Min;
+            } else if(opStr == "max") {
+                op = DataStore::IntegerOp::Max;
+            } else {
+                throw std::invalid_argument(fmt::format("unknown op '{}'", opStr));
+            }
+        } else if(keyStr == "operand") {
+            if(!cbor_isa_uint(pair.value)) {
+                throw std::invalid_argument("invalid type for `operand` (expected uint)");
+            }
+            operand = cbor_get_int(pair.value);
+        }
+    }
+
+    if(!op || !operand) {
+        throw std::invalid_argument("missing `op` or `operand`");
+    }
+
+    // perform the operation
+    uint64_t version{0};
+
+    this->curRequest.storeBegin = Clock::now();
+    const auto result = this->store->applyIntegerOp(keyName, *op,
+            static_cast<int64_t>(*operand), &version);
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+    // build the reply
+    cbor_item_t *root = cbor_new_definite_map(result ? 4 : 2);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("key")),
+        .value = cbor_move(cbor_build_string(keyName.c_str()))
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("updated")),
+        .value = cbor_move(cbor_build_bool(result.has_value()))
+    });
+
+    if(result) {
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("value")),
+            .value = cbor_move(cbor_build_uint64(static_cast<uint64_t>(*result)))
+        });
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("version")),
+            .value = cbor_move(cbor_build_uint64(version))
+        });
+    }
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Process a request to delete a config key
+ *
+ * The request contains only a `key` entry, naming the key to delete. The reply contains the key
+ * name and a `deleted` flag, which is false if the key didn't exist.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param item Root CBOR item in payload of message
+ * @param client Pointer to client this request originated on
+ */
+void RpcServer::doCfgDelete(std::span<const std::byte> packet, cbor_item_t *item,
+        const std::shared_ptr<Client> &client) {
+    // validate inputs
+    if(!cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    const auto keyName = ExtractKeyName(item);
+    if(keyName.empty()) {
+        throw std::runtime_error("failed to get key name (wtf)");
+    }
+    this->traceKey(keyName);
+
+    // TODO: validate key access
+
+    // perform the delete
+    this->curRequest.storeBegin = Clock::now();
+    const auto deleted = this->store->deleteKey(keyName);
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+    if(deleted) {
+        this->expiryWheel.cancel(keyName);
+    }
+
+    // build the reply
+    cbor_item_t *root = cbor_new_definite_map(2);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("key")),
+        .value = cbor_move(cbor_build_string(keyName.c_str()))
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("deleted")),
+        .value = cbor_move(cbor_build_bool(deleted != 0))
+    });
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Process a request to update multiple keys at once
+ *
+ * The request contains an `updates` map, from key names to their new values. Batches too large
+ * for a single message are split over several, all but the last of which have the `more` flag
+ * set: their updates are held by the client until the batch is complete. All updates of the batch
+ * are then applied in a single transaction, so either all of them take effect, or none do.
+ *
+ * The reply contains the number of keys that were `updated`, which is zero for all but the last
+ * message of a batch.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param item Root CBOR item in payload of message
+ * @param client Pointer to client this request originated on
+ */
+void RpcServer::doCfgBatchUpdate(std::span<const std::byte> packet, cbor_item_t *item,
+        const std::shared_ptr<Client> &client) {
+    bool more{false};
+
+    // validate inputs
+    if(!cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    auto keys = cbor_map_handle(item);
+
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        auto &pair = keys[i];
+
+        // validate key type: must be a string
+        if(!cbor_isa_string(pair.key)) {
+            throw std::runtime_error("invalid map key type (expected string)");
+        }
+
+        const std::string_view keyStr{reinterpret_cast<const char *>(cbor_string_handle(pair.key)),
+            cbor_string_length(pair.key)};
+
+        // more messages of this batch follow
+        if(keyStr == "more") {
+            if(!cbor_isa_float_ctrl(pair.value) || !cbor_is_bool(pair.value)) {
+                throw std::runtime_error("invalid type for `more` (expected bool)");
+            }
+            more = cbor_get_bool(pair.value);
+        }
+        // the keys to update
+        else if(keyStr == "updates") {
+            if(!cbor_isa_map(pair.value)) {
+                throw std::runtime_error("invalid type for `updates` (expected map)");
+            }
+
+            auto updates = cbor_map_handle(pair.value);
+            const auto numUpdates = cbor_map_size(pair.value);
+
+            if(client->pendingBatch.size() + numUpdates > kMaxBatchKeys) {
+                throw std::runtime_error("batch too large");
+            }
+
+            for(size_t j = 0; j < numUpdates; j++) {
+                if(!cbor_isa_string(updates[j].key) ||
+                        !cbor_string_is_definite(updates[j].key)) {
+                    throw std::runtime_error("invalid key name type (expected string)");
+                }
+
+                std::string keyName(reinterpret_cast<const char *>(
+                            cbor_string_handle(updates[j].key)),
+                        cbor_string_length(updates[j].key));
+
+                client->pendingBatch.emplace_back(std::move(keyName),
+                        DecodeValue(updates[j].value));
+            }
+        }
+    }
+
+    if(!client->pendingBatch.empty()) {
+        this->traceKey(client->pendingBatch.front().first);
+    }
+
+    // apply the batch, once we have all of it
+    size_t updated{0};
+
+    if(!more) {
+        auto batch = std::move(client->pendingBatch);
+        client->pendingBatch.clear();
+
+        this->curRequest.storeBegin = Clock::now();
+        this->store->setKeys(batch);
+        this->curRequest.storeEnd = Clock::now();
+        this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+        updated = batch.size();
+    }
+
+    // build the reply
+    cbor_item_t *root = cbor_new_definite_map(1);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("updated")),
+        .value = cbor_move(cbor_build_uint64(updated))
+    });
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Process a request to export the values of all keys
+ *
+ * Keys are returned in name order, as many as fit into a single reply. The request may contain an
+ * `after` key name, in which case only keys following it are returned; so a client can page
+ * through the entire data store by passing the last key of each reply to the next request.
+ *
+ * The reply contains a `values` map, from key names to their values; and a `more` flag, which is
+ * set if there may be further keys.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param item Root CBOR item in payload of message
+ * @param client Pointer to client this request originated on
+ */
+void RpcServer::doCfgExport(std::span<const std::byte> packet, cbor_item_t *item,
+        const std::shared_ptr<Client> &client) {
+    std::string after;
+
+    // validate inputs
+    if(!cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    auto keys = cbor_map_handle(item);
+
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        auto &pair = keys[i];
+
+        if(!cbor_isa_string(pair.key)) {
+            throw std::runtime_error("invalid map key type (expected string)");
+        }
+
+        const std::string_view keyStr{reinterpret_cast<const char *>(cbor_string_handle(pair.key)),
+            cbor_string_length(pair.key)};
+
+        if(keyStr == "after") {
+            if(!cbor_isa_string(pair.value) || !cbor_string_is_definite(pair.value)) {
+                throw std::runtime_error("invalid type for `after` (expected string)");
+            }
+
+            after = {reinterpret_cast<const char *>(cbor_string_handle(pair.value)),
+                cbor_string_length(pair.value)};
+        }
+    }
+
+    this->traceKey(after);
+
+    // read the next page of keys
+    this->curRequest.storeBegin = Clock::now();
+    const auto values = this->store->getKeys(after, kExportPageKeys);
+    this->curRequest.storeEnd = Clock::now();
+    this->curRequest.lockWait = DataStore::GetLastLockWait();
+
+    /*
+     * Encode as many of them as fit into the reply. The size of each entry is estimated
+     * conservatively, assuming the longest possible encoding for the lengths of the key name and
+     * value.
+     */
+    bool more = (values.size() == kExportPageKeys);
+    cbor_item_t *map = cbor_new_definite_map(values.size());
+    size_t payloadBytes{0};
+
+    for(const auto &[name, value] : values) {
+        size_t entryBytes = name.size() + 18;
+        if(const auto str = std::get_if<std::string>(&value)) {
+            entryBytes += str->size();
+        } else if(const auto blob = std::get_if<Blob>(&value)) {
+            entryBytes += blob->size();
+        }
+
+        if(payloadBytes + entryBytes > kMaxExportPayload) {
+            if(!payloadBytes) {
+                cbor_decref(&map);
+                throw std::runtime_error(fmt::format("key '{}' too large to export", name));
+            }
+
+            more = true;
+            break;
+        }
+        payloadBytes += entryBytes;
+
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string(name.c_str())),
+            .value = cbor_move(EncodeValue(value))
+        });
+    }
+
+    // build the reply
+    cbor_item_t *root = cbor_new_definite_map(2);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("values")),
+        .value = cbor_move(map)
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("more")),
+        .value = cbor_move(cbor_build_bool(more))
+    });
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Process a request for the daemon's statistics
+ *
+ * Replies with a map containing general server information, the per-endpoint request counters
+ * and latency histograms, the data store's counters, and its flash wear accounting (I/O on the
+ * database files, writes per top-level key prefix, and the most frequently written keys.) The
+ * request payload is ignored.
+ *
+ * @param packet Memory region containing the full RPC packet, starting at the header
+ * @param client Pointer to client this request originated on
+ */
+void RpcServer::doStats(std::span<const std::byte> packet, const std::shared_ptr<Client> &client) {
+    auto addPair = [](cbor_item_t *map, const char *key, cbor_item_t *value) {
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string(key)),
+            .value = cbor_move(value)
+        });
+    };
+
+    // general server info
+    const auto uptime = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() -
+            this->startTime).count();
+
+    auto server = cbor_new_definite_map(4);
+    addPair(server, "uptime", cbor_build_uint64(uptime));
+    addPair(server, "clients", cbor_build_uint64(this->clients.size()));
+    addPair(server, "clientsAccepted", cbor_build_uint64(this->numClientsAccepted));
+    addPair(server, "expiringKeys", cbor_build_uint64(this->expiryWheel.size()));
+
+    // endpoint stats
+    auto endpoints = cbor_new_definite_map(this->endpointStats.size());
+    for(const auto &[endpoint, stats] : this->endpointStats) {
+        auto latency = cbor_new_definite_map(4);
+        addPair(latency, "parse", stats.parse.serialize());
+        addPair(latency, "store", stats.store.serialize());
+        addPair(latency, "encode", stats.encode.serialize());
+        addPair(latency, "total", stats.total.serialize());
+
+        auto ep = cbor_new_definite_map(3);
+        addPair(ep, "requests", cbor_build_uint64(stats.requests));
+        addPair(ep, "errors", cbor_build_uint64(stats.errors));
+        addPair(ep, "latency", latency);
+
+        addPair(endpoints, EndpointName(endpoint).c_str(), ep);
+    }
+
+    // data store
+    this->curRequest.storeBegin = Clock::now();
+    const auto storeStats = this->store->getStats();
+    this->curRequest.storeEnd = Clock::now();
+
+    auto store = cbor_new_definite_map(13);
+    addPair(store, "statements", cbor_build_uint64(storeStats.statements));
+    addPair(store, "commits", cbor_build_uint64(storeStats.commits));
+    addPair(store, "cacheHits", cbor_build_uint64(storeStats.cacheHits));
+    addPair(store, "cacheMisses", cbor_build_uint64(storeStats.cacheMisses));
+    addPair(store, "dbSize", cbor_build_uint64(storeStats.dbSize));
+    addPair(store, "volatileKeys", cbor_build_uint64(storeStats.volatileKeys));
+    addPair(store, "unchangedWrites", cbor_build_uint64(storeStats.unchangedWrites));
+    addPair(store, "debouncedWrites", cbor_build_uint64(storeStats.debouncedWrites));
+    addPair(store, "pendingWrites", cbor_build_uint64(storeStats.pendingWrites));
+    addPair(store, "defaultKeys", cbor_build_uint64(storeStats.defaultKeys));
+    addPair(store, "defaultReads", cbor_build_uint64(storeStats.defaultReads));
+
+    // negative lookup cache (key filter): false positive rate over all lookups of missing keys
+    const auto missingLookups = storeStats.filterNegatives + storeStats.filterFalsePositives;
+    const double falsePositiveRate = missingLookups ?
+        static_cast<double>(storeStats.filterFalsePositives) / missingLookups : 0.;
+
+    auto negativeCache = cbor_new_definite_map(6);
+    addPair(negativeCache, "keys", cbor_build_uint64(storeStats.filterKeys));
+    addPair(negativeCache, "bytes", cbor_build_uint64(storeStats.filterBytes));
+    addPair(negativeCache, "rebuilds", cbor_build_uint64(storeStats.filterRebuilds));
+    addPair(negativeCache, "negatives", cbor_build_uint64(storeStats.filterNegatives));
+    addPair(negativeCache, "falsePositives",
+            cbor_build_uint64(storeStats.filterFalsePositives));
+    addPair(negativeCache, "falsePositiveRate", cbor_build_float8(falsePositiveRate));
+    addPair(store, "negativeCache", negativeCache);
+
+    // encoded value cache
+    auto valueCache = cbor_new_definite_map(4);
+    addPair(valueCache, "entries", cbor_build_uint64(storeStats.valueCacheEntries));
+    addPair(valueCache, "bytes", cbor_build_uint64(storeStats.valueCacheBytes));
+    addPair(valueCache, "hits", cbor_build_uint64(storeStats.valueCacheHits));
+    addPair(valueCache, "misses", cbor_build_uint64(storeStats.valueCacheMisses));
+    addPair(store, "valueCache", valueCache);
+
+    // flash wear: physical I/O per file, logical writes per key prefix, and the hottest keys
+    auto files = cbor_new_definite_map(storeStats.files.size());
+    for(size_t i = 0; i < storeStats.files.size(); i++) {
+        const auto &counters = storeStats.files[i];
+
+        auto file = cbor_new_definite_map(3);
+        addPair(file, "writes", cbor_build_uint64(counters.writes));
+        addPair(file, "bytes", cbor_build_uint64(counters.bytesWritten));
+        addPair(file, "syncs", cbor_build_uint64(counters.syncs));
+
+        addPair(files, CountingVfs::FileTypeName(static_cast<CountingVfs::FileType>(i)), file);
+    }
+
+    auto prefixes = cbor_new_definite_map(storeStats.prefixes.size());
+    for(const auto &[prefix, counters] : storeStats.prefixes) {
+        auto entry = cbor_new_definite_map(4);
+        addPair(entry, "writes", cbor_build_uint64(counters.writes));
+        addPair(entry, "bytes", cbor_build_uint64(counters.bytes));
+        addPair(entry, "commits", cbor_build_uint64(counters.commits));
+        addPair(entry, "syncs", cbor_build_uint64(counters.syncs));
+
+        addPair(prefixes, prefix.c_str(), entry);
+    }
+
+    auto hotKeys = cbor_new_definite_array(storeStats.hotKeys.size());
+    for(const auto &key : storeStats.hotKeys) {
+        auto entry = cbor_new_definite_map(3);
+        addPair(entry, "key", cbor_build_string(key.key.c_str()));
+        addPair(entry, "count", cbor_build_uint64(key.count));
+        addPair(entry, "error", cbor_build_uint64(key.error));
+
+        cbor_array_push(hotKeys, cbor_move(entry));
+    }
+
+    auto wear = cbor_new_definite_map(5);
+    addPair(wear, "logicalBytes", cbor_build_uint64(storeStats.logicalBytes));
+    addPair(wear, "pageWrites", cbor_build_uint64(storeStats.pageWrites));
+    addPair(wear, "files", files);
+    addPair(wear, "prefixes", prefixes);
+    addPair(wear, "hotKeys", hotKeys);
+
+    // assemble the whole thing and serialize it
+    auto root = cbor_new_definite_map(4);
+    addPair(root, "server", server);
+    addPair(root, "endpoints", endpoints);
+    addPair(root, "store", store);
+    addPair(root, "wear", wear);
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Dump the trace ring
+ *
+ * Reply with an array containing the traces of the most recently completed requests, oldest
+ * first. For each request, the client, endpoint, tag and key name are provided, along with the
+ * time since it completed and the duration of each processing phase; all times are in µs.
+ *
+ * @remark The request for the dump itself is not included, since it's still in progress.
+ */
+void RpcServer::doTrace(std::span<const std::byte> packet, const std::shared_ptr<Client> &client) {
+    auto addPair = [](cbor_item_t *map, const char *key, cbor_item_t *value) {
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string(key)),
+            .value = cbor_move(value)
+        });
+    };
+    auto usec = [](const double value) {
+        return cbor_build_uint64(static_cast<uint64_t>(value));
+    };
+
+    const auto now = Clock::now();
+    const auto numTraces = std::min<uint64_t>(this->traceRingWrites, kTraceRingSize);
+
+    auto traces = cbor_new_definite_array(numTraces);
+
+    for(uint64_t i = this->traceRingWrites - numTraces; i < this->traceRingWrites; i++) {
+        const auto &trace = this->traceRing[i % kTraceRingSize];
+
+        auto entry = cbor_new_definite_map(11);
+        addPair(entry, "client", cbor_build_uint32(trace.client));
+        addPair(entry, "endpoint", cbor_build_string(EndpointName(trace.endpoint).c_str()));
+        addPair(entry, "tag", cbor_build_uint8(trace.tag));
+        addPair(entry, "key", cbor_build_stringn(trace.key.data(), trace.keyLen));
+        addPair(entry, "success", cbor_build_bool(trace.success));
+        addPair(entry, "age", usec(PhaseDuration(trace.completed, now)));
+        addPair(entry, "parse", usec(PhaseDuration(trace.received, trace.parsed)));
+        addPair(entry, "lockWait", usec(std::chrono::duration<double, std::micro>(
+                        trace.lockWait).count()));
+        addPair(entry, "store", usec(PhaseDuration(trace.storeBegin, trace.storeEnd)));
+        addPair(entry, "encode", usec(PhaseDuration(std::max(trace.storeEnd, trace.parsed),
+                        trace.encoded)));
+        addPair(entry, "total", usec(PhaseDuration(trace.received, trace.completed)));
+
+        cbor_array_push(traces, cbor_move(entry));
+    }
+
+    size_t tracesBufLen;
+    unsigned char *tracesBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(traces, &tracesBuf, &tracesBufLen);
+    cbor_decref(&traces);
+
+    this->curRequest.encoded = Clock::now();
+
+    // send it as a reply
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet.data());
+
+    try {
+        client->replyTo(*hdr, {reinterpret_cast<const std::byte *>(tracesBuf), serializedBytes});
+        free(tracesBuf);
+    } catch(const std::exception &) {
+        free(tracesBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Get a human readable name for an endpoint
+ *
+ * @param endpoint Endpoint number
+ *
+ * @return Endpoint name, or its number if it's not known
+ */
+std::string RpcServer::EndpointName(const uint8_t endpoint) {
+    switch(endpoint) {
+        case kConfigQuery:
+            return "query";
+        case kConfigUpdate:
+            return "update";
+        case kConfigDelete:
+            return "delete";
+        case kConfigStats:
+            return "stats";
+        case kConfigTrace:
+            return "trace";
+        case kConfigBatchUpdate:
+            return "batch";
+        case kConfigExport:
+            return "export";
+        case kConfigCompareAndSwap:
+            return "cas";
+        case kConfigIntegerOp:
+            return "atomic";
+
+        default:
+            return fmt::format("${:02x}", endpoint);
+    }
+}
+
+/**
+ * @brief Handle a signal that indicates the process should terminate
+ */
+void RpcServer::handleTermination() {
+    PLOG_INFO << "Received signal, terminating...";
+
+    gRun = false;
+    event_base_loopbreak(this->evbase);
+}
+
+/**
+ * @brief Advance the expiration timer wheel
+ *
+ * Invoked on every tick of the timer wheel, while keys are scheduled to expire. All keys that
+ * expired since the last tick are removed from the data store at once; if that fails, they are
+ * retried after kExpiryRetryInterval.
+ */
+void RpcServer::handleExpiryTick() {
+    const auto expired = this->expiryWheel.advance(TimerWheel::Clock::now());
+
+    if(!expired.empty()) {
+        try {
+            const auto removed = this->store->expireKeys(expired);
+            PLOG_DEBUG << "expired " << removed << " key(s)";
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to expire " << expired.size() << " key(s): " << e.what();
+
+            // they're no longer in the wheel, so schedule them again to retry later
+            const auto retryAt = TimerWheel::Clock::now() + kExpiryRetryInterval;
+            for(const auto &name : expired) {
+                this->expiryWheel.schedule(name, retryAt);
+            }
+        }
+    }
+
+    this->updateExpiryEvent();
+}
+
+/**
+ * @brief Start or stop the expiration timer
+ *
+ * The timer only runs while keys are scheduled to expire, so an idle daemon doesn't need to wake
+ * up for every tick.
+ */
+void RpcServer::updateExpiryEvent() {
+    const bool pending = event_pending(this->expiryEvent, EV_TIMEOUT, nullptr);
+
+    if(!this->expiryWheel.empty() && !pending) {
+        const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                TimerWheel::kTickDuration).count();
+
+        struct timeval tv{
+            .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+            .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+        };
+        evtimer_add(this->expiryEvent, &tv);
+    } else if(this->expiryWheel.empty() && pending) {
+        evtimer_del(this->expiryEvent);
+    }
+}
+
+/**
+ * @brief Write debounced keys that are due to the data store
+ */
+void RpcServer::handleFlushTimer() {
+    try {
+        const auto written = this->store->flushPendingWrites();
+        if(written) {
+            PLOG_DEBUG << "flushed " << written << " debounced write(s)";
+        }
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to flush debounced writes: " << e.what();
+    }
+
+    this->updateFlushEvent();
+}
+
+/**
+ * @brief Sync (and possibly compact) the data store's write log
+ */
+void RpcServer::handleCheckpointTimer() {
+    try {
+        this->store->checkpoint();
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to checkpoint data store: " << e.what();
+    }
+}
+
+/**
+ * @brief Arm the flush timer for the earliest pending debounced write
+ *
+ * If no writes are pending, the timer is stopped instead.
+ */
+void RpcServer::updateFlushEvent() {
+    const auto next = this->store->getNextFlushTime();
+    if(!next) {
+        evtimer_del(this->flushEvent);
+        return;
+    }
+
+    const auto usec = std::max(std::chrono::duration_cast<std::chrono::microseconds>(
+                *next - DataStore::Clock::now()).count(), int64_t{0});
+
+    struct timeval tv{
+        .tv_sec  = static_cast<time_t>(usec / 1'000'000),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000),
+    };
+    evtimer_add(this->flushEvent, &tv);
+}
+
+
+
+/**
+ * @brief Create a new client data structure
+ *
+ * Initialize a buffer event (used for event notifications, like the connection being closed; as
  * well as when buffered data is available) for the client.
  *
  * @param server RPC server to which the client connected
@@ -821,10 +2137,16 @@ RpcServer::Client::~Client() {
  *
  * @param req Message header of the request we're replying to
  * @param payload Optional payload to add to the reply
+ *
+ * @throw std::system_error The reply doesn't fit in a message (EMSGSIZE), or sending it failed
  */
 void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const std::byte> payload) {
     // calculate total size required and reserve space
     const size_t msgSize = sizeof(struct rpc_header) + payload.size();
+    if(msgSize > UINT16_MAX) {
+        throw std::system_error(EMSGSIZE, std::generic_category(), "rpc reply too large");
+    }
+
     this->transmitBuf.resize(msgSize, std::byte(0));
     std::fill(this->transmitBuf.begin(), this->transmitBuf.begin() + sizeof(struct rpc_header),
             std::byte(0));
@@ -847,6 +2169,65 @@ void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const st
     this->send(this->transmitBuf);
 }
 
+/**
+ * @brief Reply to a previously received message with an encoded value
+ *
+ * Sends the same reply as replyTo() with a payload made up of the given prefix, encoded value and
+ * suffix. The prefix and suffix are copied, but larger values are referenced by the output buffer
+ * directly, which holds on to the value until it's been written.
+ *
+ * @param req Message header of the request we're replying to
+ * @param prefix Payload preceding the value
+ * @param value Encoded value to add to the payload
+ * @param suffix Payload following the value
+ *
+ * @throw std::system_error The reply doesn't fit in a message (EMSGSIZE), or sending it failed
+ */
+void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const std::byte> prefix,
+        const EncodedValueCache::EntryPtr &value, std::span<const std::byte> suffix) {
+    const auto &data = value->data;
+    const size_t msgSize = sizeof(struct rpc_header) + prefix.size() + data.size() +
+        suffix.size();
+    if(msgSize > UINT16_MAX) {
+        throw std::system_error(EMSGSIZE, std::generic_category(), "rpc reply too large");
+    }
+
+    struct rpc_header hdr{};
+    hdr.version = kRpcVersionLatest;
+    hdr.length = msgSize;
+    hdr.endpoint = req.endpoint;
+    hdr.tag = req.tag;
+    hdr.flags = (1 << 0);
+
+    auto out = bufferevent_get_output(this->event);
+    if(evbuffer_add(out, &hdr, sizeof(hdr)) == -1 ||
+            evbuffer_add(out, prefix.data(), prefix.size()) == -1) {
+        throw std::system_error(errno, std::generic_category(), "write rpc reply");
+    }
+
+    // small values are cheaper to copy than to reference (which allocates a buffer chain)
+    if(data.size() < kMinReferencedValueSize) {
+        if(evbuffer_add(out, data.data(), data.size()) == -1) {
+            throw std::system_error(errno, std::generic_category(), "write rpc reply");
+        }
+    } else {
+        auto ref = new EncodedValueCache::EntryPtr(value);
+        int err = evbuffer_add_reference(out, data.data(), data.size(),
+                [](auto, auto, auto ctx) {
+            delete reinterpret_cast<EncodedValueCache::EntryPtr *>(ctx);
+        }, ref);
+
+        if(err == -1) {
+            delete ref;
+            throw std::system_error(errno, std::generic_category(), "write rpc reply");
+        }
+    }
+
+    if(evbuffer_add(out, suffix.data(), suffix.size()) == -1) {
+        throw std::system_error(errno, std::generic_category(), "write rpc reply");
+    }
+}
+
 /**
  * @brief Transmit the given packet
  *
@@ -3,12 +3,21 @@
 
 #include <sys/signal.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <memory>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+#include "Capture.h"
+#include "EncodedValueCache.h"
+#include "Stats.h"
+#include "TimerWheel.h"
 
 class DataStore;
 
@@ -27,6 +36,8 @@ class RpcServer {
         RpcServer(const std::shared_ptr<DataStore> &store) : store(store) {
             this->initSocket();
             this->initEventLoop();
+            this->initCapture();
+            this->initValueCache();
         }
 
         ~RpcServer();
@@ -41,19 +52,28 @@ class RpcServer {
          * used to wait for activity on the connection.
          */
         struct Client {
+            /// Encoded values smaller than this are copied into replies, rather than referenced
+            constexpr static const size_t kMinReferencedValueSize{512};
+
             /// Underlying client file descriptor
             int socket{-1};
+            /// Unique client identifier (used in traffic captures)
+            uint32_t id{0};
             /// Socket buffer event (used for data ready to read + events)
             struct bufferevent *event{nullptr};
             /// message receive buffer
             std::vector<std::byte> receiveBuf;
             /// message transmit buffer
             std::vector<std::byte> transmitBuf;
+            /// updates of a batch update that hasn't been completely received yet
+            PropertyList pendingBatch;
 
             Client(RpcServer *, const int);
             ~Client();
 
             void replyTo(const struct rpc_header &, std::span<const std::byte>);
+            void replyTo(const struct rpc_header &, std::span<const std::byte>,
+                    const EncodedValueCache::EntryPtr &, std::span<const std::byte>);
             void send(std::span<const std::byte>);
         };
 
@@ -87,6 +107,77 @@ class RpcServer {
             ExcludeValue                        = (1 << 2),
         };
 
+        /// Clock used to timestamp requests
+        using Clock = std::chrono::steady_clock;
+
+        /**
+         * @brief Trace of a single request
+         *
+         * This is filled in as a request makes its way through the server: it holds timestamps of
+         * each processing phase, as well as some information on the request itself. Once the
+         * request completes, it's used to update the per-endpoint statistics, and copied into the
+         * trace ring.
+         */
+        struct RequestTrace {
+            /// Maximum length of key names stored in the trace (longer names are truncated)
+            constexpr static const size_t kMaxKeyLength{64};
+
+            /// Request was read from the client
+            Clock::time_point received;
+            /// Request payload has been decoded
+            Clock::time_point parsed;
+            /// Data store access started
+            Clock::time_point storeBegin;
+            /// Data store access completed
+            Clock::time_point storeEnd;
+            /// Reply has been encoded
+            Clock::time_point encoded;
+            /// Request processing completed
+            Clock::time_point completed;
+            /// Time spent waiting for the data store lock
+            std::chrono::nanoseconds lockWait{0};
+
+            /// Client that sent the request
+            uint32_t client{0};
+            /// Endpoint the request was made to
+            uint8_t endpoint{0};
+            /// Tag of the request
+            uint8_t tag{0};
+            /// Whether the request was processed successfully
+            bool success{false};
+            /// Length of the key name
+            uint8_t keyLen{0};
+            /// Key name the request operated on (if any)
+            std::array<char, kMaxKeyLength> key;
+
+            /// Get the key name the request operated on
+            std::string_view getKey() const {
+                return {this->key.data(), this->keyLen};
+            }
+        };
+
+        /**
+         * @brief Per-endpoint statistics
+         *
+         * Keeps track of the number of requests handled for an endpoint, and how long each of the
+         * phases of handling them took.
+         */
+        struct EndpointStats {
+            /// Total number of requests
+            uint64_t requests{0};
+            /// Number of requests that failed
+            uint64_t errors{0};
+
+            /// Time spent decoding the request
+            LatencyHistogram parse;
+            /// Time spent in the data store
+            LatencyHistogram store;
+            /// Time spent encoding (and queuing) the reply
+            LatencyHistogram encode;
+            /// Total request processing time
+            LatencyHistogram total;
+        };
+
     private:
         void initSocket();
 
@@ -94,28 +185,83 @@ class RpcServer {
         void initWatchdogEvent();
         void initSignalEvents();
         void initSocketEvent();
+        void initExpiryEvent();
+        void initFlushEvent();
+        void initCheckpointEvent();
+        void initCapture();
+        void initValueCache();
 
         void acceptClient();
         void handleClientRead(struct bufferevent *);
+        void handleClientMessage(std::shared_ptr<Client> &, struct evbuffer *,
+                const size_t);
         void handleClientEvent(struct bufferevent *, const size_t);
         void abortClient(struct bufferevent *);
 
         void handleTermination();
+        void handleExpiryTick();
+        void updateExpiryEvent();
+        void handleFlushTimer();
+        void updateFlushEvent();
+        void handleCheckpointTimer();
 
         void doCfgQuery(std::span<const std::byte>, struct cbor_item_t *,
                 const std::shared_ptr<Client> &);
         void getCfgQueryFlags(struct cbor_item_t *, Flags &);
         void sendKeyValue(const struct rpc_header *, const std::shared_ptr<Client> &,
-                const std::string &, const PropertyValue &, const Flags = Flags::None);
+                const std::string &, const PropertyValue &, const Flags = Flags::None,
+                const uint64_t = 0);
+        void sendEncodedKeyValue(const struct rpc_header *, const std::shared_ptr<Client> &,
+                const std::string &, const EncodedValueCache::EntryPtr &);
 
         void doCfgUpdate(std::span<const std::byte>, struct cbor_item_t *,
                 std::shared_ptr<Client> &);
+        void doCfgCompareAndSwap(std::span<const std::byte>, struct cbor_item_t *,
+                const std::shared_ptr<Client> &);
+        void doCfgIntegerOp(std::span<const std::byte>, struct cbor_item_t *,
+                const std::shared_ptr<Client> &);
+
+        void doCfgDelete(std::span<const std::byte>, struct cbor_item_t *,
+                const std::shared_ptr<Client> &);
+
+        void doCfgBatchUpdate(std::span<const std::byte>, struct cbor_item_t *,
+                const std::shared_ptr<Client> &);
+        void doCfgExport(std::span<const std::byte>, struct cbor_item_t *,
+                const std::shared_ptr<Client> &);
+
+        void doStats(std::span<const std::byte>, const std::shared_ptr<Client> &);
+        void recordRequest(const uint8_t, const bool);
+        void logSlowRequest(const RequestTrace &);
+        void doTrace(std::span<const std::byte>, const std::shared_ptr<Client> &);
+
+        /// Record the name of the key the current request operates on in its trace
+        void traceKey(const std::string_view &key) {
+            const auto len = std::min(key.size(), this->curRequest.key.size());
+            std::copy_n(key.begin(), len, this->curRequest.key.begin());
+            this->curRequest.keyLen = static_cast<uint8_t>(len);
+        }
+        void captureRequest(const std::shared_ptr<Client> &, std::span<const std::byte>,
+                const bool);
 
         static std::string ExtractKeyName(struct cbor_item_t *);
+        static PropertyValue DecodeValue(struct cbor_item_t *);
+        static struct cbor_item_t *EncodeValue(const PropertyValue &, const Flags = Flags::None);
+        static std::vector<std::byte> SerializeValue(const PropertyValue &);
+        static std::string EndpointName(const uint8_t);
 
     private:
         /// Maximum amount of clients that may be waiting to be accepted at once
         constexpr static const size_t kListenBacklog{5};
+        /// Number of requests kept in the trace ring
+        constexpr static const size_t kTraceRingSize{128};
+        /// Maximum number of keys in a single batch update
+        constexpr static const size_t kMaxBatchKeys{1 << 20};
+        /// Maximum number of keys read from the data store for a single export reply
+        constexpr static const size_t kExportPageKeys{512};
+        /// Maximum size of the key/value pairs in an export reply, in bytes
+        constexpr static const size_t kMaxExportPayload{UINT16_MAX - 64};
+        /// Time after which expiring keys are retried, if removing them failed
+        constexpr static const std::chrono::seconds kExpiryRetryInterval{1};
 
         /// Main RPC listening socket
         int listenSock{-1};
@@ -129,6 +275,12 @@ class RpcServer {
 
         /// watchdog kicking timer event (if watchdog is active)
         struct event *watchdogEvent{nullptr};
+        /// key expiration timer event (only pending while keys are scheduled to expire)
+        struct event *expiryEvent{nullptr};
+        /// debounced write flush timer event (only pending while writes are pending)
+        struct event *flushEvent{nullptr};
+        /// write log checkpoint timer event (only in the in-memory storage mode)
+        struct event *checkpointEvent{nullptr};
 
         /// libevent main loop
         struct event_base *evbase{nullptr};
@@ -138,6 +290,27 @@ class RpcServer {
 
         /// configuration data storage
         std::shared_ptr<DataStore> store;
+        /// Whether queries are answered from the data store's encoded value cache
+        bool useValueCache{false};
+
+        /// expiration deadlines of all keys with a TTL
+        TimerWheel expiryWheel;
+
+        /// traffic recorder (if enabled)
+        std::unique_ptr<CaptureWriter> capture;
+
+        /// time at which the server was started
+        Clock::time_point startTime{Clock::now()};
+        /// total number of clients accepted
+        uint64_t numClientsAccepted{0};
+        /// trace of the request currently being processed
+        RequestTrace curRequest;
+        /// traces of the most recently completed requests
+        std::array<RequestTrace, kTraceRingSize> traceRing;
+        /// total number of requests written to the trace ring
+        uint64_t traceRingWrites{0};
+        /// statistics for each endpoint, keyed by endpoint number
+        std::unordered_map<uint8_t, EndpointStats> endpointStats;
 };
 
 #endif
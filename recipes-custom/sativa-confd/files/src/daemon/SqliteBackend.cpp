@@ -0,0 +1,964 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <system_error>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <sqlite3.h>
+
+#include "SqliteBackend.h"
+#include "WearStats.h"
+#include "version.h"
+
+/**
+ * @brief Query for a single key, including its value
+ *
+ * Returns the key's id, value type, version and expiration time; followed by the value columns of
+ * all value tables (only the one for the key's type is non-null.)
+ */
+static constexpr const char *kSelectKeyQuery{R"STR(
+SELECT k.id, k.valueType, k.version, k.expiresAt, s.value, b.value, i.value, r.value
+    FROM PropertyKeys k
+    LEFT JOIN PropertyValuesString s ON s.propertyId = k.id
+    LEFT JOIN PropertyValuesBlob b ON b.propertyId = k.id
+    LEFT JOIN PropertyValuesInteger i ON i.propertyId = k.id
+    LEFT JOIN PropertyValuesReal r ON r.propertyId = k.id
+    WHERE k.key = :keyName;
+)STR"};
+
+/**
+ * @brief Open the database at the given path
+ *
+ * If there is not yet a database at the given path, it's initialized with the current schema.
+ * Otherwise, it's simply opened as is, with a few basic consistency checks.
+ *
+ * @param dbPath Path on disk of the sqlite3 database
+ *
+ * @throw std::system_error The database is already open in another process (EWOULDBLOCK)
+ */
+SqliteBackend::SqliteBackend(const std::filesystem::path &dbPath) : path(dbPath),
+    fileLock(dbPath) {
+    // open db and apply pragmas
+    PLOG_INFO << "opening db: " << dbPath.native();
+    this->db = std::make_unique<SQLite::Database>(dbPath,
+            (SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE), 0, CountingVfs::Register());
+
+    this->db->exec("PRAGMA foreign_keys = ON;");
+
+    // install hooks to count statements and report the end of transactions
+    sqlite3_trace_v2(this->db->getHandle(), SQLITE_TRACE_STMT, [](auto, auto ctx, auto, auto) {
+        reinterpret_cast<SqliteBackend *>(ctx)->numStatements++;
+        return 0;
+    }, this);
+    sqlite3_commit_hook(this->db->getHandle(), [](auto ctx) {
+        reinterpret_cast<SqliteBackend *>(ctx)->notifyTransaction(true);
+        return 0;
+    }, this);
+    sqlite3_rollback_hook(this->db->getHandle(), [](auto ctx) {
+        reinterpret_cast<SqliteBackend *>(ctx)->notifyTransaction(false);
+    }, this);
+
+    // check if db needs to be initialized
+    if(!this->db->tableExists(kMetaTableName)) {
+        PLOG_WARNING << "db is empty! initializing schema";
+        this->initSchema();
+    }
+
+    // validate schema version
+    auto versionStr = this->getMetaValue("schema.version");
+    if(!versionStr) {
+        throw std::logic_error("failed to get schema version!");
+    }
+
+    const auto version = std::stoul(*versionStr);
+    PLOG_DEBUG << "Current schema version: " << version;
+
+    if(version > kCurrentSchemaVersion) {
+        throw std::runtime_error(fmt::format("unsupported schema version {} (expected {})",
+                    version, kCurrentSchemaVersion));
+    } else if(version < kCurrentSchemaVersion) {
+        PLOG_WARNING << "upgrading db schema from version " << version;
+        this->upgradeSchema(version);
+    }
+
+    this->rebuildKeyFilter();
+}
+
+/**
+ * @brief Apply the default schema to the database
+ *
+ * Create the default tables in the database, and fills in some metadata information.
+ */
+void SqliteBackend::initSchema() {
+    SQLite::Transaction txn(*this->db);
+
+    /*
+     * Create the metadata table
+     *
+     * This table holds general information about the contents of the data store, including the
+     * schema version and application version used to edit this data.
+     */
+    this->db->exec(R"STR(
+CREATE TABLE MetaInfo (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    key text,
+    value text
+);
+CREATE UNIQUE INDEX MetaInfo_i1 ON MetaInfo(key);
+)STR");
+
+    /*
+     * Create the property keys meta table
+     *
+     * It's used to hold the string property keys (used for accessing properties) and map them to
+     * an associated type, timestamps, and an unique id. Each key also has a version, which starts
+     * at 1 and is incremented every time the key is updated; and optionally, the time at which it
+     * expires (as Unix time, in milliseconds.)
+     *
+     * An index is created on the key for fast searching, and a partial index over the keys that
+     * expire, so they can be found without scanning all keys.
+     */
+    this->db->exec(R"STR(
+CREATE TABLE PropertyKeys (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    key text,
+    valueType integer,
+    createdAt datetime DEFAULT (strftime('%s','now')),
+    updatedAt datetime DEFAULT (strftime('%s','now')),
+    version integer NOT NULL DEFAULT 1,
+    expiresAt integer
+);
+CREATE UNIQUE INDEX PropertyKeys_i1 ON PropertyKeys(key);
+CREATE INDEX PropertyKeys_i2 ON PropertyKeys(expiresAt) WHERE expiresAt IS NOT NULL;
+)STR");
+
+    /*
+     * Create property value tables
+     *
+     * For each of the different value types, create one table that has a `value` column of the
+     * appropriate type. Splitting them out ensures that we don't accidentally coerce types between
+     * columns.
+     *
+     * A unique index is created on the `propertyId` column of each table; it also serves all
+     * lookups of a key's value.
+     */
+    this->db->exec(R"STR(
+CREATE TABLE PropertyValuesString (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    propertyId integer,
+    value text,
+    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
+);
+CREATE UNIQUE INDEX PropertyValuesString_i1 ON PropertyValuesString(propertyId);
+
+CREATE TABLE PropertyValuesBlob (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    propertyId integer,
+    value blob,
+    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
+);
+CREATE UNIQUE INDEX PropertyValuesBlob_i1 ON PropertyValuesBlob(propertyId);
+
+CREATE TABLE PropertyValuesInteger (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    propertyId integer,
+    value integer,
+    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
+);
+CREATE UNIQUE INDEX PropertyValuesInteger_i1 ON PropertyValuesInteger(propertyId);
+
+CREATE TABLE PropertyValuesReal (
+    id integer PRIMARY KEY AUTOINCREMENT,
+    propertyId integer,
+    value real,
+    FOREIGN KEY(propertyId) REFERENCES PropertyKeys(id) ON DELETE CASCADE
+);
+CREATE UNIQUE INDEX PropertyValuesReal_i1 ON PropertyValuesReal(propertyId);
+)STR");
+
+    /*
+     * Insert some metadata about the schema version, collect garbage, then commit the transaction
+     * to ensure the database on disk is updated.
+     */
+    SQLite::Statement insMeta(*this->db, "INSERT INTO MetaInfo(key, value) VALUES (:key, :value);");
+
+    insMeta.bind(":key", "creator.swversion");
+    insMeta.bind(":value", kVersion);
+    insMeta.exec();
+    insMeta.reset();
+
+    const auto now = std::chrono::system_clock::now();
+
+    insMeta.bind(":key", "creator.timestamp");
+    insMeta.bind(":value",
+            std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
+    insMeta.exec();
+    insMeta.reset();
+
+    insMeta.bind(":key", "schema.version");
+    insMeta.bind(":value", kCurrentSchemaVersion);
+    insMeta.exec();
+
+    // finally, commit the transaction so all changes are applied at once
+    txn.commit();
+}
+
+/**
+ * @brief Upgrade the schema of an existing database to the current version
+ *
+ * All changes are applied in a single transaction, so an interrupted upgrade leaves the database
+ * at its old version.
+ *
+ * @param fromVersion Current schema version of the database
+ */
+void SqliteBackend::upgradeSchema(const uint32_t fromVersion) {
+    SQLite::Transaction txn(*this->db);
+
+    // 1 -> 2: add key versions (existing keys start at version 1)
+    if(fromVersion < 2) {
+        this->db->exec("ALTER TABLE PropertyKeys ADD COLUMN version integer NOT NULL DEFAULT 1;");
+    }
+    // 2 -> 3: add key expiration times (existing keys never expire)
+    if(fromVersion < 3) {
+        this->db->exec(R"STR(
+ALTER TABLE PropertyKeys ADD COLUMN expiresAt integer;
+CREATE INDEX PropertyKeys_i2 ON PropertyKeys(expiresAt) WHERE expiresAt IS NOT NULL;
+)STR");
+    }
+    // 3 -> 4: drop the value table indexes that duplicated their unique propertyId indexes
+    if(fromVersion < 4) {
+        for(const auto type : kValueTypes) {
+            this->db->exec(fmt::format("DROP INDEX IF EXISTS {}_i2;", ValueTableName(type)));
+        }
+    }
+
+    SQLite::Statement stmt(*this->db, "UPDATE MetaInfo SET value = :value "
+            "WHERE key = 'schema.version';");
+    stmt.bind(":value", kCurrentSchemaVersion);
+    stmt.exec();
+
+    txn.commit();
+}
+
+/**
+ * @brief Retrieve the value of a metadata key
+ */
+std::optional<std::string> SqliteBackend::getMetaValue(const std::string_view &key) {
+    SQLite::Statement stmt(*this->db, "SELECT id, key, value FROM MetaInfo WHERE key = :keyName;");
+    stmt.bind(":keyName", std::string(key));
+
+    if(!stmt.executeStep()) {
+        // no such key
+        return std::nullopt;
+    }
+
+    // read out the value column
+    return static_cast<std::string>(stmt.getColumn("value"));
+}
+
+/**
+ * @brief Get the database's performance counters
+ */
+StorageBackend::Counters SqliteBackend::getCounters() {
+    Counters counters{
+        .statements = this->numStatements,
+    };
+
+    // page cache counters
+    int current, highwater;
+
+    if(sqlite3_db_status(this->db->getHandle(), SQLITE_DBSTATUS_CACHE_HIT, &current, &highwater,
+                false) == SQLITE_OK) {
+        counters.cacheHits = static_cast<uint64_t>(current);
+    }
+    if(sqlite3_db_status(this->db->getHandle(), SQLITE_DBSTATUS_CACHE_MISS, &current, &highwater,
+                false) == SQLITE_OK) {
+        counters.cacheMisses = static_cast<uint64_t>(current);
+    }
+    if(sqlite3_db_status(this->db->getHandle(), SQLITE_DBSTATUS_CACHE_WRITE, &current, &highwater,
+                false) == SQLITE_OK) {
+        counters.pageWrites = static_cast<uint64_t>(current);
+    }
+
+    // file size (ignore errors; we just report zero)
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(this->path, ec);
+    if(!ec) {
+        counters.diskSize = size;
+    }
+
+    // key filter
+    counters.filterBytes = this->keyFilter.getMemoryUsage();
+    counters.filterKeys = this->keyFilter.size();
+    counters.filterRebuilds = this->numFilterRebuilds;
+    counters.filterNegatives = this->numFilterNegatives;
+    counters.filterFalsePositives = this->numFilterFalsePositives;
+
+    return counters;
+}
+
+/**
+ * @brief Rebuild the key filter from the names of all keys in the database
+ *
+ * The filter is sized for twice the current number of keys, so it can take some growth before
+ * it needs to be rebuilt again.
+ *
+ * @remark This must not be called while a transaction is in progress: if it's rolled back, keys
+ *         deleted in it would be missing from the filter.
+ */
+void SqliteBackend::rebuildKeyFilter() {
+    const auto start = std::chrono::steady_clock::now();
+
+    SQLite::Statement countStmt(*this->db, "SELECT COUNT(*) FROM PropertyKeys;");
+    countStmt.executeStep();
+    const auto numKeys = static_cast<size_t>(countStmt.getColumn(0).getInt64());
+
+    this->keyFilter.reset(std::max(numKeys * 2, kMinKeyFilterCapacity));
+
+    SQLite::Statement stmt(*this->db, "SELECT key FROM PropertyKeys;");
+    while(stmt.executeStep()) {
+        const auto column = stmt.getColumn(0);
+        this->keyFilter.add(std::string_view(column.getText(), column.getBytes()));
+    }
+
+    this->numFilterRemoved = 0;
+    this->keyFilterStale = false;
+    this->numFilterRebuilds++;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    PLOG_DEBUG << "rebuilt key filter: " << this->keyFilter.size() << " keys, "
+        << this->keyFilter.getMemoryUsage() << " bytes, took " << elapsed.count() << " µs";
+}
+
+/**
+ * @brief Test whether a key may exist, according to the key filter
+ *
+ * @return Whether the key may exist; if false, it definitely doesn't
+ */
+bool SqliteBackend::mayExist(const std::string_view &name) {
+    if(this->keyFilter.mayContain(name)) {
+        return true;
+    }
+
+    this->numFilterNegatives++;
+    return false;
+}
+
+/**
+ * @brief Add the name of a newly inserted key to the key filter
+ *
+ * If the filter has grown past its capacity, it's rebuilt (with a larger capacity) at the end of
+ * the current transaction.
+ */
+void SqliteBackend::addToKeyFilter(const std::string_view &name) {
+    this->keyFilter.add(name);
+
+    if(this->keyFilter.size() > this->keyFilter.getCapacity()) {
+        this->keyFilterStale = true;
+    }
+    if(this->keyFilterStale && sqlite3_get_autocommit(this->db->getHandle())) {
+        this->rebuildKeyFilter();
+    }
+}
+
+/**
+ * @brief Account for keys deleted from the database
+ *
+ * Their names remain in the key filter; once enough keys were deleted that this noticeably
+ * raises its false positive rate, it's rebuilt at the end of the current transaction.
+ *
+ * @param numKeys Number of keys that were deleted
+ */
+void SqliteBackend::removedFromKeyFilter(const size_t numKeys) {
+    this->numFilterRemoved += numKeys;
+
+    if(this->numFilterRemoved > this->keyFilter.getCapacity() / 4) {
+        this->keyFilterStale = true;
+    }
+    if(this->keyFilterStale && sqlite3_get_autocommit(this->db->getHandle())) {
+        this->rebuildKeyFilter();
+    }
+}
+
+
+
+/**
+ * @brief Start a transaction
+ */
+void SqliteBackend::begin() {
+    this->db->exec("BEGIN;");
+}
+
+/**
+ * @brief Start a transaction for a bulk load
+ *
+ * The transaction is exclusive, and foreign key checks are disabled for its duration (since the
+ * rows new keys reference are inserted right alongside them.) Statements to insert keys are
+ * prepared once, for all keys.
+ */
+void SqliteBackend::beginBulkLoad() {
+    // foreign key enforcement can't be changed inside a transaction
+    this->db->exec("PRAGMA foreign_keys = OFF;");
+
+    try {
+        this->db->exec("BEGIN EXCLUSIVE;");
+    } catch(const std::exception &) {
+        this->db->exec("PRAGMA foreign_keys = ON;");
+        throw;
+    }
+
+    this->bulk = std::make_unique<BulkLoad>();
+
+    try {
+        this->bulk->info = std::make_unique<SQLite::Statement>(*this->db,
+                "SELECT id FROM PropertyKeys WHERE key = :keyName;");
+        this->bulk->insertKey = std::make_unique<SQLite::Statement>(*this->db,
+                "INSERT INTO PropertyKeys (key, valueType) VALUES (:key, :type);");
+
+        for(const auto type : kValueTypes) {
+            this->bulk->insertValue[static_cast<size_t>(type)] =
+                std::make_unique<SQLite::Statement>(*this->db, fmt::format(
+                            "INSERT INTO {} (propertyId, value) VALUES (:keyId, :value);",
+                            ValueTableName(type)));
+        }
+    } catch(const std::exception &) {
+        this->rollback();
+        throw;
+    }
+}
+
+/**
+ * @brief Commit the current transaction
+ *
+ * The key filter is rebuilt afterwards, if the transaction inserted or deleted enough keys.
+ */
+void SqliteBackend::commit() {
+    this->db->exec("COMMIT;");
+    this->finishBulkLoad();
+
+    if(this->keyFilterStale) {
+        this->rebuildKeyFilter();
+    }
+}
+
+/**
+ * @brief Roll back the current transaction
+ */
+void SqliteBackend::rollback() {
+    try {
+        this->db->exec("ROLLBACK;");
+    } catch(const std::exception &) {
+        this->finishBulkLoad();
+        throw;
+    }
+
+    this->finishBulkLoad();
+
+    if(this->keyFilterStale) {
+        this->rebuildKeyFilter();
+    }
+}
+
+/**
+ * @brief Clean up after a bulk load, if one was in progress
+ *
+ * The prepared statements are released, and foreign key checks enabled again.
+ */
+void SqliteBackend::finishBulkLoad() {
+    if(!this->bulk) {
+        return;
+    }
+
+    this->bulk.reset();
+    this->db->exec("PRAGMA foreign_keys = ON;");
+}
+
+
+
+/**
+ * @brief Read a key
+ *
+ * The key and its value are read with a single query; keys that the key filter rules out aren't
+ * queried at all.
+ *
+ * @throw std::logic_error Database consistency error
+ */
+std::optional<StorageBackend::Record> SqliteBackend::get(const std::string_view &name) {
+    if(!this->mayExist(name)) {
+        return std::nullopt;
+    }
+
+    SQLite::Statement stmt(*this->db, kSelectKeyQuery);
+    stmt.bind(":keyName", std::string(name));
+
+    if(!stmt.executeStep()) {
+        this->numFilterFalsePositives++;
+        return std::nullopt;
+    }
+
+    const uint32_t valueType = stmt.getColumn(1);
+    Record record{
+        .value = ValueFromColumns(stmt, valueType, 4),
+        .version = static_cast<uint64_t>(static_cast<long long>(stmt.getColumn(2))),
+        .expiresAt = ExpiryFromColumn(stmt.getColumn(3)),
+    };
+
+    if(std::holds_alternative<std::monostate>(record.value)) {
+        throw std::logic_error(fmt::format("property '{}' ({}) (type ${:x}) has no value!", name,
+                    stmt.getColumn(0).getInt64(), valueType));
+    }
+
+    return record;
+}
+
+/**
+ * @brief Read keys in name order
+ */
+void SqliteBackend::scan(const std::string_view &after, const size_t limit,
+        const ScanCallback &visit) {
+    SQLite::Statement stmt(*this->db, R"STR(
+SELECT k.key, k.valueType, k.version, k.expiresAt, s.value, b.value, i.value, r.value
+    FROM PropertyKeys k
+    LEFT JOIN PropertyValuesString s ON s.propertyId = k.id
+    LEFT JOIN PropertyValuesBlob b ON b.propertyId = k.id
+    LEFT JOIN PropertyValuesInteger i ON i.propertyId = k.id
+    LEFT JOIN PropertyValuesReal r ON r.propertyId = k.id
+    WHERE k.key > :after ORDER BY k.key LIMIT :limit;
+)STR");
+    stmt.bind(":after", std::string(after));
+    stmt.bind(":limit", static_cast<int64_t>(limit));
+
+    while(stmt.executeStep()) {
+        std::string name = stmt.getColumn(0);
+        visit(std::move(name), {
+            .value = ValueFromColumns(stmt, stmt.getColumn(1), 4),
+            .version = static_cast<uint64_t>(static_cast<long long>(stmt.getColumn(2))),
+            .expiresAt = ExpiryFromColumn(stmt.getColumn(3)),
+        });
+    }
+}
+
+/**
+ * @brief Check whether the given key path has child keys
+ *
+ * Queries whether there exist any keys whose name starts with the specified key path.
+ */
+bool SqliteBackend::hasChildren(const std::string_view &name) {
+    SQLite::Statement stmt(*this->db, "SELECT COUNT(*) FROM PropertyKeys WHERE key LIKE :keyPrefix;");
+    stmt.bind(":keyPrefix", fmt::format("{}.%", name));
+
+    if(!stmt.executeStep()) {
+        return false;
+    }
+    return static_cast<long long>(stmt.getColumn(0)) != 0;
+}
+
+/**
+ * @brief Get all keys with an expiration time
+ *
+ * This is served by a partial index, so it doesn't need to scan all keys.
+ */
+std::vector<std::pair<std::string, StorageBackend::ExpiryTime>> SqliteBackend::getExpiring() {
+    std::vector<std::pair<std::string, ExpiryTime>> keys;
+
+    SQLite::Statement stmt(*this->db, "SELECT key, expiresAt FROM PropertyKeys "
+            "WHERE expiresAt IS NOT NULL;");
+
+    while(stmt.executeStep()) {
+        keys.emplace_back(stmt.getColumn(0).getString(),
+                ExpiryFromMsec(static_cast<long long>(stmt.getColumn(1))));
+    }
+
+    return keys;
+}
+
+
+
+/**
+ * @brief Read and modify a key
+ *
+ * The key (including its value) is read with a single query; if the callback changes it, only the
+ * rows that need to change are written.
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+void SqliteBackend::update(const std::string_view &name, const UpdateCallback &callback) {
+    std::optional<Record> record;
+    int64_t keyId{0};
+    auto oldValueType{PropertyValueType::Null};
+
+    if(this->mayExist(name)) {
+        SQLite::Statement stmt(*this->db, kSelectKeyQuery);
+        stmt.bind(":keyName", std::string(name));
+
+        if(stmt.executeStep()) {
+            keyId = stmt.getColumn(0).getInt64();
+            oldValueType = static_cast<PropertyValueType>(stmt.getColumn(1).getUInt());
+
+            record = Record{
+                .value = ValueFromColumns(stmt, static_cast<uint32_t>(oldValueType), 4),
+                .version = static_cast<uint64_t>(static_cast<long long>(stmt.getColumn(2))),
+                .expiresAt = ExpiryFromColumn(stmt.getColumn(3)),
+            };
+        } else {
+            this->numFilterFalsePositives++;
+        }
+    }
+
+    const auto oldRecord = record;
+    if(!callback(record)) {
+        return;
+    }
+
+    if(!oldRecord) {
+        if(record) {
+            this->insertKey(name, *record);
+        }
+    } else if(!record) {
+        // the associated PropertyValues* entry is deleted by constraint
+        SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE id = :keyId;");
+        stmt.bind(":keyId", keyId);
+        stmt.exec();
+
+        this->removedFromKeyFilter(1);
+    } else {
+        this->updateKey(keyId, oldValueType, *oldRecord, *record);
+    }
+}
+
+/**
+ * @brief Change the value of an existing key of the same type
+ *
+ * Instead of reading the key first, the value row is updated by a single statement, which only
+ * matches if the key exists with the same type, and only writes if the value differs; the id of
+ * the key is returned from the written row. Then, the key row is updated, returning its new
+ * version.
+ *
+ * This is deliberately not an `INSERT … ON CONFLICT` upsert: those allocate a new row id (and
+ * thus write to `sqlite_sequence`) even if nothing is inserted, so writes of a key's current
+ * value would no longer be free.
+ *
+ * @return New version of the key, if its value was replaced
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+std::optional<uint64_t> SqliteBackend::replace(const std::string_view &name,
+        const PropertyValue &value) {
+    const auto type = TypeForValue(value);
+    if(type == PropertyValueType::Null || !this->keyFilter.mayContain(name)) {
+        return std::nullopt;
+    }
+
+    int64_t keyId;
+    {
+        SQLite::Statement stmt(*this->db, fmt::format(R"STR(
+UPDATE {} SET value = :value
+    WHERE propertyId = (SELECT id FROM PropertyKeys WHERE key = :keyName AND valueType = :type)
+        AND value IS NOT :value
+    RETURNING propertyId;
+)STR", ValueTableName(type)));
+        stmt.bind(":keyName", std::string(name));
+        stmt.bind(":type", static_cast<uint32_t>(type));
+        BindValue(stmt, ":value", value);
+
+        // no such key, different type or same value
+        if(!stmt.executeStep()) {
+            return std::nullopt;
+        }
+        keyId = stmt.getColumn(0).getInt64();
+    }
+
+    SQLite::Statement stmt(*this->db, "UPDATE PropertyKeys SET version = version + 1, "
+            "updatedAt = strftime('%s','now') WHERE id = :keyId RETURNING version;");
+    stmt.bind(":keyId", keyId);
+
+    if(!stmt.executeStep()) {
+        throw std::runtime_error("failed to update property key");
+    }
+    return static_cast<uint64_t>(stmt.getColumn(0).getInt64());
+}
+
+/**
+ * @brief Create a key, unless it already exists
+ *
+ * During bulk loads, the key is looked up and inserted with statements prepared once for all keys.
+ *
+ * @return Whether the key was created
+ */
+bool SqliteBackend::insert(const std::string_view &name, const PropertyValue &value) {
+    if(!this->bulk) {
+        return StorageBackend::insert(name, value);
+    }
+
+    // check whether the key exists (unless the key filter rules it out)
+    if(this->mayExist(name)) {
+        auto &info = *this->bulk->info;
+        info.bind(":keyName", std::string(name));
+        const bool exists = info.executeStep();
+        info.reset();
+
+        if(exists) {
+            return false;
+        }
+        this->numFilterFalsePositives++;
+    }
+
+    // insert the key row…
+    const auto type = TypeForValue(value);
+    auto &insertKey = *this->bulk->insertKey;
+
+    insertKey.bind(":key", std::string(name));
+    insertKey.bind(":type", static_cast<long>(type));
+
+    if(!insertKey.exec()) {
+        throw std::runtime_error("failed to insert property key info");
+    }
+    insertKey.reset();
+
+    // …and the value row, if needed
+    if(type != PropertyValueType::Null) {
+        auto &stmt = *this->bulk->insertValue[static_cast<size_t>(type)];
+        stmt.bind(":keyId", this->db->getLastInsertRowid());
+        BindValue(stmt, ":value", value);
+
+        if(!stmt.exec()) {
+            throw std::runtime_error("failed to insert property key value");
+        }
+        stmt.reset();
+    }
+
+    this->addToKeyFilter(name);
+    return true;
+}
+
+/**
+ * @brief Update the "last modified" timestamp of a key, without changing its version
+ */
+void SqliteBackend::touch(const std::string_view &name) {
+    SQLite::Statement stmt(*this->db, "UPDATE PropertyKeys SET updatedAt = strftime('%s','now') "
+            "WHERE key = :keyName;");
+    stmt.bind(":keyName", std::string(name));
+
+    if(!stmt.exec()) {
+        throw std::runtime_error("failed to update property key timestamp");
+    }
+}
+
+/**
+ * @brief Delete a key
+ *
+ * Only the key's row is deleted; its value is deleted by constraint.
+ */
+size_t SqliteBackend::remove(const std::string_view &name) {
+    SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE key = :keyName;");
+    stmt.bind(":keyName", std::string(name));
+
+    const auto numRemoved = stmt.exec();
+    this->removedFromKeyFilter(numRemoved);
+    return numRemoved;
+}
+
+/**
+ * @brief Delete all children of a key
+ */
+size_t SqliteBackend::removeChildren(const std::string_view &name) {
+    SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE key LIKE :keyPrefix;");
+    // match _at least_ one extra character after prefix (should be a period)
+    stmt.bind(":keyPrefix", fmt::format("{}.%", name));
+
+    const auto numRemoved = stmt.exec();
+    this->removedFromKeyFilter(numRemoved);
+    return numRemoved;
+}
+
+/**
+ * @brief Delete a key, if it has an expiration time
+ */
+bool SqliteBackend::removeExpiring(const std::string_view &name) {
+    SQLite::Statement stmt(*this->db, "DELETE FROM PropertyKeys WHERE key = :keyName AND "
+            "expiresAt IS NOT NULL;");
+    stmt.bind(":keyName", std::string(name));
+
+    const auto numRemoved = stmt.exec();
+    this->removedFromKeyFilter(numRemoved);
+    return numRemoved != 0;
+}
+
+
+
+/**
+ * @brief Insert a new key in the data store
+ *
+ * Allocate a new row into the data store, including a new value row if needed.
+ *
+ * @param keyName Name of the new key
+ * @param record Value, version and expiration time of the new key
+ *
+ * @throw std::runtime_error Database consistency errors
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+void SqliteBackend::insertKey(const std::string_view &keyName, const Record &record) {
+    int err;
+
+    // validate inputs
+    if(keyName.empty()) {
+        throw std::invalid_argument("invalid name");
+    } else if(std::holds_alternative<std::monostate>(record.value)) {
+        throw std::invalid_argument("invalid value");
+    }
+
+    // insert the key row
+    const auto type = TypeForValue(record.value);
+
+    PLOG_DEBUG << "set key '" << keyName << "' type " << (uint32_t) type;
+
+    SQLite::Statement infoStmt(*this->db, "INSERT INTO PropertyKeys (key, valueType, version, "
+            "expiresAt) VALUES (:key, :type, :version, :expiresAt);");
+    infoStmt.bind(":key", std::string(keyName));
+    infoStmt.bind(":type", static_cast<long>(type));
+    infoStmt.bind(":version", static_cast<int64_t>(record.version));
+    BindExpiry(infoStmt, ":expiresAt", record.expiresAt);
+
+    err = infoStmt.exec();
+    if(!err) {
+        throw std::runtime_error("failed to insert property key info");
+    }
+
+    const auto keyId = this->db->getLastInsertRowid();
+    PLOG_VERBOSE << "inserted key '" << keyName << "': " << keyId;
+
+    // if value is non-null, insert a value row
+    if(type != PropertyValueType::Null) {
+        SQLite::Statement valueStmt(*this->db, fmt::format("INSERT INTO {} (propertyId, value) "
+                "VALUES(:keyId, :value);", ValueTableName(type)));
+        valueStmt.bind(":keyId", keyId);
+        BindValue(valueStmt, ":value", record.value);
+
+        err = valueStmt.exec();
+        if(!err) {
+            throw std::runtime_error("failed to insert property key value");
+        }
+    }
+
+    this->addToKeyFilter(keyName);
+}
+
+/**
+ * @brief Update an existing key
+ *
+ * The value row is only written if the value changed; the key row is always updated, which also
+ * updates its "last modified" timestamp.
+ *
+ * @param keyId Primary key id of the key to update
+ * @param oldValueType Type of the old value of this property
+ * @param oldRecord Record of the key as it is in the database
+ * @param newRecord Record to write
+ *
+ * @remark This should be wrapped in an outer transaction.
+ */
+void SqliteBackend::updateKey(const int64_t keyId, const PropertyValueType oldValueType,
+        const Record &oldRecord, const Record &newRecord) {
+    const auto newValueType = TypeForValue(newRecord.value);
+
+    PLOG_WARNING << "update key " << keyId << " old type " << (uint32_t) oldValueType << " new "
+        << (uint32_t) newValueType;
+
+    // delete old value row, if the type changed
+    if(oldValueType != newValueType && oldValueType != PropertyValueType::Null) {
+        SQLite::Statement delValStmt(*this->db, fmt::format("DELETE FROM {} "
+                    "WHERE propertyId = :keyId;", ValueTableName(oldValueType)));
+        delValStmt.bind(":keyId", keyId);
+        delValStmt.exec();
+    }
+
+    // insert (or update) a value row
+    if(newValueType != PropertyValueType::Null &&
+            (oldValueType != newValueType || oldRecord.value != newRecord.value)) {
+        SQLite::Statement stmt(*this->db, fmt::format("INSERT INTO {} (propertyId, value) "
+                    "VALUES (:keyId, :value) ON CONFLICT(propertyId) DO UPDATE SET value=:value",
+                ValueTableName(newValueType)));
+        stmt.bind(":keyId", keyId);
+        BindValue(stmt, ":value", newRecord.value);
+
+        if(!stmt.exec()) {
+            throw std::runtime_error("failed to upsert value");
+        }
+    }
+
+    // update the key's type, version, expiration and "last modified" timestamp
+    SQLite::Statement stmt(*this->db, "UPDATE PropertyKeys SET valueType = :valueType, "
+            "version = :version, expiresAt = :expiresAt, updatedAt = strftime('%s','now') "
+            "WHERE id = :keyId;");
+    stmt.bind(":keyId", keyId);
+    stmt.bind(":valueType", static_cast<uint32_t>(newValueType));
+    stmt.bind(":version", static_cast<int64_t>(newRecord.version));
+    BindExpiry(stmt, ":expiresAt", newRecord.expiresAt);
+
+    if(!stmt.exec()) {
+        throw std::runtime_error("failed to update property key");
+    }
+}
+
+/**
+ * @brief Decode a key's value from a query result
+ *
+ * The query must return the value columns of the string, blob, integer and real value tables (in
+ * that order) starting at the given column; only the column for the key's type is read.
+ *
+ * @param stmt Statement positioned on the row to read
+ * @param valueType Value type of the key
+ * @param firstColumn Index of the string value column
+ *
+ * @return Value of the key, or std::monostate if its value row is missing
+ *
+ * @throw std::logic_error Unsupported value type
+ */
+PropertyValue SqliteBackend::ValueFromColumns(SQLite::Statement &stmt, const uint32_t valueType,
+        const int firstColumn) {
+    switch(static_cast<PropertyValueType>(valueType)) {
+        case PropertyValueType::Null:
+            return nullptr;
+        case PropertyValueType::String: {
+            const auto column = stmt.getColumn(firstColumn);
+            return column.isNull() ? PropertyValue() : column.getString();
+        }
+        case PropertyValueType::Blob: {
+            const auto column = stmt.getColumn(firstColumn + 1);
+            if(column.isNull()) {
+                return std::monostate();
+            }
+
+            auto bytePtr = reinterpret_cast<const std::byte *>(column.getBlob());
+            return Blob(bytePtr, bytePtr + column.getBytes());
+        }
+        case PropertyValueType::Integer: {
+            const auto column = stmt.getColumn(firstColumn + 2);
+            return column.isNull() ? PropertyValue() :
+                static_cast<uint64_t>(static_cast<long long>(column));
+        }
+        case PropertyValueType::Real: {
+            const auto column = stmt.getColumn(firstColumn + 3);
+            return column.isNull() ? PropertyValue() : static_cast<double>(column);
+        }
+
+        default:
+            throw std::logic_error(fmt::format("unsupported value type ${:x}", valueType));
+    }
+}
+
+/**
+ * @brief Decode a key's expiration time from a query result
+ *
+ * @return Expiration time, or nothing if the column is null
+ */
+std::optional<StorageBackend::ExpiryTime> SqliteBackend::ExpiryFromColumn(
+        const SQLite::Column &column) {
+    if(column.isNull()) {
+        return std::nullopt;
+    }
+    return ExpiryFromMsec(column.getInt64());
+}
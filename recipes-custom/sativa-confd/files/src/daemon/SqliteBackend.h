@@ -0,0 +1,255 @@
+#ifndef SQLITEBACKEND_H
+#define SQLITEBACKEND_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "BloomFilter.h"
+#include "StorageBackend.h"
+#include "Types.h"
+
+/**
+ * @brief Storage backend on an sqlite database
+ *
+ * This is a thin wrapper around an sqlite3 database (which in turn is provided by SQLiteCpp) which
+ * actually holds all of the configuration data. Keys are stored in one table, and their values in
+ * separate tables for each type of value.
+ *
+ * The database is opened through the counting VFS, so all I/O on it is accounted for in the flash
+ * wear statistics.
+ *
+ * A Bloom filter over the names of all keys is held in memory, so that lookups of keys that don't
+ * exist usually don't need a query at all. It's built when the database is opened, and names are
+ * added as keys are inserted; since names can't be removed from it, it's rebuilt once enough keys
+ * were deleted (or it's grown past its capacity.) Rebuilds only happen outside of transactions,
+ * so the filter never misses keys that come back when a transaction is rolled back.
+ */
+class SqliteBackend: public StorageBackend {
+    public:
+        SqliteBackend(const std::filesystem::path &dbPath);
+
+        const char *getName() const override {
+            return "sqlite";
+        }
+        Counters getCounters() override;
+
+        void begin() override;
+        void beginBulkLoad() override;
+        void commit() override;
+        void rollback() override;
+
+        std::optional<Record> get(const std::string_view &name) override;
+        void scan(const std::string_view &after, const size_t limit,
+                const ScanCallback &visit) override;
+        bool hasChildren(const std::string_view &name) override;
+        std::vector<std::pair<std::string, ExpiryTime>> getExpiring() override;
+
+        void update(const std::string_view &name, const UpdateCallback &callback) override;
+        std::optional<uint64_t> replace(const std::string_view &name,
+                const PropertyValue &value) override;
+        bool insert(const std::string_view &name, const PropertyValue &value) override;
+        void touch(const std::string_view &name) override;
+        size_t remove(const std::string_view &name) override;
+        size_t removeChildren(const std::string_view &name) override;
+        bool removeExpiring(const std::string_view &name) override;
+
+    private:
+        /// Name of the metadata table
+        constexpr static const char *kMetaTableName{"MetaInfo"};
+        /**
+         * @brief Current schema version
+         *
+         * This integer value defines the database schema version. It's expected to be a
+         * monotonically increasing value, where numerically higher values indicate newer schemas.
+         *
+         * - 1: Initial version
+         * - 2: Added per-key version numbers (the `version` column of `PropertyKeys`)
+         * - 3: Added key expiration times (the `expiresAt` column of `PropertyKeys`)
+         * - 4: Dropped the redundant `PropertyValues*` `_i2` indexes
+         */
+        constexpr static const uint32_t kCurrentSchemaVersion{4};
+
+        /// Minimum number of keys the key filter is sized for
+        constexpr static const size_t kMinKeyFilterCapacity{1024};
+
+        /**
+         * @brief Property value types
+         *
+         * This enum defines the numeric values for the `valueType` columnn in the `PropertyKeys`
+         * table, which is used to store the keys (names) and types of properties.
+         */
+        enum class PropertyValueType: uint32_t {
+            /// No associated data
+            Null                        = 0,
+            /// UTF-8 encoded string
+            String                      = 1,
+            /// Raw, unformatted binary data
+            Blob                        = 2,
+            /// Unsigned integer
+            Integer                     = 3,
+            /// Floating point (decimal) number
+            Real                        = 4,
+        };
+        /// All value types that have a value table
+        constexpr static const std::array kValueTypes{PropertyValueType::String,
+            PropertyValueType::Blob, PropertyValueType::Integer, PropertyValueType::Real};
+
+        /**
+         * @brief State of an ongoing bulk load
+         *
+         * Statements used to insert keys are prepared once, and reused for every key.
+         */
+        struct BulkLoad {
+            /// Look up the id of a key
+            std::unique_ptr<SQLite::Statement> info;
+            /// Insert a key row
+            std::unique_ptr<SQLite::Statement> insertKey;
+            /// Insert a value row, indexed by value type
+            std::array<std::unique_ptr<SQLite::Statement>, kValueTypes.size() + 1> insertValue;
+        };
+
+        void initSchema();
+        void upgradeSchema(const uint32_t fromVersion);
+        std::optional<std::string> getMetaValue(const std::string_view &key);
+
+        void finishBulkLoad();
+
+        void rebuildKeyFilter();
+        bool mayExist(const std::string_view &name);
+        void addToKeyFilter(const std::string_view &name);
+        void removedFromKeyFilter(const size_t numKeys);
+
+        void insertKey(const std::string_view &keyName, const Record &record);
+        void updateKey(const int64_t keyId, const PropertyValueType oldValueType,
+                const Record &oldRecord, const Record &newRecord);
+
+        static PropertyValue ValueFromColumns(SQLite::Statement &stmt, const uint32_t valueType,
+                const int firstColumn);
+        static std::optional<ExpiryTime> ExpiryFromColumn(const SQLite::Column &column);
+
+        /// Get the name of the table containing values of the given type
+        constexpr static std::string_view ValueTableName(const PropertyValueType t) {
+            switch(t) {
+                case PropertyValueType::String:
+                    return "PropertyValuesString";
+                case PropertyValueType::Blob:
+                    return "PropertyValuesBlob";
+                case PropertyValueType::Integer:
+                    return "PropertyValuesInteger";
+                case PropertyValueType::Real:
+                    return "PropertyValuesReal";
+                default:
+                    return "";
+            }
+        }
+        /// Get the property value type enum (to store in the db) for a given value type
+        constexpr static inline PropertyValueType TypeForValue(const PropertyValue &val) {
+            return std::visit([](auto&& arg) -> PropertyValueType {
+                using T = std::decay_t<decltype(arg)>;
+                if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                    return PropertyValueType::Null;
+                }
+                else if constexpr (std::is_same_v<T, std::string>) {
+                    return PropertyValueType::String;
+                }
+                else if constexpr (std::is_same_v<T, Blob>) {
+                    return PropertyValueType::Blob;
+                }
+                else if constexpr (std::is_same_v<T, uint64_t>) {
+                    return PropertyValueType::Integer;
+                }
+                else if constexpr (std::is_same_v<T, double>) {
+                    return PropertyValueType::Real;
+                }
+                // booleans are stored as integers
+                else if constexpr (std::is_same_v<T, bool>) {
+                    return PropertyValueType::Integer;
+                }
+                // any other types get mapped as null as well (in this case, monostate)
+                else {
+                    return PropertyValueType::Null;
+                }
+            }, val);
+        }
+
+        /**
+         * @brief Bind property value to SQL statement
+         *
+         * @param stmt Statement to bind to
+         * @param colName Column name to bind the value to
+         * @param value Value to bind
+         */
+        static inline void BindValue(SQLite::Statement &stmt, const std::string_view &colName,
+                const PropertyValue &value) {
+            std::visit([&](auto&& arg) {
+                using T = std::decay_t<decltype(arg)>;
+
+                if constexpr(std::is_same_v<T, std::string>) {
+                    stmt.bind(colName.data(), arg);
+                }
+                else if constexpr(std::is_same_v<T, Blob>) {
+                    stmt.bind(colName.data(), static_cast<const void *>(arg.data()), arg.size());
+                }
+                else if constexpr(std::is_same_v<T, uint64_t>) {
+                    stmt.bind(colName.data(), static_cast<int64_t>(arg));
+                }
+                else if constexpr(std::is_same_v<T, double>) {
+                    stmt.bind(colName.data(), arg);
+                }
+                else if constexpr(std::is_same_v<T, bool>) {
+                    stmt.bind(colName.data(), arg);
+                }
+                // other types should never get through to here
+                else {
+                    throw std::logic_error("invalid type for set");
+                }
+            }, value);
+        }
+        /// Bind an expiration time (or null, if there is none) to an SQL statement
+        static inline void BindExpiry(SQLite::Statement &stmt, const std::string_view &colName,
+                const std::optional<ExpiryTime> &expiresAt) {
+            if(expiresAt) {
+                stmt.bind(colName.data(), ExpiryToMsec(*expiresAt));
+            } else {
+                stmt.bind(colName.data());
+            }
+        }
+
+    private:
+        /// storage path on disk of the underlying sqlite database
+        std::filesystem::path path;
+        /// lock held on the database file, to exclude other processes
+        FileLock fileLock;
+
+        /// sqlite database holding data
+        std::unique_ptr<SQLite::Database> db;
+        /// State of the bulk load in progress, if any
+        std::unique_ptr<BulkLoad> bulk;
+
+        /// Number of statements executed (updated by the sqlite trace callback)
+        uint64_t numStatements{0};
+
+        /// Filter over the names of all keys
+        BloomFilter keyFilter;
+        /// Number of keys deleted since the key filter was last rebuilt
+        size_t numFilterRemoved{0};
+        /// Set when the key filter should be rebuilt, once no transaction is in progress
+        bool keyFilterStale{false};
+        /// Number of times the key filter was rebuilt
+        uint64_t numFilterRebuilds{0};
+        /// Number of lookups answered by the key filter alone
+        uint64_t numFilterNegatives{0};
+        /// Number of lookups of keys that passed the key filter, but didn't exist
+        uint64_t numFilterFalsePositives{0};
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <cbor.h>
+
+#include <cmath>
+
+#include "Stats.h"
+
+/**
+ * @brief Estimate a percentile value
+ *
+ * Determine the bucket in which the given percentile falls, and return its upper bound. This is
+ * only as precise as the bucket spacing allows, which is fine for spotting regressions.
+ *
+ * @param p Percentile to calculate, in the range [0, 1]
+ *
+ * @return Approximate percentile value, in µs
+ */
+uint64_t LatencyHistogram::percentile(const double p) const {
+    if(!this->count) {
+        return 0;
+    }
+
+    const auto target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(this->count)));
+    uint64_t seen{0};
+
+    for(size_t i = 0; i < kNumBuckets; i++) {
+        seen += this->buckets[i];
+        if(seen >= target) {
+            // upper bound of this bucket, but never above the largest sample we've seen
+            return std::min<uint64_t>(this->max, (1ULL << i));
+        }
+    }
+
+    return this->max;
+}
+
+/**
+ * @brief Encode the histogram as a CBOR map
+ *
+ * The map contains the total sample count, the minimum, maximum and mean sample, a few common
+ * percentiles, and the raw bucket counts. All times are specified in µs.
+ *
+ * @return CBOR map item; the caller is responsible for releasing it
+ */
+cbor_item_t *LatencyHistogram::serialize() const {
+    auto root = cbor_new_definite_map(8);
+
+    auto add = [&](const char *key, cbor_item_t *value) {
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string(key)),
+            .value = cbor_move(value)
+        });
+    };
+
+    add("count", cbor_build_uint64(this->count));
+    add("min", cbor_build_uint64(this->count ? this->min : 0));
+    add("max", cbor_build_uint64(this->max));
+    add("mean", cbor_build_uint64(this->count ? (this->sum / this->count) : 0));
+    add("p50", cbor_build_uint64(this->percentile(.5)));
+    add("p99", cbor_build_uint64(this->percentile(.99)));
+    add("p999", cbor_build_uint64(this->percentile(.999)));
+
+    auto buckets = cbor_new_definite_array(kNumBuckets);
+    for(const auto bucket : this->buckets) {
+        cbor_array_push(buckets, cbor_move(cbor_build_uint64(bucket)));
+    }
+    add("buckets", buckets);
+
+    return root;
+}
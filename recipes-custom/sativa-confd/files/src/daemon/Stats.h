@@ -0,0 +1,86 @@
+/**
+ * @file
+ *
+ * @brief Performance counters
+ *
+ * Provides small helpers used to record performance information (request counts, latencies) in
+ * the daemon, so that they can later be retrieved via the RPC interface.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+struct cbor_item_t;
+
+/**
+ * @brief Latency histogram
+ *
+ * Records durations into logarithmically spaced buckets: bucket 0 holds all samples below 1µs,
+ * and each subsequent bucket `n` holds samples in the range [2^(n-1), 2^n) µs. The last bucket
+ * additionally holds all samples that are larger than that.
+ *
+ * Recording a sample is just a few integer operations, so this is cheap enough to do for every
+ * request.
+ */
+class LatencyHistogram {
+    public:
+        /// Number of buckets (the last bucket starts at ~4 seconds)
+        constexpr static const size_t kNumBuckets{24};
+
+        /**
+         * @brief Record a sample
+         *
+         * @param duration Time interval to record
+         */
+        void record(const std::chrono::nanoseconds duration) {
+            const auto usec = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+            this->count++;
+            this->sum += usec;
+            this->min = std::min(this->min, usec);
+            this->max = std::max(this->max, usec);
+
+            this->buckets[BucketFor(usec)]++;
+        }
+
+        /// Get the total number of samples recorded
+        constexpr auto getCount() const {
+            return this->count;
+        }
+
+        uint64_t percentile(const double p) const;
+
+        cbor_item_t *serialize() const;
+
+    private:
+        /// Get the bucket index for a sample, in µs
+        constexpr static size_t BucketFor(const uint64_t usec) {
+            size_t bucket{0};
+            for(auto v = usec; v && bucket < (kNumBuckets - 1); v >>= 1) {
+                bucket++;
+            }
+            return bucket;
+        }
+
+    private:
+        /// Number of samples in each bucket
+        std::array<uint64_t, kNumBuckets> buckets{};
+
+        /// Total number of samples
+        uint64_t count{0};
+        /// Sum of all samples (in µs)
+        uint64_t sum{0};
+        /// Smallest sample (in µs)
+        uint64_t min{std::numeric_limits<uint64_t>::max()};
+        /// Largest sample (in µs)
+        uint64_t max{0};
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "StorageBackend.h"
+
+/**
+ * @brief Create a key, unless it already exists
+ *
+ * The new key starts out at version 1, and doesn't expire. Backends may override this with a
+ * faster way to insert keys, particularly during bulk loads.
+ *
+ * @param name Name of the key to create
+ * @param value Value of the new key
+ *
+ * @return Whether the key was created
+ */
+bool StorageBackend::insert(const std::string_view &name, const PropertyValue &value) {
+    bool inserted{false};
+
+    this->update(name, [&](auto &record) {
+        if(record) {
+            return false;
+        }
+
+        record.emplace(Record{.value = value});
+        inserted = true;
+        return true;
+    });
+
+    return inserted;
+}
+
+
+
+/**
+ * @brief Start a transaction
+ */
+StorageBackend::Transaction::Transaction(StorageBackend &backend) : backend(backend) {
+    backend.begin();
+}
+
+/**
+ * @brief Roll back the transaction, unless it's been committed
+ */
+StorageBackend::Transaction::~Transaction() {
+    if(this->committed) {
+        return;
+    }
+
+    try {
+        this->backend.rollback();
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to roll back transaction: " << e.what();
+    }
+}
+
+/**
+ * @brief Commit the transaction
+ */
+void StorageBackend::Transaction::commit() {
+    this->backend.commit();
+    this->committed = true;
+}
+
+
+
+/**
+ * @brief Lock the backend files at the given path
+ *
+ * The lock is taken on a separate `.lock` file, rather than the backend's files themselves:
+ * closing any file descriptor for a database would otherwise release sqlite's own locks on it.
+ *
+ * @param path Path on disk of the backend's files
+ *
+ * @throw std::system_error Failed to open the lock file, or it's locked by another process
+ */
+StorageBackend::FileLock::FileLock(const std::filesystem::path &path) {
+    auto lockPath = path;
+    lockPath += ".lock";
+
+    this->fd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(this->fd == -1) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open lock file '{}'", lockPath.native()));
+    }
+
+    if(flock(this->fd, LOCK_EX | LOCK_NB) == -1) {
+        const auto err = errno;
+        close(this->fd);
+
+        throw std::system_error(err, std::generic_category(),
+                fmt::format("lock '{}' (is the data store in use?)", lockPath.native()));
+    }
+}
+
+/**
+ * @brief Release the lock
+ */
+StorageBackend::FileLock::~FileLock() {
+    close(this->fd);
+}
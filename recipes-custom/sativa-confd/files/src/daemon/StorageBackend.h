@@ -0,0 +1,260 @@
+#ifndef STORAGEBACKEND_H
+#define STORAGEBACKEND_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Types.h"
+
+/**
+ * @brief Interface to the storage holding the data store's keys
+ *
+ * Backends store records (a key's value, version and expiration time) by key name, and know
+ * nothing about the rules for how keys may change: the data store decides that, and then tells
+ * the backend what to write. Keys are ordered by name, so that a key and all of its children
+ * (keys whose name starts with the key's name, followed by a period) are adjacent.
+ *
+ * All changes are made in transactions: either explicitly, between begin() and commit(), or
+ * implicitly around each individual change otherwise. Backends are not thread safe; the caller
+ * must serialize all accesses.
+ */
+class StorageBackend {
+    public:
+        /// Time at which a key expires
+        using ExpiryTime = std::chrono::system_clock::time_point;
+
+        /**
+         * @brief A key as stored by the backend
+         */
+        struct Record {
+            /// Current value (booleans are stored as integers)
+            PropertyValue value;
+            /// Version of the key; starts at 1, and is incremented every time it's updated
+            uint64_t version{1};
+            /// Time at which the key expires, if any
+            std::optional<ExpiryTime> expiresAt;
+        };
+
+        /**
+         * @brief Backend performance counters
+         *
+         * Counters that don't apply to a backend are left at zero.
+         */
+        struct Counters {
+            /// Number of SQL statements executed
+            uint64_t statements{0};
+            /// Page cache hits
+            uint64_t cacheHits{0};
+            /// Page cache misses
+            uint64_t cacheMisses{0};
+            /// Number of pages written to the database files by the page cache
+            uint64_t pageWrites{0};
+            /// Size of the backend's files on disk, in bytes
+            uint64_t diskSize{0};
+
+            /// Memory used by the filter of existing key names, in bytes
+            uint64_t filterBytes{0};
+            /// Number of key names added to the filter since it was last rebuilt
+            uint64_t filterKeys{0};
+            /// Number of times the filter was rebuilt
+            uint64_t filterRebuilds{0};
+            /// Number of lookups of missing keys answered by the filter alone
+            uint64_t filterNegatives{0};
+            /// Number of lookups of missing keys that passed the filter (false positives)
+            uint64_t filterFalsePositives{0};
+        };
+
+        /**
+         * @brief Callback deciding how to change a key
+         *
+         * It receives the key's current record (or nothing, if it doesn't exist) which it may
+         * modify in place, create, or reset to remove the key; and returns whether the changed
+         * record should be written.
+         */
+        using UpdateCallback = std::function<bool(std::optional<Record> &record)>;
+        /// Callback invoked for each key during a scan
+        using ScanCallback = std::function<void(std::string &&name, Record &&record)>;
+        /// Callback invoked when a transaction ends, with whether it was committed
+        using TransactionHook = std::function<void(const bool committed)>;
+
+        /**
+         * @brief Scoped transaction
+         *
+         * The transaction is rolled back when this object goes out of scope, unless it has been
+         * committed.
+         */
+        class Transaction {
+            public:
+                Transaction(StorageBackend &backend);
+                ~Transaction();
+
+                Transaction(const Transaction &) = delete;
+                Transaction &operator=(const Transaction &) = delete;
+
+                void commit();
+
+            private:
+                /// Backend in which the transaction was started
+                StorageBackend &backend;
+                /// Set once the transaction was committed
+                bool committed{false};
+        };
+
+    public:
+        virtual ~StorageBackend() = default;
+
+        /**
+         * @brief Install a callback to invoke when transactions end
+         *
+         * The callback is invoked when a transaction is committed, before its changes are
+         * written out (or after, if commitHookAfterWrite() says so); and after a transaction is
+         * rolled back. This includes implicit transactions.
+         */
+        void setTransactionHook(const TransactionHook &hook) {
+            this->transactionHook = hook;
+        }
+        /**
+         * @brief Whether commits are reported only once they've been written out
+         *
+         * Backends that can't undo a commit after writing it out report it afterwards, so that a
+         * commit that fails to be written is only reported as rolled back.
+         */
+        virtual bool commitHookAfterWrite() const {
+            return false;
+        }
+
+        /// Get the name of the backend, as used in the configuration
+        virtual const char *getName() const = 0;
+        /// Get the backend's performance counters
+        virtual Counters getCounters() = 0;
+
+        /// Start a transaction
+        virtual void begin() = 0;
+        /**
+         * @brief Start a transaction for loading many keys at once
+         *
+         * Backends may optimize for inserting many keys; by default, this is the same as begin().
+         */
+        virtual void beginBulkLoad() {
+            this->begin();
+        }
+        /// Commit the current transaction
+        virtual void commit() = 0;
+        /// Roll back the current transaction, discarding all changes made in it
+        virtual void rollback() = 0;
+
+        /// Get a key's record
+        virtual std::optional<Record> get(const std::string_view &name) = 0;
+        /**
+         * @brief Get keys in name order
+         *
+         * @param after Only visit keys whose name sorts after this one (pass an empty string to
+         *        start from the first key)
+         * @param limit Maximum number of keys to visit
+         * @param visit Callback invoked for each key
+         */
+        virtual void scan(const std::string_view &after, const size_t limit,
+                const ScanCallback &visit) = 0;
+        /// Test whether there are any children of the given key
+        virtual bool hasChildren(const std::string_view &name) = 0;
+        /// Get all keys that have an expiration time, and the times they expire
+        virtual std::vector<std::pair<std::string, ExpiryTime>> getExpiring() = 0;
+
+        /**
+         * @brief Read, and then modify a key
+         *
+         * @param name Name of the key to modify
+         * @param callback Callback deciding how to modify the key
+         */
+        virtual void update(const std::string_view &name, const UpdateCallback &callback) = 0;
+        /**
+         * @brief Change the value of an existing key, if that's all there is to do
+         *
+         * This is a shortcut for the most common update: the key exists with a (non-null) value
+         * of the same type, which differs from the new value. The value is replaced, and the
+         * key's version incremented; its expiration time is left as is. In all other cases,
+         * nothing is written, and the caller has to fall back to update().
+         *
+         * By default, nothing is ever written.
+         *
+         * @param name Name of the key to modify
+         * @param value New value of the key
+         *
+         * @return New version of the key, if its value was replaced
+         */
+        virtual std::optional<uint64_t> replace(const std::string_view &name,
+                const PropertyValue &value) {
+            (void) name, (void) value;
+            return std::nullopt;
+        }
+        virtual bool insert(const std::string_view &name, const PropertyValue &value);
+        /// Update a key's "last modified" timestamp, without changing it otherwise
+        virtual void touch(const std::string_view &name) = 0;
+        /// Remove a key; returns the number of keys removed
+        virtual size_t remove(const std::string_view &name) = 0;
+        /// Remove all children of a key (but not the key itself); returns the number removed
+        virtual size_t removeChildren(const std::string_view &name) = 0;
+        /// Remove a key, but only if it has an expiration time; returns whether it was removed
+        virtual bool removeExpiring(const std::string_view &name) = 0;
+
+        /**
+         * @brief Make all committed changes durable
+         *
+         * Backends that don't make committed changes durable right away need this to be called
+         * periodically; by default, it does nothing.
+         */
+        virtual void checkpoint() {}
+
+    protected:
+        /**
+         * @brief Advisory lock on a backend's files
+         *
+         * An exclusive lock on a file alongside the backend's files, held for as long as it is
+         * open. This ensures only a single process (either the daemon, or a tool using libconfd in
+         * embedded mode) writes to them at a time.
+         */
+        class FileLock {
+            public:
+                FileLock(const std::filesystem::path &path);
+                ~FileLock();
+
+                FileLock(const FileLock &) = delete;
+                FileLock &operator=(const FileLock &) = delete;
+
+            private:
+                /// File descriptor of the lock file
+                int fd{-1};
+        };
+
+        /// Invoke the transaction hook, if one is installed
+        void notifyTransaction(const bool committed) {
+            if(this->transactionHook) {
+                this->transactionHook(committed);
+            }
+        }
+
+        /// Convert an expiration time to how it's stored (Unix time, in ms)
+        constexpr static int64_t ExpiryToMsec(const ExpiryTime time) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                    time.time_since_epoch()).count();
+        }
+        /// Convert a stored expiration time to a time point
+        constexpr static ExpiryTime ExpiryFromMsec(const int64_t msec) {
+            return ExpiryTime(std::chrono::milliseconds(msec));
+        }
+
+    private:
+        /// Callback invoked when transactions end
+        TransactionHook transactionHook;
+};
+
+#endif
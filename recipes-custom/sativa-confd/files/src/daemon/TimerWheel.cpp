@@ -0,0 +1,140 @@
+#include <algorithm>
+
+#include "TimerWheel.h"
+
+/**
+ * @brief Schedule a key to expire
+ *
+ * If the key is already scheduled, its previous deadline is replaced.
+ *
+ * @param key Name of the key
+ * @param deadline Time at which the key expires; it's rounded up to the next tick, so keys never
+ *        expire early.
+ */
+void TimerWheel::schedule(const std::string_view &key, const Clock::time_point deadline) {
+    auto [it, inserted] = this->entries.try_emplace(std::string(key));
+    auto &entry = it->second;
+
+    if(!inserted) {
+        this->levels[entry.level][entry.slot].erase(entry.pos);
+    }
+
+    entry.deadline = std::max(this->tickFor(deadline) + 1, this->currentTick + 1);
+    this->place(it->first, entry);
+}
+
+/**
+ * @brief Cancel a key's expiration
+ *
+ * @param key Name of the key
+ *
+ * @return Whether the key was scheduled
+ */
+bool TimerWheel::cancel(const std::string_view &key) {
+    auto it = this->entries.find(std::string(key));
+    if(it == this->entries.end()) {
+        return false;
+    }
+
+    const auto &entry = it->second;
+    this->levels[entry.level][entry.slot].erase(entry.pos);
+    this->entries.erase(it);
+
+    return true;
+}
+
+/**
+ * @brief Advance the wheel to the current time
+ *
+ * Process all ticks that elapsed since the last call, cascading keys down to lower levels as
+ * needed, and collect the keys whose deadline has passed. These are no longer scheduled
+ * afterwards.
+ *
+ * @param now Current time
+ *
+ * @return Names of all keys that expired
+ */
+std::vector<std::string> TimerWheel::advance(const Clock::time_point now) {
+    constexpr static const uint64_t kSlotMask{kNumSlots - 1};
+
+    const auto target = this->tickFor(now);
+    std::vector<std::string> expired;
+
+    while(this->currentTick < target) {
+        // nothing to do until a key is scheduled again
+        if(this->entries.empty()) {
+            this->currentTick = target;
+            break;
+        }
+
+        const auto tick = ++this->currentTick;
+
+        // when a level wraps around, move the next slot of the level above it down
+        for(size_t level = 1; level < kNumLevels; level++) {
+            if(tick & ((1ULL << (kSlotBits * level)) - 1)) {
+                break;
+            }
+            this->cascade(level);
+        }
+
+        // then expire all keys in this tick's slot
+        Slot slot;
+        slot.swap(this->levels[0][tick & kSlotMask]);
+
+        for(const auto key : slot) {
+            auto it = this->entries.find(*key);
+            if(it->second.deadline <= tick) {
+                expired.emplace_back(std::move(this->entries.extract(it).key()));
+            } else {
+                this->place(it->first, it->second);
+            }
+        }
+    }
+
+    return expired;
+}
+
+/**
+ * @brief Insert a key into the slot for its deadline
+ *
+ * The level is chosen based on how far in the future the deadline is, relative to the current
+ * tick; deadlines past the range of the highest level are clamped to its last slot.
+ *
+ * @param key Name of the key (owned by the entries map)
+ * @param entry Entry for the key, whose position is updated
+ */
+void TimerWheel::place(const std::string &key, Entry &entry) {
+    const auto delta = std::max(entry.deadline, this->currentTick) - this->currentTick;
+    auto tick = std::max(entry.deadline, this->currentTick);
+
+    size_t level{0};
+    while(level < kNumLevels && delta >= (1ULL << (kSlotBits * (level + 1)))) {
+        level++;
+    }
+
+    if(level == kNumLevels) {
+        level = kNumLevels - 1;
+        tick = this->currentTick + (1ULL << (kSlotBits * kNumLevels)) - 1;
+    }
+
+    entry.level = static_cast<uint8_t>(level);
+    entry.slot = static_cast<uint8_t>((tick >> (kSlotBits * level)) & (kNumSlots - 1));
+
+    auto &slot = this->levels[level][entry.slot];
+    entry.pos = slot.insert(slot.end(), &key);
+}
+
+/**
+ * @brief Move all keys in the current slot of the given level to lower levels
+ *
+ * @param level Level to cascade (must be at least 1)
+ */
+void TimerWheel::cascade(const size_t level) {
+    Slot slot;
+    slot.swap(this->levels[level][(this->currentTick >> (kSlotBits * level)) & (kNumSlots - 1)]);
+
+    for(const auto key : slot) {
+        auto it = this->entries.find(*key);
+        this->place(it->first, it->second);
+    }
+}
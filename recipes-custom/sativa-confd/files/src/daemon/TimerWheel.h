@@ -0,0 +1,107 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Hierarchical timer wheel
+ *
+ * Tracks the expiration deadlines of keys (by name), without requiring a separate timer for each
+ * of them: time is divided into ticks, and each level of the wheel has a fixed number of slots.
+ * Keys expiring within the next few ticks are placed in the slot for their deadline on the lowest
+ * level; keys further in the future go in coarser slots on higher levels, and are moved down a
+ * level (cascaded) as their deadline approaches.
+ *
+ * Scheduling and cancelling a key are constant time operations, and advancing the wheel only
+ * visits the slots for the ticks that passed, regardless of how many keys are scheduled.
+ *
+ * Deadlines past the range of the wheel are parked in the highest level, and rescheduled every
+ * time that slot is cascaded until they are in range.
+ */
+class TimerWheel {
+    public:
+        /// Clock used for deadlines
+        using Clock = std::chrono::steady_clock;
+
+        /// Duration of a single tick (the resolution of deadlines)
+        constexpr static const std::chrono::milliseconds kTickDuration{100};
+
+    public:
+        TimerWheel() : startTime(Clock::now()) {}
+
+        void schedule(const std::string_view &key, const Clock::time_point deadline);
+        bool cancel(const std::string_view &key);
+        std::vector<std::string> advance(const Clock::time_point now);
+
+        /// Test whether the key has a deadline scheduled
+        bool contains(const std::string_view &key) const {
+            return this->entries.contains(std::string(key));
+        }
+
+        /// Get the number of keys scheduled
+        size_t size() const {
+            return this->entries.size();
+        }
+        /// Test whether no keys are scheduled
+        bool empty() const {
+            return this->entries.empty();
+        }
+
+    private:
+        /// Number of levels
+        constexpr static const size_t kNumLevels{4};
+        /// Number of slots per level, as a power of two
+        constexpr static const size_t kSlotBits{6};
+        /// Number of slots per level
+        constexpr static const size_t kNumSlots{1U << kSlotBits};
+
+        /// Slot containing the names of all keys with a deadline in its range
+        using Slot = std::list<const std::string *>;
+
+        /**
+         * @brief Information about a scheduled key
+         */
+        struct Entry {
+            /// Tick at which the key expires
+            uint64_t deadline{0};
+            /// Level the key is currently placed in
+            uint8_t level{0};
+            /// Slot (in that level) the key is currently placed in
+            uint8_t slot{0};
+            /// Position of the key in the slot's list
+            Slot::iterator pos;
+        };
+
+        /// Get the number of the tick that contains the given time
+        uint64_t tickFor(const Clock::time_point time) const {
+            if(time <= this->startTime) {
+                return 0;
+            }
+            return std::chrono::duration_cast<std::chrono::milliseconds>(time - this->startTime)
+                / kTickDuration;
+        }
+
+        void place(const std::string &key, Entry &entry);
+        void cascade(const size_t level);
+
+    private:
+        /// Time corresponding to tick zero
+        Clock::time_point startTime;
+        /// Most recently processed tick
+        uint64_t currentTick{0};
+
+        /// Scheduled keys, by name
+        std::unordered_map<std::string, Entry> entries;
+        /// Slots for each level of the wheel
+        std::array<std::array<Slot, kNumSlots>, kNumLevels> levels;
+};
+
+#endif
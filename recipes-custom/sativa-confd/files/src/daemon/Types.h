@@ -11,6 +11,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -32,4 +33,7 @@ using Blob = std::vector<std::byte>;
 using PropertyValue = std::variant<std::monostate, std::nullptr_t, std::string, Blob,
         uint64_t, double, bool>;
 
+/// List of key names and their values
+using PropertyList = std::vector<std::pair<std::string, PropertyValue>>;
+
 #endif
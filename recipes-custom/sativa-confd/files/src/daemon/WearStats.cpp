@@ -0,0 +1,359 @@
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "WearStats.h"
+
+std::array<CountingVfs::AtomicCounters, CountingVfs::kNumFileTypes> CountingVfs::gCounters;
+
+/**
+ * @brief File opened through the counting VFS
+ *
+ * The underlying VFS' file structure is allocated directly after this one.
+ */
+struct CountingVfsFile {
+    /// Base structure (must be first)
+    sqlite3_file base;
+    /// Counters to update for this file
+    CountingVfs::AtomicCounters *counters;
+
+    /// Get the file structure of the underlying VFS
+    sqlite3_file *real() {
+        return reinterpret_cast<sqlite3_file *>(this + 1);
+    }
+
+    static int Open(sqlite3_vfs *, const char *, sqlite3_file *, int, int *);
+
+    static int Close(sqlite3_file *);
+    static int Read(sqlite3_file *, void *, int, sqlite3_int64);
+    static int Write(sqlite3_file *, const void *, int, sqlite3_int64);
+    static int Truncate(sqlite3_file *, sqlite3_int64);
+    static int Sync(sqlite3_file *, int);
+    static int FileSize(sqlite3_file *, sqlite3_int64 *);
+    static int Lock(sqlite3_file *, int);
+    static int Unlock(sqlite3_file *, int);
+    static int CheckReservedLock(sqlite3_file *, int *);
+    static int FileControl(sqlite3_file *, int, void *);
+    static int SectorSize(sqlite3_file *);
+    static int DeviceCharacteristics(sqlite3_file *);
+    static int ShmMap(sqlite3_file *, int, int, int, void volatile **);
+    static int ShmLock(sqlite3_file *, int, int, int);
+    static void ShmBarrier(sqlite3_file *);
+    static int ShmUnmap(sqlite3_file *, int);
+    static int Fetch(sqlite3_file *, sqlite3_int64, int, void **);
+    static int Unfetch(sqlite3_file *, sqlite3_int64, void *);
+
+    /// I/O methods for all files opened through the VFS
+    static const sqlite3_io_methods kMethods;
+};
+
+const sqlite3_io_methods CountingVfsFile::kMethods{
+    .iVersion = 3,
+    .xClose = Close,
+    .xRead = Read,
+    .xWrite = Write,
+    .xTruncate = Truncate,
+    .xSync = Sync,
+    .xFileSize = FileSize,
+    .xLock = Lock,
+    .xUnlock = Unlock,
+    .xCheckReservedLock = CheckReservedLock,
+    .xFileControl = FileControl,
+    .xSectorSize = SectorSize,
+    .xDeviceCharacteristics = DeviceCharacteristics,
+    .xShmMap = ShmMap,
+    .xShmLock = ShmLock,
+    .xShmBarrier = ShmBarrier,
+    .xShmUnmap = ShmUnmap,
+    .xFetch = Fetch,
+    .xUnfetch = Unfetch,
+};
+
+/// Get the underlying file of a file opened through the counting VFS
+static inline sqlite3_file *RealFile(sqlite3_file *file) {
+    return reinterpret_cast<CountingVfsFile *>(file)->real();
+}
+
+int CountingVfsFile::Close(sqlite3_file *file) {
+    auto real = RealFile(file);
+    return real->pMethods->xClose(real);
+}
+int CountingVfsFile::Read(sqlite3_file *file, void *buf, int amount, sqlite3_int64 offset) {
+    auto real = RealFile(file);
+    return real->pMethods->xRead(real, buf, amount, offset);
+}
+int CountingVfsFile::Write(sqlite3_file *file, const void *buf, int amount,
+        sqlite3_int64 offset) {
+    auto self = reinterpret_cast<CountingVfsFile *>(file);
+    self->counters->writes++;
+    self->counters->bytesWritten += static_cast<uint64_t>(amount);
+
+    auto real = self->real();
+    return real->pMethods->xWrite(real, buf, amount, offset);
+}
+int CountingVfsFile::Truncate(sqlite3_file *file, sqlite3_int64 size) {
+    auto real = RealFile(file);
+    return real->pMethods->xTruncate(real, size);
+}
+int CountingVfsFile::Sync(sqlite3_file *file, int flags) {
+    auto self = reinterpret_cast<CountingVfsFile *>(file);
+    self->counters->syncs++;
+
+    auto real = self->real();
+    return real->pMethods->xSync(real, flags);
+}
+int CountingVfsFile::FileSize(sqlite3_file *file, sqlite3_int64 *outSize) {
+    auto real = RealFile(file);
+    return real->pMethods->xFileSize(real, outSize);
+}
+int CountingVfsFile::Lock(sqlite3_file *file, int type) {
+    auto real = RealFile(file);
+    return real->pMethods->xLock(real, type);
+}
+int CountingVfsFile::Unlock(sqlite3_file *file, int type) {
+    auto real = RealFile(file);
+    return real->pMethods->xUnlock(real, type);
+}
+int CountingVfsFile::CheckReservedLock(sqlite3_file *file, int *outResult) {
+    auto real = RealFile(file);
+    return real->pMethods->xCheckReservedLock(real, outResult);
+}
+int CountingVfsFile::FileControl(sqlite3_file *file, int op, void *arg) {
+    auto real = RealFile(file);
+    return real->pMethods->xFileControl(real, op, arg);
+}
+int CountingVfsFile::SectorSize(sqlite3_file *file) {
+    auto real = RealFile(file);
+    return real->pMethods->xSectorSize(real);
+}
+int CountingVfsFile::DeviceCharacteristics(sqlite3_file *file) {
+    auto real = RealFile(file);
+    return real->pMethods->xDeviceCharacteristics(real);
+}
+
+// the remaining methods are optional, depending on the version of the underlying file's methods
+int CountingVfsFile::ShmMap(sqlite3_file *file, int page, int pageSize, int extend,
+        void volatile **outPage) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion < 2) {
+        return SQLITE_IOERR_SHMMAP;
+    }
+    return real->pMethods->xShmMap(real, page, pageSize, extend, outPage);
+}
+int CountingVfsFile::ShmLock(sqlite3_file *file, int offset, int n, int flags) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion < 2) {
+        return SQLITE_IOERR_SHMLOCK;
+    }
+    return real->pMethods->xShmLock(real, offset, n, flags);
+}
+void CountingVfsFile::ShmBarrier(sqlite3_file *file) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion >= 2) {
+        real->pMethods->xShmBarrier(real);
+    }
+}
+int CountingVfsFile::ShmUnmap(sqlite3_file *file, int deleteFlag) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion < 2) {
+        return SQLITE_OK;
+    }
+    return real->pMethods->xShmUnmap(real, deleteFlag);
+}
+int CountingVfsFile::Fetch(sqlite3_file *file, sqlite3_int64 offset, int amount, void **outPtr) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion < 3) {
+        *outPtr = nullptr;
+        return SQLITE_OK;
+    }
+    return real->pMethods->xFetch(real, offset, amount, outPtr);
+}
+int CountingVfsFile::Unfetch(sqlite3_file *file, sqlite3_int64 offset, void *ptr) {
+    auto real = RealFile(file);
+    if(real->pMethods->iVersion < 3) {
+        return SQLITE_OK;
+    }
+    return real->pMethods->xUnfetch(real, offset, ptr);
+}
+
+/// Underlying VFS
+static sqlite3_vfs *gParentVfs{nullptr};
+/// The counting VFS (copied from the underlying VFS, with the open method replaced)
+static sqlite3_vfs gCountingVfs;
+
+/**
+ * @brief Open a file through the counting VFS
+ *
+ * The file is opened by the underlying VFS, and wrapped so that all I/O on it goes through us.
+ */
+int CountingVfsFile::Open(sqlite3_vfs *, const char *name, sqlite3_file *file, int flags,
+        int *outFlags) {
+    auto self = reinterpret_cast<CountingVfsFile *>(file);
+    auto real = self->real();
+
+    real->pMethods = nullptr;
+    const auto err = gParentVfs->xOpen(gParentVfs, name, real, flags, outFlags);
+    if(!real->pMethods) {
+        file->pMethods = nullptr;
+        return err;
+    }
+
+    CountingVfs::FileType type{CountingVfs::FileType::Other};
+    if(flags & SQLITE_OPEN_MAIN_DB) {
+        type = CountingVfs::FileType::Database;
+    } else if(flags & SQLITE_OPEN_MAIN_JOURNAL) {
+        type = CountingVfs::FileType::Journal;
+    } else if(flags & SQLITE_OPEN_WAL) {
+        type = CountingVfs::FileType::Wal;
+    }
+
+    self->counters = &CountingVfs::gCounters[static_cast<size_t>(type)];
+    file->pMethods = &CountingVfsFile::kMethods;
+
+    return err;
+}
+
+/**
+ * @brief Register the counting VFS
+ *
+ * This is done only once per process; it's not made the default VFS.
+ *
+ * @return Name of the VFS, to pass when opening a database
+ *
+ * @throw std::runtime_error Failed to register the VFS
+ */
+const char *CountingVfs::Register() {
+    static std::once_flag gOnce;
+    static int gStatus{SQLITE_OK};
+
+    std::call_once(gOnce, []() {
+        gParentVfs = sqlite3_vfs_find(nullptr);
+        if(!gParentVfs) {
+            gStatus = SQLITE_ERROR;
+            return;
+        }
+
+        // all other calls go straight to the underlying VFS
+        gCountingVfs = *gParentVfs;
+        gCountingVfs.szOsFile = static_cast<int>(sizeof(CountingVfsFile)) + gParentVfs->szOsFile;
+        gCountingVfs.pNext = nullptr;
+        gCountingVfs.zName = kName;
+        gCountingVfs.xOpen = CountingVfsFile::Open;
+
+        gStatus = sqlite3_vfs_register(&gCountingVfs, 0);
+    });
+
+    if(gStatus != SQLITE_OK) {
+        throw std::runtime_error(fmt::format("failed to register vfs: {}",
+                    sqlite3_errstr(gStatus)));
+    }
+
+    return kName;
+}
+
+/**
+ * @brief Get a snapshot of the I/O counters for a type of file
+ */
+CountingVfs::Counters CountingVfs::GetCounters(const FileType type) {
+    const auto &counters = gCounters[static_cast<size_t>(type)];
+
+    return {
+        .writes = counters.writes,
+        .bytesWritten = counters.bytesWritten,
+        .syncs = counters.syncs,
+    };
+}
+
+/**
+ * @brief Get the total number of syncs, across all types of file
+ */
+uint64_t CountingVfs::GetTotalSyncs() {
+    uint64_t syncs{0};
+    for(const auto &counters : gCounters) {
+        syncs += counters.syncs;
+    }
+    return syncs;
+}
+
+/**
+ * @brief Get the name of a type of file, as used in the statistics
+ */
+const char *CountingVfs::FileTypeName(const FileType type) {
+    switch(type) {
+        case FileType::Database:
+            return "db";
+        case FileType::Journal:
+            return "journal";
+        case FileType::Wal:
+            return "wal";
+        case FileType::Log:
+            return "log";
+        case FileType::Snapshot:
+            return "snapshot";
+        default:
+            return "other";
+    }
+}
+
+
+
+/**
+ * @brief Record a write to a key
+ *
+ * If the key is tracked already, its count is incremented. Otherwise, it's added (if there's
+ * space) or it replaces the key with the lowest count.
+ *
+ * @param key Name of the key that was written
+ */
+void HotKeyTracker::record(const std::string_view &key) {
+    const std::string name(key);
+
+    auto it = this->indices.find(name);
+    if(it != this->indices.end()) {
+        this->entries[it->second].count++;
+        return;
+    }
+
+    if(this->entries.size() < this->capacity) {
+        this->indices.emplace(name, this->entries.size());
+        this->entries.push_back({.key = name, .count = 1});
+        return;
+    }
+
+    // replace the key with the lowest count
+    const auto min = std::min_element(this->entries.begin(), this->entries.end(),
+            [](const auto &a, const auto &b) {
+        return a.count < b.count;
+    });
+    const auto index = static_cast<size_t>(std::distance(this->entries.begin(), min));
+
+    this->indices.erase(min->key);
+    this->indices.emplace(name, index);
+
+    min->key = name;
+    min->error = min->count;
+    min->count++;
+}
+
+/**
+ * @brief Get the most frequently written keys
+ *
+ * @param count Maximum number of keys to return
+ *
+ * @return Keys with the highest write counts, in descending order
+ */
+std::vector<HotKeyTracker::Entry> HotKeyTracker::top(const size_t count) const {
+    auto sorted = this->entries;
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.count > b.count;
+    });
+
+    if(sorted.size() > count) {
+        sorted.resize(count);
+    }
+    return sorted;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file
+ *
+ * @brief Flash wear accounting
+ *
+ * Helpers used by the data store to figure out how much it's writing to the underlying storage,
+ * and on whose behalf: a sqlite VFS shim that counts the physical I/O on the database files, and
+ * a tracker for the most frequently written keys.
+ */
+#ifndef WEARSTATS_H
+#define WEARSTATS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief sqlite VFS that counts writes and syncs
+ *
+ * This wraps the default VFS: all calls are forwarded to it, but writes and syncs on files opened
+ * through it are counted first, broken down by the type of file. Those are the operations that
+ * actually wear out flash storage; comparing them to the logical size of the writes issued to the
+ * data store yields the write amplification.
+ *
+ * The counters are global, so they include all databases in the process opened with this VFS.
+ * Files the data store writes itself (the write log and snapshots of the in-memory mode) are
+ * accounted here as well.
+ */
+class CountingVfs {
+    public:
+        /// Name under which the VFS is registered
+        constexpr static const char *kName{"confd-counting"};
+
+        /**
+         * @brief Type of file the counters apply to
+         */
+        enum class FileType: uint8_t {
+            /// Main database file
+            Database,
+            /// Rollback journal
+            Journal,
+            /// Write-ahead log
+            Wal,
+            /// Write log of the in-memory mode
+            Log,
+            /// Snapshot of the in-memory mode
+            Snapshot,
+            /// Any other file (temporary databases, super-journals, …)
+            Other,
+        };
+        /// Number of file types
+        constexpr static const size_t kNumFileTypes{6};
+
+        /**
+         * @brief I/O counters for a type of file
+         */
+        struct Counters {
+            /// Number of write calls
+            uint64_t writes{0};
+            /// Total bytes written
+            uint64_t bytesWritten{0};
+            /// Number of sync calls
+            uint64_t syncs{0};
+        };
+
+    public:
+        static const char *Register();
+
+        static Counters GetCounters(const FileType type);
+        static uint64_t GetTotalSyncs();
+
+        /// Account a write to a file made outside of sqlite
+        static void RecordWrite(const FileType type, const size_t bytes) {
+            auto &counters = gCounters[static_cast<size_t>(type)];
+            counters.writes++;
+            counters.bytesWritten += bytes;
+        }
+        /// Account a sync of a file made outside of sqlite
+        static void RecordSync(const FileType type) {
+            gCounters[static_cast<size_t>(type)].syncs++;
+        }
+
+        static const char *FileTypeName(const FileType type);
+
+    private:
+        /**
+         * @brief Live counters for a type of file
+         */
+        struct AtomicCounters {
+            std::atomic_uint64_t writes{0};
+            std::atomic_uint64_t bytesWritten{0};
+            std::atomic_uint64_t syncs{0};
+        };
+
+        /// Counters for each type of file
+        static std::array<AtomicCounters, kNumFileTypes> gCounters;
+
+        friend struct CountingVfsFile;
+};
+
+/**
+ * @brief Tracks the most frequently written keys
+ *
+ * Implements the space-saving algorithm: a fixed number of keys are tracked along with a write
+ * count. A write to a key that isn't tracked replaces the key with the lowest count, and inherits
+ * its count (which is remembered as the maximum overestimate for the new key.) The most frequently
+ * written keys are thus guaranteed to be tracked, with bounded memory regardless of how many
+ * distinct keys there are.
+ */
+class HotKeyTracker {
+    public:
+        /**
+         * @brief A tracked key
+         */
+        struct Entry {
+            /// Name of the key
+            std::string key;
+            /// Estimated number of writes to the key
+            uint64_t count{0};
+            /// Maximum amount by which the count overestimates the actual number of writes
+            uint64_t error{0};
+        };
+
+    public:
+        /**
+         * @brief Initialize the tracker
+         *
+         * @param capacity Maximum number of keys to track; this should be a few times larger than
+         *        the number of keys that will be reported, for the counts to be accurate.
+         */
+        HotKeyTracker(const size_t capacity) : capacity(capacity) {}
+
+        void record(const std::string_view &key);
+        std::vector<Entry> top(const size_t count) const;
+
+    private:
+        /// Maximum number of keys tracked
+        size_t capacity;
+
+        /// Tracked keys
+        std::vector<Entry> entries;
+        /// Index of each key in the tracked key list
+        std::unordered_map<std::string, size_t> indices;
+};
+
+#endif
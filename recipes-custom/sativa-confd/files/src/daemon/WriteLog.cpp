@@ -0,0 +1,642 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "WearStats.h"
+#include "WriteLog.h"
+
+/// Magic value at the start of snapshot files
+static constexpr const char *kSnapshotMagic{"confdsnp"};
+/// Magic value at the start of log files
+static constexpr const char *kLogMagic{"confdlog"};
+/// Value stored in place of the expiration time for keys that don't expire
+static constexpr const int64_t kNoExpiry{std::numeric_limits<int64_t>::min()};
+
+/**
+ * @brief Value type tags
+ *
+ * These are the same values as used for the value type column in the database.
+ */
+enum class ValueTag: uint8_t {
+    Null                        = 0,
+    String                      = 1,
+    Blob                        = 2,
+    Integer                     = 3,
+    Real                        = 4,
+};
+
+/**
+ * @brief Append a trivially copyable value to a buffer
+ */
+template<typename T>
+static void Put(std::vector<std::byte> &buf, const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    const auto offset = buf.size();
+    buf.resize(offset + sizeof(T));
+    std::memcpy(buf.data() + offset, &value, sizeof(T));
+}
+
+/**
+ * @brief Append raw bytes to a buffer
+ */
+static void PutBytes(std::vector<std::byte> &buf, const void *data, const size_t length) {
+    auto bytes = reinterpret_cast<const std::byte *>(data);
+    buf.insert(buf.end(), bytes, bytes + length);
+}
+
+/**
+ * @brief Sequential reader for a record's payload
+ *
+ * Reading past the end of the payload throws; since records are checksummed, this indicates a
+ * bug rather than a damaged file.
+ */
+class PayloadReader {
+    public:
+        PayloadReader(std::span<const std::byte> data) : data(data) {}
+
+        /// Whether all of the payload has been read
+        bool empty() const {
+            return this->data.empty();
+        }
+
+        /// Read a trivially copyable value
+        template<typename T>
+        T get() {
+            T value;
+            std::memcpy(&value, this->take(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        /// Read the given number of bytes
+        std::span<const std::byte> take(const size_t length) {
+            if(length > this->data.size()) {
+                throw std::runtime_error("malformed write log record");
+            }
+
+            const auto bytes = this->data.subspan(0, length);
+            this->data = this->data.subspan(length);
+            return bytes;
+        }
+
+    private:
+        std::span<const std::byte> data;
+};
+
+/**
+ * @brief Initialize the write log
+ *
+ * The files are not accessed until load() is called.
+ *
+ * @param basePath Path from which the names of the snapshot and log files are derived (by adding
+ *        a `.snapshot` and `.log` suffix, respectively)
+ * @param options Options for the write log
+ */
+WriteLog::WriteLog(const std::filesystem::path &basePath, const Options &options) :
+    options(options) {
+    this->snapshotPath = basePath;
+    this->snapshotPath += ".snapshot";
+    this->logPath = basePath;
+    this->logPath += ".log";
+}
+
+/**
+ * @brief Close the write log
+ *
+ * Any records not yet synced to disk are synced first.
+ */
+WriteLog::~WriteLog() {
+    if(this->logFd == -1) {
+        return;
+    }
+
+    try {
+        this->sync();
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "failed to sync write log: " << e.what();
+    }
+    close(this->logFd);
+}
+
+/**
+ * @brief Read back the snapshot and log
+ *
+ * All changes in the snapshot, followed by all changes in the log, are passed to the callback in
+ * the order they were made. If the log ends in an incomplete or damaged record, it's truncated
+ * just before it. Missing files are created, and the log is opened for appending.
+ *
+ * @param apply Callback to invoke for each change
+ *
+ * @throw std::runtime_error The snapshot is damaged
+ * @throw std::system_error Failed to read or create the files
+ */
+void WriteLog::load(const ApplyCallback &apply) {
+    // restore the snapshot (which is always written completely)
+    const auto snapshot = ReadFile(this->snapshotPath);
+    if(!snapshot.empty()) {
+        const auto generation = CheckHeader(snapshot, kSnapshotMagic);
+        if(!generation) {
+            throw std::runtime_error(fmt::format("invalid snapshot '{}'",
+                        this->snapshotPath.native()));
+        }
+
+        const auto records = std::span(snapshot).subspan(kHeaderSize);
+        if(this->replay(records, apply) != records.size()) {
+            throw std::runtime_error(fmt::format("snapshot '{}' is damaged",
+                        this->snapshotPath.native()));
+        }
+
+        this->generation = *generation;
+        this->snapshotSize = snapshot.size();
+    }
+
+    // then apply the log (if it belongs to this snapshot)
+    const auto log = ReadFile(this->logPath);
+    bool createLog{true};
+
+    if(!log.empty()) {
+        const auto generation = CheckHeader(log, kLogMagic);
+
+        if(generation && *generation == this->generation) {
+            const auto records = std::span(log).subspan(kHeaderSize);
+            const auto valid = this->replay(records, apply);
+
+            this->logSize = kHeaderSize + valid;
+            createLog = false;
+
+            if(valid != records.size()) {
+                PLOG_WARNING << "discarding " << (records.size() - valid)
+                    << " bytes of incomplete write log records";
+
+                if(truncate(this->logPath.c_str(), static_cast<off_t>(this->logSize)) == -1) {
+                    throw std::system_error(errno, std::generic_category(), "truncate write log");
+                }
+            }
+        } else {
+            PLOG_WARNING << "discarding stale write log '" << this->logPath.native() << "'";
+        }
+    }
+
+    if(createLog) {
+        std::vector<std::byte> header;
+        EncodeHeader(header, kLogMagic, this->generation);
+
+        WriteFileAtomic(this->logPath, header);
+        this->logSize = header.size();
+    }
+
+    this->openLog();
+}
+
+/**
+ * @brief Append changes to the log
+ *
+ * All of the changes are written as a single record, so after a crash either all or none of them
+ * are restored.
+ *
+ * @param entries Changes to append
+ *
+ * @throw std::system_error Failed to write the record; the log is left unchanged
+ */
+void WriteLog::append(std::span<const Entry> entries) {
+    if(this->logFd == -1) {
+        throw std::runtime_error("write log is unavailable");
+    }
+
+    std::vector<std::byte> buf;
+    EncodeRecord(buf, entries);
+
+    try {
+        WriteFully(this->logFd, buf);
+    } catch(const std::exception &) {
+        // remove whatever part of the record was written, so later records remain readable
+        if(ftruncate(this->logFd, static_cast<off_t>(this->logSize)) == -1) {
+            PLOG_ERROR << "failed to truncate write log: " << strerror(errno);
+        }
+        throw;
+    }
+
+    CountingVfs::RecordWrite(CountingVfs::FileType::Log, buf.size());
+    this->logSize += buf.size();
+    this->dirty = true;
+
+    if(this->options.syncWrites) {
+        this->sync();
+    }
+}
+
+/**
+ * @brief Ensure all records appended to the log so far are on disk
+ */
+void WriteLog::sync() {
+    if(!this->dirty) {
+        return;
+    }
+
+    if(fdatasync(this->logFd) == -1) {
+        throw std::system_error(errno, std::generic_category(), "sync write log");
+    }
+    CountingVfs::RecordSync(CountingVfs::FileType::Log);
+
+    this->dirty = false;
+}
+
+/**
+ * @brief Replace the snapshot with the given state, and clear the log
+ *
+ * The new snapshot is written to a temporary file first, and renamed over the old one once it's
+ * complete; then the log is replaced by an empty one the same way.
+ *
+ * @param entries Changes that, applied to an empty data store, recreate its current state
+ *
+ * @throw std::system_error Failed to write the snapshot or log
+ */
+void WriteLog::compact(std::span<const Entry> entries) {
+    const auto generation = this->generation + 1;
+
+    // write the snapshot
+    std::vector<std::byte> buf;
+    EncodeHeader(buf, kSnapshotMagic, generation);
+
+    for(size_t i = 0; i < entries.size(); i += kSnapshotEntriesPerRecord) {
+        EncodeRecord(buf, entries.subspan(i,
+                    std::min(kSnapshotEntriesPerRecord, entries.size() - i)));
+    }
+
+    WriteFileAtomic(this->snapshotPath, buf);
+    CountingVfs::RecordWrite(CountingVfs::FileType::Snapshot, buf.size());
+    CountingVfs::RecordSync(CountingVfs::FileType::Snapshot);
+
+    this->generation = generation;
+    this->snapshotSize = buf.size();
+
+    /*
+     * Start a new log. The old log is stale now, so if this fails, stop appending to it: its
+     * records would be discarded when it's next loaded.
+     */
+    close(this->logFd);
+    this->logFd = -1;
+
+    buf.clear();
+    EncodeHeader(buf, kLogMagic, generation);
+
+    WriteFileAtomic(this->logPath, buf);
+    CountingVfs::RecordWrite(CountingVfs::FileType::Log, buf.size());
+    CountingVfs::RecordSync(CountingVfs::FileType::Log);
+
+    this->logSize = buf.size();
+    this->dirty = false;
+
+    this->openLog();
+}
+
+/**
+ * @brief Open the log file for appending
+ */
+void WriteLog::openLog() {
+    this->logFd = open(this->logPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if(this->logFd == -1) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open write log '{}'", this->logPath.native()));
+    }
+}
+
+/**
+ * @brief Apply all valid records in a buffer
+ *
+ * Records are processed until the end of the buffer, or until a record that's incomplete or whose
+ * checksum doesn't match is encountered.
+ *
+ * @param data Records to apply (following the file header)
+ * @param apply Callback to invoke for each change
+ *
+ * @return Number of bytes of valid records at the start of the buffer
+ */
+size_t WriteLog::replay(std::span<const std::byte> data, const ApplyCallback &apply) const {
+    size_t offset{0};
+
+    while(data.size() - offset >= kRecordHeaderSize) {
+        uint32_t length, crc;
+        std::memcpy(&length, data.data() + offset, sizeof(length));
+        std::memcpy(&crc, data.data() + offset + sizeof(length), sizeof(crc));
+
+        if(length > data.size() - offset - kRecordHeaderSize) {
+            break;
+        }
+
+        const auto payload = data.subspan(offset + kRecordHeaderSize, length);
+        if(Crc32(payload) != crc) {
+            break;
+        }
+
+        DecodeRecord(payload, apply);
+        offset += kRecordHeaderSize + length;
+    }
+
+    return offset;
+}
+
+/**
+ * @brief Encode a file header
+ */
+void WriteLog::EncodeHeader(std::vector<std::byte> &buf, const char *magic,
+        const uint64_t generation) {
+    PutBytes(buf, magic, 8);
+    Put(buf, kFormatVersion);
+    Put(buf, generation);
+}
+
+/**
+ * @brief Encode a record holding the given changes
+ *
+ * The record consists of the length of its payload, a checksum over the payload, and the payload
+ * itself, which is the concatenation of all changes.
+ */
+void WriteLog::EncodeRecord(std::vector<std::byte> &buf, std::span<const Entry> entries) {
+    const auto start = buf.size();
+    buf.resize(start + kRecordHeaderSize);
+
+    for(const auto &entry : entries) {
+        EncodeEntry(buf, entry);
+    }
+
+    const auto payload = std::span(buf).subspan(start + kRecordHeaderSize);
+    if(payload.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("write log record too large");
+    }
+
+    const uint32_t length = payload.size(), crc = Crc32(payload);
+    std::memcpy(buf.data() + start, &length, sizeof(length));
+    std::memcpy(buf.data() + start + sizeof(length), &crc, sizeof(crc));
+}
+
+/**
+ * @brief Encode a single change
+ *
+ * Each change starts with its kind and the key's name; sets are followed by the key's version,
+ * expiration time and value (as a type tag, followed by the value; strings and blobs are prefixed
+ * with their length.)
+ */
+void WriteLog::EncodeEntry(std::vector<std::byte> &buf, const Entry &entry) {
+    if(entry.name.size() > std::numeric_limits<uint16_t>::max()) {
+        throw std::invalid_argument("key name too long");
+    }
+
+    Put(buf, static_cast<uint8_t>(entry.op));
+    Put(buf, static_cast<uint16_t>(entry.name.size()));
+    PutBytes(buf, entry.name.data(), entry.name.size());
+
+    if(entry.op != Entry::Op::Set) {
+        return;
+    }
+
+    Put(buf, entry.version);
+    Put(buf, entry.expiresAt.value_or(kNoExpiry));
+
+    std::visit([&](auto &&arg) {
+        using T = std::decay_t<decltype(arg)>;
+
+        if constexpr(std::is_same_v<T, std::nullptr_t>) {
+            Put(buf, ValueTag::Null);
+        } else if constexpr(std::is_same_v<T, std::string> || std::is_same_v<T, Blob>) {
+            if(arg.size() > std::numeric_limits<uint32_t>::max()) {
+                throw std::invalid_argument("value too large");
+            }
+
+            Put(buf, std::is_same_v<T, std::string> ? ValueTag::String : ValueTag::Blob);
+            Put(buf, static_cast<uint32_t>(arg.size()));
+            PutBytes(buf, arg.data(), arg.size());
+        } else if constexpr(std::is_same_v<T, uint64_t>) {
+            Put(buf, ValueTag::Integer);
+            Put(buf, arg);
+        } else if constexpr(std::is_same_v<T, bool>) {
+            Put(buf, ValueTag::Integer);
+            Put(buf, static_cast<uint64_t>(arg));
+        } else if constexpr(std::is_same_v<T, double>) {
+            Put(buf, ValueTag::Real);
+            Put(buf, arg);
+        } else {
+            throw std::invalid_argument("invalid value");
+        }
+    }, entry.value);
+}
+
+/**
+ * @brief Decode all changes in a record's payload, and apply them
+ */
+void WriteLog::DecodeRecord(std::span<const std::byte> payload, const ApplyCallback &apply) {
+    PayloadReader reader(payload);
+
+    while(!reader.empty()) {
+        Entry entry;
+
+        entry.op = static_cast<Entry::Op>(reader.get<uint8_t>());
+        const auto nameBytes = reader.take(reader.get<uint16_t>());
+        entry.name.assign(reinterpret_cast<const char *>(nameBytes.data()), nameBytes.size());
+
+        switch(entry.op) {
+            case Entry::Op::Set:
+                break;
+            case Entry::Op::Delete:
+            case Entry::Op::DeleteSubkeys:
+                apply(std::move(entry));
+                continue;
+
+            default:
+                throw std::runtime_error(fmt::format("invalid write log op ${:02x}",
+                            static_cast<uint8_t>(entry.op)));
+        }
+
+        entry.version = reader.get<uint64_t>();
+        if(const auto expiresAt = reader.get<int64_t>(); expiresAt != kNoExpiry) {
+            entry.expiresAt = expiresAt;
+        }
+
+        switch(static_cast<ValueTag>(reader.get<uint8_t>())) {
+            case ValueTag::Null:
+                entry.value = nullptr;
+                break;
+            case ValueTag::String: {
+                const auto bytes = reader.take(reader.get<uint32_t>());
+                entry.value = std::string(reinterpret_cast<const char *>(bytes.data()),
+                        bytes.size());
+                break;
+            }
+            case ValueTag::Blob: {
+                const auto bytes = reader.take(reader.get<uint32_t>());
+                entry.value = Blob(bytes.begin(), bytes.end());
+                break;
+            }
+            case ValueTag::Integer:
+                entry.value = reader.get<uint64_t>();
+                break;
+            case ValueTag::Real:
+                entry.value = reader.get<double>();
+                break;
+
+            default:
+                throw std::runtime_error("invalid write log value type");
+        }
+
+        apply(std::move(entry));
+    }
+}
+
+/**
+ * @brief Validate a file header
+ *
+ * @return Generation of the file, or nothing if the header is invalid
+ */
+std::optional<uint64_t> WriteLog::CheckHeader(std::span<const std::byte> data,
+        const char *magic) {
+    if(data.size() < kHeaderSize || std::memcmp(data.data(), magic, 8)) {
+        return std::nullopt;
+    }
+
+    uint32_t version;
+    std::memcpy(&version, data.data() + 8, sizeof(version));
+    if(version != kFormatVersion) {
+        return std::nullopt;
+    }
+
+    uint64_t generation;
+    std::memcpy(&generation, data.data() + 12, sizeof(generation));
+    return generation;
+}
+
+/**
+ * @brief Read an entire file
+ *
+ * @return File contents, or an empty buffer if the file doesn't exist
+ */
+std::vector<std::byte> WriteLog::ReadFile(const std::filesystem::path &path) {
+    std::vector<std::byte> data;
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        if(errno == ENOENT) {
+            return data;
+        }
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open '{}'", path.native()));
+    }
+
+    std::array<std::byte, 16384> chunk;
+    while(true) {
+        const auto nRead = read(fd, chunk.data(), chunk.size());
+        if(nRead == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            const auto err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(),
+                    fmt::format("read '{}'", path.native()));
+        } else if(!nRead) {
+            break;
+        }
+
+        data.insert(data.end(), chunk.begin(), chunk.begin() + nRead);
+    }
+
+    close(fd);
+    return data;
+}
+
+/**
+ * @brief Replace a file atomically
+ *
+ * The data is written to a temporary file, which is synced and then renamed over the file; the
+ * directory is synced as well, so the rename is durable.
+ */
+void WriteLog::WriteFileAtomic(const std::filesystem::path &path,
+        std::span<const std::byte> data) {
+    auto tempPath = path;
+    tempPath += ".tmp";
+
+    const int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open '{}'", tempPath.native()));
+    }
+
+    try {
+        WriteFully(fd, data);
+
+        if(fdatasync(fd) == -1) {
+            throw std::system_error(errno, std::generic_category(),
+                    fmt::format("sync '{}'", tempPath.native()));
+        }
+    } catch(const std::exception &) {
+        close(fd);
+        unlink(tempPath.c_str());
+        throw;
+    }
+
+    close(fd);
+
+    if(rename(tempPath.c_str(), path.c_str()) == -1) {
+        const auto err = errno;
+        unlink(tempPath.c_str());
+        throw std::system_error(err, std::generic_category(),
+                fmt::format("rename '{}'", tempPath.native()));
+    }
+
+    // sync the directory (failing this isn't fatal; the rename just may not be durable yet)
+    const int dirFd = open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd != -1) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+}
+
+/**
+ * @brief Write an entire buffer to a file descriptor
+ */
+void WriteLog::WriteFully(const int fd, std::span<const std::byte> data) {
+    while(!data.empty()) {
+        const auto written = write(fd, data.data(), data.size());
+        if(written == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+
+        data = data.subspan(static_cast<size_t>(written));
+    }
+}
+
+/**
+ * @brief Calculate the CRC-32 (IEEE 802.3 polynomial) of a buffer
+ */
+uint32_t WriteLog::Crc32(std::span<const std::byte> data) {
+    constexpr static const auto kTable = []() {
+        std::array<uint32_t, 256> table{};
+        for(uint32_t i = 0; i < table.size(); i++) {
+            uint32_t crc = i;
+            for(size_t bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320U) : (crc >> 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    uint32_t crc{0xFFFFFFFFU};
+    for(const auto byte : data) {
+        crc = kTable[(crc ^ static_cast<uint8_t>(byte)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,148 @@
+#ifndef WRITELOG_H
+#define WRITELOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Types.h"
+
+/**
+ * @brief Durable log of changes to an in-memory data store
+ *
+ * Provides persistence for the data store's in-memory mode, using two files alongside each other:
+ *
+ * - A snapshot, containing the complete state of the data store as of some point in time. It's
+ *   only ever replaced as a whole, by writing a new snapshot to a temporary file and renaming it
+ *   into place.
+ * - An append-only log, holding all changes made since the snapshot was written. Each record
+ *   carries a checksum, so a record that was only partially written (say, due to a power loss)
+ *   is detected and discarded when the log is replayed.
+ *
+ * Once the log grows large enough, it's compacted: the current state is written out as a new
+ * snapshot, and the log starts over empty. Both files carry a generation number, which is
+ * incremented by each compaction, so a log left over from before a snapshot (if the compaction
+ * was interrupted) is never replayed on top of it.
+ *
+ * Values are stored in native byte order; the files aren't meant to be moved between machines.
+ */
+class WriteLog {
+    public:
+        /**
+         * @brief Options for the write log
+         */
+        struct Options {
+            /// Sync the log to disk after every record, rather than only in sync()
+            bool syncWrites{false};
+            /// Size of the log (in bytes) past which it should be compacted
+            size_t compactSize{256 * 1024};
+        };
+
+        /**
+         * @brief A change to the data store
+         */
+        struct Entry {
+            /**
+             * @brief Kinds of changes
+             */
+            enum class Op: uint8_t {
+                /// Set the key's value, version and expiration time
+                Set                     = 1,
+                /// Remove the key
+                Delete                  = 2,
+                /// Remove all children of the key (but not the key itself)
+                DeleteSubkeys           = 3,
+            };
+
+            /// Kind of change
+            Op op{Op::Set};
+            /// Name of the key
+            std::string name;
+
+            /// New value of the key (set only)
+            PropertyValue value;
+            /// New version of the key (set only)
+            uint64_t version{0};
+            /// Time at which the key expires, as Unix time in ms (set only)
+            std::optional<int64_t> expiresAt;
+        };
+
+        /// Callback invoked with each change read back from disk, in order
+        using ApplyCallback = std::function<void(Entry &&)>;
+
+    public:
+        WriteLog(const std::filesystem::path &basePath, const Options &options);
+        ~WriteLog();
+
+        WriteLog(const WriteLog &) = delete;
+        WriteLog &operator=(const WriteLog &) = delete;
+
+        void load(const ApplyCallback &apply);
+
+        void append(std::span<const Entry> entries);
+        void sync();
+        void compact(std::span<const Entry> entries);
+
+        /// Test whether the log has grown large enough to be compacted
+        bool needsCompaction() const {
+            return this->logSize >= this->options.compactSize;
+        }
+        /// Get the total size of the snapshot and log on disk, in bytes
+        uint64_t getDiskSize() const {
+            return this->snapshotSize + this->logSize;
+        }
+
+    private:
+        /// Size of the file header (magic, format version and generation)
+        constexpr static const size_t kHeaderSize{8 + 4 + 8};
+        /// Size of the header of each record (payload length and checksum)
+        constexpr static const size_t kRecordHeaderSize{4 + 4};
+        /// File format version
+        constexpr static const uint32_t kFormatVersion{1};
+        /// Maximum number of entries per record in snapshots
+        constexpr static const size_t kSnapshotEntriesPerRecord{256};
+
+        void openLog();
+        size_t replay(std::span<const std::byte> data, const ApplyCallback &apply) const;
+
+        static void EncodeHeader(std::vector<std::byte> &buf, const char *magic,
+                const uint64_t generation);
+        static void EncodeRecord(std::vector<std::byte> &buf, std::span<const Entry> entries);
+        static void EncodeEntry(std::vector<std::byte> &buf, const Entry &entry);
+        static void DecodeRecord(std::span<const std::byte> payload, const ApplyCallback &apply);
+
+        static std::optional<uint64_t> CheckHeader(std::span<const std::byte> data,
+                const char *magic);
+        static std::vector<std::byte> ReadFile(const std::filesystem::path &path);
+        static void WriteFileAtomic(const std::filesystem::path &path,
+                std::span<const std::byte> data);
+        static void WriteFully(const int fd, std::span<const std::byte> data);
+        static uint32_t Crc32(std::span<const std::byte> data);
+
+    private:
+        /// Path of the snapshot file
+        std::filesystem::path snapshotPath;
+        /// Path of the log file
+        std::filesystem::path logPath;
+        /// Options as specified on creation
+        Options options;
+
+        /// File descriptor of the log (opened for appending)
+        int logFd{-1};
+        /// Generation of the current snapshot and log
+        uint64_t generation{0};
+
+        /// Current size of the log file, in bytes
+        uint64_t logSize{0};
+        /// Current size of the snapshot file, in bytes
+        uint64_t snapshotSize{0};
+        /// Whether records were appended since the log was last synced
+        bool dirty{false};
+};
+
+#endif
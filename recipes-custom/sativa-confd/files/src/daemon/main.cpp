@@ -6,6 +6,7 @@
 #include <atomic>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include <plog/Log.h>
@@ -18,7 +19,10 @@
 
 #include "Config.h"
 #include "DataStore.h"
+#include "DefaultsImage.h"
+#include "MemoryBackend.h"
 #include "RpcServer.h"
+#include "SqliteBackend.h"
 #include "watchdog.h"
 #include "version.h"
 
@@ -209,7 +213,44 @@ int main(const int argc, char * const * argv) {
 
     // open and initialize data store
     try {
-        store = std::make_unique<DataStore>(Config::GetStoragePath());
+        std::unique_ptr<StorageBackend> backend;
+        switch(Config::GetStorageBackend()) {
+            case Config::StorageBackendType::Sqlite:
+                backend = std::make_unique<SqliteBackend>(Config::GetStoragePath());
+                break;
+            case Config::StorageBackendType::Memory:
+                backend = std::make_unique<MemoryBackend>(Config::GetStoragePath(),
+                        WriteLog::Options{
+                            .syncWrites = Config::GetMemorySyncWrites(),
+                            .compactSize = Config::GetMemoryCompactSize(),
+                        });
+                break;
+            case Config::StorageBackendType::Transient:
+                PLOG_WARNING << "using transient storage: keys will be lost on exit!";
+                backend = std::make_unique<MemoryBackend>();
+                break;
+        }
+
+        store = std::make_unique<DataStore>(std::move(backend), Config::GetVolatilePrefixes());
+
+        // a missing defaults image shouldn't keep the daemon from serving the keys it has
+        const auto &defaultsPath = Config::GetDefaultsPath();
+        if(!defaultsPath.empty()) {
+            try {
+                auto defaults = std::make_unique<DefaultsImage>(defaultsPath);
+                PLOG_INFO << "loaded " << defaults->size() << " default key(s) from "
+                    << defaultsPath.native();
+                store->setDefaults(std::move(defaults));
+            } catch(const std::exception &err) {
+                PLOG_ERROR << "failed to open defaults image: " << err.what();
+            }
+        }
+
+        store->setUnchangedWritePolicy(Config::GetStorageTouchUnchanged() ?
+                DataStore::UnchangedWritePolicy::Touch : DataStore::UnchangedWritePolicy::Skip);
+        for(const auto &policy : Config::GetDebouncePolicies()) {
+            store->addDebouncePolicy(policy.prefix, policy.interval);
+        }
     } catch(const std::exception &err) {
         PLOG_FATAL << "failed to initialize data store: " << err.what();
         return 1;
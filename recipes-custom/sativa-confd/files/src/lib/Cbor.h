@@ -0,0 +1,327 @@
+/**
+ * @file
+ *
+ * @brief Minimal CBOR encoder and decoder
+ *
+ * The RPC messages exchanged with confd are small maps of scalar values. Building (and parsing)
+ * these with libcbor requires a heap allocation for every item, as well as for the serialized
+ * buffer; these lightweight helpers instead work directly on the connection's buffers.
+ */
+#ifndef LIBCONFD_CBOR_H
+#define LIBCONFD_CBOR_H
+
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "Exceptions.h"
+
+/**
+ * @brief CBOR writer
+ *
+ * Appends CBOR items to the end of a byte buffer. Only definite length items are produced, and
+ * integers are always encoded in their shortest form.
+ *
+ * @remark The buffer is only ever grown, never shrunk; so once it's sized for the largest message
+ *         sent on a connection, encoding doesn't allocate.
+ */
+class CborWriter {
+    public:
+        /// Major types, shifted into the initial byte position
+        enum class Type: uint8_t {
+            UnsignedInt                 = (0 << 5),
+            NegativeInt                 = (1 << 5),
+            ByteString                  = (2 << 5),
+            TextString                  = (3 << 5),
+            Array                       = (4 << 5),
+            Map                         = (5 << 5),
+            Simple                      = (7 << 5),
+        };
+
+        CborWriter(std::vector<std::byte> &buffer) : buffer(buffer) {}
+
+        /// Begin a map with the given number of key/value pairs
+        void map(const size_t pairs) {
+            this->head(Type::Map, pairs);
+        }
+
+        /// Write a text string
+        void string(const std::string_view &str) {
+            this->head(Type::TextString, str.size());
+            this->append(str.data(), str.size());
+        }
+
+        /// Write a byte string
+        void bytes(std::span<const std::byte> data) {
+            this->head(Type::ByteString, data.size());
+            this->append(data.data(), data.size());
+        }
+
+        /// Write an unsigned integer
+        void uint(const uint64_t value) {
+            this->head(Type::UnsignedInt, value);
+        }
+
+        /// Write a double precision floating point value
+        void real(const double value) {
+            const auto bits = std::bit_cast<uint64_t>(value);
+
+            this->byte(static_cast<uint8_t>(Type::Simple) | 27);
+            this->bigEndian(bits, sizeof(bits));
+        }
+
+        /// Write a boolean value
+        void boolean(const bool value) {
+            this->byte(static_cast<uint8_t>(Type::Simple) | (value ? 21 : 20));
+        }
+
+        /// Write a null value
+        void null() {
+            this->byte(static_cast<uint8_t>(Type::Simple) | 22);
+        }
+
+        /// Append items that were already encoded
+        void raw(std::span<const std::byte> data) {
+            this->append(data.data(), data.size());
+        }
+
+    private:
+        /// Write the initial byte (and argument) of an item
+        void head(const Type type, const uint64_t arg) {
+            const auto major = static_cast<uint8_t>(type);
+
+            if(arg < 24) {
+                this->byte(major | arg);
+            } else if(arg <= UINT8_MAX) {
+                this->byte(major | 24);
+                this->bigEndian(arg, 1);
+            } else if(arg <= UINT16_MAX) {
+                this->byte(major | 25);
+                this->bigEndian(arg, 2);
+            } else if(arg <= UINT32_MAX) {
+                this->byte(major | 26);
+                this->bigEndian(arg, 4);
+            } else {
+                this->byte(major | 27);
+                this->bigEndian(arg, 8);
+            }
+        }
+
+        /// Write the low `bytes` bytes of a value, most significant first
+        void bigEndian(const uint64_t value, const size_t bytes) {
+            for(size_t i = bytes; i > 0; i--) {
+                this->byte((value >> ((i - 1) * 8)) & 0xFF);
+            }
+        }
+
+        void byte(const uint8_t value) {
+            this->buffer.push_back(std::byte{value});
+        }
+
+        void append(const void *data, const size_t length) {
+            auto ptr = reinterpret_cast<const std::byte *>(data);
+            this->buffer.insert(this->buffer.end(), ptr, ptr + length);
+        }
+
+    private:
+        /// Buffer to append items to
+        std::vector<std::byte> &buffer;
+};
+
+/**
+ * @brief CBOR reader
+ *
+ * Reads CBOR items sequentially out of a buffer, without copying them: strings in the returned
+ * items point directly into the buffer. Indefinite length items and tags are not supported, as
+ * confd never produces them.
+ *
+ * @remark All decoding errors are reported by throwing a ConfdError with the
+ *         `kConfdInvalidResponse` status.
+ */
+class CborReader {
+    public:
+        /**
+         * @brief A decoded item
+         *
+         * For arrays and maps, only the number of elements is decoded; the elements themselves
+         * follow, and must be read (or skipped) individually.
+         */
+        struct Item {
+            enum class Type {
+                UnsignedInt, NegativeInt, ByteString, TextString, Array, Map, Bool, Null,
+                Undefined, Real,
+            };
+
+            /// Type of the item
+            Type type;
+            /// Integer value (for negative ints, the encoded value, i.e. -1 - n), or element count
+            uint64_t arg{0};
+            /// Floating point value
+            double real{0};
+            /// Data of byte and text strings
+            std::span<const std::byte> data;
+
+            /// Get the data of a text string
+            std::string_view string() const {
+                return {reinterpret_cast<const char *>(this->data.data()), this->data.size()};
+            }
+            /// Test whether the item is a text string with the given value
+            bool is(const std::string_view &str) const {
+                return this->type == Type::TextString && this->string() == str;
+            }
+        };
+
+        CborReader(std::span<const std::byte> buffer) : buffer(buffer) {}
+
+        /**
+         * @brief Read the next item from the buffer
+         */
+        Item read() {
+            Item item;
+            const auto initial = this->byte();
+            const auto major = initial >> 5, info = initial & 0x1F;
+
+            // simple values and floats
+            if(major == 7) {
+                switch(info) {
+                    case 20:
+                    case 21:
+                        item.type = Item::Type::Bool;
+                        item.arg = (info == 21);
+                        break;
+                    case 22:
+                        item.type = Item::Type::Null;
+                        break;
+                    case 23:
+                        item.type = Item::Type::Undefined;
+                        break;
+                    case 25:
+                        item.type = Item::Type::Real;
+                        item.real = HalfToDouble(this->bigEndian(2));
+                        break;
+                    case 26:
+                        item.type = Item::Type::Real;
+                        item.real = std::bit_cast<float>(
+                                static_cast<uint32_t>(this->bigEndian(4)));
+                        break;
+                    case 27:
+                        item.type = Item::Type::Real;
+                        item.real = std::bit_cast<double>(this->bigEndian(8));
+                        break;
+
+                    default:
+                        throw ConfdError("unsupported cbor simple value", kConfdInvalidResponse);
+                }
+
+                return item;
+            }
+
+            // all other types have an argument
+            if(info < 24) {
+                item.arg = info;
+            } else if(info <= 27) {
+                item.arg = this->bigEndian(1 << (info - 24));
+            } else {
+                throw ConfdError("unsupported cbor item length", kConfdInvalidResponse);
+            }
+
+            switch(major) {
+                case 0:
+                    item.type = Item::Type::UnsignedInt;
+                    break;
+                case 1:
+                    item.type = Item::Type::NegativeInt;
+                    break;
+                case 2:
+                case 3:
+                    item.type = (major == 2) ? Item::Type::ByteString : Item::Type::TextString;
+                    if(item.arg > this->buffer.size() - this->offset) {
+                        throw ConfdError("truncated cbor string", kConfdInvalidResponse);
+                    }
+                    item.data = this->buffer.subspan(this->offset, item.arg);
+                    this->offset += item.arg;
+                    break;
+                case 4:
+                    item.type = Item::Type::Array;
+                    break;
+                case 5:
+                    item.type = Item::Type::Map;
+                    break;
+
+                default:
+                    throw ConfdError("unsupported cbor major type", kConfdInvalidResponse);
+            }
+
+            return item;
+        }
+
+        /// Get the offset of the next item in the buffer
+        size_t position() const {
+            return this->offset;
+        }
+
+        /**
+         * @brief Skip the contents of an item that was just read
+         *
+         * For arrays and maps, this consumes all of their elements; it does nothing for any other
+         * type of item.
+         */
+        void skip(const Item &item) {
+            uint64_t count{0};
+            if(item.type == Item::Type::Array) {
+                count = item.arg;
+            } else if(item.type == Item::Type::Map) {
+                count = item.arg * 2;
+            }
+
+            for(uint64_t i = 0; i < count; i++) {
+                this->skip(this->read());
+            }
+        }
+
+    private:
+        uint8_t byte() {
+            if(this->offset >= this->buffer.size()) {
+                throw ConfdError("truncated cbor item", kConfdInvalidResponse);
+            }
+            return static_cast<uint8_t>(this->buffer[this->offset++]);
+        }
+
+        uint64_t bigEndian(const size_t bytes) {
+            uint64_t value{0};
+            for(size_t i = 0; i < bytes; i++) {
+                value = (value << 8) | this->byte();
+            }
+            return value;
+        }
+
+        /// Convert an IEEE 754 half precision value to a double
+        static double HalfToDouble(const uint16_t half) {
+            const int exp = (half >> 10) & 0x1F;
+            const int mant = half & 0x3FF;
+            double value;
+
+            if(exp == 0) {
+                value = std::ldexp(mant, -24);
+            } else if(exp != 31) {
+                value = std::ldexp(mant + 1024, exp - 25);
+            } else {
+                value = mant ? NAN : INFINITY;
+            }
+
+            return (half & 0x8000) ? -value : value;
+        }
+
+    private:
+        /// Buffer to read from
+        std::span<const std::byte> buffer;
+        /// Offset of the next byte to read
+        size_t offset{0};
+};
+
+#endif
@@ -0,0 +1,487 @@
+#include <cerrno>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <variant>
+
+#include <plog/Log.h>
+
+#include "rpc/types.h"
+#include "Config.h"
+#include "DefaultsImage.h"
+#include "EmbeddedStore.h"
+#include "Exceptions.h"
+
+/**
+ * @brief Decoded request
+ *
+ * All requests are maps, holding the name of the key they pertain to, and (for updates) its new
+ * value; any other entries are ignored.
+ */
+struct Request {
+    /// Name of the key
+    std::string key;
+    /// New value of the key, if specified
+    std::optional<CborReader::Item> value;
+    /// Expected version of the key, if specified
+    std::optional<uint64_t> version;
+    /// Time to live of the key (in ms), if specified
+    std::optional<uint64_t> ttl;
+};
+
+/**
+ * @brief Decode a request payload
+ *
+ * @throw ConfdError The request is malformed
+ */
+static Request ParseRequest(std::span<const std::byte> payload) {
+    CborReader reader(payload);
+    Request req;
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid payload: expected map", kConfdInvalidArguments);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        if(key.type != CborReader::Item::Type::TextString) {
+            throw ConfdError("invalid map key type (expected string)", kConfdInvalidArguments);
+        }
+
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("key")) {
+            if(value.type != CborReader::Item::Type::TextString) {
+                throw ConfdError("invalid type for `key` (expected string)",
+                        kConfdInvalidArguments);
+            }
+            req.key = value.string();
+        } else if(key.is("value")) {
+            req.value = value;
+        } else if(key.is("version")) {
+            if(value.type != CborReader::Item::Type::UnsignedInt) {
+                throw ConfdError("invalid type for `version` (expected uint)",
+                        kConfdInvalidArguments);
+            }
+            req.version = value.arg;
+        } else if(key.is("ttl")) {
+            if(value.type != CborReader::Item::Type::UnsignedInt || !value.arg) {
+                throw ConfdError("invalid `ttl` (expected non-zero uint)",
+                        kConfdInvalidArguments);
+            } else if(value.arg > static_cast<uint64_t>(DataStore::kMaxTtl.count())) {
+                throw ConfdError("invalid `ttl` (too large)", kConfdInvalidArguments);
+            }
+            req.ttl = value.arg;
+        }
+    }
+
+    if(req.key.empty()) {
+        throw ConfdError("failed to get key name", kConfdInvalidArguments);
+    }
+
+    return req;
+}
+
+
+
+/**
+ * @brief Open the data store
+ *
+ * The data store is set up the same way confd sets it up: if confd's config file exists, its
+ * volatile key prefixes, factory defaults image, unchanged write handling and write debounce
+ * policies are applied.
+ *
+ * @param dbPath Path on disk of the sqlite3 database; it's created if it doesn't exist.
+ * @param configPath Path of confd's config file
+ *
+ * @throw std::runtime_error The config file is invalid
+ * @throw std::system_error The data store is in use by another process (EWOULDBLOCK), or confd is
+ *        configured to use a storage backend other than the database (ENOTSUP)
+ */
+EmbeddedStore::EmbeddedStore(const std::filesystem::path &dbPath,
+        const std::filesystem::path &configPath) {
+    Config::Reset();
+    if(std::filesystem::exists(configPath)) {
+        Config::Read(configPath);
+    }
+
+    // the database isn't where confd keeps its keys in the in-memory modes
+    if(Config::GetStorageBackend() != Config::StorageBackendType::Sqlite) {
+        throw std::system_error(ENOTSUP, std::generic_category(),
+                "embedded mode requires the sqlite backend");
+    }
+
+    this->store = std::make_unique<DataStore>(dbPath, Config::GetVolatilePrefixes());
+
+    // as with confd, a missing defaults image only leaves the defaults unavailable
+    const auto &defaultsPath = Config::GetDefaultsPath();
+    if(!defaultsPath.empty()) {
+        try {
+            this->store->setDefaults(std::make_unique<DefaultsImage>(defaultsPath));
+        } catch(const std::exception &err) {
+            PLOG_ERROR << "failed to open defaults image: " << err.what();
+        }
+    }
+
+    this->store->setUnchangedWritePolicy(Config::GetStorageTouchUnchanged() ?
+            DataStore::UnchangedWritePolicy::Touch : DataStore::UnchangedWritePolicy::Skip);
+    for(const auto &policy : Config::GetDebouncePolicies()) {
+        this->store->addDebouncePolicy(policy.prefix, policy.interval);
+    }
+}
+
+/**
+ * @brief Handle a request
+ *
+ * Process the request just like confd would, and encode the same reply it would send. There's no
+ * timer to write out debounced writes, so any that are due are written after each request (and
+ * the remaining ones when the data store is closed).
+ *
+ * @param ep Endpoint the request is addressed to
+ * @param request Request payload
+ * @param outReply Buffer to receive the reply payload; it's cleared first.
+ *
+ * @throw ConfdError The request is invalid, or the endpoint isn't supported in embedded mode
+ */
+void EmbeddedStore::handleRequest(const uint8_t ep, std::span<const std::byte> request,
+        std::vector<std::byte> &outReply) {
+    outReply.clear();
+    CborWriter writer(outReply);
+
+    try {
+        switch(ep) {
+            case kConfigQuery:
+                this->doQuery(request, writer);
+                break;
+            case kConfigUpdate:
+                this->doUpdate(request, writer);
+                break;
+            case kConfigDelete:
+                this->doDelete(request, writer);
+                break;
+            case kConfigBatchUpdate:
+                this->doBatchUpdate(request, writer);
+                break;
+            case kConfigExport:
+                this->doExport(request, writer);
+                break;
+            case kConfigCompareAndSwap:
+                this->doCompareAndSwap(request, writer);
+                break;
+            case kConfigIntegerOp:
+                this->doIntegerOp(request, writer);
+                break;
+
+            // there are no daemon statistics or traces to report
+            default:
+                throw ConfdError("endpoint not supported in embedded mode", kConfdNotSupported);
+        }
+    }
+    // the data store rejects invalid names and values (such as changing the type of a key)
+    catch(const std::invalid_argument &e) {
+        throw ConfdError(e.what(), kConfdInvalidArguments);
+    }
+
+    this->store->flushPendingWrites();
+}
+
+/**
+ * @brief Read a key
+ *
+ * The reply contains a `found` flag and, if the key exists, its value and version.
+ */
+void EmbeddedStore::doQuery(std::span<const std::byte> request, CborWriter &reply) {
+    const auto req = ParseRequest(request);
+    uint64_t version{0};
+    const auto value = this->store->getKey(req.key, &version);
+    const bool found = !std::holds_alternative<std::monostate>(value);
+
+    reply.map(found ? 3 : 1);
+    if(found) {
+        reply.string("value");
+        EncodeValue(reply, value);
+        reply.string("version");
+        reply.uint(version);
+    }
+    reply.string("found");
+    reply.boolean(found);
+}
+
+/**
+ * @brief Update the value of a key
+ *
+ * The key's expiration time is always updated, as there's no record of which keys expire. Keys
+ * aren't actually removed once they expire until confd is started.
+ */
+void EmbeddedStore::doUpdate(std::span<const std::byte> request, CborWriter &reply) {
+    const auto req = ParseRequest(request);
+    if(!req.value) {
+        throw ConfdError("missing value", kConfdInvalidArguments);
+    }
+
+    std::optional<DataStore::ExpiryTime> expiresAt;
+    if(req.ttl) {
+        expiresAt = std::chrono::system_clock::now() + std::chrono::milliseconds(*req.ttl);
+    }
+
+    this->store->setKeyWithExpiry(req.key, DecodeValue(*req.value), expiresAt);
+
+    reply.map(1);
+    reply.string("updated");
+    reply.boolean(true);
+}
+
+/**
+ * @brief Update the value of a key, if its version matches
+ *
+ * The reply contains an `updated` flag, and the key's new (or, if not updated, current) version.
+ */
+void EmbeddedStore::doCompareAndSwap(std::span<const std::byte> request, CborWriter &reply) {
+    const auto req = ParseRequest(request);
+    if(!req.value) {
+        throw ConfdError("missing value", kConfdInvalidArguments);
+    } else if(!req.version) {
+        throw ConfdError("missing version", kConfdInvalidArguments);
+    }
+
+    const auto result = this->store->setKeyIfVersion(req.key, DecodeValue(*req.value),
+            *req.version);
+
+    reply.map(2);
+    reply.string("updated");
+    reply.boolean(result.applied);
+    reply.string("version");
+    reply.uint(result.version);
+}
+
+/**
+ * @brief Atomically modify the value of an integer key
+ *
+ * The reply contains an `updated` flag and, if the key was updated, its new value and version.
+ */
+void EmbeddedStore::doIntegerOp(std::span<const std::byte> request, CborWriter &reply) {
+    CborReader reader(request);
+    std::string name;
+    std::optional<DataStore::IntegerOp> op;
+    std::optional<uint64_t> operand;
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid payload: expected map", kConfdInvalidArguments);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("key") && value.type == CborReader::Item::Type::TextString) {
+            name = value.string();
+        } else if(key.is("op") && value.type == CborReader::Item::Type::TextString) {
+            if(value.is("add")) {
+                op = DataStore::IntegerOp::Add;
+            } else if(value.is("sub")) {
+                op = DataStore::IntegerOp::Subtract;
+            } else if(value.is("min")) {
+                op = DataStore::IntegerOp::Min;
+            } else if(value.is("max")) {
+                op = DataStore::IntegerOp::Max;
+            }
+        } else if(key.is("operand") && value.type == CborReader::Item::Type::UnsignedInt) {
+            operand = value.arg;
+        }
+    }
+
+    if(name.empty() || !op || !operand) {
+        throw ConfdError("missing key, op or operand", kConfdInvalidArguments);
+    }
+
+    uint64_t version{0};
+    const auto result = this->store->applyIntegerOp(name, *op, static_cast<int64_t>(*operand),
+            &version);
+
+    reply.map(result ? 3 : 1);
+    reply.string("updated");
+    reply.boolean(result.has_value());
+
+    if(result) {
+        reply.string("value");
+        reply.uint(static_cast<uint64_t>(*result));
+        reply.string("version");
+        reply.uint(version);
+    }
+}
+
+/**
+ * @brief Delete a key
+ *
+ * The reply contains a `deleted` flag, which is false if the key didn't exist.
+ */
+void EmbeddedStore::doDelete(std::span<const std::byte> request, CborWriter &reply) {
+    const auto req = ParseRequest(request);
+    const auto deleted = this->store->deleteKey(req.key);
+
+    reply.map(1);
+    reply.string("deleted");
+    reply.boolean(deleted != 0);
+}
+
+/**
+ * @brief Update multiple keys in a single transaction
+ *
+ * The library sends batches in a single request in embedded mode, so batches split over multiple
+ * requests (with the `more` flag set) aren't supported.
+ */
+void EmbeddedStore::doBatchUpdate(std::span<const std::byte> request, CborWriter &reply) {
+    CborReader reader(request);
+    PropertyList updates;
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid payload: expected map", kConfdInvalidArguments);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto value = reader.read();
+
+        if(key.is("more")) {
+            if(value.type != CborReader::Item::Type::Bool || value.arg) {
+                throw ConfdError("split batches not supported", kConfdNotSupported);
+            }
+        } else if(key.is("updates") && value.type == CborReader::Item::Type::Map) {
+            updates.reserve(value.arg);
+
+            for(size_t j = 0; j < value.arg; j++) {
+                const auto name = reader.read();
+                if(name.type != CborReader::Item::Type::TextString) {
+                    throw ConfdError("invalid key name type (expected string)",
+                            kConfdInvalidArguments);
+                }
+
+                updates.emplace_back(name.string(), DecodeValue(reader.read()));
+            }
+        } else {
+            reader.skip(value);
+        }
+    }
+
+    this->store->setKeys(updates);
+
+    reply.map(1);
+    reply.string("updated");
+    reply.uint(updates.size());
+}
+
+/**
+ * @brief Export the values of the keys following a given key
+ *
+ * Replies are limited to the same size as confd's, so callers page through the keys the same
+ * way, regardless of mode.
+ */
+void EmbeddedStore::doExport(std::span<const std::byte> request, CborWriter &reply) {
+    CborReader reader(request);
+    std::string after;
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid payload: expected map", kConfdInvalidArguments);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("after") && value.type == CborReader::Item::Type::TextString) {
+            after = value.string();
+        }
+    }
+
+    // encode as many keys as fit
+    const auto values = this->store->getKeys(after, kExportPageKeys);
+    bool more = (values.size() == kExportPageKeys);
+
+    std::vector<std::byte> pairs;
+    CborWriter writer(pairs);
+    size_t numPairs{0};
+
+    for(const auto &[name, value] : values) {
+        const auto start = pairs.size();
+
+        writer.string(name);
+        EncodeValue(writer, value);
+
+        if(pairs.size() > kMaxExportPayload) {
+            if(!numPairs) {
+                throw ConfdError("key too large to export", kConfdNotSupported);
+            }
+
+            pairs.resize(start);
+            more = true;
+            break;
+        }
+        numPairs++;
+    }
+
+    reply.map(2);
+    reply.string("values");
+    reply.map(numPairs);
+    reply.raw(pairs);
+    reply.string("more");
+    reply.boolean(more);
+}
+
+
+
+/**
+ * @brief Convert a value from a request into a property value
+ *
+ * @throw ConfdError Unsupported value type
+ */
+PropertyValue EmbeddedStore::DecodeValue(const CborReader::Item &item) {
+    switch(item.type) {
+        case CborReader::Item::Type::TextString:
+            return std::string(item.string());
+        case CborReader::Item::Type::ByteString:
+            return Blob(item.data.begin(), item.data.end());
+        case CborReader::Item::Type::UnsignedInt:
+            return item.arg;
+        case CborReader::Item::Type::Real:
+            return item.real;
+        case CborReader::Item::Type::Bool:
+            return static_cast<bool>(item.arg);
+        case CborReader::Item::Type::Null:
+            return nullptr;
+
+        default:
+            throw ConfdError("invalid value type", kConfdInvalidArguments);
+    }
+}
+
+/**
+ * @brief Encode a property value into a reply
+ */
+void EmbeddedStore::EncodeValue(CborWriter &writer, const PropertyValue &value) {
+    std::visit([&](auto&& arg) {
+        using T = std::decay_t<decltype(arg)>;
+
+        if constexpr(std::is_same_v<T, std::string>) {
+            writer.string(arg);
+        } else if constexpr(std::is_same_v<T, Blob>) {
+            writer.bytes(arg);
+        } else if constexpr(std::is_same_v<T, uint64_t>) {
+            writer.uint(arg);
+        } else if constexpr(std::is_same_v<T, double>) {
+            writer.real(arg);
+        } else if constexpr(std::is_same_v<T, bool>) {
+            writer.boolean(arg);
+        } else {
+            writer.null();
+        }
+    }, value);
+}
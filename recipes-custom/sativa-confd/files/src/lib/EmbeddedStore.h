@@ -0,0 +1,59 @@
+#ifndef LIBCONFD_EMBEDDEDSTORE_H
+#define LIBCONFD_EMBEDDEDSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "Cbor.h"
+#include "DataStore.h"
+
+/**
+ * @brief In-process data store
+ *
+ * Used in place of the RPC connection when the library is opened in embedded mode: rather than
+ * sending requests to confd, they are handled right away against a data store opened by the
+ * library itself. Requests and replies use the same encoding as the RPC protocol, so the API
+ * wrappers work the same either way.
+ *
+ * The data store is locked for as long as it's open, so this fails if confd (or another process
+ * in embedded mode) is already using the database. Its settings are read from confd's config
+ * file, so volatile keys and factory defaults behave the same as they do through confd.
+ */
+class EmbeddedStore {
+    /// Maximum number of keys returned by a single export request
+    constexpr static const size_t kExportPageKeys{512};
+    /// Maximum size of the key/value pairs in an export reply (same as confd), in bytes
+    constexpr static const size_t kMaxExportPayload{UINT16_MAX - 64};
+
+    /// Path of confd's config file, which the data store's settings are read from
+    constexpr static const char *kConfigPath{"/usr/etc/confd.toml"};
+
+    public:
+        EmbeddedStore(const std::filesystem::path &dbPath,
+                const std::filesystem::path &configPath = kConfigPath);
+
+        void handleRequest(const uint8_t ep, std::span<const std::byte> request,
+                std::vector<std::byte> &outReply);
+
+    private:
+        void doQuery(std::span<const std::byte> request, CborWriter &reply);
+        void doUpdate(std::span<const std::byte> request, CborWriter &reply);
+        void doDelete(std::span<const std::byte> request, CborWriter &reply);
+        void doCompareAndSwap(std::span<const std::byte> request, CborWriter &reply);
+        void doIntegerOp(std::span<const std::byte> request, CborWriter &reply);
+        void doBatchUpdate(std::span<const std::byte> request, CborWriter &reply);
+        void doExport(std::span<const std::byte> request, CborWriter &reply);
+
+        static PropertyValue DecodeValue(const CborReader::Item &item);
+        static void EncodeValue(CborWriter &writer, const PropertyValue &value);
+
+    private:
+        /// Underlying data store
+        std::unique_ptr<DataStore> store;
+};
+
+#endif
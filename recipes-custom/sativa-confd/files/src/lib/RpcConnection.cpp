@@ -1,3 +1,4 @@
+#include <poll.h>
 #include <unistd.h>
 #include <sys/un.h>
 #include <sys/socket.h>
@@ -5,22 +6,186 @@
 #include <cerrno>
 #include <cstring>
 #include <system_error>
+#include <thread>
 
 #include "rpc/types.h"
+#include "EmbeddedStore.h"
+#include "Exceptions.h"
 #include "RpcConnection.h"
 
 RpcConnection *RpcConnection::gShared{nullptr};
 
+std::atomic_bool RpcConnection::gPerThread{false};
+std::atomic<uint64_t> RpcConnection::gGeneration{0};
+std::mutex RpcConnection::gConfigLock;
+std::string RpcConnection::gSocketPath;
+std::shared_ptr<EmbeddedStore> RpcConnection::gEmbeddedStore;
+std::atomic<int64_t> RpcConnection::gDefaultTimeout{0};
+
+thread_local std::unique_ptr<RpcConnection> RpcConnection::gThreadConnection;
+thread_local uint64_t RpcConnection::gThreadGeneration{0};
+
+/**
+ * @brief Set up the library's default connection
+ *
+ * In shared mode, the connection used by all threads is established right away. In per-thread
+ * mode, connections are established lazily; but we'll still create the calling thread's
+ * connection, so that errors are reported here rather than on the first request.
+ *
+ * In embedded mode, the data store is opened here, and shared by all connections.
+ *
+ * @param path Path to the confd socket, or the database (in embedded mode)
+ * @param perThread Whether each thread should get its own connection
+ * @param embedded Whether to handle requests in-process rather than connecting to confd
+ */
+void RpcConnection::Init(const std::string_view &path, const bool perThread,
+        const bool embedded) {
+    if(gShared || gPerThread) {
+        throw std::logic_error("rpc connection already initialized!");
+    }
+
+    std::shared_ptr<EmbeddedStore> store;
+    if(embedded) {
+        store = std::make_shared<EmbeddedStore>(std::filesystem::path(path));
+    }
+
+    if(!perThread) {
+        gShared = store ? new RpcConnection(store) : new RpcConnection(path);
+        return;
+    }
+
+    {
+        std::lock_guard lg(gConfigLock);
+        gSocketPath = path;
+        gEmbeddedStore = std::move(store);
+    }
+
+    gGeneration++;
+    gPerThread = true;
+
+    try {
+        Get();
+    } catch(const std::exception &) {
+        gPerThread = false;
+
+        std::lock_guard lg(gConfigLock);
+        gEmbeddedStore.reset();
+        throw;
+    }
+}
+
+/**
+ * @brief Release the library's default connection
+ *
+ * In per-thread mode, only the calling thread's connection is closed immediately; the
+ * connections of other threads are closed when those threads exit, or the next time they try to
+ * use the library.
+ *
+ * @remark In embedded mode, the data store is closed (and its lock released) once the last of
+ *         these connections is closed.
+ */
+void RpcConnection::Deinit() {
+    delete gShared;
+    gShared = nullptr;
+
+    if(gPerThread) {
+        gPerThread = false;
+        gGeneration++;
+        gThreadConnection.reset();
+
+        std::lock_guard lg(gConfigLock);
+        gEmbeddedStore.reset();
+    }
+}
+
+/**
+ * @brief Get the connection to use for a request
+ *
+ * @param handle Connection handle specified by the caller, if any
+ *
+ * @return The handle, if one was specified; otherwise, the default connection for the calling
+ *         thread, which is established if needed.
+ *
+ * @throw std::system_error The library isn't connected (ENOTCONN) or connecting failed
+ */
+RpcConnection *RpcConnection::Get(struct confd_handle *handle) {
+    if(handle) {
+        return handle;
+    }
+
+    // per-thread connection: (re)create it if needed
+    if(gPerThread) {
+        const auto generation = gGeneration.load();
+
+        if(!gThreadConnection || gThreadGeneration != generation) {
+            gThreadConnection.reset();
+
+            std::string path;
+            std::shared_ptr<EmbeddedStore> store;
+            {
+                std::lock_guard lg(gConfigLock);
+                path = gSocketPath;
+                store = gEmbeddedStore;
+            }
+
+            gThreadConnection = store ? std::make_unique<RpcConnection>(store) :
+                std::make_unique<RpcConnection>(path);
+            gThreadGeneration = generation;
+        }
+
+        return gThreadConnection.get();
+    }
+
+    // otherwise, use the shared connection
+    if(!gShared) {
+        throw std::system_error(ENOTCONN, std::generic_category(), "confd not opened");
+    }
+
+    return gShared;
+}
+
 /**
  * @brief Establish RPC connection
  *
  * Create the RPC socket and dial the path specified.
  */
-RpcConnection::RpcConnection(const std::string_view &socketPath) {
+RpcConnection::RpcConnection(const std::string_view &socketPath) : socketPath(socketPath) {
+    this->connect(this->getDeadline());
+}
+
+/**
+ * @brief Create an embedded connection
+ *
+ * Requests on the connection are handled by the given data store, rather than sent to confd.
+ */
+RpcConnection::RpcConnection(const std::shared_ptr<EmbeddedStore> &store) : store(store) {
+}
+
+/**
+ * @brief Close RPC connection
+ *
+ * We'll close the socket and release all allocated memory.
+ */
+RpcConnection::~RpcConnection() {
+    this->disconnect();
+}
+
+/**
+ * @brief Dial the confd socket
+ *
+ * The socket is non-blocking, so that no socket operation can take longer than the deadline of
+ * the request it's part of: connecting waits (by polling) for the connection to be established,
+ * and if confd's listen backlog is full, it's retried until the deadline passes.
+ *
+ * @param deadline Time by which the connection must be established
+ *
+ * @throw ConfdError The deadline passed (kConfdTimedOut)
+ */
+void RpcConnection::connect(const Clock::time_point deadline) {
     int err;
 
     // create the socket
-    this->socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    this->socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
     if(this->socket == -1) {
         throw std::system_error(errno, std::generic_category(), "create rpc socket");
     }
@@ -29,46 +194,89 @@ RpcConnection::RpcConnection(const std::string_view &socketPath) {
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
 
-    strncpy(addr.sun_path, socketPath.data(), sizeof(addr.sun_path) - 1);
+    strncpy(addr.sun_path, this->socketPath.c_str(), sizeof(addr.sun_path) - 1);
 
     // dial it
-    err = connect(this->socket, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
-    if(err == -1) {
-        throw std::system_error(errno, std::generic_category(), "dial rpc socket");
+    try {
+        while(true) {
+            err = ::connect(this->socket, reinterpret_cast<struct sockaddr *>(&addr),
+                    sizeof(addr));
+            if(!err) {
+                break;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            // listen backlog is full: there's nothing to wait on, so try again shortly
+            else if(errno == EAGAIN && Clock::now() + kConnectRetryDelay < deadline) {
+                std::this_thread::sleep_for(kConnectRetryDelay);
+                continue;
+            }
+            // connection in progress: it's complete once the socket becomes writable
+            else if(errno == EINPROGRESS) {
+                this->waitFor(POLLOUT, deadline);
+
+                int error{0};
+                socklen_t errorLen{sizeof(error)};
+                if(getsockopt(this->socket, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1) {
+                    throw std::system_error(errno, std::generic_category(), "dial rpc socket");
+                } else if(error) {
+                    throw std::system_error(error, std::generic_category(), "dial rpc socket");
+                }
+                break;
+            }
+
+            throw std::system_error(errno, std::generic_category(), "dial rpc socket");
+        }
+    } catch(const std::exception &) {
+        this->disconnect();
+        throw;
     }
 }
 
 /**
- * @brief Close RPC connection
+ * @brief Close the socket
  *
- * We'll close the socket and release all allocated memory.
+ * The connection is re-established before the next request is sent.
  */
-RpcConnection::~RpcConnection() {
+void RpcConnection::disconnect() {
     if(this->socket != -1) {
         close(this->socket);
+        this->socket = -1;
     }
 }
 
 
 
 /**
- * @brief Create and send packet
+ * @brief Begin encoding a request
  *
- * Given the endpoint and optional payload, format a packet and then send it to the RPC connection.
+ * Resets the transmit buffer so that it contains only a (blank) message header; the payload of
+ * the request is then encoded directly after it, using the returned writer.
  *
- * @return Tag of the sent packet
+ * @return CBOR writer that appends to the transmit buffer
+ *
+ * @remark The transmit buffer keeps its capacity between requests, so in steady state, encoding
+ *         a request does not allocate any memory.
  */
-uint8_t RpcConnection::sendPacket(const uint8_t ep, std::span<const std::byte> payload) {
-    // allocate buffer
-    const size_t msgSize = sizeof(struct rpc_header) + payload.size();
-    this->transmitBuf.resize(msgSize, std::byte(0));
-    std::fill(this->transmitBuf.begin(), this->transmitBuf.begin() + sizeof(struct rpc_header),
-            std::byte(0));
+CborWriter RpcConnection::beginRequest() {
+    this->transmitBuf.assign(sizeof(struct rpc_header), std::byte(0));
+    return CborWriter(this->transmitBuf);
+}
 
-    // copy payload
-    if(!payload.empty()) {
-        std::copy(payload.begin(), payload.end(),
-                (this->transmitBuf.begin() + offsetof(struct rpc_header, payload)));
+/**
+ * @brief Send the request in the transmit buffer
+ *
+ * Fill in the header of the message previously started with beginRequest(), then send it.
+ *
+ * @param ep Endpoint to send the request to
+ * @param deadline Time by which the request must have been sent
+ *
+ * @return Tag of the sent packet
+ */
+uint8_t RpcConnection::sendRequest(const uint8_t ep, const Clock::time_point deadline) {
+    const size_t msgSize = this->transmitBuf.size();
+    if(msgSize > UINT16_MAX) {
+        throw std::system_error(EMSGSIZE, std::generic_category(), "rpc message too large");
     }
 
     // fill in the header
@@ -81,11 +289,41 @@ uint8_t RpcConnection::sendPacket(const uint8_t ep, std::span<const std::byte> p
     hdr->tag = tag;
 
     // send the packet
-    this->sendPacket(this->transmitBuf);
+    this->sendPacket(this->transmitBuf, deadline);
 
     return tag;
 }
 
+/**
+ * @brief Create and send packet
+ *
+ * Given the endpoint and optional payload, format a packet and then send it to the RPC connection.
+ *
+ * @return Tag of the sent packet
+ */
+uint8_t RpcConnection::sendPacket(const uint8_t ep, std::span<const std::byte> payload) {
+    if(this->store) {
+        throw ConfdError("requests without reply not supported in embedded mode",
+                kConfdNotSupported);
+    }
+
+    this->beginRequest();
+    this->transmitBuf.insert(this->transmitBuf.end(), payload.begin(), payload.end());
+
+    const auto deadline = this->getDeadline();
+
+    try {
+        if(this->socket == -1) {
+            this->reconnect(deadline);
+        }
+
+        return this->sendRequest(ep, deadline);
+    } catch(const std::exception &) {
+        this->disconnect();
+        throw;
+    }
+}
+
 /**
  * @brief Send a packet, then await its reply
  *
@@ -100,35 +338,243 @@ uint8_t RpcConnection::sendPacket(const uint8_t ep, std::span<const std::byte> p
  */
 void RpcConnection::sendPacketWithReply(const uint8_t ep, std::span<const std::byte> payload,
         std::span<const std::byte> &outReplyPayload) {
-    std::span<const std::byte> replyPacket;
+    this->beginRequest();
+    this->transmitBuf.insert(this->transmitBuf.end(), payload.begin(), payload.end());
 
-    // send the request
-    const auto tag = this->sendPacket(ep, payload);
+    this->sendRequestWithReply(ep, outReplyPayload);
+}
 
-    // receive the response and validate the header
-    this->receivePacket(replyPacket);
-    if(replyPacket.empty()) {
-        throw std::logic_error("received empty reply packet?");
+/**
+ * @brief Send the request in the transmit buffer, then await its reply
+ *
+ * The request must previously have been encoded using the writer returned by beginRequest().
+ *
+ * The entire exchange must complete within the connection's timeout. If it doesn't, or any other
+ * IO error occurs, the connection is closed (since it may still receive a stale reply) and then
+ * re-established before the next request.
+ *
+ * If the connection is lost during an idempotent request (for example, because confd restarted)
+ * the connection is re-established, and the request is sent again.
+ *
+ * Embedded connections instead hand the request directly to the data store, which places its
+ * reply in the receive buffer.
+ *
+ * @param ep Endpoint to send the request to
+ * @param outReplyPayload Buffer containing the payload of the received packet
+ *
+ * @note The reply packet buffer is valid only until the next packet reception.
+ */
+void RpcConnection::sendRequestWithReply(const uint8_t ep,
+        std::span<const std::byte> &outReplyPayload) {
+    if(this->store) {
+        this->store->handleRequest(ep, std::span(this->transmitBuf).subspan(
+                    sizeof(struct rpc_header)), this->receiveBuf);
+        outReplyPayload = this->receiveBuf;
+        return;
     }
 
-    auto &replyHdr = *reinterpret_cast<const struct rpc_header *>(replyPacket.data());
+    std::span<const std::byte> replyPacket;
+    const auto deadline = this->getDeadline();
+
+    for(size_t attempt = 0; ; attempt++) {
+        try {
+            if(this->socket == -1) {
+                this->reconnect(deadline);
+            }
+
+            // send the request
+            const auto tag = this->sendRequest(ep, deadline);
+
+            // receive the response and validate the header
+            this->receivePacket(replyPacket, deadline);
+            if(replyPacket.empty()) {
+                throw std::logic_error("received empty reply packet?");
+            }
 
-    if(replyHdr.endpoint != ep) {
+            auto &replyHdr = *reinterpret_cast<const struct rpc_header *>(replyPacket.data());
+
+            if(replyHdr.endpoint != ep) {
 #ifndef NDEBUG
-        fprintf(stderr, "got ep %02x, expected %02x\n", replyHdr.endpoint, ep);
+                fprintf(stderr, "got ep %02x, expected %02x\n", replyHdr.endpoint, ep);
 #endif
-        throw std::runtime_error("ep mismatch");
-    } else if(replyHdr.tag != tag) {
+                throw std::runtime_error("ep mismatch");
+            } else if(replyHdr.tag != tag) {
 #ifndef NDEBUG
-        fprintf(stderr, "got tag %02x, expected %02x\n", replyHdr.tag, tag);
+                fprintf(stderr, "got tag %02x, expected %02x\n", replyHdr.tag, tag);
 #endif
-        throw std::runtime_error("tag mismatch");
+                throw std::runtime_error("tag mismatch");
+            }
+
+            break;
+        }
+        // replay idempotent requests if the connection went away
+        catch(const std::system_error &e) {
+            this->disconnect();
+
+            if(!IsIdempotent(ep) || !IsConnectionLost(e.code()) || attempt >= kMaxReplays) {
+                throw;
+            }
+        }
+        catch(const std::exception &) {
+            this->disconnect();
+            throw;
+        }
     }
 
     // get the payload
     outReplyPayload = replyPacket.subspan(offsetof(struct rpc_header, payload));
 }
 
+/**
+ * @brief Re-establish the connection
+ *
+ * While confd is restarting, its socket may not exist, or refuse connections; so connecting is
+ * retried with exponential backoff, until either the request's deadline or the maximum reconnect
+ * time passes.
+ *
+ * @param deadline Deadline of the request that needs the connection
+ */
+void RpcConnection::reconnect(const Clock::time_point deadline) {
+    const auto giveUp = std::min(deadline, Clock::now() + kReconnectMaxTime);
+    auto delay = kReconnectInitialDelay;
+
+    while(true) {
+        try {
+            this->connect(giveUp);
+            return;
+        } catch(const std::system_error &e) {
+            const auto err = e.code().value();
+            if((err != ECONNREFUSED && err != ENOENT && err != EAGAIN) ||
+                    Clock::now() + delay > giveUp) {
+                throw;
+            }
+        }
+
+        std::this_thread::sleep_for(delay);
+        delay = std::min(delay * 2, kReconnectMaxDelay);
+    }
+}
+
+/**
+ * @brief Determine whether a request can safely be sent again
+ *
+ * Updates are idempotent too, since they set an absolute value; but deletes are not, as a
+ * replayed delete would report that the key doesn't exist. Neither are batch updates, since the
+ * earlier parts of a batch are lost with the connection; nor conditional updates, as a replay
+ * would find the version already changed by the original request; nor integer operations, which
+ * would be applied twice.
+ */
+bool RpcConnection::IsIdempotent(const uint8_t ep) {
+    switch(ep) {
+        case kConfigQuery:
+        case kConfigUpdate:
+        case kConfigStats:
+        case kConfigTrace:
+        case kConfigExport:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Determine whether an error indicates that the connection to confd was lost
+ */
+bool RpcConnection::IsConnectionLost(const std::error_code &code) {
+    switch(code.value()) {
+        case EPIPE:
+        case ECONNRESET:
+        case ECONNABORTED:
+        case ENOTCONN:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+/**
+ * @brief Get the deadline for a request started now
+ *
+ * @return Time by which the request must complete, or the maximum time point if there is no
+ *         timeout
+ */
+RpcConnection::Clock::time_point RpcConnection::getDeadline() const {
+    const auto timeout = this->timeout.value_or(std::chrono::milliseconds(gDefaultTimeout));
+    if(timeout.count() <= 0) {
+        return Clock::time_point::max();
+    }
+
+    return Clock::now() + timeout;
+}
+
+/**
+ * @brief Wait for the socket to become ready
+ *
+ * @param events Events to wait for (as in `poll()`)
+ * @param deadline Time at which to give up waiting
+ *
+ * @throw ConfdError The deadline passed (kConfdTimedOut)
+ */
+void RpcConnection::waitFor(const short events, const Clock::time_point deadline) {
+    struct pollfd pfd{
+        .fd = this->socket,
+        .events = events,
+        .revents = 0,
+    };
+
+    while(true) {
+        int timeout{-1};
+
+        if(deadline != Clock::time_point::max()) {
+            const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                    deadline - Clock::now()).count();
+            if(remaining <= 0) {
+                throw ConfdError("rpc request timed out", kConfdTimedOut);
+            }
+            timeout = static_cast<int>(std::min<int64_t>(remaining, INT32_MAX));
+        }
+
+        const auto err = poll(&pfd, 1, timeout);
+        if(err == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "poll rpc socket");
+        } else if(err == 1) {
+            // errors and hangups are reported by the subsequent read/write
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Read an exact number of bytes from the socket
+ *
+ * @param buffer Buffer to fill completely
+ * @param deadline Time by which all data must have been read
+ */
+void RpcConnection::readFully(std::span<std::byte> buffer, const Clock::time_point deadline) {
+    size_t numRead{0};
+
+    while(numRead < buffer.size()) {
+        this->waitFor(POLLIN, deadline);
+
+        const auto err = read(this->socket, buffer.data() + numRead, buffer.size() - numRead);
+        if(err == -1) {
+            if(errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "read rpc message");
+        } else if(!err) {
+            throw std::system_error(ECONNRESET, std::generic_category(), "rpc connection closed");
+        }
+
+        numRead += err;
+    }
+}
 
 /**
  * @brief Receive a raw packet
@@ -144,22 +590,15 @@ void RpcConnection::sendPacketWithReply(const uint8_t ep, std::span<const std::b
  * @remark If this call succeeds, the caller is guaranteed that the packet's header has passed
  *         validation and basic sanity checks, and that the packet contents are likely valid.
  */
-void RpcConnection::receivePacket(std::span<const std::byte> &outPacket) {
-    int err;
-
+void RpcConnection::receivePacket(std::span<const std::byte> &outPacket,
+        const Clock::time_point deadline) {
     // ensure we have space for _at least_ a header
     if(this->receiveBuf.size() < sizeof(struct rpc_header)) {
         this->receiveBuf.resize(sizeof(struct rpc_header));
     }
 
     // read the header first
-    err = read(this->socket, this->receiveBuf.data(), sizeof(struct rpc_header));
-    if(err == -1) {
-        throw std::system_error(errno, std::generic_category(), "read rpc message (header)");
-    } else if(err != sizeof(struct rpc_header)) {
-        // TODO: can we recover from this?
-        throw std::runtime_error("insufficient read (header)");
-    }
+    this->readFully({this->receiveBuf.data(), sizeof(struct rpc_header)}, deadline);
 
     // validate the header and get how much payload to read
     size_t payloadToRead{0};
@@ -177,17 +616,11 @@ void RpcConnection::receivePacket(std::span<const std::byte> &outPacket) {
     }
 
     // read payload, if any
-    if(payloadToRead) {
-        this->receiveBuf.resize(sizeof(struct rpc_header) + payloadToRead);
+    this->receiveBuf.resize(sizeof(struct rpc_header) + payloadToRead);
 
-        err = read(this->socket, this->receiveBuf.data() + offsetof(struct rpc_header, payload),
-                payloadToRead);
-        if(err == -1) {
-            throw std::system_error(errno, std::generic_category(), "read rpc message (payload)");
-        } else if(err != payloadToRead) {
-            // TODO: can we recover from this?
-            throw std::runtime_error("insufficient read (payload)");
-        }
+    if(payloadToRead) {
+        this->readFully({this->receiveBuf.data() + offsetof(struct rpc_header, payload),
+                payloadToRead}, deadline);
     }
 
     // output it
@@ -197,21 +630,30 @@ void RpcConnection::receivePacket(std::span<const std::byte> &outPacket) {
 /**
  * @brief Send a raw packet
  *
- * Transmit the given buffer over the socket connection.
+ * Transmit the given buffer over the socket connection, waiting for the socket to become
+ * writable as needed. Since the socket is non-blocking, each write only sends as much as fits in
+ * the socket buffer, so a large packet can't block past the deadline.
  *
  * @param packet Raw packet (including header) to send
+ * @param deadline Time by which the entire packet must have been written
  */
-void RpcConnection::sendPacket(std::span<const std::byte> packet) {
-    int err;
-    err = write(this->socket, packet.data(), packet.size());
+void RpcConnection::sendPacket(std::span<const std::byte> packet,
+        const Clock::time_point deadline) {
+    size_t written{0};
 
-    // IO failed
-    if(err == -1) {
-        throw std::system_error(errno, std::generic_category(), "write rpc message");
-    }
-    // partial write (TODO: handle this)
-    else if(err != packet.size()) {
-        throw std::runtime_error("insufficient write");
+    while(written < packet.size()) {
+        this->waitFor(POLLOUT, deadline);
+
+        // don't raise SIGPIPE in the calling process if confd has gone away
+        const auto err = send(this->socket, packet.data() + written, packet.size() - written,
+                MSG_NOSIGNAL);
+        if(err == -1) {
+            if(errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write rpc message");
+        }
+
+        written += err;
     }
 }
-
@@ -1,68 +1,177 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <span>
 #include <stdexcept>
+#include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
+#include "Cbor.h"
+
+class EmbeddedStore;
+struct confd_handle;
+
 /**
  * @brief RPC connection to confd
  *
  * This class encapsulates an RPC socket connection to confd. It holds all of the buffers we re-use
  * during the life of the connection as well.
+ *
+ * The library's default connection is either a single connection shared by all threads of the
+ * process, or (in per-thread mode) a connection for each thread, which is created the first time
+ * the thread makes a request and closed when it exits. Callers can additionally create their own
+ * connections, in the form of handles.
+ *
+ * In embedded mode, the default connection doesn't connect to confd at all: requests are instead
+ * handled in-process, by a data store the library opens itself.
  */
 class RpcConnection {
     constexpr static const std::string_view kDefaultSocketPath{"/var/run/confd/rpc.sock"};
 
+    /// Maximum number of times a request is replayed after losing the connection
+    constexpr static const size_t kMaxReplays{2};
+    /// Delay before the first reconnection attempt; it doubles with each failed attempt
+    constexpr static const std::chrono::milliseconds kReconnectInitialDelay{5};
+    /// Maximum delay between reconnection attempts
+    constexpr static const std::chrono::milliseconds kReconnectMaxDelay{500};
+    /// Maximum time to spend trying to reconnect for a single request
+    constexpr static const std::chrono::seconds kReconnectMaxTime{5};
+    /// Delay before trying to connect again when confd's listen backlog is full
+    constexpr static const std::chrono::milliseconds kConnectRetryDelay{1};
+
     public:
+        /// Clock used for request deadlines
+        using Clock = std::chrono::steady_clock;
+
+        RpcConnection(const std::string_view &socketPath);
+        RpcConnection(const std::shared_ptr<EmbeddedStore> &store);
+        ~RpcConnection();
+
         uint8_t sendPacket(const uint8_t ep, std::span<const std::byte> payload);
         void sendPacketWithReply(const uint8_t ep, std::span<const std::byte> payload,
                 std::span<const std::byte> &outReplyPayload);
 
-        /// Attempt to allocate the shared RPC connection
-        static void Init(const std::string_view &path = kDefaultSocketPath) {
-            if(gShared) {
-                throw std::logic_error("rpc connection already initialized!");
-            }
-            gShared = new RpcConnection(path);
+        CborWriter beginRequest();
+        void sendRequestWithReply(const uint8_t ep, std::span<const std::byte> &outReplyPayload);
+
+        static void Init(const std::string_view &path = kDefaultSocketPath,
+                const bool perThread = false, const bool embedded = false);
+        static void Deinit();
+
+        static RpcConnection *Get(struct confd_handle *handle = nullptr);
+
+        /**
+         * @brief Set the default request timeout
+         *
+         * This applies to all connections that don't have their own timeout set, including the
+         * library's default connection.
+         *
+         * @param timeout Maximum duration of a request, or zero to wait indefinitely
+         */
+        static void SetDefaultTimeout(const std::chrono::milliseconds timeout) {
+            gDefaultTimeout = timeout.count();
         }
 
-        /// Release the shared RPC connection
-        static void Deinit() {
-            delete gShared;
-            gShared = nullptr;
+        /**
+         * @brief Set the request timeout for this connection
+         *
+         * @param timeout Maximum duration of a request, or zero to wait indefinitely
+         */
+        void setTimeout(const std::chrono::milliseconds timeout) {
+            this->timeout = timeout;
         }
 
-        /// Return the global RPC connection instance
-        static auto The() {
-            return gShared;
+        /**
+         * @brief Check whether requests are handled in-process
+         *
+         * Embedded connections aren't subject to the RPC message size limit.
+         */
+        bool isEmbedded() const {
+            return !!this->store;
         }
 
         /**
          * @brief Recursion lock
          *
          * All API wrapper functions should take and hold this lock for the duration of their
-         * execution to ensure nothing conflicts/breaks.
+         * execution to ensure nothing conflicts/breaks. It's only ever contended for the shared
+         * connection.
          */
         std::mutex lock;
 
+        /**
+         * @brief Version of the key read by the most recent query
+         *
+         * Zero if the key didn't exist (or confd didn't report its version.)
+         */
+        uint64_t lastVersion{0};
+
+        /**
+         * @brief Time to live (in ms) for keys updated on this connection
+         *
+         * When non-zero, it's sent with every update request, and the key expires this long after
+         * it was updated. Zero if keys shouldn't expire.
+         */
+        uint32_t updateTtl{0};
+
     private:
-        RpcConnection(const std::string_view &socketPath);
-        ~RpcConnection();
+        void connect(const Clock::time_point deadline);
+        void reconnect(const Clock::time_point deadline);
+        void disconnect();
+
+        static bool IsIdempotent(const uint8_t ep);
+        static bool IsConnectionLost(const std::error_code &code);
 
-        void receivePacket(std::span<const std::byte> &);
-        void sendPacket(std::span<const std::byte>);
+        Clock::time_point getDeadline() const;
+        uint8_t sendRequest(const uint8_t ep, const Clock::time_point deadline);
+        void receivePacket(std::span<const std::byte> &, const Clock::time_point deadline);
+        void sendPacket(std::span<const std::byte>, const Clock::time_point deadline);
+
+        void waitFor(const short events, const Clock::time_point deadline);
+        void readFully(std::span<std::byte> buffer, const Clock::time_point deadline);
 
     private:
+        /// Connection shared by all threads (if not in per-thread mode)
         static RpcConnection *gShared;
 
-        /// File descriptor for the socket
+        /// Whether each thread gets its own connection
+        static std::atomic_bool gPerThread;
+        /// Incremented whenever the library is opened or closed, to invalidate thread connections
+        static std::atomic<uint64_t> gGeneration;
+        /// Protects the socket path (in per-thread mode)
+        static std::mutex gConfigLock;
+        /// Socket path to use for per-thread connections
+        static std::string gSocketPath;
+        /// Data store to use for per-thread connections (in embedded mode)
+        static std::shared_ptr<EmbeddedStore> gEmbeddedStore;
+
+        /// Default request timeout (in ms; 0 = no timeout)
+        static std::atomic<int64_t> gDefaultTimeout;
+
+        /// This thread's connection (in per-thread mode)
+        static thread_local std::unique_ptr<RpcConnection> gThreadConnection;
+        /// Generation at which this thread's connection was created
+        static thread_local uint64_t gThreadGeneration;
+
+        /// Path of the socket we're connected to
+        std::string socketPath;
+        /// Data store that handles requests in-process (in embedded mode)
+        std::shared_ptr<EmbeddedStore> store;
+        /// File descriptor for the socket (or -1, if it needs to be re-established)
         int socket{-1};
 
+        /// Request timeout for this connection (if not set, the default timeout applies)
+        std::optional<std::chrono::milliseconds> timeout;
+
         /// Transmit buffer
         std::vector<std::byte> transmitBuf;
         /// Receive message buffer
@@ -72,4 +181,14 @@ class RpcConnection {
         uint8_t nextTag{0};
 };
 
+/**
+ * @brief Caller-owned connection
+ *
+ * Handles are regular connections, except that they're created and released explicitly by the
+ * caller, rather than managed by the library.
+ */
+struct confd_handle: public RpcConnection {
+    using RpcConnection::RpcConnection;
+};
+
 #endif
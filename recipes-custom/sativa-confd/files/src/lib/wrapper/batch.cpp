@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "rpc/types.h"
+#include "confd.h"
+#include "Cbor.h"
+#include "Exceptions.h"
+#include "RpcConnection.h"
+
+/**
+ * @brief Maximum size of the encoded key/value pairs in a single batch update message
+ *
+ * This leaves room for the message header, as well as the rest of the request map.
+ */
+constexpr static const size_t kMaxBatchPayload{UINT16_MAX - 32};
+
+/**
+ * @brief Split an encoded map of updates into its key/value pairs
+ *
+ * @param updates CBOR encoded map of key names to values
+ *
+ * @return Offsets of the start of each pair in the buffer, followed by the end of the last pair
+ *
+ * @throw ConfdError The updates aren't a map of strings to scalar values
+ */
+static std::vector<size_t> SplitUpdates(std::span<const std::byte> updates) {
+    CborReader reader(updates);
+    std::vector<size_t> offsets;
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("updates must be a map", kConfdInvalidArguments);
+    }
+
+    offsets.reserve(root.arg + 1);
+
+    for(size_t i = 0; i < root.arg; i++) {
+        offsets.push_back(reader.position());
+
+        const auto key = reader.read();
+        if(key.type != CborReader::Item::Type::TextString) {
+            throw ConfdError("key names must be strings", kConfdInvalidArguments);
+        }
+
+        const auto value = reader.read();
+        if(value.type == CborReader::Item::Type::Array ||
+                value.type == CborReader::Item::Type::Map) {
+            throw ConfdError("values must be scalar", kConfdInvalidArguments);
+        }
+    }
+
+    offsets.push_back(reader.position());
+    return offsets;
+}
+
+/**
+ * @brief Get the number of updated keys from a batch update reply
+ */
+static uint64_t GetUpdatedCount(std::span<const std::byte> payload) {
+    CborReader reader(payload);
+    uint64_t updated{0};
+
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("updated")) {
+            if(value.type != CborReader::Item::Type::UnsignedInt) {
+                throw ConfdError("invalid `updated` key (expected uint)", kConfdInvalidResponse);
+            }
+            updated = value.arg;
+        }
+    }
+
+    return updated;
+}
+
+int confd_handle_update_batch(confd_handle_t *handle, const void *updates,
+        const size_t updatesLen) {
+    if(!updates || !updatesLen) {
+        return kConfdInvalidArguments;
+    }
+
+    try {
+        std::span<const std::byte> buffer{reinterpret_cast<const std::byte *>(updates),
+            updatesLen};
+        const auto offsets = SplitUpdates(buffer);
+        const size_t numPairs = offsets.size() - 1;
+
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        /*
+         * Send the pairs in as few messages as possible; in-process, there's no limit on the size
+         * of a message, so the entire batch is sent at once.
+         */
+        const size_t maxPayload = conn->isEmbedded() ? SIZE_MAX : kMaxBatchPayload;
+        size_t first{0};
+
+        do {
+            size_t last = first;
+            while(last < numPairs && offsets[last + 1] - offsets[first] <= maxPayload) {
+                last++;
+            }
+
+            if(last == first && numPairs) {
+                throw std::system_error(EMSGSIZE, std::generic_category(), "update too large");
+            }
+
+            const bool more = (last < numPairs);
+
+            auto writer = conn->beginRequest();
+            writer.map(2);
+            writer.string("updates");
+            writer.map(last - first);
+            writer.raw(buffer.subspan(offsets[first], offsets[last] - offsets[first]));
+            writer.string("more");
+            writer.boolean(more);
+
+            std::span<const std::byte> replyPayload;
+            conn->sendRequestWithReply(kConfigBatchUpdate, replyPayload);
+
+            // once the batch is complete, all keys should have been updated
+            const auto updated = GetUpdatedCount(replyPayload);
+            if(!more && updated != numPairs) {
+                throw ConfdError("not all keys updated", kConfdInvalidResponse);
+            }
+
+            first = last;
+        } while(first < numPairs);
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
+    }
+
+    return kConfdStatusSuccess;
+}
+
+int confd_update_batch(const void *updates, const size_t updatesLen) {
+    return confd_handle_update_batch(nullptr, updates, updatesLen);
+}
+
+int confd_export(const char *after, void *outBuf, const size_t outBufLen,
+        size_t *outActualLen) {
+    if(!outBuf || !outBufLen) {
+        return kConfdInvalidArguments;
+    }
+
+    try {
+        std::span<const std::byte> replyPayload;
+
+        auto conn = RpcConnection::Get();
+        std::lock_guard lg(conn->lock);
+
+        auto writer = conn->beginRequest();
+        if(after) {
+            writer.map(1);
+            writer.string("after");
+            writer.string(after);
+        } else {
+            writer.map(0);
+        }
+
+        conn->sendRequestWithReply(kConfigExport, replyPayload);
+
+        // copy out the raw payload
+        if(outActualLen) {
+            *outActualLen = replyPayload.size();
+        }
+
+        const auto toCopy = std::min(replyPayload.size(), outBufLen);
+        memcpy(outBuf, replyPayload.data(), toCopy);
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
+    }
+
+    return kConfdStatusSuccess;
+}
@@ -0,0 +1,227 @@
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <system_error>
+
+#include "rpc/types.h"
+#include "confd.h"
+#include "Cbor.h"
+#include "Exceptions.h"
+#include "RpcConnection.h"
+
+/**
+ * @brief Serialize a conditional update request for the given key name
+ *
+ * @param writer CBOR writer to encode the request with
+ * @param keyName Key name to update
+ * @param version Version the key is expected to have
+ * @param writeValue Function to invoke to encode the value to set for the key
+ */
+template<typename Func>
+static void SerializeCasRequest(CborWriter &writer, const char *keyName, const uint64_t version,
+        Func &&writeValue) {
+    writer.map(3);
+    writer.string("key");
+    writer.string(keyName);
+    writer.string("version");
+    writer.uint(version);
+    writer.string("value");
+    writeValue(writer);
+}
+
+/**
+ * @brief Decode a conditional update response
+ *
+ * @param payload Reply payload
+ * @param outVersion Variable to receive the key's (new or current) version
+ *
+ * @return Whether the key was updated
+ */
+static bool DecodeResponse(std::span<const std::byte> payload, uint64_t &outVersion) {
+    CborReader reader(payload);
+    bool updated{false}, hasVersion{false};
+
+    // root item _must_ be a map
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("updated")) {
+            if(value.type != CborReader::Item::Type::Bool) {
+                throw ConfdError("invalid `updated` key (expected bool)", kConfdInvalidResponse);
+            }
+            updated = value.arg;
+        } else if(key.is("version")) {
+            if(value.type != CborReader::Item::Type::UnsignedInt) {
+                throw ConfdError("invalid `version` key (expected uint)", kConfdInvalidResponse);
+            }
+            outVersion = value.arg;
+            hasVersion = true;
+        }
+    }
+
+    if(!hasVersion) {
+        throw ConfdError("response has no version", kConfdInvalidResponse);
+    }
+
+    return updated;
+}
+
+/**
+ * @brief Handle a conditional update of a variable
+ *
+ * @param handle Connection to perform the request on (or `nullptr` for the default connection)
+ * @param key Name of the key to update
+ * @param version Version the key is expected to have
+ * @param outVersion Variable to receive the key's version (may be `nullptr`)
+ * @param writeValue Function to invoke to encode the key's new value
+ *
+ * @return Status code
+ */
+template<typename Func>
+static int DoCompareAndSwap(confd_handle_t *handle, const char *key, const uint64_t version,
+        uint64_t *outVersion, Func &&writeValue) {
+    int ret{kConfdStatusSuccess};
+
+    try {
+        std::span<const std::byte> replyPayload;
+        uint64_t newVersion{0};
+
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        // serialize request, then send it and await the response
+        auto writer = conn->beginRequest();
+        SerializeCasRequest(writer, key, version, writeValue);
+
+        conn->sendRequestWithReply(kConfigCompareAndSwap, replyPayload);
+
+        if(!DecodeResponse(replyPayload, newVersion)) {
+            ret = kConfdVersionMismatch;
+        }
+        if(outVersion) {
+            *outVersion = newVersion;
+        }
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        ret = e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        ret = -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+
+
+int confd_handle_cas_string(confd_handle_t *handle, const char *key, const uint64_t version,
+        const char *str, const size_t strLen, uint64_t *outVersion) {
+    if(!key || !str) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [&](CborWriter &writer) {
+        writer.string({str, strLen});
+    });
+}
+
+int confd_handle_cas_blob(confd_handle_t *handle, const char *key, const uint64_t version,
+        const void *blob, const size_t blobLen, uint64_t *outVersion) {
+    if(!key || !blob) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [&](CborWriter &writer) {
+        writer.bytes({reinterpret_cast<const std::byte *>(blob), blobLen});
+    });
+}
+
+int confd_handle_cas_int(confd_handle_t *handle, const char *key, const uint64_t version,
+        const int64_t value, uint64_t *outVersion) {
+    if(!key) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [&](CborWriter &writer) {
+        writer.uint(static_cast<uint64_t>(value));
+    });
+}
+
+int confd_handle_cas_real(confd_handle_t *handle, const char *key, const uint64_t version,
+        const double value, uint64_t *outVersion) {
+    if(!key) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [&](CborWriter &writer) {
+        writer.real(value);
+    });
+}
+
+int confd_handle_cas_bool(confd_handle_t *handle, const char *key, const uint64_t version,
+        const bool value, uint64_t *outVersion) {
+    if(!key) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [&](CborWriter &writer) {
+        writer.boolean(value);
+    });
+}
+
+int confd_handle_cas_null(confd_handle_t *handle, const char *key, const uint64_t version,
+        uint64_t *outVersion) {
+    if(!key) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoCompareAndSwap(handle, key, version, outVersion, [](CborWriter &writer) {
+        writer.null();
+    });
+}
+
+
+
+int confd_cas_string(const char *key, const uint64_t version, const char *str,
+        const size_t strLen, uint64_t *outVersion) {
+    return confd_handle_cas_string(nullptr, key, version, str, strLen, outVersion);
+}
+
+int confd_cas_blob(const char *key, const uint64_t version, const void *blob,
+        const size_t blobLen, uint64_t *outVersion) {
+    return confd_handle_cas_blob(nullptr, key, version, blob, blobLen, outVersion);
+}
+
+int confd_cas_int(const char *key, const uint64_t version, const int64_t value,
+        uint64_t *outVersion) {
+    return confd_handle_cas_int(nullptr, key, version, value, outVersion);
+}
+
+int confd_cas_real(const char *key, const uint64_t version, const double value,
+        uint64_t *outVersion) {
+    return confd_handle_cas_real(nullptr, key, version, value, outVersion);
+}
+
+int confd_cas_bool(const char *key, const uint64_t version, const bool value,
+        uint64_t *outVersion) {
+    return confd_handle_cas_bool(nullptr, key, version, value, outVersion);
+}
+
+int confd_cas_null(const char *key, const uint64_t version, uint64_t *outVersion) {
+    return confd_handle_cas_null(nullptr, key, version, outVersion);
+}
@@ -3,6 +3,7 @@
 #include <sys/socket.h>
 
 #include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <system_error>
 
@@ -10,11 +11,22 @@
 #include "RpcConnection.h"
 #include "version.h"
 
+/// Socket path used when the caller doesn't specify one
+constexpr static const char *kDefaultSocketPath{"/var/run/confd/rpc.sock"};
+/// Database path used in embedded mode when the caller doesn't specify one
+constexpr static const char *kDefaultDatabasePath{"/persistent/config/confd-data/storage.db"};
+
 int confd_open(const char *socketPath) {
-    auto realPath = socketPath ? socketPath : "/var/run/confd/rpc.sock";
+    return confd_open_ex(socketPath, 0);
+}
+
+int confd_open_ex(const char *socketPath, const unsigned int flags) {
+    const bool embedded = (flags & kConfdOpenEmbedded);
+    auto realPath = socketPath ? socketPath : (embedded ? kDefaultDatabasePath :
+            kDefaultSocketPath);
 
     try {
-        RpcConnection::Init(realPath);
+        RpcConnection::Init(realPath, (flags & kConfdOpenPerThread), embedded);
     } catch(const std::system_error &e) {
         return -e.code().value();
     } catch(const std::exception &) {
@@ -28,6 +40,41 @@ int confd_close() {
     return 0;
 }
 
+int confd_handle_open(const char *socketPath, confd_handle_t **outHandle) {
+    if(!outHandle) {
+        return kConfdInvalidArguments;
+    }
+    auto realPath = socketPath ? socketPath : kDefaultSocketPath;
+
+    try {
+        *outHandle = new confd_handle(realPath);
+    } catch(const std::system_error &e) {
+        return -e.code().value();
+    } catch(const std::exception &) {
+        return -1;
+    }
+    return 0;
+}
+
+int confd_handle_close(confd_handle_t *handle) {
+    delete handle;
+    return 0;
+}
+
+int confd_set_timeout(const unsigned int timeoutMs) {
+    RpcConnection::SetDefaultTimeout(std::chrono::milliseconds(timeoutMs));
+    return 0;
+}
+
+int confd_handle_set_timeout(confd_handle_t *handle, const unsigned int timeoutMs) {
+    if(!handle) {
+        return kConfdInvalidArguments;
+    }
+
+    handle->setTimeout(std::chrono::milliseconds(timeoutMs));
+    return 0;
+}
+
 const char *confd_version_string() {
     return kVersion;
 }
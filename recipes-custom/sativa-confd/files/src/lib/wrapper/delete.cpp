@@ -1,23 +1,101 @@
-#include <cbor.h>
-
 #include <unistd.h>
 
-#include <algorithm>
 #include <cstddef>
 #include <cstdint>
-#include <cstdlib>
-#include <vector>
+#include <span>
+#include <system_error>
 
 #include "rpc/types.h"
 #include "confd.h"
+#include "Cbor.h"
 #include "Exceptions.h"
 #include "RpcConnection.h"
 
-int confd_delete(const char *key) {
+/**
+ * @brief Serialize a delete request for the given key name
+ */
+static void SerializeDeleteRequest(CborWriter &writer, const char *keyName) {
+    writer.map(1);
+    writer.string("key");
+    writer.string(keyName);
+}
+
+/**
+ * @brief Check whether a delete response indicates the key was deleted
+ *
+ * @throw ConfdError If the response is malformed, or the key didn't exist
+ */
+static void ValidateResponse(std::span<const std::byte> payload) {
+    CborReader reader(payload);
+    bool deleted{false};
+
+    // root item _must_ be a map
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        if(key.type != CborReader::Item::Type::TextString) {
+            throw ConfdError("invalid root key type (expected string)", kConfdInvalidResponse);
+        }
+
+        const auto value = reader.read();
+        reader.skip(value);
+
+        if(key.is("deleted")) {
+            if(value.type != CborReader::Item::Type::Bool) {
+                throw ConfdError("invalid `deleted` key (expected bool)", kConfdInvalidResponse);
+            }
+
+            deleted = value.arg;
+        }
+    }
+
+    if(!deleted) {
+        throw ConfdError("key not found", kConfdNotFound);
+    }
+}
+
+int confd_handle_delete(confd_handle_t *handle, const char *key) {
     if(!key) {
         return kConfdInvalidArguments;
     }
 
-    // TODO: implement this
-    return kConfdNotSupported;
+    int ret{kConfdStatusSuccess};
+
+    try {
+        std::span<const std::byte> replyPayload;
+
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        // serialize request, then send it and await the response
+        auto writer = conn->beginRequest();
+        SerializeDeleteRequest(writer, key);
+
+        conn->sendRequestWithReply(kConfigDelete, replyPayload);
+
+        // validate the response
+        ValidateResponse(replyPayload);
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        ret = e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        ret = -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int confd_delete(const char *key) {
+    return confd_handle_delete(nullptr, key);
 }
@@ -0,0 +1,147 @@
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <system_error>
+
+#include "rpc/types.h"
+#include "confd.h"
+#include "Cbor.h"
+#include "Exceptions.h"
+#include "RpcConnection.h"
+
+/**
+ * @brief Get the name of an integer operation, as used in requests
+ *
+ * @return Operation name, or an empty string if the operation is invalid
+ */
+static std::string_view OpName(const enum confd_integer_operation op) {
+    switch(op) {
+        case kConfdIntegerAdd:
+            return "add";
+        case kConfdIntegerSubtract:
+            return "sub";
+        case kConfdIntegerMin:
+            return "min";
+        case kConfdIntegerMax:
+            return "max";
+
+        default:
+            return "";
+    }
+}
+
+/**
+ * @brief Decode the response to an integer operation
+ *
+ * @param payload Reply payload
+ *
+ * @return The key's resulting value
+ *
+ * @throw ConfdError The key isn't an integer (kConfdTypeMismatch) or the response is malformed
+ */
+static int64_t DecodeResponse(std::span<const std::byte> payload) {
+    CborReader reader(payload);
+    bool updated{false}, hasValue{false};
+    uint64_t value{0};
+
+    // root item _must_ be a map
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
+    }
+
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
+        const auto item = reader.read();
+        reader.skip(item);
+
+        if(key.is("updated")) {
+            if(item.type != CborReader::Item::Type::Bool) {
+                throw ConfdError("invalid `updated` key (expected bool)", kConfdInvalidResponse);
+            }
+            updated = item.arg;
+        } else if(key.is("value")) {
+            if(item.type != CborReader::Item::Type::UnsignedInt) {
+                throw ConfdError("invalid `value` key (expected uint)", kConfdInvalidResponse);
+            }
+            value = item.arg;
+            hasValue = true;
+        }
+    }
+
+    // confd only refuses to update keys with non-integer values
+    if(!updated) {
+        throw ConfdError("key is not an integer", kConfdTypeMismatch);
+    } else if(!hasValue) {
+        throw ConfdError("response has no value", kConfdInvalidResponse);
+    }
+
+    return static_cast<int64_t>(value);
+}
+
+
+
+int confd_handle_integer_op(confd_handle_t *handle, const char *key,
+        const enum confd_integer_operation op, const int64_t operand, int64_t *outValue) {
+    const auto opName = OpName(op);
+    if(!key || opName.empty()) {
+        return kConfdInvalidArguments;
+    }
+
+    try {
+        std::span<const std::byte> replyPayload;
+
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        // serialize request, then send it and await the response
+        auto writer = conn->beginRequest();
+        writer.map(3);
+        writer.string("key");
+        writer.string(key);
+        writer.string("op");
+        writer.string(opName);
+        writer.string("operand");
+        writer.uint(static_cast<uint64_t>(operand));
+
+        conn->sendRequestWithReply(kConfigIntegerOp, replyPayload);
+
+        const auto value = DecodeResponse(replyPayload);
+        if(outValue) {
+            *outValue = value;
+        }
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
+    }
+
+    return kConfdStatusSuccess;
+}
+
+int confd_handle_increment(confd_handle_t *handle, const char *key, const int64_t delta,
+        int64_t *outValue) {
+    return confd_handle_integer_op(handle, key, kConfdIntegerAdd, delta, outValue);
+}
+
+
+
+int confd_integer_op(const char *key, const enum confd_integer_operation op,
+        const int64_t operand, int64_t *outValue) {
+    return confd_handle_integer_op(nullptr, key, op, operand, outValue);
+}
+
+int confd_increment(const char *key, const int64_t delta, int64_t *outValue) {
+    return confd_handle_integer_op(nullptr, key, kConfdIntegerAdd, delta, outValue);
+}
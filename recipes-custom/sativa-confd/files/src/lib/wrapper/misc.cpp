@@ -10,7 +10,7 @@ const char *confd_strerror(int error) {
     // positive errors are our internal error types
     if(error >= 0) {
         // TODO: better way to get max error size?
-        static const std::array<std::string_view, 9> gErrorStrings{{
+        static const std::array<std::string_view, 11> gErrorStrings{{
             "success",
             "value type mismatch",
             "access denied",
@@ -20,6 +20,8 @@ const char *confd_strerror(int error) {
             "value is null",
             "out of memory",
             "invalid arguments",
+            "timed out",
+            "version mismatch",
         }};
 
         if(error >= gErrorStrings.size()) {
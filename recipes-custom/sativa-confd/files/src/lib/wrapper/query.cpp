@@ -1,46 +1,25 @@
-#include <cbor.h>
-
 #include <unistd.h>
 
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
-#include <cstdlib>
-#include <vector>
+#include <cstring>
+#include <span>
+#include <system_error>
 
 #include "rpc/types.h"
 #include "confd.h"
+#include "Cbor.h"
 #include "Exceptions.h"
 #include "RpcConnection.h"
 
 /**
  * @brief Serialize a query for the given key name
  */
-static std::vector<std::byte> SerializeKeyRequest(const char *keyName) {
-    std::vector<std::byte> msgBuf;
-
-    // build the request object
-    cbor_item_t *root = cbor_new_definite_map(1);
-    cbor_map_add(root, (struct cbor_pair) {
-        .key = cbor_move(cbor_build_string("key")),
-        .value = cbor_move(cbor_build_string(keyName))
-    });
-
-    // serialize it
-    size_t rootBufLen;
-    unsigned char *rootBuf{nullptr};
-    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
-
-    // copy it into a vector
-    msgBuf.resize(serializedBytes);
-    std::copy(reinterpret_cast<const std::byte *>(rootBuf),
-            reinterpret_cast<const std::byte *>(rootBuf + serializedBytes), msgBuf.begin());
-
-    // clean up
-    free(rootBuf);
-    cbor_decref(&root);
-
-    return msgBuf;
+static void SerializeKeyRequest(CborWriter &writer, const char *keyName) {
+    writer.map(1);
+    writer.string("key");
+    writer.string(keyName);
 }
 
 /**
@@ -48,56 +27,64 @@ static std::vector<std::byte> SerializeKeyRequest(const char *keyName) {
  *
  * This will convert errors from the server (such as "key not found" or "access denied") into the
  * corresponding exception.
+ *
+ * @param payload Reply payload
+ * @param outVersion Variable to receive the key's version (or zero, if not reported)
+ *
+ * @remark The returned item refers to the payload buffer, so it's only valid as long as it is.
  */
-static cbor_item_t *ExtractValue(cbor_item_t *root) {
-    cbor_item_t *value{nullptr};
-    bool found{false};
+static CborReader::Item ExtractValue(std::span<const std::byte> payload, uint64_t &outVersion) {
+    CborReader reader(payload);
+    CborReader::Item value{.type = CborReader::Item::Type::Undefined};
+    bool found{false}, hasValue{false};
+
+    outVersion = 0;
 
     // root item _must_ be a map
-    if(!cbor_isa_map(root)) {
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
         throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
     }
 
     // iterate over all keys
-    auto keys = cbor_map_handle(root);
-
-    for(size_t i = 0; i < cbor_map_size(root); i++) {
-        auto &pair = keys[i];
+    for(size_t i = 0; i < root.arg; i++) {
+        const auto key = reader.read();
 
         // validate key type: must be a string
-        if(!cbor_isa_string(pair.key)) {
+        if(key.type != CborReader::Item::Type::TextString) {
             throw ConfdError("invalid root key type (expected string)", kConfdInvalidResponse);
         }
 
-        const auto keyStr = reinterpret_cast<const char *>(cbor_string_handle(pair.key));
-        const auto keyStrLen = cbor_string_length(pair.key);
-
-        if(!keyStr) {
-            throw ConfdError("failed to get root key", kConfdInvalidResponse);
-        }
+        const auto item = reader.read();
+        reader.skip(item);
 
         // is this the "found" flag?
-        if(!strncmp(keyStr, "found", keyStrLen)) {
-            if(!cbor_isa_float_ctrl(pair.value) || !cbor_is_bool(pair.value)) {
+        if(key.is("found")) {
+            if(item.type != CborReader::Item::Type::Bool) {
                 throw ConfdError("invalid `found` key (expected bool)", kConfdInvalidResponse);
             }
 
-            found = cbor_get_bool(pair.value);
+            found = item.arg;
         }
         // is this the value?
-        else if(!strncmp(keyStr, "value", keyStrLen)) {
-            value = pair.value;
+        else if(key.is("value")) {
+            value = item;
+            hasValue = true;
+        }
+        // the key's version
+        else if(key.is("version") && item.type == CborReader::Item::Type::UnsignedInt) {
+            outVersion = item.arg;
         }
     }
 
-    // ensure the item was found, then return the ref to it
+    // ensure the item was found
     if(!found) {
         throw ConfdError("key not found", kConfdNotFound);
+    } else if(!hasValue) {
+        throw ConfdError("found value, but response has no value", kConfdInvalidResponse);
     }
-
     // was the found item `null`?
-    else if(cbor_isa_float_ctrl(value) && cbor_float_get_width(value) == CBOR_FLOAT_0 &&
-            cbor_is_null(value)) {
+    else if(value.type == CborReader::Item::Type::Null) {
         throw ConfdError("value is null", kConfdNullValue);
     }
 
@@ -107,51 +94,35 @@ static cbor_item_t *ExtractValue(cbor_item_t *root) {
 /**
  * @brief Handle a request for a variable
  *
+ * The request is encoded directly into the connection's transmit buffer, and the reply decoded in
+ * place in its receive buffer; so in steady state, a query doesn't allocate any memory.
+ *
+ * @param handle Connection to perform the request on (or `nullptr` for the default connection)
  * @param key Name of the key to request
- * @param Func Function to invoke with the reply
+ * @param replyHandler Function to invoke with the value from the reply
  *
  * @return Status code
  */
-static int DoQuery(const char *key, const std::function<int(cbor_item_t *)> &replyHandler) {
+template<typename Func>
+static int DoQuery(confd_handle_t *handle, const char *key, Func &&replyHandler) {
     int ret{kConfdNotSupported};
 
     try {
         std::span<const std::byte> replyPayload;
 
-        // serialize request
-        auto req = SerializeKeyRequest(key);
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
 
-        // send the request and await the response
-        std::lock_guard lg(RpcConnection::The()->lock);
-        RpcConnection::The()->sendPacketWithReply(kConfigQuery, req, replyPayload);
+        // serialize request, then send it and await the response
+        auto writer = conn->beginRequest();
+        SerializeKeyRequest(writer, key);
 
-        // set up CBOR decoder
-        cbor_load_result res{};
-        auto root = cbor_load(reinterpret_cast<const cbor_data>(replyPayload.data()),
-                replyPayload.size(), &res);
-        if(!root || res.error.code != CBOR_ERR_NONE) {
-            return kConfdInvalidResponse;
-        }
+        conn->sendRequestWithReply(kConfigQuery, replyPayload);
 
-        // invoke the specified handler
-        try {
-            // perform common validation and extract value
-            auto value = ExtractValue(root);
-            if(!value) {
-                throw std::logic_error("found value, but do not have an associated cbor item!");
-            }
-
-            // with the value, invoke the reply handler (it just verifies type and retrieves it)
-            ret = replyHandler(value);
-
-            // clean up root
-            cbor_decref(&root);
-        }
-        // propagate exception, but clean up CBOR item
-        catch(const std::exception &) {
-            cbor_decref(&root);
-            throw;
-        }
+        // perform common validation and extract value, then invoke the reply handler (it just
+        // verifies type and retrieves it)
+        const auto value = ExtractValue(replyPayload, conn->lastVersion);
+        ret = replyHandler(value);
     }
     // confd errors include a status code
     catch(const ConfdError &e) {
@@ -171,152 +142,200 @@ static int DoQuery(const char *key, const std::function<int(cbor_item_t *)> &rep
 
 
 
-int confd_get_string(const char *key, char *outStr, const size_t outStrLen,
-        size_t *outActualLen) {
+int confd_handle_get_string(confd_handle_t *handle, const char *key,
+        char *outStr, const size_t outStrLen, size_t *outActualLen) {
     if(!key || !outStr || !outStrLen) {
         return kConfdInvalidArguments;
     }
 
-    return DoQuery(key, [&](auto value) -> int {
-        if(!cbor_isa_string(value)) {
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::TextString) {
             throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
         // copy out string, ensuring it's zero terminated
-        const auto str = reinterpret_cast<const char *>(cbor_string_handle(value));
-        const auto strLen = cbor_string_length(value);
+        const auto str = value.string();
 
         if(outActualLen) {
-            *outActualLen = strLen;
+            *outActualLen = str.size();
         }
 
-        const auto toCopy = std::min(strLen, outStrLen - 1);
-        memcpy(outStr, str, toCopy);
+        const auto toCopy = std::min(str.size(), outStrLen - 1);
+        memcpy(outStr, str.data(), toCopy);
         outStr[toCopy] = '\0';
 
         return 0;
     });
 }
 
-int confd_get_blob(const char *key, void *outBlob, const size_t outBlobLen,
-        size_t *outActualLen) {
+int confd_handle_get_blob(confd_handle_t *handle, const char *key,
+        void *outBlob, const size_t outBlobLen, size_t *outActualLen) {
     if(!key || !outBlob || !outBlobLen) {
         return kConfdInvalidArguments;
     }
 
-    return DoQuery(key, [&](auto value) -> int {
-        if(!cbor_isa_bytestring(value)) {
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::ByteString) {
             throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
-        // copy out string, ensuring it's zero terminated
-        const auto blob = reinterpret_cast<const std::byte *>(cbor_bytestring_handle(value));
-        const auto blobLen = cbor_bytestring_length(value);
-
+        // copy out the blob
         if(outActualLen) {
-            *outActualLen = blobLen;
+            *outActualLen = value.data.size();
         }
 
-        const auto toCopy = std::min(blobLen, outBlobLen);
-        memcpy(outBlob, blob, toCopy);
+        const auto toCopy = std::min(value.data.size(), outBlobLen);
+        memcpy(outBlob, value.data.data(), toCopy);
 
         return 0;
     });
 }
 
-int confd_get_int(const char *key, int64_t *outValue) {
-    if(!key || !outValue) {
+int confd_handle_borrow_string(confd_handle_t *handle, const char *key, const char **outStr,
+        size_t *outStrLen) {
+    if(!key || !outStr || !outStrLen) {
         return kConfdInvalidArguments;
     }
 
-    return DoQuery(key, [&](auto value) -> int {
-        if(!cbor_isa_uint(value)) {
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::TextString) {
             throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
-        switch(cbor_int_get_width(value)) {
-            case CBOR_INT_8:
-                *outValue = cbor_get_uint8(value);
-                break;
-            case CBOR_INT_16:
-                *outValue = cbor_get_uint16(value);
-                break;
-            case CBOR_INT_32:
-                *outValue = cbor_get_uint32(value);
-                break;
-            case CBOR_INT_64:
-                *outValue = cbor_get_uint64(value);
-                break;
-        }
+        // the value points into the connection's receive buffer
+        *outStr = value.string().data();
+        *outStrLen = value.string().size();
 
         return 0;
     });
 }
 
-int confd_get_real(const char *key, double *outValue) {
-    if(!key || !outValue) {
+int confd_handle_borrow_blob(confd_handle_t *handle, const char *key, const void **outBlob,
+        size_t *outBlobLen) {
+    if(!key || !outBlob || !outBlobLen) {
         return kConfdInvalidArguments;
     }
 
-
-    return DoQuery(key, [&](auto value) -> int {
-        if(!cbor_isa_float_ctrl(value)) {
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::ByteString) {
             throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
-        // convert it to the appropriate floating point type
-        switch(cbor_float_get_width(value)) {
-            case CBOR_FLOAT_16:
-                *outValue = cbor_float_get_float2(value);
-                break;
-            case CBOR_FLOAT_32:
-                *outValue = cbor_float_get_float4(value);
-                break;
-            case CBOR_FLOAT_64:
-                *outValue = cbor_float_get_float8(value);
-                break;
-
-            default:
-                throw ConfdError("unsupported CBOR float type", kConfdTypeMismatch);
-        }
+        *outBlob = value.data.data();
+        *outBlobLen = value.data.size();
 
         return 0;
     });
 }
 
-int confd_get_bool(const char *key, bool *outValue) {
+int confd_handle_get_int(confd_handle_t *handle, const char *key, int64_t *outValue) {
     if(!key || !outValue) {
         return kConfdInvalidArguments;
     }
 
-    return DoQuery(key, [&](auto value) -> int {
-        // check if integer
-        if(cbor_isa_uint(value)) {
-            uint64_t temp;
-            switch(cbor_int_get_width(value)) {
-                case CBOR_INT_8:
-                    temp = cbor_get_uint8(value);
-                    break;
-                case CBOR_INT_16:
-                    temp = cbor_get_uint16(value);
-                    break;
-                case CBOR_INT_32:
-                    temp = cbor_get_uint32(value);
-                    break;
-                case CBOR_INT_64:
-                    temp = cbor_get_uint64(value);
-                    break;
-            }
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::UnsignedInt) {
+            throw ConfdError("invalid value type", kConfdTypeMismatch);
+        }
+
+        *outValue = static_cast<int64_t>(value.arg);
+        return 0;
+    });
+}
+
+int confd_handle_get_real(confd_handle_t *handle, const char *key, double *outValue) {
+    if(!key || !outValue) {
+        return kConfdInvalidArguments;
+    }
 
-            *outValue = !!temp;
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        if(value.type != CborReader::Item::Type::Real) {
+            throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
-        // otherwise, check if it's an actual bool value
-        if(!cbor_isa_float_ctrl(value) || !cbor_is_bool(value)) {
+        *outValue = value.real;
+        return 0;
+    });
+}
+
+int confd_handle_get_bool(confd_handle_t *handle, const char *key, bool *outValue) {
+    if(!key || !outValue) {
+        return kConfdInvalidArguments;
+    }
+
+    return DoQuery(handle, key, [&](const CborReader::Item &value) -> int {
+        // integers are converted (nonzero is true); otherwise it must be an actual bool value
+        if(value.type != CborReader::Item::Type::UnsignedInt &&
+                value.type != CborReader::Item::Type::Bool) {
             throw ConfdError("invalid value type", kConfdTypeMismatch);
         }
 
-        *outValue = cbor_get_bool(value);
+        *outValue = !!value.arg;
         return 0;
     });
 }
+
+
+
+int confd_handle_get_last_version(confd_handle_t *handle, uint64_t *outVersion) {
+    if(!outVersion) {
+        return kConfdInvalidArguments;
+    }
+
+    try {
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        *outVersion = conn->lastVersion;
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
+    }
+
+    return kConfdStatusSuccess;
+}
+
+
+
+int confd_get_string(const char *key, char *outStr, const size_t outStrLen,
+        size_t *outActualLen) {
+    return confd_handle_get_string(nullptr, key, outStr, outStrLen, outActualLen);
+}
+
+int confd_get_blob(const char *key, void *outBlob, const size_t outBlobLen,
+        size_t *outActualLen) {
+    return confd_handle_get_blob(nullptr, key, outBlob, outBlobLen, outActualLen);
+}
+
+int confd_borrow_string(const char *key, const char **outStr, size_t *outStrLen) {
+    return confd_handle_borrow_string(nullptr, key, outStr, outStrLen);
+}
+
+int confd_borrow_blob(const char *key, const void **outBlob, size_t *outBlobLen) {
+    return confd_handle_borrow_blob(nullptr, key, outBlob, outBlobLen);
+}
+
+int confd_get_int(const char *key, int64_t *outValue) {
+    return confd_handle_get_int(nullptr, key, outValue);
+}
+
+int confd_get_real(const char *key, double *outValue) {
+    return confd_handle_get_real(nullptr, key, outValue);
+}
+
+int confd_get_bool(const char *key, bool *outValue) {
+    return confd_handle_get_bool(nullptr, key, outValue);
+}
+
+int confd_get_last_version(uint64_t *outVersion) {
+    return confd_handle_get_last_version(nullptr, outVersion);
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <system_error>
+
+#include "rpc/types.h"
+#include "confd.h"
+#include "Exceptions.h"
+#include "RpcConnection.h"
+
+/**
+ * @brief Send a request without parameters and copy out the raw reply payload
+ *
+ * @param endpoint Endpoint to send the request to
+ * @param outBuf Buffer to receive the payload
+ * @param outBufLen Size of the output buffer, in bytes
+ * @param outActualLen Variable to receive the actual size of the payload (may be NULL)
+ */
+static int GetRawReply(const uint8_t endpoint, void *outBuf, const size_t outBufLen,
+        size_t *outActualLen) {
+    if(!outBuf || !outBufLen) {
+        return kConfdInvalidArguments;
+    }
+
+    try {
+        std::span<const std::byte> replyPayload;
+
+        // the request is just an empty map
+        static const std::array<std::byte, 1> kRequest{{std::byte{0xa0}}};
+
+        auto conn = RpcConnection::Get();
+        std::lock_guard lg(conn->lock);
+        conn->sendPacketWithReply(endpoint, kRequest, replyPayload);
+
+        // copy out the raw payload
+        if(outActualLen) {
+            *outActualLen = replyPayload.size();
+        }
+
+        const auto toCopy = std::min(replyPayload.size(), outBufLen);
+        memcpy(outBuf, replyPayload.data(), toCopy);
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
+    }
+
+    return kConfdStatusSuccess;
+}
+
+int confd_get_stats(void *outBuf, const size_t outBufLen, size_t *outActualLen) {
+    return GetRawReply(kConfigStats, outBuf, outBufLen, outActualLen);
+}
+
+int confd_get_trace(void *outBuf, const size_t outBufLen, size_t *outActualLen) {
+    return GetRawReply(kConfigTrace, outBuf, outBufLen, outActualLen);
+}
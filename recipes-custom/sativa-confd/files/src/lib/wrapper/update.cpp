@@ -1,53 +1,37 @@
-#include <cbor.h>
-
 #include <unistd.h>
 
-#include <algorithm>
 #include <cstddef>
 #include <cstdint>
-#include <cstdlib>
-#include <vector>
+#include <span>
+#include <system_error>
 
 #include "rpc/types.h"
 #include "confd.h"
+#include "Cbor.h"
 #include "Exceptions.h"
 #include "RpcConnection.h"
 
 /**
  * @brief Serialize an update request for the given key name
  *
+ * @param writer CBOR writer to encode the request with
  * @param keyName Key name to update
- * @param value Value to set for the key
+ * @param ttl Time to live of the key, in milliseconds (or zero, if it shouldn't expire)
+ * @param writeValue Function to invoke to encode the value to set for the key
  */
-static std::vector<std::byte> SerializeUpdateRequest(const char *keyName, cbor_item_t *value) {
-    std::vector<std::byte> msgBuf;
-
-    // build the request object
-    cbor_item_t *root = cbor_new_definite_map(2);
-    cbor_map_add(root, (struct cbor_pair) {
-        .key = cbor_move(cbor_build_string("key")),
-        .value = cbor_move(cbor_build_string(keyName))
-    });
-    cbor_map_add(root, (struct cbor_pair) {
-        .key = cbor_move(cbor_build_string("value")),
-        .value = cbor_move(value)
-    });
-
-    // serialize it
-    size_t rootBufLen;
-    unsigned char *rootBuf{nullptr};
-    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
-
-    // copy it into a vector
-    msgBuf.resize(serializedBytes);
-    std::copy(reinterpret_cast<const std::byte *>(rootBuf),
-            reinterpret_cast<const std::byte *>(rootBuf + serializedBytes), msgBuf.begin());
-
-    // clean up
-    free(rootBuf);
-    cbor_decref(&root);
-
-    return msgBuf;
+template<typename Func>
+static void SerializeUpdateRequest(CborWriter &writer, const char *keyName, const uint32_t ttl,
+        Func &&writeValue) {
+    writer.map(ttl ? 3 : 2);
+    writer.string("key");
+    writer.string(keyName);
+    writer.string("value");
+    writeValue(writer);
+
+    if(ttl) {
+        writer.string("ttl");
+        writer.uint(ttl);
+    }
 }
 
 /**
@@ -55,59 +39,46 @@ static std::vector<std::byte> SerializeUpdateRequest(const char *keyName, cbor_i
  *
  * Ensures the update completed successfully, raising an error if not.
  */
-static void ValidateResponse(const cbor_item_t *root) {
-    // TODO: implement
+static void ValidateResponse(std::span<const std::byte> payload) {
+    CborReader reader(payload);
+
+    // root item _must_ be a map
+    const auto root = reader.read();
+    if(root.type != CborReader::Item::Type::Map) {
+        throw ConfdError("invalid root (expected map)", kConfdInvalidResponse);
+    }
 }
 
 /**
  * @brief Handle an update of a variable
  *
+ * The request is encoded directly into the connection's transmit buffer, so in steady state, an
+ * update doesn't allocate any memory.
+ *
+ * @param handle Connection to perform the request on (or `nullptr` for the default connection)
  * @param key Name of the key to request
- * @param value CBOR value corresponding to the key
- * @param Func Function to invoke with the reply
+ * @param writeValue Function to invoke to encode the key's new value
  *
  * @return Status code
  */
-static int DoUpdate(const char *key, cbor_item_t *value,
-        const std::function<int(cbor_item_t *)> &replyHandler = [](auto) -> int {
-            return 0;
-        }) {
-    int ret{kConfdNotSupported};
+template<typename Func>
+static int DoUpdate(confd_handle_t *handle, const char *key, Func &&writeValue) {
+    int ret{kConfdStatusSuccess};
 
     try {
         std::span<const std::byte> replyPayload;
 
-        // serialize request
-        auto req = SerializeUpdateRequest(key, value);
-
-        // send the request and await the response
-        std::lock_guard lg(RpcConnection::The()->lock);
-        RpcConnection::The()->sendPacketWithReply(kConfigUpdate, req, replyPayload);
-
-        // set up CBOR decoder
-        cbor_load_result res{};
-        auto root = cbor_load(reinterpret_cast<const cbor_data>(replyPayload.data()),
-                replyPayload.size(), &res);
-        if(!root || res.error.code != CBOR_ERR_NONE) {
-            return kConfdInvalidResponse;
-        }
-
-        // invoke the specified handler
-        try {
-            // perform common validation
-            ValidateResponse(root);
-
-            // invoke the handler
-            ret = replyHandler(root);
-
-            // clean up root
-            cbor_decref(&root);
-        }
-        // propagate exception, but clean up CBOR item
-        catch(const std::exception &) {
-            cbor_decref(&root);
-            throw;
-        }
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
+
+        // serialize request, then send it and await the response
+        auto writer = conn->beginRequest();
+        SerializeUpdateRequest(writer, key, conn->updateTtl, writeValue);
+
+        conn->sendRequestWithReply(kConfigUpdate, replyPayload);
+
+        // perform common validation
+        ValidateResponse(replyPayload);
     }
     // confd errors include a status code
     catch(const ConfdError &e) {
@@ -127,93 +98,117 @@ static int DoUpdate(const char *key, cbor_item_t *value,
 
 
 
-int confd_set_string(const char *key, const char *str, const size_t strLen) {
-    if(!key || !str) {
-        return kConfdInvalidArguments;
-    }
+int confd_handle_set_update_ttl(confd_handle_t *handle, const unsigned int ttlMs) {
+    try {
+        auto conn = RpcConnection::Get(handle);
+        std::lock_guard lg(conn->lock);
 
-    // copy the string
-    char *temp = reinterpret_cast<char *>(malloc(strLen + 1));
-    if(!temp) {
-        return kConfdNoMemory;
+        conn->updateTtl = ttlMs;
+    }
+    // confd errors include a status code
+    catch(const ConfdError &e) {
+        return e.status();
+    }
+    // return the underlying errno for system errors
+    catch(const std::system_error &e) {
+        return -e.code().value();
+    }
+    // generic errors have no more information
+    catch(const std::exception &) {
+        return -1;
     }
 
-    memcpy(temp, str, strLen);
-    temp[strLen] = '\0';
+    return kConfdStatusSuccess;
+}
 
-    // shove it into a CBOR string
-    auto cborValue = cbor_new_definite_string();
-    if(!cborValue) {
-        free(temp);
-        return kConfdNoMemory;
+int confd_handle_set_string(confd_handle_t *handle, const char *key,
+        const char *str, const size_t strLen) {
+    if(!key || !str) {
+        return kConfdInvalidArguments;
     }
 
-    cbor_string_set_handle(cborValue, reinterpret_cast<cbor_mutable_data>(temp), strLen);
-
-    return DoUpdate(key, cborValue);
+    return DoUpdate(handle, key, [&](CborWriter &writer) {
+        writer.string({str, strLen});
+    });
 }
 
-int confd_set_blob(const char *key, const void *blob, const size_t blobLen) {
+int confd_handle_set_blob(confd_handle_t *handle, const char *key,
+        const void *blob, const size_t blobLen) {
     if(!key || !blob) {
         return kConfdInvalidArguments;
     }
 
-    auto cborValue = cbor_build_bytestring(reinterpret_cast<cbor_data>(blob), blobLen);
-    if(!cborValue) {
-        return kConfdNoMemory;
-    }
-
-    return DoUpdate(key, cborValue);
+    return DoUpdate(handle, key, [&](CborWriter &writer) {
+        writer.bytes({reinterpret_cast<const std::byte *>(blob), blobLen});
+    });
 }
 
-int confd_set_int(const char *key, const int64_t value) {
+int confd_handle_set_int(confd_handle_t *handle, const char *key, const int64_t value) {
     if(!key) {
         return kConfdInvalidArguments;
     }
 
-    auto cborValue = cbor_build_uint64(static_cast<uint64_t>(value));
-    if(!cborValue) {
-        return kConfdNoMemory;
-    }
-
-    return DoUpdate(key, cborValue);
+    return DoUpdate(handle, key, [&](CborWriter &writer) {
+        writer.uint(static_cast<uint64_t>(value));
+    });
 }
 
-int confd_set_real(const char *key, const double value) {
+int confd_handle_set_real(confd_handle_t *handle, const char *key, const double value) {
     if(!key) {
         return kConfdInvalidArguments;
     }
 
-    auto cborValue = cbor_build_float8(value);
-    if(!cborValue) {
-        return kConfdNoMemory;
-    }
-
-    return DoUpdate(key, cborValue);
+    return DoUpdate(handle, key, [&](CborWriter &writer) {
+        writer.real(value);
+    });
 }
 
-int confd_set_bool(const char *key, const bool value) {
+int confd_handle_set_bool(confd_handle_t *handle, const char *key, const bool value) {
     if(!key) {
         return kConfdInvalidArguments;
     }
 
-    auto cborValue = cbor_build_bool(value);
-    if(!cborValue) {
-        return kConfdNoMemory;
-    }
-
-    return DoUpdate(key, cborValue);
+    return DoUpdate(handle, key, [&](CborWriter &writer) {
+        writer.boolean(value);
+    });
 }
 
-int confd_set_null(const char *key) {
+int confd_handle_set_null(confd_handle_t *handle, const char *key) {
     if(!key) {
         return kConfdInvalidArguments;
     }
 
-    auto cborValue = cbor_new_null();
-    if(!cborValue) {
-        return kConfdNoMemory;
-    }
+    return DoUpdate(handle, key, [](CborWriter &writer) {
+        writer.null();
+    });
+}
+
+
 
-    return DoUpdate(key, cborValue);
+int confd_set_update_ttl(const unsigned int ttlMs) {
+    return confd_handle_set_update_ttl(nullptr, ttlMs);
+}
+
+int confd_set_string(const char *key, const char *str, const size_t strLen) {
+    return confd_handle_set_string(nullptr, key, str, strLen);
+}
+
+int confd_set_blob(const char *key, const void *blob, const size_t blobLen) {
+    return confd_handle_set_blob(nullptr, key, blob, blobLen);
+}
+
+int confd_set_int(const char *key, const int64_t value) {
+    return confd_handle_set_int(nullptr, key, value);
+}
+
+int confd_set_real(const char *key, const double value) {
+    return confd_handle_set_real(nullptr, key, value);
+}
+
+int confd_set_bool(const char *key, const bool value) {
+    return confd_handle_set_bool(nullptr, key, value);
+}
+
+int confd_set_null(const char *key) {
+    return confd_handle_set_null(nullptr, key);
 }
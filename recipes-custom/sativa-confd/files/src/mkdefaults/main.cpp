@@ -0,0 +1,254 @@
+/**
+ * @file
+ *
+ * @brief Factory defaults image builder
+ *
+ * Host tool, run at image build time, that converts files holding the default values of keys
+ * (in any of the formats supported by `confdutil --import`) into the read-only defaults image
+ * loaded by confd (see the `storage.defaults` config key.)
+ *
+ * Multiple input files may be specified; if a key is present in more than one of them, the value
+ * from the last file wins. Alternatively, the contents of an existing image can be dumped.
+ */
+#include <cbor.h>
+#include <fmt/core.h>
+
+#include <getopt.h>
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DefaultsImage.h"
+#include "Formats.h"
+#include "Types.h"
+
+/**
+ * @brief Command line options
+ */
+struct Options {
+    /// Image file to write (or dump)
+    std::string outputPath;
+    /// Format of the input files (determined from their extension if not specified)
+    std::optional<Formats::Format> format;
+    /// Input files to read
+    std::vector<std::string> inputs;
+
+    /// Dump the contents of the image, rather than building it
+    bool dump{false};
+};
+
+/**
+ * @brief Read a file into memory
+ */
+static std::vector<std::byte> ReadFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file.good()) {
+        throw std::runtime_error(fmt::format("failed to open '{}'", path));
+    }
+
+    std::vector<std::byte> buf;
+    char chunk[16 * 1024];
+    while(file.read(chunk, sizeof(chunk)) || file.gcount()) {
+        const auto start = reinterpret_cast<const std::byte *>(chunk);
+        buf.insert(buf.end(), start, start + file.gcount());
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Convert a CBOR value to a key value
+ *
+ * The same value types are accepted as for updates sent to confd.
+ *
+ * @throw std::invalid_argument The value has an unsupported type
+ */
+static PropertyValue DecodeValue(cbor_item_t *item) {
+    if(cbor_isa_string(item) && cbor_string_is_definite(item)) {
+        return std::string(reinterpret_cast<const char *>(cbor_string_handle(item)),
+                cbor_string_length(item));
+    } else if(cbor_isa_bytestring(item) && cbor_bytestring_is_definite(item)) {
+        const auto data = reinterpret_cast<const std::byte *>(cbor_bytestring_handle(item));
+        return Blob(data, data + cbor_bytestring_length(item));
+    } else if(cbor_isa_uint(item)) {
+        return static_cast<uint64_t>(cbor_get_int(item));
+    } else if(cbor_isa_float_ctrl(item)) {
+        if(!cbor_float_ctrl_is_ctrl(item)) {
+            return cbor_float_get_float(item);
+        } else if(cbor_is_null(item)) {
+            return nullptr;
+        } else if(cbor_is_bool(item)) {
+            return cbor_get_bool(item);
+        }
+    }
+
+    throw std::invalid_argument(fmt::format("unsupported value type {}", cbor_typeof(item)));
+}
+
+/**
+ * @brief Read the keys from all input files, and write them to the image
+ *
+ * @param opts Command line options (specifying the input files and the image to write)
+ */
+static void BuildImage(const Options &opts) {
+    std::map<std::string, PropertyValue> keys;
+
+    for(const auto &path : opts.inputs) {
+        const auto format = opts.format ? opts.format : Formats::ForPath(path);
+        if(!format) {
+            throw std::runtime_error(fmt::format("unknown format of '{}' (specify --format)",
+                        path));
+        }
+
+        const auto data = ReadFile(path);
+        auto map = Formats::Read(*format, data);
+
+        try {
+            const auto pairs = cbor_map_handle(map);
+            for(size_t i = 0; i < cbor_map_size(map); i++) {
+                const auto &pair = pairs[i];
+                const std::string name(reinterpret_cast<const char *>(
+                            cbor_string_handle(pair.key)), cbor_string_length(pair.key));
+
+                try {
+                    keys.insert_or_assign(name, DecodeValue(pair.value));
+                } catch(const std::exception &e) {
+                    throw std::runtime_error(fmt::format("{}: key '{}': {}", path, name,
+                                e.what()));
+                }
+            }
+        } catch(const std::exception &) {
+            cbor_decref(&map);
+            throw;
+        }
+
+        cbor_decref(&map);
+    }
+
+    PropertyList values(std::make_move_iterator(keys.begin()),
+            std::make_move_iterator(keys.end()));
+    DefaultsImage::Write(opts.outputPath, values);
+
+    std::cerr << fmt::format("wrote {} default keys to '{}'", values.size(), opts.outputPath)
+        << std::endl;
+}
+
+/**
+ * @brief Print all keys in an image
+ *
+ * @param path Path of the image file
+ */
+static void DumpImage(const std::string &path) {
+    DefaultsImage image(path);
+
+    for(size_t i = 0; i < image.size(); i++) {
+        const auto value = image.getValue(i);
+        std::string str;
+
+        if(std::holds_alternative<std::nullptr_t>(value)) {
+            str = "(null)";
+        } else if(auto string = std::get_if<std::string>(&value)) {
+            str = fmt::format("`{}`", *string);
+        } else if(auto blob = std::get_if<Blob>(&value)) {
+            str = fmt::format("({} bytes)", blob->size());
+        } else if(auto integer = std::get_if<uint64_t>(&value)) {
+            str = fmt::format("{}", *integer);
+        } else if(auto real = std::get_if<double>(&value)) {
+            str = fmt::format("{:g}", *real);
+        }
+
+        std::cout << fmt::format("{}={}", image.getName(i), str) << std::endl;
+    }
+
+    std::cerr << fmt::format("{} keys, {} bytes", image.size(), image.getFileSize())
+        << std::endl;
+}
+
+
+
+/**
+ * @brief Defaults image builder entry point
+ *
+ * All arguments that aren't switches are input files. The following switches are supported:
+ *
+ * - output: Image file to write (required)
+ * - format: Format of the input files (json, toml or cbor); by default, it's determined from each
+ *   file's extension.
+ * - dump: Print the contents of the image specified by --output, rather than writing it
+ */
+int main(const int argc, char * const *argv) {
+    Options opts;
+
+    // parse command line
+    int c;
+    while(1) {
+        int index{0};
+        const static struct option options[] = {
+            {"output",                  required_argument, 0, 0},
+            {"format",                  required_argument, 0, 0},
+            {"dump",                    no_argument, 0, 0},
+            {nullptr,                   0, 0, 0},
+        };
+
+        c = getopt_long(argc, argv, "", options, &index);
+
+        // end of options
+        if(c == -1) {
+            break;
+        }
+        // unknown option
+        else if(c == '?') {
+            return 1;
+        }
+
+        switch(index) {
+            case 0:
+                opts.outputPath = optarg;
+                break;
+            case 1:
+                opts.format = Formats::ForName(optarg);
+                if(!opts.format) {
+                    std::cerr << "invalid format: `" << optarg << "`" << std::endl;
+                    return 1;
+                }
+                break;
+            case 2:
+                opts.dump = true;
+                break;
+        }
+    }
+
+    for(int i = optind; i < argc; i++) {
+        opts.inputs.emplace_back(argv[i]);
+    }
+
+    if(opts.outputPath.empty()) {
+        std::cerr << "image file is required (--output)" << std::endl;
+        return 1;
+    } else if(!opts.dump && opts.inputs.empty()) {
+        std::cerr << "at least one input file is required" << std::endl;
+        return 1;
+    }
+
+    try {
+        if(opts.dump) {
+            DumpImage(opts.outputPath);
+        } else {
+            BuildImage(opts);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,557 @@
+/**
+ * @file
+ *
+ * @brief RPC traffic replay tool
+ *
+ * Plays back a capture file recorded by confd (see the `rpc.capture` config key) against a confd
+ * instance: each client in the capture gets its own connection, over which its requests are sent
+ * in their original order. Requests can be sent with their original timing, or as fast as
+ * possible.
+ *
+ * For each request, the round trip time observed during replay is compared with the processing
+ * time recorded by the server when the capture was made.
+ *
+ * Alternatively, the contents of a capture can be dumped in a human readable form.
+ */
+#include <fmt/core.h>
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <rpc/capture.h>
+#include <rpc/types.h>
+
+#include "HexDump.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Replay parameters
+ */
+struct Options {
+    /// Socket of the confd instance to replay against
+    std::string socketPath{"/var/run/confd/rpc.sock"};
+    /// Capture file to read
+    std::string capturePath;
+
+    /// Send requests as fast as possible, rather than with their original timing
+    bool fast{false};
+    /// Factor by which to speed up playback (when using original timing)
+    double speed{1.};
+    /// Dump the capture contents instead of replaying
+    bool dump{false};
+};
+
+/**
+ * @brief Capture file reader
+ *
+ * Reads records sequentially from a capture file.
+ */
+class CaptureReader {
+    public:
+        /**
+         * @brief A record read from the capture file
+         */
+        struct Record {
+            /// Record header
+            struct rpc_capture_record info;
+            /// Frame data (if any)
+            std::vector<std::byte> data;
+        };
+
+        CaptureReader(const std::string &path);
+
+        bool read(Record &record);
+
+        /// Get the capture file header
+        constexpr auto &getHeader() const {
+            return this->header;
+        }
+
+    private:
+        /// Capture file stream
+        std::ifstream file;
+        /// File header
+        struct rpc_capture_header header;
+};
+
+/**
+ * @brief Open a capture file and validate its header
+ */
+CaptureReader::CaptureReader(const std::string &path) : file(path, std::ios::binary) {
+    if(!this->file) {
+        throw std::system_error(errno, std::generic_category(), "open capture file");
+    }
+
+    if(!this->file.read(reinterpret_cast<char *>(&this->header), sizeof(this->header))) {
+        throw std::runtime_error("failed to read capture header");
+    } else if(this->header.magic != kRpcCaptureMagic) {
+        throw std::runtime_error(fmt::format("invalid capture magic ${:08x}",
+                    static_cast<uint32_t>(this->header.magic)));
+    } else if(this->header.version != kRpcCaptureVersion) {
+        throw std::runtime_error(fmt::format("unsupported capture version ${:04x}",
+                    static_cast<uint16_t>(this->header.version)));
+    }
+}
+
+/**
+ * @brief Read the next record
+ *
+ * @return Whether a record was read; `false` indicates the end of the file was reached.
+ *
+ * @throw std::runtime_error If the file ends in the middle of a record
+ */
+bool CaptureReader::read(Record &record) {
+    if(!this->file.read(reinterpret_cast<char *>(&record.info), sizeof(record.info))) {
+        if(this->file.gcount()) {
+            throw std::runtime_error("truncated capture record");
+        }
+        return false;
+    }
+
+    record.data.resize(record.info.length);
+
+    if(record.info.length && !this->file.read(reinterpret_cast<char *>(record.data.data()),
+                record.info.length)) {
+        // the daemon was likely killed while writing
+        throw std::runtime_error("truncated capture record data");
+    }
+
+    return true;
+}
+
+
+
+/**
+ * @brief Get the display name of an endpoint
+ */
+static std::string EndpointName(const uint8_t endpoint) {
+    switch(endpoint) {
+        case kConfigQuery:
+            return "query";
+        case kConfigUpdate:
+            return "update";
+        case kConfigStats:
+            return "stats";
+        case kConfigDelete:
+            return "delete";
+        default:
+            return fmt::format("${:02x}", endpoint);
+    }
+}
+
+/**
+ * @brief Dump the contents of a capture file
+ *
+ * Print each record, followed by a hex dump of the frame's payload.
+ */
+static void DumpCapture(CaptureReader &reader) {
+    CaptureReader::Record record;
+
+    std::cout << fmt::format("capture started at {}.{:09} (UNIX time)",
+            reader.getHeader().startTime / 1'000'000'000ULL,
+            reader.getHeader().startTime % 1'000'000'000ULL) << std::endl;
+
+    while(reader.read(record)) {
+        const auto &info = record.info;
+        const auto ts = static_cast<double>(info.timestamp) / 1e9;
+
+        if(info.type == kRpcCaptureClose) {
+            std::cout << fmt::format("[{:14.6f}] client {}: closed", ts, info.client) << std::endl;
+            continue;
+        } else if(info.type != kRpcCaptureFrame) {
+            std::cout << fmt::format("[{:14.6f}] client {}: unknown record type ${:02x}", ts,
+                    info.client, info.type) << std::endl;
+            continue;
+        }
+
+        if(record.data.size() < sizeof(struct rpc_header)) {
+            std::cout << fmt::format("[{:14.6f}] client {}: short frame ({} bytes)", ts,
+                    info.client, record.data.size()) << std::endl;
+            continue;
+        }
+
+        const auto hdr = reinterpret_cast<const struct rpc_header *>(record.data.data());
+
+        std::cout << fmt::format("[{:14.6f}] client {}: {} (tag ${:02x}, flags ${:02x}, {} bytes)"
+                ", took {:.1f} µs{}", ts, info.client, EndpointName(hdr->endpoint), hdr->tag,
+                hdr->flags, hdr->length, static_cast<double>(info.duration) / 1000.,
+                (info.flags & kRpcCaptureFailed) ? " (failed)" : "") << std::endl;
+
+        HexDump::dumpBuffer(std::cout, std::span<const std::byte>(record.data).subspan(
+                    sizeof(struct rpc_header)));
+    }
+}
+
+
+
+/**
+ * @brief Latency samples for one endpoint
+ */
+struct EndpointResult {
+    /// Server processing time recorded in the capture (ns)
+    std::vector<int64_t> original;
+    /// Round trip time during replay (ns)
+    std::vector<int64_t> replayed;
+    /// Difference between replayed and original time, per request (ns)
+    std::vector<int64_t> divergence;
+
+    /// Number of requests that failed during replay
+    size_t errors{0};
+    /// Number of requests whose success differed from the capture
+    size_t mismatches{0};
+};
+
+/**
+ * @brief Connections to confd, one per captured client
+ */
+class ConnectionPool {
+    public:
+        ConnectionPool(const std::string &path) : socketPath(path) {}
+        ~ConnectionPool();
+
+        int get(const uint32_t client);
+        void close(const uint32_t client);
+
+    private:
+        /// Path to the RPC socket
+        std::string socketPath;
+        /// Open connections, keyed by client id from the capture
+        std::unordered_map<uint32_t, int> fds;
+};
+
+/**
+ * @brief Close all connections
+ */
+ConnectionPool::~ConnectionPool() {
+    for(const auto &[client, fd] : this->fds) {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief Get the connection for a captured client
+ *
+ * Connects to the server if there's no connection for this client yet.
+ */
+int ConnectionPool::get(const uint32_t client) {
+    if(this->fds.contains(client)) {
+        return this->fds.at(client);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, this->socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        const auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "connect");
+    }
+
+    this->fds.emplace(client, fd);
+    return fd;
+}
+
+/**
+ * @brief Close the connection of a captured client, if it's open
+ */
+void ConnectionPool::close(const uint32_t client) {
+    if(!this->fds.contains(client)) {
+        return;
+    }
+
+    ::close(this->fds.at(client));
+    this->fds.erase(client);
+}
+
+/**
+ * @brief Send a request and wait for its reply
+ *
+ * @return Whether a complete reply was received; if not, the server closed the connection.
+ */
+static bool Transact(const int fd, std::span<const std::byte> frame, std::vector<std::byte> &buf) {
+    // send the request
+    size_t written{0};
+    while(written < frame.size()) {
+        const auto err = send(fd, frame.data() + written, frame.size() - written, MSG_NOSIGNAL);
+        if(err == -1) {
+            if(errno == EINTR) {
+                continue;
+            } else if(errno == EPIPE || errno == ECONNRESET) {
+                return false;
+            }
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        written += err;
+    }
+
+    // read the reply header, then the rest of the reply
+    auto readFully = [&](std::byte *out, const size_t len) -> bool {
+        size_t numRead{0};
+        while(numRead < len) {
+            const auto err = read(fd, out + numRead, len - numRead);
+            if(err == -1) {
+                if(errno == EINTR) {
+                    continue;
+                } else if(errno == ECONNRESET) {
+                    return false;
+                }
+                throw std::system_error(errno, std::generic_category(), "read");
+            } else if(!err) {
+                return false;
+            }
+            numRead += err;
+        }
+        return true;
+    };
+
+    buf.resize(sizeof(struct rpc_header));
+    if(!readFully(buf.data(), buf.size())) {
+        return false;
+    }
+
+    const auto length = reinterpret_cast<const struct rpc_header *>(buf.data())->length;
+    if(length < sizeof(struct rpc_header)) {
+        throw std::runtime_error(fmt::format("invalid reply length {}", length));
+    }
+
+    buf.resize(length);
+    return readFully(buf.data() + sizeof(struct rpc_header), length - sizeof(struct rpc_header));
+}
+
+/**
+ * @brief Get a percentile from a sorted list of samples, in µs
+ */
+static double Percentile(const std::vector<int64_t> &sorted, const double p) {
+    if(sorted.empty()) {
+        return 0;
+    }
+
+    const auto idx = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return static_cast<double>(sorted[std::clamp<size_t>(idx, 1, sorted.size()) - 1]) / 1000.;
+}
+
+/**
+ * @brief Print the replay results
+ *
+ * For each endpoint, print the distribution of the originally recorded processing time, the
+ * round trip time during replay, and the per-request difference between the two.
+ */
+static void PrintResults(std::map<uint8_t, EndpointResult> &results,
+        const std::chrono::duration<double> elapsed, const Clock::duration maxLag,
+        const bool timed) {
+    size_t total{0};
+
+    std::cout << fmt::format("{:<8} {:>8} {:>6} {:>6} {:>11} {:>11} {:>11} {:>11} {:>11} {:>11}",
+            "endpoint", "count", "errors", "diff", "orig p50", "orig p99", "replay p50",
+            "replay p99", "div p50", "div p99") << std::endl;
+
+    for(auto &[endpoint, result] : results) {
+        for(auto vec : {&result.original, &result.replayed, &result.divergence}) {
+            std::sort(vec->begin(), vec->end());
+        }
+
+        total += result.replayed.size() + result.errors;
+
+        std::cout << fmt::format("{:<8} {:>8} {:>6} {:>6} {:>11.1f} {:>11.1f} {:>11.1f} {:>11.1f} "
+                "{:>11.1f} {:>11.1f}", EndpointName(endpoint), result.replayed.size(),
+                result.errors, result.mismatches, Percentile(result.original, .5),
+                Percentile(result.original, .99), Percentile(result.replayed, .5),
+                Percentile(result.replayed, .99), Percentile(result.divergence, .5),
+                Percentile(result.divergence, .99)) << std::endl;
+    }
+
+    std::cout << fmt::format("replayed {} requests in {:.2f} s ({:.1f} req/s); times in µs",
+            total, elapsed.count(), static_cast<double>(total) / elapsed.count()) << std::endl;
+
+    if(timed) {
+        std::cout << fmt::format("max schedule lag: {:.1f} µs", static_cast<double>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(maxLag).count()) / 1000.)
+            << std::endl;
+    }
+}
+
+/**
+ * @brief Replay a capture file
+ *
+ * Requests are sent in the order they were captured, each on the connection belonging to the
+ * client that originally sent it. With original timing, we wait until the request's (scaled)
+ * offset from the start of the capture has elapsed before sending it.
+ */
+static void ReplayCapture(CaptureReader &reader, const Options &opts) {
+    ConnectionPool connections(opts.socketPath);
+    std::map<uint8_t, EndpointResult> results;
+    std::vector<std::byte> replyBuf;
+
+    CaptureReader::Record record;
+    Clock::duration maxLag{0};
+
+    const auto start = Clock::now();
+
+    while(reader.read(record)) {
+        const auto &info = record.info;
+
+        // closing connections is replayed, so clients reconnect like they originally did
+        if(info.type == kRpcCaptureClose) {
+            connections.close(info.client);
+            continue;
+        } else if(info.type != kRpcCaptureFrame || record.data.size() < sizeof(struct rpc_header)) {
+            continue;
+        }
+
+        const auto hdr = reinterpret_cast<const struct rpc_header *>(record.data.data());
+        auto &result = results[hdr->endpoint];
+
+        // wait until it's time to send this request
+        if(!opts.fast) {
+            const auto offset = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double, std::nano>(
+                        static_cast<double>(info.timestamp) / opts.speed));
+            const auto target = start + offset;
+
+            std::this_thread::sleep_until(target);
+            maxLag = std::max(maxLag, Clock::now() - target);
+        }
+
+        // send it and wait for the reply
+        const auto fd = connections.get(info.client);
+
+        const auto reqStart = Clock::now();
+        const bool success = Transact(fd, record.data, replyBuf);
+        const auto reqEnd = Clock::now();
+
+        if(success == !!(info.flags & kRpcCaptureFailed)) {
+            result.mismatches++;
+        }
+
+        // server aborts the connection on failure; reconnect for the next request
+        if(!success) {
+            result.errors++;
+            connections.close(info.client);
+            continue;
+        }
+
+        const int64_t rtt = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                reqEnd - reqStart).count();
+
+        result.original.push_back(info.duration);
+        result.replayed.push_back(rtt);
+        result.divergence.push_back(rtt - static_cast<int64_t>(info.duration));
+    }
+
+    PrintResults(results, Clock::now() - start, maxLag, !opts.fast);
+}
+
+
+
+/**
+ * @brief Replay tool entry point
+ *
+ * The following switches are supported:
+ *
+ * - capture: Capture file to read (required)
+ * - socket: Path to the confd RPC socket to replay against
+ * - fast: Send requests as fast as possible, rather than with their original timing
+ * - speed: Factor by which to speed up playback when using original timing
+ * - dump: Print the contents of the capture, rather than replaying it
+ *
+ * Divergence is the difference between the round trip time observed during replay and the
+ * processing time recorded by the server; it thus includes IPC overhead, which is not part of the
+ * recorded time.
+ */
+int main(const int argc, char * const *argv) {
+    Options opts;
+
+    // parse command line
+    int c;
+    while(1) {
+        int index{0};
+        const static struct option options[] = {
+            {"capture",                 required_argument, 0, 0},
+            {"socket",                  required_argument, 0, 0},
+            {"fast",                    no_argument, 0, 0},
+            {"speed",                   required_argument, 0, 0},
+            {"dump",                    no_argument, 0, 0},
+            {nullptr,                   0, 0, 0},
+        };
+
+        c = getopt_long(argc, argv, "", options, &index);
+
+        // end of options
+        if(c == -1) {
+            break;
+        }
+        // unknown option
+        else if(c == '?') {
+            return 1;
+        }
+
+        switch(index) {
+            case 0:
+                opts.capturePath = optarg;
+                break;
+            case 1:
+                opts.socketPath = optarg;
+                break;
+            case 2:
+                opts.fast = true;
+                break;
+            case 3:
+                opts.speed = strtod(optarg, nullptr);
+                break;
+            case 4:
+                opts.dump = true;
+                break;
+        }
+    }
+
+    if(opts.capturePath.empty()) {
+        std::cerr << "capture file is required (--capture)" << std::endl;
+        return 1;
+    } else if(opts.speed <= 0) {
+        std::cerr << "invalid playback speed" << std::endl;
+        return 1;
+    }
+
+    try {
+        CaptureReader reader(opts.capturePath);
+
+        if(opts.dump) {
+            DumpCapture(reader);
+        } else {
+            ReplayCapture(reader, opts);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "replay failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
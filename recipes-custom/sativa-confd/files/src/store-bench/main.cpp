@@ -0,0 +1,593 @@
+/**
+ * @file
+ *
+ * @brief DataStore micro-benchmarks
+ *
+ * Exercises the data store directly (without going through the RPC interface) to measure the cost
+ * of the underlying database and schema in isolation. Each benchmark performs an operation a
+ * number of times, timing each invocation individually. Any of the storage backends can be
+ * benchmarked, so they can be compared against each other.
+ *
+ * Results are written as JSON, so that runs from different commits can be compared by scripts.
+ */
+#include <fmt/format.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "DataStore.h"
+#include "MemoryBackend.h"
+#include "SqliteBackend.h"
+#include "Types.h"
+#include "version.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Benchmark parameters
+ */
+struct Options {
+    /// Directory in which to create the temporary databases
+    std::filesystem::path dir{std::filesystem::temp_directory_path()};
+    /// Storage backend to benchmark (`sqlite`, `memory` or `transient`)
+    std::string backend{"sqlite"};
+    /// Number of iterations for per-key benchmarks
+    size_t iterations{1000};
+    /// Number of keys in the database for the open benchmark
+    size_t openKeys{100000};
+    /// Number of times the database is opened
+    size_t openIterations{10};
+    /// Number of keys in the tree for the subkey delete benchmark
+    size_t treeKeys{10000};
+    /// Number of times the subkey delete benchmark is repeated
+    size_t treeIterations{5};
+    /// Only run benchmarks whose name contains this string
+    std::string filter;
+    /// File to write results to (stdout if empty)
+    std::filesystem::path outPath;
+};
+
+/**
+ * @brief Timing samples for a single benchmark
+ */
+struct Result {
+    /// Benchmark name
+    std::string name;
+    /// Duration of each iteration, in nanoseconds
+    std::vector<uint64_t> samples;
+};
+
+/**
+ * @brief Value types that can be benchmarked
+ *
+ * Each corresponds to one of the property value types in the data store.
+ */
+static const std::vector<std::pair<const char *, PropertyValue>> kValueTypes{
+    {"null", nullptr},
+    {"string", std::string(32, 'x')},
+    {"blob", Blob(32, std::byte{0xa5})},
+    {"integer", uint64_t{0x1234'5678}},
+    {"real", 420.69},
+};
+
+/**
+ * @brief Benchmark runner
+ *
+ * Holds the working directory (in which all scratch databases are created) and collects results
+ * of all benchmarks run.
+ */
+class Runner {
+    public:
+        Runner(const Options &opts);
+        ~Runner();
+
+        void runAll();
+        void writeJson(std::ostream &os) const;
+
+    private:
+        void benchGet();
+        void benchSet();
+        void benchDeleteSubkeys();
+        void benchOpen();
+
+        bool shouldRun(const std::string_view &name) const {
+            return this->opts.filter.empty() || name.find(this->opts.filter) != std::string::npos;
+        }
+
+        std::filesystem::path makeDbPath(const std::string_view &name);
+        std::unique_ptr<StorageBackend> makeBackend(const std::filesystem::path &path) const;
+        std::unique_ptr<DataStore> makeStore(const std::string_view &name);
+        std::unique_ptr<DataStore> makePopulatedStore(const std::filesystem::path &path,
+                const std::vector<std::string_view> &prefixes, const size_t numKeys);
+        void record(const std::string &name, const size_t iterations,
+                const std::function<void(size_t)> &work);
+
+        static void Populate(const std::filesystem::path &path, const std::string_view &prefix,
+                const size_t numKeys);
+
+    private:
+        /// Benchmark configuration
+        const Options &opts;
+        /// Scratch directory for databases
+        std::filesystem::path dir;
+
+        /// Results of all benchmarks run so far
+        std::vector<Result> results;
+};
+
+/**
+ * @brief Initialize the runner and create its scratch directory
+ */
+Runner::Runner(const Options &opts) : opts(opts) {
+    std::string dirTemplate = (opts.dir / "confd-store-bench.XXXXXX");
+    if(!mkdtemp(dirTemplate.data())) {
+        throw std::system_error(errno, std::generic_category(), "mkdtemp");
+    }
+
+    this->dir = dirTemplate;
+}
+
+/**
+ * @brief Remove the scratch directory and all databases in it
+ */
+Runner::~Runner() {
+    std::error_code ec;
+    std::filesystem::remove_all(this->dir, ec);
+}
+
+/**
+ * @brief Run all benchmarks that match the filter
+ */
+void Runner::runAll() {
+    this->benchGet();
+    this->benchSet();
+    this->benchDeleteSubkeys();
+    this->benchOpen();
+}
+
+/**
+ * @brief Get the path for a fresh scratch database
+ *
+ * Any existing database (and its journal, or write log and snapshot) of the same name is removed.
+ */
+std::filesystem::path Runner::makeDbPath(const std::string_view &name) {
+    const auto path = this->dir / fmt::format("{}.db", name);
+
+    for(const auto suffix : {"", "-journal", "-wal", "-shm", ".log", ".snapshot"}) {
+        std::filesystem::remove(path.native() + suffix);
+    }
+
+    return path;
+}
+
+/**
+ * @brief Open the storage backend being benchmarked at the given path
+ *
+ * The transient backend ignores the path, and always starts out empty.
+ */
+std::unique_ptr<StorageBackend> Runner::makeBackend(const std::filesystem::path &path) const {
+    if(this->opts.backend == "memory") {
+        return std::make_unique<MemoryBackend>(path, WriteLog::Options{});
+    } else if(this->opts.backend == "transient") {
+        return std::make_unique<MemoryBackend>();
+    }
+
+    return std::make_unique<SqliteBackend>(path);
+}
+
+/**
+ * @brief Create a data store on a fresh scratch database
+ */
+std::unique_ptr<DataStore> Runner::makeStore(const std::string_view &name) {
+    return std::make_unique<DataStore>(this->makeBackend(this->makeDbPath(name)));
+}
+
+/**
+ * @brief Create a data store filled with integer keys
+ *
+ * sqlite databases are populated directly (see Populate()); all other backends by loading the
+ * keys through the data store, one prefix at a time.
+ *
+ * @param path Fresh scratch database to create the store at
+ * @param prefixes Key prefixes; keys are named `{prefix}.{index}`
+ * @param numKeys Number of keys to insert under each prefix
+ */
+std::unique_ptr<DataStore> Runner::makePopulatedStore(const std::filesystem::path &path,
+        const std::vector<std::string_view> &prefixes, const size_t numKeys) {
+    if(this->opts.backend == "sqlite") {
+        {
+            DataStore init(path);
+        }
+        for(const auto &prefix : prefixes) {
+            Populate(path, prefix, numKeys);
+        }
+
+        return std::make_unique<DataStore>(path);
+    }
+
+    auto store = std::make_unique<DataStore>(this->makeBackend(path));
+
+    for(const auto &prefix : prefixes) {
+        PropertyList values;
+        values.reserve(numKeys);
+
+        for(size_t i = 0; i < numKeys; i++) {
+            values.emplace_back(fmt::format("{}.{}", prefix, i), uint64_t{i});
+        }
+        store->setKeys(values);
+    }
+
+    return store;
+}
+
+/**
+ * @brief Time a benchmark
+ *
+ * Invoke the work function the given number of times, and record the duration of each call.
+ *
+ * @param name Benchmark name
+ * @param iterations Number of times to invoke the work function
+ * @param work Function to invoke; it receives the iteration index
+ */
+void Runner::record(const std::string &name, const size_t iterations,
+        const std::function<void(size_t)> &work) {
+    Result result{name, {}};
+    result.samples.reserve(iterations);
+
+    std::cerr << "running: " << name << std::endl;
+
+    for(size_t i = 0; i < iterations; i++) {
+        const auto start = Clock::now();
+        work(i);
+        const auto end = Clock::now();
+
+        result.samples.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    this->results.emplace_back(std::move(result));
+}
+
+/**
+ * @brief Fill a database with integer keys
+ *
+ * Keys are inserted directly into the database, inside of a single transaction; going through the
+ * data store would commit every key individually, making setup of large databases take ages.
+ *
+ * @param path Database to populate; it must already have been initialized by the data store
+ * @param prefix Key prefix; keys are named `{prefix}.{index}`
+ * @param numKeys Number of keys to insert
+ */
+void Runner::Populate(const std::filesystem::path &path, const std::string_view &prefix,
+        const size_t numKeys) {
+    SQLite::Database db(path, SQLite::OPEN_READWRITE);
+    SQLite::Transaction txn(db);
+
+    SQLite::Statement insKey(db, "INSERT INTO PropertyKeys(key, valueType) VALUES (:key, 3);");
+    SQLite::Statement insValue(db, "INSERT INTO PropertyValuesInteger(propertyId, value) VALUES "
+            "(:id, :value);");
+
+    for(size_t i = 0; i < numKeys; i++) {
+        insKey.bind(":key", fmt::format("{}.{}", prefix, i));
+        insKey.exec();
+        insKey.reset();
+
+        insValue.bind(":id", static_cast<int64_t>(db.getLastInsertRowid()));
+        insValue.bind(":value", static_cast<int64_t>(i));
+        insValue.exec();
+        insValue.reset();
+    }
+
+    txn.commit();
+}
+
+
+
+/**
+ * @brief Benchmark key reads
+ *
+ * For each value type, read existing keys (hits); then read keys that don't exist (misses).
+ */
+void Runner::benchGet() {
+    const auto n = this->opts.iterations;
+
+    for(const auto &[typeName, value] : kValueTypes) {
+        const auto name = fmt::format("getKey.hit.{}", typeName);
+        if(!this->shouldRun(name)) {
+            continue;
+        }
+
+        auto store = this->makeStore("get");
+        for(size_t i = 0; i < n; i++) {
+            store->setKey(fmt::format("bench.{}", i), value);
+        }
+
+        this->record(name, n, [&](auto i) {
+            if(std::holds_alternative<std::monostate>(store->getKey(fmt::format("bench.{}", i)))) {
+                throw std::logic_error("key not found during hit benchmark");
+            }
+        });
+    }
+
+    if(this->shouldRun("getKey.miss")) {
+        auto store = this->makeStore("get");
+        for(size_t i = 0; i < n; i++) {
+            store->setKey(fmt::format("bench.{}", i), uint64_t{i});
+        }
+
+        this->record("getKey.miss", n, [&](auto i) {
+            if(!std::holds_alternative<std::monostate>(store->getKey(fmt::format("miss.{}", i)))) {
+                throw std::logic_error("key found during miss benchmark");
+            }
+        });
+    }
+}
+
+/**
+ * @brief Benchmark key writes
+ *
+ * For each value type, insert new keys into an empty store; then update each of them with a value
+ * of the same type.
+ */
+void Runner::benchSet() {
+    const auto n = this->opts.iterations;
+
+    for(const auto &[typeName, value] : kValueTypes) {
+        const auto insName = fmt::format("setKey.insert.{}", typeName);
+        const auto updName = fmt::format("setKey.update.{}", typeName);
+
+        if(!this->shouldRun(insName) && !this->shouldRun(updName)) {
+            continue;
+        }
+
+        auto store = this->makeStore("set");
+
+        // the insert pass also serves as setup for the update pass, so always run it
+        auto insert = [&](auto i) {
+            store->setKey(fmt::format("bench.{}", i), value);
+        };
+
+        if(this->shouldRun(insName)) {
+            this->record(insName, n, insert);
+        } else {
+            for(size_t i = 0; i < n; i++) {
+                insert(i);
+            }
+        }
+
+        if(this->shouldRun(updName)) {
+            this->record(updName, n, [&](auto i) {
+                store->setKey(fmt::format("bench.{}", i), value);
+            });
+        }
+    }
+}
+
+/**
+ * @brief Benchmark deleting a large key tree
+ *
+ * Populate a database with a large number of keys under one prefix (plus the same number of keys
+ * under an unrelated prefix, so the delete has to be selective) and then delete the whole tree.
+ */
+void Runner::benchDeleteSubkeys() {
+    const auto name = fmt::format("deleteSubkeys.{}", this->opts.treeKeys);
+    if(!this->shouldRun(name)) {
+        return;
+    }
+
+    Result result{name, {}};
+    std::cerr << "running: " << name << std::endl;
+
+    for(size_t i = 0; i < this->opts.treeIterations; i++) {
+        auto store = this->makePopulatedStore(this->makeDbPath("tree"), {"tree", "other"},
+                this->opts.treeKeys);
+
+        const auto start = Clock::now();
+        const auto deleted = store->deleteSubkeys("tree");
+        const auto end = Clock::now();
+
+        if(deleted != this->opts.treeKeys) {
+            throw std::logic_error(fmt::format("deleted {} keys, expected {}", deleted,
+                        this->opts.treeKeys));
+        }
+
+        result.samples.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    this->results.emplace_back(std::move(result));
+}
+
+/**
+ * @brief Benchmark opening a large database
+ *
+ * Measures how long it takes to open an existing database, then read a single key from it; this
+ * is roughly the work done at daemon startup before the first request can be served.
+ *
+ * The transient backend has nothing to open, so it's skipped.
+ */
+void Runner::benchOpen() {
+    const auto name = fmt::format("open.{}", this->opts.openKeys);
+    if(!this->shouldRun(name) || this->opts.backend == "transient") {
+        return;
+    }
+
+    const auto path = this->makeDbPath("open");
+    this->makePopulatedStore(path, {"bench"}, this->opts.openKeys);
+
+    this->record(name, this->opts.openIterations, [&](auto) {
+        DataStore store(this->makeBackend(path));
+        store.getKey("bench.0");
+    });
+}
+
+/**
+ * @brief Write the results of all benchmarks as JSON
+ *
+ * The output is an object containing the version of confd, the parameters used, and an array
+ * with the statistics of each benchmark; all times are in nanoseconds.
+ */
+void Runner::writeJson(std::ostream &os) const {
+    os << "{" << std::endl;
+    os << fmt::format("  \"version\": \"{}\",", kVersion) << std::endl;
+    os << fmt::format("  \"gitHash\": \"{}\",", kVersionGitHash) << std::endl;
+    os << fmt::format("  \"timestamp\": {},", static_cast<int64_t>(std::time(nullptr)))
+        << std::endl;
+    os << fmt::format("  \"params\": {{\"backend\": \"{}\", \"iterations\": {}, "
+            "\"openKeys\": {}, \"treeKeys\": {}}},", this->opts.backend, this->opts.iterations,
+            this->opts.openKeys, this->opts.treeKeys) << std::endl;
+    os << "  \"benchmarks\": [" << std::endl;
+
+    for(size_t i = 0; i < this->results.size(); i++) {
+        const auto &result = this->results[i];
+
+        auto samples = result.samples;
+        std::sort(samples.begin(), samples.end());
+
+        const auto percentile = [&](const double p) -> uint64_t {
+            const auto idx = static_cast<size_t>(std::ceil(p * static_cast<double>(samples.size())));
+            return samples[std::clamp<size_t>(idx, 1, samples.size()) - 1];
+        };
+
+        const auto total = std::accumulate(samples.begin(), samples.end(), uint64_t{0});
+        const auto mean = samples.empty() ? 0 : (total / samples.size());
+
+        os << fmt::format("    {{\"name\": \"{}\", \"iterations\": {}, \"totalNs\": {}, "
+                "\"meanNs\": {}, \"minNs\": {}, \"p50Ns\": {}, \"p99Ns\": {}, \"maxNs\": {}, "
+                "\"opsPerSec\": {:.1f}}}", result.name, samples.size(), total, mean,
+                samples.empty() ? 0 : samples.front(), samples.empty() ? 0 : percentile(.5),
+                samples.empty() ? 0 : percentile(.99), samples.empty() ? 0 : samples.back(),
+                total ? (static_cast<double>(samples.size()) * 1e9 / static_cast<double>(total))
+                : 0.);
+        os << ((i + 1 < this->results.size()) ? "," : "") << std::endl;
+    }
+
+    os << "  ]" << std::endl;
+    os << "}" << std::endl;
+}
+
+
+
+/**
+ * @brief Micro-benchmark entry point
+ *
+ * The following switches are supported:
+ *
+ * - dir: Directory in which scratch databases are created (defaults to the temp directory)
+ * - backend: Storage backend to benchmark (`sqlite`, the default; `memory` or `transient`)
+ * - iterations: Number of iterations for the get/set benchmarks
+ * - open-keys: Number of keys in the database for the open benchmark
+ * - tree-keys: Number of keys in the tree deleted by the subkey delete benchmark
+ * - filter: Only run benchmarks whose name contains this string
+ * - output: Write JSON results to this file rather than stdout
+ *
+ * Progress messages are written to stderr.
+ */
+int main(const int argc, char * const *argv) {
+    Options opts;
+
+    // parse command line
+    int c;
+    while(1) {
+        int index{0};
+        const static struct option options[] = {
+            {"dir",                     required_argument, 0, 0},
+            {"iterations",              required_argument, 0, 0},
+            {"open-keys",               required_argument, 0, 0},
+            {"tree-keys",               required_argument, 0, 0},
+            {"filter",                  required_argument, 0, 0},
+            {"output",                  required_argument, 0, 0},
+            {"backend",                 required_argument, 0, 0},
+            {nullptr,                   0, 0, 0},
+        };
+
+        c = getopt_long(argc, argv, "", options, &index);
+
+        // end of options
+        if(c == -1) {
+            break;
+        }
+        // unknown option
+        else if(c == '?') {
+            return 1;
+        }
+
+        try {
+            switch(index) {
+                case 0:
+                    opts.dir = optarg;
+                    break;
+                case 1:
+                    opts.iterations = std::stoul(optarg);
+                    break;
+                case 2:
+                    opts.openKeys = std::stoul(optarg);
+                    break;
+                case 3:
+                    opts.treeKeys = std::stoul(optarg);
+                    break;
+                case 4:
+                    opts.filter = optarg;
+                    break;
+                case 5:
+                    opts.outPath = optarg;
+                    break;
+                case 6:
+                    opts.backend = optarg;
+                    break;
+            }
+        } catch(const std::exception &e) {
+            std::cerr << fmt::format("invalid value for --{}: {}", options[index].name, e.what())
+                << std::endl;
+            return 1;
+        }
+    }
+
+    if(!opts.iterations) {
+        std::cerr << "iteration count must be nonzero" << std::endl;
+        return 1;
+    } else if(opts.backend != "sqlite" && opts.backend != "memory" &&
+            opts.backend != "transient") {
+        std::cerr << "invalid backend '" << opts.backend << "'" << std::endl;
+        return 1;
+    }
+
+    // run benchmarks and output results
+    try {
+        Runner runner(opts);
+        runner.runAll();
+
+        if(opts.outPath.empty()) {
+            runner.writeJson(std::cout);
+        } else {
+            std::ofstream out(opts.outPath);
+            runner.writeJson(out);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+/**
+ * @file
+ *
+ * @brief libconfd allocation test
+ *
+ * Checks that, once warmed up, queries made through libconfd don't allocate any memory: the
+ * request is encoded into the connection's transmit buffer, and the reply decoded in place in its
+ * receive buffer, both of which keep their capacity between requests.
+ *
+ * malloc, calloc and realloc are interposed to count the allocations made by the test thread. The
+ * queries are answered by a minimal stand-in for confd, running on a thread of its own (whose
+ * allocations aren't counted) so the test doesn't depend on a daemon or database.
+ */
+#include <confd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "rpc/types.h"
+
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+}
+
+/// Whether allocations made by this thread are counted
+static thread_local bool gCounting{false};
+/// Number of allocations counted
+static std::atomic<size_t> gAllocations{0};
+
+extern "C" void *malloc(size_t size) {
+    if(gCounting) {
+        gAllocations++;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size) {
+    if(gCounting) {
+        gAllocations++;
+    }
+    return __libc_calloc(num, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    if(gCounting) {
+        gAllocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+/// Number of queries made before allocations are counted
+constexpr static const size_t kWarmupQueries{100};
+/// Number of queries made while counting allocations
+constexpr static const size_t kCountedQueries{1000};
+
+/**
+ * @brief Get the encoded value the stand-in server replies with for a key
+ *
+ * Keys are named after the type of their value.
+ */
+static std::vector<uint8_t> EncodedValue(const std::string_view &key) {
+    if(key == "int") {
+        return {0x18, 0x2a};
+    } else if(key == "string") {
+        return {0x65, 'h', 'e', 'l', 'l', 'o'};
+    } else if(key == "real") {
+        return {0xfb, 0x3f, 0xf8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    } else if(key == "bool") {
+        return {0xf5};
+    } else if(key == "blob") {
+        return {0x43, 0x01, 0x02, 0x03};
+    }
+
+    return {0xf6};
+}
+
+/**
+ * @brief Read an exact number of bytes from a socket
+ *
+ * @return Whether all bytes were read, rather than the connection being closed
+ */
+static bool ReadFully(const int fd, void *buf, const size_t len) {
+    size_t numRead{0};
+
+    while(numRead < len) {
+        const auto err = read(fd, reinterpret_cast<std::byte *>(buf) + numRead, len - numRead);
+        if(err == -1 && errno == EINTR) {
+            continue;
+        } else if(err <= 0) {
+            return false;
+        }
+        numRead += err;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Answer queries on a connection until it's closed
+ *
+ * Each query is answered with the value named by its key, in the same form as confd's replies.
+ */
+static void ServeQueries(const int fd) {
+    std::vector<uint8_t> request, reply;
+
+    while(true) {
+        struct rpc_header hdr;
+        if(!ReadFully(fd, &hdr, sizeof(hdr)) || hdr.length < sizeof(hdr)) {
+            return;
+        }
+
+        request.resize(hdr.length - sizeof(hdr));
+        if(!ReadFully(fd, request.data(), request.size())) {
+            return;
+        }
+
+        // requests are maps of one entry: `key` followed by the key name (shorter than 24 bytes)
+        std::string_view key;
+        if(request.size() > 5 && (request[5] & 0xe0) == 0x60) {
+            key = {reinterpret_cast<const char *>(request.data()) + 6,
+                static_cast<size_t>(request[5] & 0x1f)};
+        }
+
+        const auto value = EncodedValue(key);
+
+        reply.assign(sizeof(hdr), 0);
+        reply.insert(reply.end(), {0xa3, 0x65, 'f', 'o', 'u', 'n', 'd', 0xf5});
+        reply.insert(reply.end(), {0x67, 'v', 'e', 'r', 's', 'i', 'o', 'n', 0x01});
+        reply.insert(reply.end(), {0x65, 'v', 'a', 'l', 'u', 'e'});
+        reply.insert(reply.end(), value.begin(), value.end());
+
+        auto replyHdr = reinterpret_cast<struct rpc_header *>(reply.data());
+        replyHdr->version = kRpcVersionLatest;
+        replyHdr->length = reply.size();
+        replyHdr->endpoint = hdr.endpoint;
+        replyHdr->tag = hdr.tag;
+        replyHdr->flags = (1 << 0);
+
+        if(write(fd, reply.data(), reply.size()) != static_cast<ssize_t>(reply.size())) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Make the same query repeatedly, counting the allocations of the last ones
+ *
+ * @param name Name of the query, for the output
+ * @param query Function making the query; returns whether it succeeded
+ *
+ * @return Whether all queries succeeded without allocating
+ */
+template<typename Func>
+static bool CheckQuery(const char *name, Func &&query) {
+    size_t failed{0};
+
+    for(size_t i = 0; i < kWarmupQueries; i++) {
+        failed += !query();
+    }
+
+    gAllocations = 0;
+    gCounting = true;
+
+    for(size_t i = 0; i < kCountedQueries; i++) {
+        failed += !query();
+    }
+
+    gCounting = false;
+    const size_t allocations = gAllocations;
+
+    printf("%-20s %zu allocation(s), %zu failed quer%s\n", name, allocations, failed,
+            (failed == 1) ? "y" : "ies");
+    return !allocations && !failed;
+}
+
+int main() {
+    // listen on a socket in a temporary directory
+    char dirTemplate[]{"/tmp/confd-alloc-XXXXXX"};
+    if(!mkdtemp(dirTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    const std::filesystem::path dir{dirTemplate};
+    const auto socketPath = (dir / "rpc.sock").native();
+
+    const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    if(listenFd == -1 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) == -1 || listen(listenFd, 1) == -1) {
+        perror("listen");
+        std::filesystem::remove_all(dir);
+        return 1;
+    }
+
+    std::thread server([listenFd] {
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if(fd != -1) {
+            ServeQueries(fd);
+            close(fd);
+        }
+    });
+
+    bool success{false};
+    int err = confd_open(socketPath.c_str());
+
+    if(err) {
+        fprintf(stderr, "confd_open failed: %d\n", err);
+    } else {
+        int64_t intValue;
+        double realValue;
+        bool boolValue;
+        std::array<char, 64> str;
+        std::array<std::byte, 64> blob;
+        size_t len;
+        const char *borrowed;
+        const void *borrowedBlob;
+
+        success = true;
+        success &= CheckQuery("confd_get_int", [&] {
+            return !confd_get_int("int", &intValue) && intValue == 42;
+        });
+        success &= CheckQuery("confd_get_string", [&] {
+            return !confd_get_string("string", str.data(), str.size(), &len) &&
+                std::string_view(str.data()) == "hello";
+        });
+        success &= CheckQuery("confd_get_real", [&] {
+            return !confd_get_real("real", &realValue) && realValue == 1.5;
+        });
+        success &= CheckQuery("confd_get_bool", [&] {
+            return !confd_get_bool("bool", &boolValue) && boolValue;
+        });
+        success &= CheckQuery("confd_get_blob", [&] {
+            return !confd_get_blob("blob", blob.data(), blob.size(), &len) && len == 3;
+        });
+        success &= CheckQuery("confd_borrow_string", [&] {
+            return !confd_borrow_string("string", &borrowed, &len) && len == 5;
+        });
+        success &= CheckQuery("confd_borrow_blob", [&] {
+            return !confd_borrow_blob("blob", &borrowedBlob, &len) && len == 3;
+        });
+
+        confd_close();
+    }
+
+    // closing the connection ends the server thread
+    if(err) {
+        shutdown(listenFd, SHUT_RDWR);
+    }
+    server.join();
+
+    close(listenFd);
+    std::filesystem::remove_all(dir);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+/**
+ * @file
+ *
+ * @brief Data store test
+ *
+ * Exercises the data store on the in-memory backend: reading and writing keys, deleting them,
+ * key expiration, compare-and-swap updates and integer operations (also on debounced keys). Each
+ * test runs on a transient backend, and again on one persisted by a write log, which is then
+ * reopened to check that the changes (including versions and expiration times) survive.
+ */
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+#include "DataStore.h"
+#include "MemoryBackend.h"
+
+using namespace std::chrono_literals;
+
+/// Number of failed checks
+static size_t gFailures{0};
+
+/**
+ * @brief Record the result of a check
+ *
+ * Failed checks are printed (with the expression that failed) but don't stop the test.
+ */
+#define CHECK(expr) do { \
+    if(!(expr)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+        gFailures++; \
+    } \
+} while(0)
+
+/**
+ * @brief Opens a data store for a test
+ *
+ * If persistent, it always opens the same write log; the previous store must be closed first.
+ */
+using StoreFactory = std::function<std::unique_ptr<DataStore>()>;
+
+/**
+ * @brief Check whether a call throws the given exception type
+ */
+template<typename Exception, typename Func>
+static bool Throws(Func &&func) {
+    try {
+        func();
+    } catch(const Exception &) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reading and writing keys of all types, and their versions
+ */
+static void TestGetSet(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+    uint64_t version{0};
+
+    CHECK(std::holds_alternative<std::monostate>(store->getKey("test.missing", &version)));
+    CHECK(version == 0);
+
+    store->setKey("test.string", std::string("hello"));
+    store->setKey("test.blob", Blob{std::byte{1}, std::byte{2}});
+    store->setKey("test.int", uint64_t{42});
+    store->setKey("test.real", 1.5);
+    store->setKey("test.bool", true);
+    store->setKey("test.null", nullptr);
+
+    CHECK(store->getKey("test.string", &version) == PropertyValue(std::string("hello")));
+    CHECK(version == 1);
+    CHECK(store->getKey("test.blob") == PropertyValue(Blob{std::byte{1}, std::byte{2}}));
+    CHECK(store->getKey("test.int") == PropertyValue(uint64_t{42}));
+    CHECK(store->getKey("test.real") == PropertyValue(1.5));
+    // booleans are stored as integers
+    CHECK(store->getKey("test.bool") == PropertyValue(uint64_t{1}));
+    CHECK(store->getKey("test.null") == PropertyValue(nullptr));
+
+    // updates bump the version; unchanged writes are skipped, and don't
+    store->setKey("test.int", uint64_t{43});
+    store->setKey("test.int", uint64_t{43});
+    CHECK(store->getKey("test.int", &version) == PropertyValue(uint64_t{43}));
+    CHECK(version == 2);
+
+    // a key's type can't change
+    CHECK(Throws<std::invalid_argument>([&] {
+        store->setKey("test.int", std::string("nope"));
+    }));
+
+    store->setKeys({{"test.batch.a", uint64_t{1}}, {"test.batch.b", uint64_t{2}}});
+    const auto batch = store->getKeys("test.batch", 2);
+    CHECK(batch.size() == 2 && batch[0].first == "test.batch.a" &&
+            batch[1].first == "test.batch.b");
+
+    if(persistent) {
+        store.reset();
+        store = open();
+
+        CHECK(store->getKey("test.string") == PropertyValue(std::string("hello")));
+        CHECK(store->getKey("test.int", &version) == PropertyValue(uint64_t{43}));
+        CHECK(version == 2);
+        CHECK(store->getKey("test.batch.b") == PropertyValue(uint64_t{2}));
+    }
+}
+
+/**
+ * @brief Deleting keys, and subtrees of keys
+ */
+static void TestDelete(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+    uint64_t version{0};
+
+    store->setKey("del.a", uint64_t{1});
+    store->setKey("del.b.x", uint64_t{2});
+    store->setKey("del.b.y", uint64_t{3});
+    store->setKey("del.c", uint64_t{4});
+    store->setKey("del.c", uint64_t{5});
+
+    CHECK(store->deleteKey("del.a") == 1);
+    CHECK(store->deleteKey("del.a") == 0);
+    CHECK(std::holds_alternative<std::monostate>(store->getKey("del.a")));
+
+    CHECK(store->deleteSubkeys("del.b") == 2);
+    CHECK(std::holds_alternative<std::monostate>(store->getKey("del.b.x")));
+
+    // deleting a key discards its version
+    CHECK(store->deleteKey("del.c") == 1);
+    store->setKey("del.c", uint64_t{6});
+    store->getKey("del.c", &version);
+    CHECK(version == 1);
+
+    if(persistent) {
+        store.reset();
+        store = open();
+
+        CHECK(std::holds_alternative<std::monostate>(store->getKey("del.a")));
+        CHECK(std::holds_alternative<std::monostate>(store->getKey("del.b.y")));
+        CHECK(store->getKey("del.c") == PropertyValue(uint64_t{6}));
+    }
+}
+
+/**
+ * @brief Setting, clearing and expiring keys with an expiration time
+ */
+static void TestTtl(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+    const auto now = std::chrono::time_point_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now());
+
+    store->setKeyWithExpiry("ttl.past", uint64_t{1}, now - 1s);
+    store->setKeyWithExpiry("ttl.future", uint64_t{2}, now + 1h);
+    store->setKeyWithExpiry("ttl.cleared", uint64_t{3}, now + 1h);
+    store->setKeyWithExpiry("ttl.cleared", uint64_t{3}, std::nullopt);
+    store->setKey("ttl.none", uint64_t{4});
+
+    // other updates leave the expiration time alone
+    store->setKey("ttl.future", uint64_t{5});
+
+    if(persistent) {
+        store.reset();
+        store = open();
+    }
+
+    auto expiring = store->getExpiringKeys();
+    CHECK(expiring.size() == 2);
+
+    std::vector<std::string> expired;
+    for(const auto &[name, expiresAt] : expiring) {
+        if(name == "ttl.past") {
+            CHECK(expiresAt == now - 1s);
+        } else if(name == "ttl.future") {
+            CHECK(expiresAt == now + 1h);
+        } else {
+            CHECK(!"unexpected expiring key");
+        }
+
+        if(expiresAt <= now) {
+            expired.push_back(name);
+        }
+    }
+
+    // keys without an expiration time are never expired, even if asked to
+    expired.push_back("ttl.none");
+
+    CHECK(store->expireKeys(expired) == 1);
+    CHECK(std::holds_alternative<std::monostate>(store->getKey("ttl.past")));
+    CHECK(store->getKey("ttl.future") == PropertyValue(uint64_t{5}));
+    CHECK(store->getKey("ttl.none") == PropertyValue(uint64_t{4}));
+    CHECK(store->getExpiringKeys().size() == 1);
+}
+
+/**
+ * @brief Compare-and-swap updates and atomic integer operations
+ */
+static void TestCompareAndSwap(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+
+    // version zero only creates the key
+    auto result = store->setKeyIfVersion("cas.key", uint64_t{1}, 0);
+    CHECK(result.applied && result.version == 1);
+
+    result = store->setKeyIfVersion("cas.key", uint64_t{2}, 0);
+    CHECK(!result.applied && result.version == 1);
+
+    result = store->setKeyIfVersion("cas.key", uint64_t{2}, 1);
+    CHECK(result.applied && result.version == 2);
+
+    // a stale version is rejected, and reports the current one
+    result = store->setKeyIfVersion("cas.key", uint64_t{3}, 1);
+    CHECK(!result.applied && result.version == 2);
+    CHECK(store->getKey("cas.key") == PropertyValue(uint64_t{2}));
+
+    uint64_t version{0};
+    CHECK(store->applyIntegerOp("cas.key", DataStore::IntegerOp::Add, 10, &version) == 12);
+    CHECK(version == 3);
+    CHECK(store->applyIntegerOp("cas.key", DataStore::IntegerOp::Max, 5, &version) == 12);
+
+    if(persistent) {
+        store.reset();
+        store = open();
+    }
+
+    result = store->setKeyIfVersion("cas.key", uint64_t{20}, 3);
+    CHECK(result.applied && result.version == 4);
+    CHECK(store->getKey("cas.key", &version) == PropertyValue(uint64_t{20}));
+    CHECK(version == 4);
+}
+
+/**
+ * @brief Compare-and-swap updates of debounced keys
+ *
+ * Pending writes are checked against (and survive) updates that aren't applied.
+ */
+static void TestDebouncedCompareAndSwap(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+    store->addDebouncePolicy("deb", 1h);
+    uint64_t version{0};
+
+    store->setKey("deb.cas", uint64_t{1});
+    store->setKey("deb.cas", uint64_t{2});
+    CHECK(store->getKey("deb.cas", &version) == PropertyValue(uint64_t{2}));
+    CHECK(version == 2);
+
+    auto result = store->setKeyIfVersion("deb.cas", uint64_t{3}, 1);
+    CHECK(!result.applied && result.version == 2);
+    CHECK(store->getKey("deb.cas", &version) == PropertyValue(uint64_t{2}));
+    CHECK(version == 2);
+
+    result = store->setKeyIfVersion("deb.cas", uint64_t{3}, 2);
+    CHECK(result.applied && result.version == 3);
+
+    store->setKey("deb.cas", uint64_t{4});
+    result = store->setKeyIfVersion("deb.cas", uint64_t{5}, 3);
+    CHECK(!result.applied && result.version == 4);
+
+    if(persistent) {
+        store.reset();
+        store = open();
+    }
+
+    CHECK(store->getKey("deb.cas", &version) == PropertyValue(uint64_t{4}));
+    CHECK(version == 4);
+}
+
+/**
+ * @brief Integer operations on debounced keys
+ *
+ * Pending writes are applied before (and survive) operations that are rejected.
+ */
+static void TestDebouncedIntegerOp(const StoreFactory &open, const bool persistent) {
+    auto store = open();
+    store->addDebouncePolicy("deb", 1h);
+    uint64_t version{0};
+
+    store->setKey("deb.count", uint64_t{5});
+    CHECK(store->applyIntegerOp("deb.count", DataStore::IntegerOp::Add, 2, &version) == 7);
+    CHECK(version == 2);
+
+    // operations on keys that aren't integers are rejected
+    store->setKey("deb.text", std::string("hello"));
+    CHECK(!store->applyIntegerOp("deb.text", DataStore::IntegerOp::Add, 1));
+    CHECK(store->getKey("deb.text", &version) == PropertyValue(std::string("hello")));
+    CHECK(version == 1);
+
+    if(persistent) {
+        store.reset();
+        store = open();
+    }
+
+    CHECK(store->getKey("deb.count") == PropertyValue(uint64_t{7}));
+    CHECK(store->getKey("deb.text") == PropertyValue(std::string("hello")));
+}
+
+int main() {
+    char dirTemplate[]{"/tmp/confd-datastore-XXXXXX"};
+    if(!mkdtemp(dirTemplate)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::filesystem::path dir{dirTemplate};
+
+    const std::pair<const char *, void (*)(const StoreFactory &, const bool)> tests[]{
+        {"getset", TestGetSet},
+        {"delete", TestDelete},
+        {"ttl", TestTtl},
+        {"cas", TestCompareAndSwap},
+        {"debounced-cas", TestDebouncedCompareAndSwap},
+        {"debounced-int", TestDebouncedIntegerOp},
+    };
+
+    for(const auto &[name, test] : tests) {
+        // transient backend
+        try {
+            test([] {
+                return std::make_unique<DataStore>(std::make_unique<MemoryBackend>());
+            }, false);
+        } catch(const std::exception &e) {
+            fprintf(stderr, "%s (transient): %s\n", name, e.what());
+            gFailures++;
+        }
+
+        // backend persisted by a write log, which each test starts afresh
+        const auto logPath = dir / name;
+        try {
+            test([&] {
+                return std::make_unique<DataStore>(std::make_unique<MemoryBackend>(logPath,
+                            WriteLog::Options{}));
+            }, true);
+        } catch(const std::exception &e) {
+            fprintf(stderr, "%s (persistent): %s\n", name, e.what());
+            gFailures++;
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+
+    printf("%zu check(s) failed\n", gFailures);
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,411 @@
+#include <cbor.h>
+#include <fmt/core.h>
+#include <json/json.h>
+#include <toml++/toml.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Formats.h"
+
+/// Key names and values, in the order they were read
+using ValueList = std::vector<std::pair<std::string, cbor_item_t *>>;
+
+/// Name of the key that marks a table as holding a blob
+constexpr static const std::string_view kBlobKey{"$blob"};
+/// Name of the key that marks a table as holding a null value
+constexpr static const std::string_view kNullKey{"$null"};
+
+/// Characters used for base64 encoding
+constexpr static const std::string_view kBase64Chars{
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+
+/**
+ * @brief Encode binary data as base64
+ */
+static std::string Base64Encode(std::span<const std::byte> data) {
+    std::string out;
+    out.reserve(((data.size() + 2) / 3) * 4);
+
+    for(size_t i = 0; i < data.size(); i += 3) {
+        const size_t remaining = std::min<size_t>(3, data.size() - i);
+        uint32_t chunk{0};
+        for(size_t j = 0; j < 3; j++) {
+            chunk = (chunk << 8) | (j < remaining ? static_cast<uint8_t>(data[i + j]) : 0);
+        }
+
+        for(size_t j = 0; j < 4; j++) {
+            out += (j <= remaining) ? kBase64Chars[(chunk >> (18 - j * 6)) & 0x3F] : '=';
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief Decode base64 encoded data
+ *
+ * @throw std::invalid_argument The string contains invalid characters
+ */
+static std::vector<std::byte> Base64Decode(const std::string_view &str) {
+    std::vector<std::byte> out;
+    out.reserve((str.size() / 4) * 3);
+
+    uint32_t chunk{0};
+    size_t bits{0};
+
+    for(const auto c : str) {
+        if(c == '=') {
+            break;
+        }
+
+        const auto value = kBase64Chars.find(c);
+        if(value == std::string_view::npos) {
+            throw std::invalid_argument(fmt::format("invalid base64 character '{}'", c));
+        }
+
+        chunk = (chunk << 6) | value;
+        bits += 6;
+
+        if(bits >= 8) {
+            bits -= 8;
+            out.push_back(std::byte((chunk >> bits) & 0xFF));
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief Get the full name of a key nested under another
+ */
+static std::string JoinKey(const std::string &parent, const std::string_view &name) {
+    return parent.empty() ? std::string(name) : fmt::format("{}.{}", parent, name);
+}
+
+/**
+ * @brief Build a CBOR map from a list of values
+ *
+ * @remark The map takes ownership of the values.
+ */
+static cbor_item_t *BuildMap(ValueList &values) {
+    auto map = cbor_new_definite_map(values.size());
+
+    for(auto &[name, value] : values) {
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_stringn(name.data(), name.size())),
+            .value = cbor_move(value)
+        });
+    }
+    values.clear();
+
+    return map;
+}
+
+/**
+ * @brief Release the values in a list (after a failed read)
+ */
+static void FreeValues(ValueList &values) {
+    for(auto &[name, value] : values) {
+        cbor_decref(&value);
+    }
+    values.clear();
+}
+
+
+
+/**
+ * @brief Flatten a JSON value into the list of keys
+ */
+static void ReadJsonValue(const Json::Value &value, const std::string &name, ValueList &out) {
+    switch(value.type()) {
+        case Json::nullValue:
+            out.emplace_back(name, cbor_new_null());
+            break;
+        case Json::intValue:
+            out.emplace_back(name, cbor_build_uint64(static_cast<uint64_t>(value.asInt64())));
+            break;
+        case Json::uintValue:
+            out.emplace_back(name, cbor_build_uint64(value.asUInt64()));
+            break;
+        case Json::realValue:
+            out.emplace_back(name, cbor_build_float8(value.asDouble()));
+            break;
+        case Json::stringValue: {
+            const auto str = value.asString();
+            out.emplace_back(name, cbor_build_stringn(str.data(), str.size()));
+            break;
+        }
+        case Json::booleanValue:
+            out.emplace_back(name, cbor_build_bool(value.asBool()));
+            break;
+
+        case Json::objectValue:
+            // blob or null marker
+            if(value.size() == 1 && value.isMember(std::string(kBlobKey))) {
+                const auto blob = Base64Decode(value[std::string(kBlobKey)].asString());
+                out.emplace_back(name, cbor_build_bytestring(
+                            reinterpret_cast<cbor_data>(blob.data()), blob.size()));
+            } else if(value.size() == 1 && value.isMember(std::string(kNullKey))) {
+                out.emplace_back(name, cbor_new_null());
+            }
+            // otherwise, it's a nested set of keys
+            else {
+                for(const auto &member : value.getMemberNames()) {
+                    ReadJsonValue(value[member], JoinKey(name, member), out);
+                }
+            }
+            break;
+
+        default:
+            throw std::invalid_argument(fmt::format("unsupported value type for key '{}'", name));
+    }
+}
+
+/**
+ * @brief Read keys from a JSON object
+ */
+static void ReadJson(std::span<const std::byte> data, ValueList &out) {
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+
+    Json::Value root;
+    std::string errors;
+    const auto begin = reinterpret_cast<const char *>(data.data());
+
+    if(!reader->parse(begin, begin + data.size(), &root, &errors)) {
+        throw std::runtime_error(fmt::format("failed to parse json: {}", errors));
+    } else if(!root.isObject()) {
+        throw std::runtime_error("invalid json (expected object)");
+    }
+
+    ReadJsonValue(root, "", out);
+}
+
+/**
+ * @brief Flatten a TOML table into the list of keys
+ */
+static void ReadTomlTable(const toml::table &table, const std::string &prefix, ValueList &out) {
+    for(auto &&[key, node] : table) {
+        const auto name = JoinKey(prefix, key.str());
+
+        if(node.is_table()) {
+            const auto &child = *node.as_table();
+
+            // blob or null marker
+            if(child.size() == 1 && child[kBlobKey].is_string()) {
+                const auto blob = Base64Decode(child[kBlobKey].value_or(""));
+                out.emplace_back(name, cbor_build_bytestring(
+                            reinterpret_cast<cbor_data>(blob.data()), blob.size()));
+            } else if(child.size() == 1 && child.contains(kNullKey)) {
+                out.emplace_back(name, cbor_new_null());
+            }
+            // otherwise, it's a nested set of keys
+            else {
+                ReadTomlTable(child, name, out);
+            }
+        } else if(node.is_string()) {
+            const auto &str = node.as_string()->get();
+            out.emplace_back(name, cbor_build_stringn(str.data(), str.size()));
+        } else if(node.is_integer()) {
+            out.emplace_back(name, cbor_build_uint64(static_cast<uint64_t>(
+                            node.as_integer()->get())));
+        } else if(node.is_floating_point()) {
+            out.emplace_back(name, cbor_build_float8(node.as_floating_point()->get()));
+        } else if(node.is_boolean()) {
+            out.emplace_back(name, cbor_build_bool(node.as_boolean()->get()));
+        } else {
+            throw std::invalid_argument(fmt::format("unsupported value type for key '{}'",
+                        name));
+        }
+    }
+}
+
+/**
+ * @brief Flatten a CBOR map into the list of keys
+ */
+static void ReadCborMap(cbor_item_t *map, const std::string &prefix, ValueList &out) {
+    auto pairs = cbor_map_handle(map);
+
+    for(size_t i = 0; i < cbor_map_size(map); i++) {
+        if(!cbor_isa_string(pairs[i].key) || !cbor_string_is_definite(pairs[i].key)) {
+            throw std::invalid_argument("invalid key name (expected string)");
+        }
+
+        const auto name = JoinKey(prefix, {reinterpret_cast<const char *>(
+                    cbor_string_handle(pairs[i].key)), cbor_string_length(pairs[i].key)});
+        auto value = pairs[i].value;
+
+        if(cbor_isa_map(value)) {
+            ReadCborMap(value, name, out);
+        } else if(cbor_isa_string(value) || cbor_isa_bytestring(value) || cbor_isa_uint(value) ||
+                cbor_isa_float_ctrl(value)) {
+            out.emplace_back(name, cbor_incref(value));
+        } else {
+            throw std::invalid_argument(fmt::format("unsupported value type for key '{}'",
+                        name));
+        }
+    }
+}
+
+
+
+/**
+ * @brief Get a format by its name
+ *
+ * @param name Format name (`json`, `toml` or `cbor`)
+ */
+std::optional<Formats::Format> Formats::ForName(const std::string_view &name) {
+    if(name == "json") {
+        return Format::Json;
+    } else if(name == "toml") {
+        return Format::Toml;
+    } else if(name == "cbor") {
+        return Format::Cbor;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Determine the format of a file from its extension
+ */
+std::optional<Formats::Format> Formats::ForPath(const std::filesystem::path &path) {
+    const auto ext = path.extension().string();
+    if(ext.empty()) {
+        return std::nullopt;
+    }
+    return ForName(std::string_view(ext).substr(1));
+}
+
+/**
+ * @brief Read keys from a file
+ *
+ * @param format Format of the file
+ * @param data Contents of the file
+ *
+ * @return CBOR map of key names to their values (the caller must release it)
+ *
+ * @throw std::exception The file is malformed, or contains unsupported values
+ */
+cbor_item_t *Formats::Read(const Format format, std::span<const std::byte> data) {
+    ValueList values;
+
+    try {
+        switch(format) {
+            case Format::Json:
+                ReadJson(data, values);
+                break;
+            case Format::Toml: {
+                const auto table = toml::parse(std::string_view(
+                            reinterpret_cast<const char *>(data.data()), data.size()));
+                ReadTomlTable(table, "", values);
+                break;
+            }
+            case Format::Cbor: {
+                struct cbor_load_result result{};
+                auto root = cbor_load(reinterpret_cast<cbor_data>(data.data()), data.size(),
+                        &result);
+                if(!root || result.error.code != CBOR_ERR_NONE) {
+                    throw std::runtime_error(fmt::format("failed to decode cbor: {}",
+                                result.error.code));
+                } else if(!cbor_isa_map(root)) {
+                    cbor_decref(&root);
+                    throw std::runtime_error("invalid cbor (expected map)");
+                }
+
+                try {
+                    ReadCborMap(root, "", values);
+                } catch(const std::exception &) {
+                    cbor_decref(&root);
+                    throw;
+                }
+                cbor_decref(&root);
+                break;
+            }
+        }
+    } catch(const std::exception &) {
+        FreeValues(values);
+        throw;
+    }
+
+    return BuildMap(values);
+}
+
+/**
+ * @brief Write keys to a file
+ *
+ * @param format Format to write
+ * @param values CBOR map of key names to their values
+ * @param os Stream to write the file to
+ */
+void Formats::Write(const Format format, cbor_item_t *values, std::ostream &os) {
+    if(format == Format::Cbor) {
+        unsigned char *buf{nullptr};
+        size_t bufLen{0};
+        const auto length = cbor_serialize_alloc(values, &buf, &bufLen);
+
+        os.write(reinterpret_cast<const char *>(buf), length);
+        free(buf);
+        return;
+    }
+
+    Json::Value json(Json::objectValue);
+    toml::table table;
+
+    auto pairs = cbor_map_handle(values);
+
+    for(size_t i = 0; i < cbor_map_size(values); i++) {
+        const std::string name(reinterpret_cast<const char *>(cbor_string_handle(pairs[i].key)),
+                cbor_string_length(pairs[i].key));
+        auto value = pairs[i].value;
+
+        if(cbor_isa_string(value)) {
+            const std::string str(reinterpret_cast<const char *>(cbor_string_handle(value)),
+                    cbor_string_length(value));
+            json[name] = str;
+            table.insert(name, str);
+        } else if(cbor_isa_bytestring(value)) {
+            const auto str = Base64Encode({reinterpret_cast<const std::byte *>(
+                        cbor_bytestring_handle(value)), cbor_bytestring_length(value)});
+
+            json[name][std::string(kBlobKey)] = str;
+
+            toml::table blob;
+            blob.insert(kBlobKey, str);
+            table.insert(name, std::move(blob));
+        } else if(cbor_isa_uint(value)) {
+            json[name] = Json::UInt64(cbor_get_int(value));
+            // TOML integers are signed; values that don't fit wrap around, as with confd_set_int
+            table.insert(name, static_cast<int64_t>(cbor_get_int(value)));
+        } else if(cbor_isa_float_ctrl(value) && cbor_float_ctrl_is_ctrl(value) &&
+                cbor_is_bool(value)) {
+            json[name] = cbor_get_bool(value);
+            table.insert(name, cbor_get_bool(value));
+        } else if(cbor_isa_float_ctrl(value) && cbor_float_ctrl_is_ctrl(value)) {
+            json[name] = Json::Value(Json::nullValue);
+
+            toml::table null;
+            null.insert(kNullKey, true);
+            table.insert(name, std::move(null));
+        } else if(cbor_isa_float_ctrl(value)) {
+            json[name] = cbor_float_get_float(value);
+            table.insert(name, cbor_float_get_float(value));
+        }
+    }
+
+    if(format == Format::Json) {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "    ";
+
+        std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+        writer->write(json, &os);
+        os << std::endl;
+    } else {
+        os << table << std::endl;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef UTIL_FORMATS_H
+#define UTIL_FORMATS_H
+
+#include <cbor.h>
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string_view>
+
+/**
+ * @brief Import/export file formats
+ *
+ * Converts between the file formats supported for importing and exporting keys, and the CBOR
+ * map of key names to values that confd uses for batch updates and exports.
+ *
+ * Keys are written as a flat map, using the full key names; when reading, nested tables/maps are
+ * flattened by joining their key names with periods. Since JSON and TOML have no binary type,
+ * blobs are represented there as a table containing a `$blob` key whose value is the base64
+ * encoded data; and as TOML also lacks a null value, nulls are represented as a table with a
+ * `$null` key.
+ */
+class Formats {
+    public:
+        /// Supported file formats
+        enum class Format {
+            Json,
+            Toml,
+            Cbor,
+        };
+
+        static std::optional<Format> ForName(const std::string_view &name);
+        static std::optional<Format> ForPath(const std::filesystem::path &path);
+
+        static cbor_item_t *Read(const Format format, std::span<const std::byte> data);
+        static void Write(const Format format, cbor_item_t *values, std::ostream &os);
+};
+
+#endif
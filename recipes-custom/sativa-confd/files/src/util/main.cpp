@@ -1,8 +1,10 @@
+#include <cbor.h>
 #include <confd.h>
 #include <fmt/core.h>
 
 #include <getopt.h>
 
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
@@ -11,8 +13,10 @@
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "Formats.h"
 #include "HexDump.h"
 
 
@@ -23,6 +27,10 @@ enum class Operation {
     Read,
     Write,
     Delete,
+    Stats,
+    Trace,
+    Import,
+    Export,
 };
 /// Value type
 enum class Type {
@@ -75,23 +83,17 @@ static void ReadKey(const std::string_view &key, const Type type) {
 
     // invoke the appropriate read function
     if(type == Type::String) {
-        size_t actual{0};
-        std::vector<char> buffer;
-        // XXX: hacky, can we get the actual string size?
-        buffer.resize(1024 * 64);
+        const char *str{nullptr};
+        size_t length{0};
 
-        err = confd_get_string(key.data(), buffer.data(), buffer.size(), &actual);
+        err = confd_borrow_string(key.data(), &str, &length);
         EnsureSuccess(err, true);
 
-        if(actual > buffer.size()) {
-            std::cerr << fmt::format("NOTE: string is truncated (total {} bytes, showing {})",
-                    actual, buffer.size() - 1);
-        }
-
         if(err == kConfdNullValue) {
             std::cout << fmt::format("{}:{}=(null)", key, "string") << std::endl;
         } else {
-            std::cout << fmt::format("{}:{}=`{}`", key, "string", buffer.data()) << std::endl;
+            std::cout << fmt::format("{}:{}=`{}`", key, "string", std::string_view(str, length))
+                << std::endl;
         }
     }
     else if(type == Type::Integer) {
@@ -131,27 +133,18 @@ static void ReadKey(const std::string_view &key, const Type type) {
         }
     }
     else if(type == Type::Blob) {
-        size_t actual{0};
-        std::vector<std::byte> buffer;
-
-        // XXX: hacky, can we get the actual size ahead of time?
-        buffer.resize(128 * 1024);
+        const void *blob{nullptr};
+        size_t length{0};
 
-        err = confd_get_blob(key.data(), buffer.data(), buffer.size(), &actual);
+        err = confd_borrow_blob(key.data(), &blob, &length);
         EnsureSuccess(err, true);
 
-        if(actual > buffer.size()) {
-            std::cerr << fmt::format("NOTE: blob is truncated (total {} bytes, showing {})",
-                    actual, buffer.size() - 1);
-        }
-
         if(err == kConfdNullValue) {
             std::cout << fmt::format("{}:{}=(null)", key, "blob") << std::endl;
         } else {
-            buffer.resize(actual);
-            std::cout << fmt::format("{}:{}=({} bytes)", key, "blob", actual) << std::endl;
+            std::cout << fmt::format("{}:{}=({} bytes)", key, "blob", length) << std::endl;
 
-            std::span<const std::byte> span{buffer.data(), actual};
+            std::span<const std::byte> span{reinterpret_cast<const std::byte *>(blob), length};
             HexDump::dumpBuffer(std::cout, span);
         }
     }
@@ -269,6 +262,361 @@ static void WriteKey(const std::string_view &key, const std::string &valueStr, c
     }
 }
 
+/**
+ * @brief Print a CBOR item in a human readable form
+ *
+ * Maps are printed as one `key: value` line per entry, with nested maps indented below their key.
+ * Arrays of scalar values are printed on a single line.
+ *
+ * @param item Item to print
+ * @param indent Current indentation level
+ */
+static void PrintCborItem(const cbor_item_t *item, const size_t indent = 0) {
+    const std::string prefix(indent * 2, ' ');
+
+    if(cbor_isa_map(item)) {
+        auto pairs = cbor_map_handle(item);
+
+        for(size_t i = 0; i < cbor_map_size(item); i++) {
+            std::string key;
+            if(cbor_isa_string(pairs[i].key)) {
+                key = {reinterpret_cast<const char *>(cbor_string_handle(pairs[i].key)),
+                    cbor_string_length(pairs[i].key)};
+            } else {
+                key = "?";
+            }
+
+            if(cbor_isa_map(pairs[i].value)) {
+                std::cout << prefix << key << ":" << std::endl;
+                PrintCborItem(pairs[i].value, indent + 1);
+            } else {
+                std::cout << prefix << key << ": ";
+                PrintCborItem(pairs[i].value, 0);
+            }
+        }
+    } else if(cbor_isa_array(item)) {
+        std::cout << "[";
+        for(size_t i = 0; i < cbor_array_size(item); i++) {
+            auto value = cbor_array_get(item, i);
+            if(cbor_isa_uint(value)) {
+                std::cout << (i ? ", " : "") << cbor_get_int(value);
+            } else {
+                std::cout << (i ? ", " : "") << "…";
+            }
+            cbor_decref(&value);
+        }
+        std::cout << "]" << std::endl;
+    } else if(cbor_isa_uint(item)) {
+        std::cout << cbor_get_int(item) << std::endl;
+    } else if(cbor_isa_string(item)) {
+        std::cout << std::string_view{reinterpret_cast<const char *>(cbor_string_handle(item)),
+            cbor_string_length(item)} << std::endl;
+    } else if(cbor_isa_float_ctrl(item) && cbor_is_float(item)) {
+        std::cout << cbor_float_get_float(item) << std::endl;
+    } else if(cbor_isa_float_ctrl(item) && cbor_is_bool(item)) {
+        std::cout << (cbor_get_bool(item) ? "true" : "false") << std::endl;
+    } else {
+        std::cout << "(unsupported type " << cbor_typeof(item) << ")" << std::endl;
+    }
+}
+
+/**
+ * @brief Retrieve and print confd's statistics
+ *
+ * All latency values are in µs.
+ */
+static void PrintStats() {
+    int err;
+    size_t actual{0};
+    std::vector<std::byte> buffer;
+    buffer.resize(64 * 1024);
+
+    err = confd_get_stats(buffer.data(), buffer.size(), &actual);
+    EnsureSuccess(err);
+
+    if(actual > buffer.size()) {
+        throw std::runtime_error(fmt::format("stats truncated ({} bytes)", actual));
+    }
+
+    // decode and print
+    struct cbor_load_result result{};
+    auto root = cbor_load(reinterpret_cast<cbor_data>(buffer.data()), actual, &result);
+    if(!root || result.error.code != CBOR_ERR_NONE) {
+        throw std::runtime_error(fmt::format("failed to decode stats: {}", result.error.code));
+    }
+
+    PrintCborItem(root);
+    cbor_decref(&root);
+}
+
+/**
+ * @brief Retrieve and print the traces of recent requests
+ *
+ * Each request is printed on one line, oldest first; all times are in µs.
+ */
+static void PrintTrace() {
+    int err;
+    size_t actual{0};
+    std::vector<std::byte> buffer;
+    buffer.resize(64 * 1024);
+
+    err = confd_get_trace(buffer.data(), buffer.size(), &actual);
+    EnsureSuccess(err);
+
+    if(actual > buffer.size()) {
+        throw std::runtime_error(fmt::format("trace truncated ({} bytes)", actual));
+    }
+
+    // decode
+    struct cbor_load_result result{};
+    auto root = cbor_load(reinterpret_cast<cbor_data>(buffer.data()), actual, &result);
+    if(!root || result.error.code != CBOR_ERR_NONE) {
+        throw std::runtime_error(fmt::format("failed to decode trace: {}", result.error.code));
+    } else if(!cbor_isa_array(root)) {
+        cbor_decref(&root);
+        throw std::runtime_error("invalid trace (expected array)");
+    }
+
+    // print a line for each trace
+    std::cout << fmt::format("{:>10} {:>6} {:<8} {:>4} {:>8} {:>8} {:>8} {:>8} {:>8}  {}", "age",
+            "client", "endpoint", "tag", "parse", "lock", "store", "encode", "total", "key")
+        << std::endl;
+
+    for(size_t i = 0; i < cbor_array_size(root); i++) {
+        auto entry = cbor_array_get(root, i);
+        std::unordered_map<std::string, uint64_t> numbers;
+        std::unordered_map<std::string, std::string> strings;
+        bool success{true};
+
+        for(size_t j = 0; cbor_isa_map(entry) && j < cbor_map_size(entry); j++) {
+            const auto &pair = cbor_map_handle(entry)[j];
+            if(!cbor_isa_string(pair.key)) {
+                continue;
+            }
+
+            const std::string name(reinterpret_cast<const char *>(cbor_string_handle(pair.key)),
+                    cbor_string_length(pair.key));
+
+            if(cbor_isa_uint(pair.value)) {
+                numbers[name] = cbor_get_int(pair.value);
+            } else if(cbor_isa_string(pair.value)) {
+                strings[name] = std::string(reinterpret_cast<const char *>(
+                            cbor_string_handle(pair.value)), cbor_string_length(pair.value));
+            } else if(cbor_isa_float_ctrl(pair.value) && cbor_is_bool(pair.value)) {
+                success = cbor_get_bool(pair.value);
+            }
+        }
+
+        std::cout << fmt::format("{:>10} {:>6} {:<8} {:>4} {:>8} {:>8} {:>8} {:>8} {:>8}  {}{}",
+                numbers["age"], numbers["client"], strings["endpoint"], numbers["tag"],
+                numbers["parse"], numbers["lockWait"], numbers["store"], numbers["encode"],
+                numbers["total"], strings["key"], success ? "" : " (failed)") << std::endl;
+
+        cbor_decref(&entry);
+    }
+
+    cbor_decref(&root);
+}
+/**
+ * @brief Read a file (or the standard input, if the path is `-`) into memory
+ */
+static std::vector<std::byte> ReadFile(const std::string &path) {
+    std::vector<std::byte> buf;
+    std::istream *is{&std::cin};
+    std::ifstream file;
+
+    if(path != "-") {
+        file.open(path, std::ios::binary);
+        if(!file.good()) {
+            throw std::runtime_error(fmt::format("failed to open '{}'", path));
+        }
+        is = &file;
+    }
+
+    char chunk[16 * 1024];
+    while(is->read(chunk, sizeof(chunk)) || is->gcount()) {
+        const auto start = reinterpret_cast<const std::byte *>(chunk);
+        buf.insert(buf.end(), start, start + is->gcount());
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Get the time elapsed since a given point, in milliseconds
+ */
+static double MsecSince(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+/**
+ * @brief Import keys from a file
+ *
+ * The file is read and converted into a batch update, which confd applies in a single
+ * transaction: if any of the keys can't be updated, none of them are. Timing information is
+ * printed to the standard error.
+ *
+ * @param path Path of the file to import, or `-` to read the standard input
+ * @param format File format
+ */
+static void ImportKeys(const std::string &path, const Formats::Format format) {
+    int err;
+
+    // read and convert the file
+    const auto parseStart = std::chrono::steady_clock::now();
+
+    const auto data = ReadFile(path);
+    auto values = Formats::Read(format, data);
+    const auto numKeys = cbor_map_size(values);
+
+    unsigned char *buf{nullptr};
+    size_t bufLen{0};
+    const auto length = cbor_serialize_alloc(values, &buf, &bufLen);
+    cbor_decref(&values);
+
+    const auto parseTime = MsecSince(parseStart);
+
+    // then apply it
+    const auto applyStart = std::chrono::steady_clock::now();
+
+    err = confd_update_batch(buf, length);
+    free(buf);
+    EnsureSuccess(err);
+
+    const auto applyTime = MsecSince(applyStart);
+
+    std::cerr << fmt::format("imported {} keys: parse {:.1f} ms, apply {:.1f} ms ({:.0f} keys/s)",
+            numKeys, parseTime, applyTime, numKeys / (applyTime / 1000.)) << std::endl;
+}
+
+/**
+ * @brief Export all keys to a file
+ *
+ * Keys are retrieved a page at a time, then written out in the given format. Timing information
+ * is printed to the standard error.
+ *
+ * @param path Path of the file to write, or `-` to write to the standard output
+ * @param format File format
+ */
+static void ExportKeys(const std::string &path, const Formats::Format format) {
+    int err;
+    size_t actual{0};
+    std::vector<std::byte> buffer;
+    buffer.resize(64 * 1024);
+
+    std::vector<cbor_item_t *> pages;
+    std::string after;
+    bool more{true};
+    size_t numKeys{0};
+
+    // retrieve all pages
+    const auto fetchStart = std::chrono::steady_clock::now();
+
+    try {
+        while(more) {
+            err = confd_export(after.empty() ? nullptr : after.c_str(), buffer.data(),
+                    buffer.size(), &actual);
+            EnsureSuccess(err);
+
+            if(actual > buffer.size()) {
+                throw std::runtime_error(fmt::format("export truncated ({} bytes)", actual));
+            }
+
+            struct cbor_load_result result{};
+            auto root = cbor_load(reinterpret_cast<cbor_data>(buffer.data()), actual, &result);
+            if(!root || result.error.code != CBOR_ERR_NONE) {
+                throw std::runtime_error(fmt::format("failed to decode export: {}",
+                            result.error.code));
+            }
+            pages.push_back(root);
+
+            // find the values and whether there are more keys
+            more = false;
+            cbor_item_t *values{nullptr};
+
+            for(size_t i = 0; cbor_isa_map(root) && i < cbor_map_size(root); i++) {
+                const auto &pair = cbor_map_handle(root)[i];
+                if(!cbor_isa_string(pair.key)) {
+                    continue;
+                }
+
+                const std::string_view name(reinterpret_cast<const char *>(
+                            cbor_string_handle(pair.key)), cbor_string_length(pair.key));
+
+                if(name == "values" && cbor_isa_map(pair.value)) {
+                    values = pair.value;
+                } else if(name == "more" && cbor_isa_float_ctrl(pair.value) &&
+                        cbor_is_bool(pair.value)) {
+                    more = cbor_get_bool(pair.value);
+                }
+            }
+
+            if(!values) {
+                throw std::runtime_error("invalid export (missing values)");
+            }
+
+            const auto size = cbor_map_size(values);
+            numKeys += size;
+
+            if(more) {
+                if(!size) {
+                    throw std::runtime_error("invalid export (empty page)");
+                }
+
+                const auto last = cbor_map_handle(values)[size - 1].key;
+                after = {reinterpret_cast<const char *>(cbor_string_handle(last)),
+                    cbor_string_length(last)};
+            }
+        }
+    } catch(const std::exception &) {
+        for(auto page : pages) {
+            cbor_decref(&page);
+        }
+        throw;
+    }
+
+    // merge them into a single map
+    auto all = cbor_new_definite_map(numKeys);
+
+    for(auto page : pages) {
+        for(size_t i = 0; i < cbor_map_size(page); i++) {
+            const auto &pair = cbor_map_handle(page)[i];
+            if(!cbor_isa_map(pair.value)) {
+                continue;
+            }
+
+            for(size_t j = 0; j < cbor_map_size(pair.value); j++) {
+                cbor_map_add(all, cbor_map_handle(pair.value)[j]);
+            }
+        }
+
+        cbor_decref(&page);
+    }
+
+    const auto fetchTime = MsecSince(fetchStart);
+
+    // write the file
+    const auto writeStart = std::chrono::steady_clock::now();
+
+    if(path == "-") {
+        Formats::Write(format, all, std::cout);
+    } else {
+        std::ofstream os(path, std::ios::binary | std::ios::trunc);
+        if(!os.good()) {
+            cbor_decref(&all);
+            throw std::runtime_error(fmt::format("failed to open '{}'", path));
+        }
+
+        Formats::Write(format, all, os);
+    }
+
+    cbor_decref(&all);
+
+    std::cerr << fmt::format("exported {} keys: fetch {:.1f} ms, write {:.1f} ms", numKeys,
+            fetchTime, MsecSince(writeStart)) << std::endl;
+}
+
 
 /**
  * @brief Utility entry point
@@ -281,8 +629,17 @@ static void WriteKey(const std::string_view &key, const std::string &valueStr, c
  * - write: Value to write to the key
  * - delete: Delete a key
  * - type: Type of the key's value; required for reads and writes
+ * - stats: Print confd's performance counters
+ * - trace: Print the traces of the most recent requests
+ * - import: Apply all keys in the given file (or `-` for stdin) in a single transaction
+ * - export: Write all keys to the given file (or `-` for stdout)
+ * - format: File format for imports and exports (json, toml or cbor); by default, it's
+ *   determined from the file's extension.
+ * - database: Access the database at the given path directly, rather than going through confd.
+ *   This only works while confd isn't running, e.g. to build a filesystem image.
  *
- * Note that you must always specify one of --read, --write or --delete.
+ * Note that you must always specify one of --read, --write, --delete, --stats, --trace, --import
+ * or --export.
  */
 int main(const int argc, char * const *argv) {
     int err;
@@ -295,6 +652,12 @@ int main(const int argc, char * const *argv) {
     std::optional<Type> valueType;
     // raw value string (for writes)
     std::string writeValue;
+    // file to import from or export to
+    std::string filePath;
+    // format of that file
+    std::optional<Formats::Format> fileFormat;
+    // path of the database to open directly, if any
+    std::string databasePath;
     // determines return code if we get to the end of main()
     bool success{true};
 
@@ -315,6 +678,18 @@ int main(const int argc, char * const *argv) {
             {"delete",                  no_argument, 0, 0},
             // type for writes
             {"type",                    required_argument, 0, 0},
+            // print statistics
+            {"stats",                   no_argument, 0, 0},
+            // print request traces
+            {"trace",                   no_argument, 0, 0},
+            // import keys from a file
+            {"import",                  required_argument, 0, 0},
+            // export keys to a file
+            {"export",                  required_argument, 0, 0},
+            // file format for imports and exports
+            {"format",                  required_argument, 0, 0},
+            // open the database directly
+            {"database",                required_argument, 0, 0},
             // TODO: add value type flag
             {nullptr,                   0, 0, 0},
         };
@@ -335,9 +710,11 @@ int main(const int argc, char * const *argv) {
                 keyName = optarg;
             }
             // we'll be reading the key
-            else if(index == 2 || index == 3 || index == 4) {
+            else if(index == 2 || index == 3 || index == 4 || index == 6 || index == 7 ||
+                    index == 8 || index == 9) {
                 if(what != Operation::None) {
-                    std::cerr << "--read, --write and --delete are mutually exclusive";
+                    std::cerr << "--read, --write, --delete, --stats, --trace, --import and "
+                        "--export are mutually exclusive";
                     return 1;
                 }
 
@@ -352,6 +729,20 @@ int main(const int argc, char * const *argv) {
                     case 4:
                         what = Operation::Delete;
                         break;
+                    case 6:
+                        what = Operation::Stats;
+                        break;
+                    case 7:
+                        what = Operation::Trace;
+                        break;
+                    case 8:
+                        what = Operation::Import;
+                        filePath = optarg;
+                        break;
+                    case 9:
+                        what = Operation::Export;
+                        filePath = optarg;
+                        break;
                 }
             }
             // value type (parse it)
@@ -375,11 +766,24 @@ int main(const int argc, char * const *argv) {
                     return 1;
                 }
             }
+            // file format
+            else if(index == 10) {
+                fileFormat = Formats::ForName(optarg);
+                if(!fileFormat) {
+                    std::cerr << "invalid format: `" << optarg << "`" << std::endl;
+                    return 1;
+                }
+            }
+            // database path
+            else if(index == 11) {
+                databasePath = optarg;
+            }
         }
     }
 
     // validate the args
-    if(keyName.empty()) {
+    if(keyName.empty() && what != Operation::Stats && what != Operation::Trace &&
+            what != Operation::Import && what != Operation::Export) {
         std::cerr << "key name is required (--key)" << std::endl;
         return 1;
     }
@@ -387,9 +791,22 @@ int main(const int argc, char * const *argv) {
         std::cerr << "value type is required (--type)" << std::endl;
         return 1;
     }
+    else if(what == Operation::Import || what == Operation::Export) {
+        if(!fileFormat && filePath != "-") {
+            fileFormat = Formats::ForPath(filePath);
+        }
+        if(!fileFormat) {
+            std::cerr << "file format is required (--format)" << std::endl;
+            return 1;
+        }
+    }
 
-    // establish connection
-    err = confd_open(socketPath.c_str());
+    // establish connection (or open the database directly)
+    if(!databasePath.empty()) {
+        err = confd_open_ex(databasePath.c_str(), kConfdOpenEmbedded);
+    } else {
+        err = confd_open(socketPath.c_str());
+    }
     if(err) {
         std::cerr << "failed to connect to confd: " << err << std::endl;
         return 1;
@@ -408,8 +825,26 @@ int main(const int argc, char * const *argv) {
                 break;
             // delete a key
             case Operation::Delete:
-                // TODO: implement
-                throw std::runtime_error("not yet implemented");
+                err = confd_delete(keyName.c_str());
+                EnsureSuccess(err);
+
+                std::cout << fmt::format("{}: deleted", keyName) << std::endl;
+                break;
+            // print statistics
+            case Operation::Stats:
+                PrintStats();
+                break;
+            // print request traces
+            case Operation::Trace:
+                PrintTrace();
+                break;
+            // import keys from a file
+            case Operation::Import:
+                ImportKeys(filePath, *fileFormat);
+                break;
+            // export keys to a file
+            case Operation::Export:
+                ExportKeys(filePath, *fileFormat);
                 break;
 
             default:
@@ -1,11 +1,13 @@
 #ifndef PLCOMMON_RPC_CLIENTBASE_H
 #define PLCOMMON_RPC_CLIENTBASE_H
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <span>
+#include <unordered_map>
 #include <vector>
 
 #include <load-common/EventLoop.h>
@@ -23,6 +25,12 @@ struct RpcHeader;
  *
  * Client implementations simply need to implement a single method to handle received packets,
  * which receives a packet header and decoded CBOR payload.
+ *
+ * If the connection to the remote is lost, it's re-established automatically, retrying with
+ * exponential backoff. Requests marked as idempotent that were still awaiting a reply are then
+ * sent again (with their original tags) and any idempotent requests made while disconnected are
+ * sent once the connection is back. Subclasses can override handleReconnected() to re-establish
+ * any other state, such as subscriptions.
  */
 class ClientBase {
     public:
@@ -32,7 +40,13 @@ class ClientBase {
 
     protected:
         void sendRaw(std::span<const std::byte> payload);
-        uint8_t sendPacket(const uint8_t endpoint, std::span<const std::byte> payload);
+        uint8_t sendPacket(const uint8_t endpoint, std::span<const std::byte> payload,
+                const bool idempotent = false);
+
+        /// Whether the connection to the remote is currently established
+        inline bool isConnected() const {
+            return this->bev != nullptr;
+        }
 
         virtual void handleIncomingMessageRaw(const struct RpcHeader &header,
                 std::span<const std::byte> payload);
@@ -53,14 +67,30 @@ class ClientBase {
 
         virtual void handleConnectionClosed();
         virtual void handleIoError(const uintptr_t flags);
+        virtual void handleReconnected();
 
     private:
+        /// Delay before the first reconnection attempt; it doubles with each failed attempt
+        constexpr static const std::chrono::milliseconds kReconnectInitialDelay{10};
+        /// Maximum delay between reconnection attempts
+        constexpr static const std::chrono::milliseconds kReconnectMaxDelay{5000};
+        /// Maximum number of pending idempotent requests (one for each nonzero tag)
+        constexpr static const size_t kMaxPendingRequests{UINT8_MAX};
+
         int connectSocket();
+        void initBufferEvent();
+
+        void connectionLost();
+        void scheduleReconnect();
+        void reconnect();
 
         void bevRead(struct bufferevent *);
         void bevEvent(struct bufferevent *, const uintptr_t);
 
     private:
+        /// event base the client's events are scheduled on
+        struct event_base *evbase{nullptr};
+
         /// filesystem path for the RPC socket
         std::filesystem::path socketPath;
         /// File descriptor for RPC socket
@@ -73,6 +103,14 @@ class ClientBase {
 
         /// Packet receive buffer
         std::vector<std::byte> rxBuf;
+
+        /// Idempotent requests awaiting a reply (or to be sent on reconnection), by tag
+        std::unordered_map<uint8_t, std::vector<std::byte>> pendingRequests;
+
+        /// Timer event for reconnection attempts
+        struct event *reconnectEvent{nullptr};
+        /// Delay before the next reconnection attempt
+        std::chrono::milliseconds reconnectDelay{kReconnectInitialDelay};
 };
 }
 
@@ -4,8 +4,10 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <system_error>
+#include <vector>
 
 #include <cbor.h>
 #include <event2/event.h>
@@ -25,9 +27,6 @@ using namespace PlCommon::Rpc;
  */
 ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
         const std::shared_ptr<PlCommon::EventLoop> &ev) : socketPath(rpcSocketPath) {
-    int err;
-    auto evbase = ev->getEvBase();
-
     // validate args
     if(!ev) {
         throw std::invalid_argument("invalid event loop");
@@ -35,10 +34,49 @@ ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
         throw std::invalid_argument("rpc socket path is empty!");
     }
 
+    this->evbase = ev->getEvBase();
+
+    // create the reconnection timer
+    this->reconnectEvent = evtimer_new(this->evbase, [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<ClientBase *>(ctx)->reconnect();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to reconnect: " << e.what();
+        }
+    }, this);
+    if(!this->reconnectEvent) {
+        throw std::runtime_error("failed to allocate reconnect event");
+    }
+
     // establish connection and create an event
     this->fd = this->connectSocket();
+    this->initBufferEvent();
+}
+
+/**
+ * @brief Clean up client resources
+ */
+ClientBase::~ClientBase() {
+    if(this->reconnectEvent) {
+        event_free(this->reconnectEvent);
+    }
 
-    this->bev = bufferevent_socket_new(evbase, this->fd, 0);
+    if(this->bev) {
+        bufferevent_free(this->bev);
+    }
+
+    if(this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+/**
+ * @brief Create the buffer event for the connected socket and add it to the run loop
+ */
+void ClientBase::initBufferEvent() {
+    int err;
+
+    this->bev = bufferevent_socket_new(this->evbase, this->fd, 0);
     if(!this->bev) {
         throw std::runtime_error("failed to create bufferevent");
     }
@@ -65,20 +103,6 @@ ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
     if(err == -1) {
         throw std::runtime_error("failed to enable bufferevent");
     }
-
-}
-
-/**
- * @brief Clean up client resources
- */
-ClientBase::~ClientBase() {
-    if(this->bev) {
-        bufferevent_free(this->bev);
-    }
-
-    if(this->fd != -1) {
-        close(this->fd);
-    }
 }
 
 /**
@@ -122,6 +146,104 @@ int ClientBase::connectSocket() {
 
 
 
+/**
+ * @brief Tear down a lost connection
+ *
+ * Release the socket and its buffer event, then schedule a reconnection attempt.
+ */
+void ClientBase::connectionLost() {
+    if(this->bev) {
+        bufferevent_free(this->bev);
+        this->bev = nullptr;
+    }
+
+    if(this->fd != -1) {
+        close(this->fd);
+        this->fd = -1;
+    }
+
+    this->reconnectDelay = kReconnectInitialDelay;
+    this->scheduleReconnect();
+}
+
+/**
+ * @brief Arm the reconnection timer with the current backoff delay
+ */
+void ClientBase::scheduleReconnect() {
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            this->reconnectDelay).count();
+    struct timeval tv{
+        .tv_sec = static_cast<time_t>(usec / 1'000'000),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000),
+    };
+
+    evtimer_add(this->reconnectEvent, &tv);
+}
+
+/**
+ * @brief Attempt to re-establish the connection
+ *
+ * On success, all pending idempotent requests are sent (in the order of their tags) and the
+ * subclass is notified; requests that fail to be sent remain pending. Otherwise, the socket (if it was connected) is closed again, and another
+ * attempt is scheduled after doubling the delay.
+ */
+void ClientBase::reconnect() {
+    try {
+        this->fd = this->connectSocket();
+    } catch(const std::system_error &e) {
+        PLOG_DEBUG << "reconnect failed: " << e.what() << " (retrying in "
+            << this->reconnectDelay.count() << " ms)";
+
+        this->reconnectDelay = std::min(this->reconnectDelay * 2, kReconnectMaxDelay);
+        this->scheduleReconnect();
+        return;
+    }
+
+    try {
+        this->initBufferEvent();
+    } catch(const std::exception &e) {
+        PLOG_WARNING << "reconnect failed: " << e.what() << " (retrying in "
+            << this->reconnectDelay.count() << " ms)";
+
+        if(this->bev) {
+            bufferevent_free(this->bev);
+            this->bev = nullptr;
+        }
+
+        close(this->fd);
+        this->fd = -1;
+
+        this->reconnectDelay = std::min(this->reconnectDelay * 2, kReconnectMaxDelay);
+        this->scheduleReconnect();
+        return;
+    }
+
+    PLOG_INFO << "RPC connection re-established";
+
+    // replay requests
+    std::vector<uint8_t> tags;
+    tags.reserve(this->pendingRequests.size());
+
+    for(const auto &[tag, packet] : this->pendingRequests) {
+        tags.push_back(tag);
+    }
+    std::sort(tags.begin(), tags.end());
+
+    for(const auto tag : tags) {
+        try {
+            this->sendRaw(this->pendingRequests.at(tag));
+        } catch(const std::system_error &e) {
+            // it stays pending, so it's sent again if the connection is lost (and re-established)
+            PLOG_WARNING << "failed to resend request " << static_cast<int>(tag) << ": "
+                << e.what();
+        }
+    }
+
+    this->handleReconnected();
+}
+
+
+
 /**
  * @brief Handle a received message
  *
@@ -139,26 +261,43 @@ void ClientBase::bevRead(struct bufferevent *ev) {
         throw std::runtime_error("failed to drain read buffer");
     }
 
-    // validate header
-    if(pending < sizeof(struct RpcHeader)) {
-        PLOG_WARNING << fmt::format("insufficient RPC read (got {})", pending);
-        return;
-    }
+    // the buffer may hold several messages (e.g. replies to replayed requests)
+    std::span<const std::byte> data{this->rxBuf.data(), pending};
 
-    auto hdr = reinterpret_cast<const struct RpcHeader *>(this->rxBuf.data());
-    if(hdr->version != kRpcVersionLatest) {
-        PLOG_WARNING << fmt::format("unknown rpc version ${:04x}", hdr->version);
-        return;
-    } else if(hdr->length < sizeof(struct RpcHeader)) {
-        PLOG_WARNING << fmt::format("invalid rpc packet size ({} bytes)", hdr->length);
-        return;
-    }
+    while(!data.empty()) {
+        // validate header
+        if(data.size() < sizeof(struct RpcHeader)) {
+            PLOG_WARNING << fmt::format("insufficient RPC read (got {})", data.size());
+            return;
+        }
+
+        auto hdr = reinterpret_cast<const struct RpcHeader *>(data.data());
+        if(hdr->version != kRpcVersionLatest) {
+            PLOG_WARNING << fmt::format("unknown rpc version ${:04x}", hdr->version);
+            return;
+        } else if(hdr->length < sizeof(struct RpcHeader)) {
+            PLOG_WARNING << fmt::format("invalid rpc packet size ({} bytes)", hdr->length);
+            return;
+        }
+        // incomplete message: put it back until the rest arrives
+        else if(hdr->length > data.size()) {
+            evbuffer_prepend(buf, data.data(), data.size());
+            return;
+        }
 
-    // invoke the handler
-    std::span<const std::byte> payload{reinterpret_cast<const std::byte *>(hdr->payload),
-        hdr->length - sizeof(*hdr)};
+        // this completes the request with this tag, if it's pending
+        if(!(hdr->flags & kRpcFlagBroadcast)) {
+            this->pendingRequests.erase(hdr->tag);
+        }
+
+        // invoke the handler
+        std::span<const std::byte> payload{reinterpret_cast<const std::byte *>(hdr->payload),
+            hdr->length - sizeof(*hdr)};
 
-    this->handleIncomingMessageRaw(*hdr, payload);
+        this->handleIncomingMessageRaw(*hdr, payload);
+
+        data = data.subspan(hdr->length);
+    }
 }
 
 /**
@@ -170,11 +309,12 @@ void ClientBase::bevEvent(struct bufferevent *, const uintptr_t flags) {
     // connection closed
     if(flags & BEV_EVENT_EOF) {
         this->handleConnectionClosed();
-        this->fd = 0;
+        this->connectionLost();
     }
     // IO error
     else if(flags & BEV_EVENT_ERROR) {
         this->handleIoError(flags);
+        this->connectionLost();
     }
 }
 
@@ -182,9 +322,16 @@ void ClientBase::bevEvent(struct bufferevent *, const uintptr_t flags) {
  * @brief Send a raw packet to the remote
  *
  * This assumes the packet already has a `struct RpcHeader` prepended.
+ *
+ * @throw std::system_error The connection is not established (ENOTCONN) or writing failed
  */
 void ClientBase::sendRaw(std::span<const std::byte> payload) {
-    int err = write(this->fd, payload.data(), payload.size());
+    if(this->fd == -1) {
+        throw std::system_error(ENOTCONN, std::generic_category(), "write");
+    }
+
+    // don't raise SIGPIPE if the remote has gone away; we'll find out via the buffer event
+    int err = send(this->fd, payload.data(), payload.size(), MSG_NOSIGNAL);
     if(err == -1) {
         throw std::system_error(errno, std::generic_category(), "write");
     }
@@ -195,9 +342,26 @@ void ClientBase::sendRaw(std::span<const std::byte> payload) {
  *
  * Generate a full packet (including packet header) and send it to the remote.
  *
+ * @param endpoint Endpoint to send the packet to
+ * @param payload Payload of the packet
+ * @param idempotent Whether the request may safely be processed multiple times by the remote; if
+ *        so, it's kept until a reply is received, and sent again if the connection is lost in the
+ *        meantime.
+ *
  * @return Tag value associated with the packet
+ *
+ * @throw std::system_error All tags are held by pending requests (EAGAIN), or sending failed
+ *
+ * @remark While disconnected, idempotent requests are queued to be sent after reconnecting;
+ *         sending any other request fails with ENOTCONN.
  */
-uint8_t ClientBase::sendPacket(const uint8_t endpoint, std::span<const std::byte> payload) {
+uint8_t ClientBase::sendPacket(const uint8_t endpoint, std::span<const std::byte> payload,
+        const bool idempotent) {
+    // every (nonzero) tag is held by a pending request
+    if(this->pendingRequests.size() >= kMaxPendingRequests) {
+        throw std::system_error(EAGAIN, std::generic_category(), "no free request tag");
+    }
+
     std::vector<std::byte> buffer;
     buffer.resize(sizeof(struct RpcHeader) + payload.size(), std::byte{0});
 
@@ -207,19 +371,36 @@ uint8_t ClientBase::sendPacket(const uint8_t endpoint, std::span<const std::byte
     hdr->length = sizeof(*hdr) + payload.size();
     hdr->endpoint = endpoint;
 
+    // find a tag that isn't used by a pending request
     do {
         hdr->tag = ++this->nextTag;
-        // TODO: ensure there isn't a packet with this tag outstanding
-    } while(!hdr->tag);
+    } while(!hdr->tag || this->pendingRequests.contains(hdr->tag));
 
     // copy payload
     if(!payload.empty()) {
         std::copy(payload.begin(), payload.end(), buffer.begin() + sizeof(*hdr));
     }
 
-    // send and return tag
-    this->sendRaw(buffer);
-    return hdr->tag;
+    const auto tag = hdr->tag;
+
+    // send it (queueing it for replay, if idempotent) and return tag
+    if(!idempotent) {
+        this->sendRaw(buffer);
+        return tag;
+    }
+
+    auto &packet = this->pendingRequests.emplace(tag, std::move(buffer)).first->second;
+    if(this->fd != -1) {
+        try {
+            this->sendRaw(packet);
+        } catch(const std::system_error &e) {
+            // it will be sent again once reconnected
+            PLOG_WARNING << "failed to send request " << static_cast<int>(tag) << ": "
+                << e.what();
+        }
+    }
+
+    return tag;
 }
 
 
@@ -287,3 +468,16 @@ void ClientBase::handleConnectionClosed() {
 void ClientBase::handleIoError(const uintptr_t flags) {
     PLOG_WARNING << fmt::format("RPC connection error: ${:x}", flags);
 }
+
+/**
+ * @brief Handle the connection having been re-established
+ *
+ * Invoked after the connection was lost, then re-established, and all pending idempotent
+ * requests have been sent again. Subclasses should override this to restore any other state held
+ * by the remote on behalf of the connection, such as subscriptions, and to fail any
+ * non-idempotent requests that were awaiting a reply, since it will never arrive.
+ *
+ * @remark This is a default handler and it does nothing.
+ */
+void ClientBase::handleReconnected() {
+}